@@ -0,0 +1,365 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cuda_runtime.h>
+
+#include <libsgm.h>
+
+#include "synthetic_scene.h"
+
+static const char* USAGE =
+"usage: sgm-eval [options]\n"
+"  --config=SPEC      configuration to evaluate, may be repeated, e.g. name:paths=4,census=2,subpixel=1\n"
+"                     keys: paths, census, subpixel, P1, P2, uniqueness, LR_max_diff, fused, disparity\n"
+"  --configs=PATH     file with one SPEC per line, lines starting with # are ignored\n"
+"  --scenes=LIST      synthetic scenes with ground truth                    [random_dot,slanted_planes,textureless]\n"
+"  --resolution=WxH   image size                                            [1280x720]\n"
+"  --seeds=N          scenes rendered per scene type                        [3]\n"
+"  --iterations=N     frames timed per configuration and scene              [20]\n"
+"  --output=PATH      write results as CSV\n";
+
+struct Config
+{
+	std::string name;
+	int disparity = 128;
+	int paths = 8;
+	int census = 1;
+	bool subpixel = true;
+	int P1 = 10;
+	int P2 = 120;
+	float uniqueness = 0.95f;
+	int LR_max_diff = 1;
+	bool fused = false;
+};
+
+// metrics over pixels visible in both views, errors only over pixels with valid output
+struct Metrics
+{
+	double frame_ms = 0;
+	double bad1 = 0;    // fraction of valid pixels with error above 1 pixel
+	double bad2 = 0;    // fraction of valid pixels with error above 2 pixels
+	double rmse = 0;    // root mean square error in pixels
+	double density = 0; // fraction of visible pixels with valid output
+};
+
+struct Options
+{
+	std::vector<Config> configs;
+	std::vector<std::string> scenes{ "random_dot", "slanted_planes", "textureless" };
+	int width = 1280;
+	int height = 720;
+	int seeds = 3;
+	int iterations = 20;
+	std::string output;
+};
+
+static bool parse_config(const std::string& spec, Config& config)
+{
+	const size_t colon = spec.find(':');
+	config.name = colon == std::string::npos ? spec : spec.substr(0, colon);
+	if (colon == std::string::npos)
+		return !config.name.empty();
+
+	std::istringstream is(spec.substr(colon + 1));
+	std::string item;
+	while (std::getline(is, item, ',')) {
+		const size_t eq = item.find('=');
+		if (eq == std::string::npos)
+			return false;
+		const std::string key = item.substr(0, eq);
+		const char* value = item.c_str() + eq + 1;
+		if (key == "paths") config.paths = std::atoi(value);
+		else if (key == "census") config.census = std::atoi(value);
+		else if (key == "subpixel") config.subpixel = std::atoi(value) != 0;
+		else if (key == "P1") config.P1 = std::atoi(value);
+		else if (key == "P2") config.P2 = std::atoi(value);
+		else if (key == "uniqueness") config.uniqueness = static_cast<float>(std::atof(value));
+		else if (key == "LR_max_diff") config.LR_max_diff = std::atoi(value);
+		else if (key == "fused") config.fused = std::atoi(value) != 0;
+		else if (key == "disparity") config.disparity = std::atoi(value);
+		else return false;
+	}
+	return true;
+}
+
+// speed knobs available in this library: scanline count, census window and subpixel refinement
+static void default_configs(std::vector<Config>& configs)
+{
+	const char* specs[] = {
+		"8path_sym9x7_subpix:paths=8,census=1,subpixel=1",
+		"8path_sym9x7:paths=8,census=1,subpixel=0",
+		"4path_sym9x7_subpix:paths=4,census=1,subpixel=1",
+		"8path_5x5_subpix:paths=8,census=2,subpixel=1",
+		"4path_5x5:paths=4,census=2,subpixel=0",
+		"8path_13x11_subpix:paths=8,census=4,subpixel=1",
+		"8path_sparse13x11_subpix:paths=8,census=5,subpixel=1",
+		"8path_sym9x7_fused_subpix:paths=8,census=1,subpixel=1,fused=1",
+	};
+	for (const char* spec : specs) {
+		Config config;
+		parse_config(spec, config);
+		configs.push_back(config);
+	}
+}
+
+static bool parse_options(int argc, char* argv[], Options& opt)
+{
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		const size_t eq = arg.find('=');
+		const std::string key = arg.substr(0, eq);
+		const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+		if (key == "--config") {
+			Config config;
+			if (!parse_config(value, config))
+				return false;
+			opt.configs.push_back(config);
+		}
+		else if (key == "--configs") {
+			std::ifstream ifs(value);
+			std::string line;
+			if (!ifs)
+				return false;
+			while (std::getline(ifs, line)) {
+				if (line.empty() || line[0] == '#')
+					continue;
+				Config config;
+				if (!parse_config(line, config))
+					return false;
+				opt.configs.push_back(config);
+			}
+		}
+		else if (key == "--scenes") {
+			opt.scenes.clear();
+			std::istringstream is(value);
+			std::string item;
+			while (std::getline(is, item, ','))
+				opt.scenes.push_back(item);
+		}
+		else if (key == "--resolution") { if (sscanf(value.c_str(), "%dx%d", &opt.width, &opt.height) != 2) return false; }
+		else if (key == "--seeds") opt.seeds = std::atoi(value.c_str());
+		else if (key == "--iterations") opt.iterations = std::atoi(value.c_str());
+		else if (key == "--output") opt.output = value;
+		else return false;
+	}
+	if (opt.configs.empty())
+		default_configs(opt.configs);
+	return opt.seeds > 0 && opt.iterations > 0;
+}
+
+// rows are split into bands evaluated by hardware threads, partial sums are reduced at the end
+static Metrics evaluate(const sgm::SyntheticScene& scene, const std::vector<uint16_t>& disparity, int invalid, int scale)
+{
+	struct Partial
+	{
+		double visible = 0, valid = 0, bad1 = 0, bad2 = 0, squared = 0;
+	};
+
+	const int num_threads = std::max(1, std::min(static_cast<int>(std::thread::hardware_concurrency()), scene.height));
+	std::vector<Partial> partials(num_threads);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < num_threads; t++) {
+		threads.emplace_back([&, t] {
+			Partial& p = partials[t];
+			for (int y = t * scene.height / num_threads; y < (t + 1) * scene.height / num_threads; y++) {
+				for (int x = 0; x < scene.width; x++) {
+					const size_t i = static_cast<size_t>(y) * scene.width + x;
+					if (scene.occluded[i])
+						continue;
+					p.visible++;
+					const int d = static_cast<int16_t>(disparity[i]);
+					if (d == invalid)
+						continue;
+					const double err = std::fabs(static_cast<double>(d) / scale - scene.disparity[i]);
+					p.valid++;
+					p.bad1 += err > 1;
+					p.bad2 += err > 2;
+					p.squared += err * err;
+				}
+			}
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+
+	Partial total;
+	for (const Partial& p : partials) {
+		total.visible += p.visible;
+		total.valid += p.valid;
+		total.bad1 += p.bad1;
+		total.bad2 += p.bad2;
+		total.squared += p.squared;
+	}
+
+	Metrics m;
+	m.density = total.visible > 0 ? total.valid / total.visible : 0;
+	if (total.valid > 0) {
+		m.bad1 = total.bad1 / total.valid;
+		m.bad2 = total.bad2 / total.valid;
+		m.rmse = std::sqrt(total.squared / total.valid);
+	}
+	return m;
+}
+
+static Metrics run(const Options& opt, const Config& config, const std::vector<sgm::SyntheticScene>& scenes)
+{
+	const sgm::PathType path_type = config.paths == 8 ? sgm::PathType::SCAN_8PATH : sgm::PathType::SCAN_4PATH;
+	const sgm::StereoSGM::Parameters param(config.P1, config.P2, config.uniqueness, config.subpixel, path_type, 0, config.LR_max_diff,
+		static_cast<sgm::CensusType>(config.census), config.fused);
+	sgm::StereoSGM sgm(opt.width, opt.height, config.disparity, 8, 16, sgm::EXECUTE_INOUT_CUDA2CUDA, param);
+	const int scale = config.subpixel ? sgm::StereoSGM::SUBPIXEL_SCALE : 1;
+
+	const size_t src_bytes = static_cast<size_t>(opt.width) * opt.height;
+	const size_t dst_bytes = sizeof(uint16_t) * opt.width * opt.height;
+	void *srcL, *srcR, *dst;
+	cudaMalloc(&srcL, src_bytes);
+	cudaMalloc(&srcR, src_bytes);
+	cudaMalloc(&dst, dst_bytes);
+
+	Metrics sum;
+	std::vector<uint16_t> disparity(static_cast<size_t>(opt.width) * opt.height);
+	for (const auto& scene : scenes) {
+		cudaMemcpy(srcL, scene.left.data(), src_bytes, cudaMemcpyHostToDevice);
+		cudaMemcpy(srcR, scene.right.data(), src_bytes, cudaMemcpyHostToDevice);
+
+		// first frame warms up and is the one evaluated
+		sgm.execute(srcL, srcR, dst);
+		cudaMemcpy(disparity.data(), dst, dst_bytes, cudaMemcpyDeviceToHost);
+
+		const auto t1 = std::chrono::steady_clock::now();
+		for (int i = 0; i < opt.iterations; i++)
+			sgm.execute(srcL, srcR, dst);
+		cudaDeviceSynchronize();
+		const auto t2 = std::chrono::steady_clock::now();
+
+		Metrics m = evaluate(scene, disparity, sgm.get_invalid_disparity(), scale);
+		m.frame_ms = std::chrono::duration<double, std::milli>(t2 - t1).count() / opt.iterations;
+		sum.frame_ms += m.frame_ms;
+		sum.bad1 += m.bad1;
+		sum.bad2 += m.bad2;
+		sum.rmse += m.rmse;
+		sum.density += m.density;
+	}
+
+	cudaFree(srcL);
+	cudaFree(srcR);
+	cudaFree(dst);
+
+	const double n = static_cast<double>(scenes.size());
+	sum.frame_ms /= n;
+	sum.bad1 /= n;
+	sum.bad2 /= n;
+	sum.rmse /= n;
+	sum.density /= n;
+	return sum;
+}
+
+// a configuration is on the front if no other one is at least as fast and as good, and strictly better in one
+template <typename Better>
+static std::vector<bool> pareto_front(const std::vector<Metrics>& metrics, Better better)
+{
+	std::vector<bool> front(metrics.size(), true);
+	for (size_t i = 0; i < metrics.size(); i++) {
+		for (size_t j = 0; j < metrics.size() && front[i]; j++) {
+			const bool no_worse = metrics[j].frame_ms <= metrics[i].frame_ms && !better(metrics[i], metrics[j]);
+			const bool strictly = metrics[j].frame_ms < metrics[i].frame_ms || better(metrics[j], metrics[i]);
+			if (i != j && no_worse && strictly)
+				front[i] = false;
+		}
+	}
+	return front;
+}
+
+int main(int argc, char* argv[])
+{
+	Options opt;
+	if (!parse_options(argc, argv, opt)) {
+		std::cerr << USAGE;
+		return EXIT_FAILURE;
+	}
+
+	std::vector<sgm::SyntheticScene> scenes;
+	for (const auto& name : opt.scenes) {
+		sgm::SceneType type;
+		if (!sgm::parse_scene(name.c_str(), type)) {
+			std::cerr << "unknown scene: " << name << std::endl;
+			return EXIT_FAILURE;
+		}
+		// the smallest disparity size keeps ground truth inside the range of every configuration
+		int max_disparity = 256;
+		for (const Config& config : opt.configs)
+			max_disparity = std::min(max_disparity, config.disparity);
+		for (int seed = 1; seed <= opt.seeds; seed++) {
+			scenes.emplace_back();
+			sgm::render_scene(type, opt.width, opt.height, max_disparity, 8, static_cast<uint32_t>(seed), scenes.back());
+		}
+	}
+
+	std::vector<Metrics> metrics;
+	for (const Config& config : opt.configs) {
+		metrics.push_back(run(opt, config, scenes));
+		const Metrics& m = metrics.back();
+		fprintf(stderr, "%-32s %8.3f ms  bad1 %6.2f%%  bad2 %6.2f%%  rmse %6.3f  density %6.2f%%\n", config.name.c_str(),
+			m.frame_ms, 100 * m.bad1, 100 * m.bad2, m.rmse, 100 * m.density);
+	}
+
+	const auto front_bad1 = pareto_front(metrics, [](const Metrics& a, const Metrics& b) { return a.bad1 < b.bad1; });
+	const auto front_bad2 = pareto_front(metrics, [](const Metrics& a, const Metrics& b) { return a.bad2 < b.bad2; });
+	const auto front_rmse = pareto_front(metrics, [](const Metrics& a, const Metrics& b) { return a.rmse < b.rmse; });
+	const auto front_density = pareto_front(metrics, [](const Metrics& a, const Metrics& b) { return a.density > b.density; });
+
+	// Pareto report, fastest first, * marks configurations on the front of each metric
+	std::vector<size_t> order(metrics.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return metrics[a].frame_ms < metrics[b].frame_ms; });
+
+	printf("%-32s %10s %10s %10s %10s %10s\n", "configuration", "time[ms]", "bad1[%]", "bad2[%]", "rmse[px]", "density[%]");
+	for (size_t i : order) {
+		const Metrics& m = metrics[i];
+		printf("%-32s %10.3f %9.2f%c %9.2f%c %9.3f%c %9.2f%c\n", opt.configs[i].name.c_str(), m.frame_ms,
+			100 * m.bad1, front_bad1[i] ? '*' : ' ', 100 * m.bad2, front_bad2[i] ? '*' : ' ',
+			m.rmse, front_rmse[i] ? '*' : ' ', 100 * m.density, front_density[i] ? '*' : ' ');
+	}
+
+	if (!opt.output.empty()) {
+		std::ofstream ofs(opt.output);
+		if (!ofs) {
+			std::cerr << "failed to write " << opt.output << std::endl;
+			return EXIT_FAILURE;
+		}
+		ofs << "name,frame_ms,bad1,bad2,rmse,density,pareto_bad1,pareto_bad2,pareto_rmse,pareto_density\n";
+		for (size_t i : order) {
+			const Metrics& m = metrics[i];
+			ofs << opt.configs[i].name << "," << m.frame_ms << "," << m.bad1 << "," << m.bad2 << "," << m.rmse << "," << m.density
+				<< "," << front_bad1[i] << "," << front_bad2[i] << "," << front_rmse[i] << "," << front_density[i] << "\n";
+		}
+	}
+	return EXIT_SUCCESS;
+}
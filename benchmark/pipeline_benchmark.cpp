@@ -0,0 +1,390 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cuda_runtime.h>
+
+#include <libsgm.h>
+
+#include "synthetic_scene.h"
+
+static const char* USAGE =
+"usage: sgm-pipeline-bench [options]\n"
+"  --scenes=LIST       synthetic scenes (random_dot,slanted_planes,textureless)     [random_dot]\n"
+"  --resolutions=LIST  image sizes as WxH                                           [640x480,1280x720,1920x1080]\n"
+"  --disparities=LIST  disparity sizes (64,128,256)                                  [64,128,256]\n"
+"  --paths=LIST        numbers of scanlines (4,8)                                    [4,8]\n"
+"  --census=LIST       census types (0:9x7 1:SYMMETRIC_9x7 2:5x5 3:11x9 4:13x11 5:SPARSE_13x11) [1]\n"
+"  --depth=N           input depth bits (8,16)                                       [8]\n"
+"  --subpixel          enable subpixel estimation\n"
+"  --host              pass host buffers, so latency includes transfers\n"
+"  --warmup=N          frames run before measuring                                   [10]\n"
+"  --iterations=N      measured frames per configuration                             [100]\n"
+"  --output=PATH       write results as JSON\n"
+"  --baseline=PATH     compare with JSON results of a previous run, exit with 2 on regression\n"
+"  --tolerance=F       allowed relative slowdown of p50 and p99 latency              [0.05]\n";
+
+struct Options
+{
+	std::vector<std::string> scenes{ "random_dot" };
+	std::vector<std::string> resolutions{ "640x480", "1280x720", "1920x1080" };
+	std::vector<std::string> disparities{ "64", "128", "256" };
+	std::vector<std::string> paths{ "4", "8" };
+	std::vector<std::string> census{ "1" };
+	int depth = 8;
+	bool subpixel = false;
+	bool host = false;
+	int warmup = 10;
+	int iterations = 100;
+	std::string output;
+	std::string baseline;
+	double tolerance = 0.05;
+};
+
+struct Result
+{
+	std::string scene;
+	int width, height, disparity, paths;
+	std::string census;
+	int input_depth, output_depth;
+	bool subpixel, host;
+	int iterations;
+	double mean_ms, p50_ms, p90_ms, p99_ms, max_ms;
+	double mpix_per_sec, mpix_disp_per_sec;
+
+	std::string key() const
+	{
+		std::ostringstream os;
+		os << scene << " " << width << "x" << height << " disp=" << disparity << " paths=" << paths << " " << census
+			<< " in=" << input_depth << " out=" << output_depth << (subpixel ? " subpixel" : "") << (host ? " host" : "");
+		return os.str();
+	}
+};
+
+static std::vector<std::string> split(const std::string& s, char delim)
+{
+	std::vector<std::string> items;
+	std::istringstream is(s);
+	std::string item;
+	while (std::getline(is, item, delim))
+		if (!item.empty())
+			items.push_back(item);
+	return items;
+}
+
+static const char* census_type_name(sgm::CensusType census_type)
+{
+	switch (census_type) {
+	case sgm::CensusType::CENSUS_9x7: return "CENSUS_9x7";
+	case sgm::CensusType::SYMMETRIC_CENSUS_9x7: return "SYMMETRIC_CENSUS_9x7";
+	case sgm::CensusType::CENSUS_5x5: return "CENSUS_5x5";
+	case sgm::CensusType::CENSUS_11x9: return "CENSUS_11x9";
+	case sgm::CensusType::CENSUS_13x11: return "CENSUS_13x11";
+	case sgm::CensusType::SPARSE_CENSUS_13x11: return "SPARSE_CENSUS_13x11";
+	}
+	return "";
+}
+
+// -1 unless the whole string is a decimal integer
+static int parse_int(const std::string& s)
+{
+	char* end = nullptr;
+	const long v = std::strtol(s.c_str(), &end, 10);
+	return !s.empty() && *end == '\0' && v >= 0 && v <= INT_MAX ? static_cast<int>(v) : -1;
+}
+
+static bool parse_options(int argc, char* argv[], Options& opt)
+{
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		const size_t eq = arg.find('=');
+		const std::string key = arg.substr(0, eq);
+		const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+		if (key == "--scenes") opt.scenes = split(value, ',');
+		else if (key == "--resolutions") opt.resolutions = split(value, ',');
+		else if (key == "--disparities") opt.disparities = split(value, ',');
+		else if (key == "--paths") opt.paths = split(value, ',');
+		else if (key == "--census") opt.census = split(value, ',');
+		else if (key == "--depth") opt.depth = std::atoi(value.c_str());
+		else if (key == "--subpixel") opt.subpixel = true;
+		else if (key == "--host") opt.host = true;
+		else if (key == "--warmup") opt.warmup = std::atoi(value.c_str());
+		else if (key == "--iterations") opt.iterations = std::atoi(value.c_str());
+		else if (key == "--output") opt.output = value;
+		else if (key == "--baseline") opt.baseline = value;
+		else if (key == "--tolerance") opt.tolerance = std::atof(value.c_str());
+		else return false;
+	}
+
+	// the same values the samples accept, so an invalid list fails before any configuration runs
+	for (const auto& disparity : opt.disparities) {
+		const int disp_size = parse_int(disparity);
+		if (disp_size != 64 && disp_size != 128 && disp_size != 256) {
+			std::cerr << "disparity size must be 64, 128 or 256: " << disparity << std::endl;
+			return false;
+		}
+	}
+	for (const auto& paths : opt.paths) {
+		const int num_paths = parse_int(paths);
+		if (num_paths != 4 && num_paths != 8) {
+			std::cerr << "number of scanlines must be 4 or 8: " << paths << std::endl;
+			return false;
+		}
+	}
+	for (const auto& census : opt.census) {
+		const int census_type = parse_int(census);
+		if (census_type < 0 || census_type > static_cast<int>(sgm::CensusType::SPARSE_CENSUS_13x11)) {
+			std::cerr << "census type must be 0, 1, 2, 3, 4 or 5: " << census << std::endl;
+			return false;
+		}
+	}
+	return (opt.depth == 8 || opt.depth == 16) && opt.iterations > 0 && opt.warmup >= 0;
+}
+
+static void check_cuda(cudaError_t err, const char* what)
+{
+	if (err != cudaSuccess) {
+		std::cerr << what << " failed: " << cudaGetErrorString(err) << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+}
+
+static Result run(const Options& opt, sgm::SceneType scene_type, int width, int height, int disp_size, int num_paths,
+	sgm::CensusType census_type)
+{
+	sgm::SyntheticScene scene;
+	sgm::render_scene(scene_type, width, height, disp_size, opt.depth, 1, scene);
+
+	const sgm::PathType path_type = num_paths == 8 ? sgm::PathType::SCAN_8PATH : sgm::PathType::SCAN_4PATH;
+	const sgm::StereoSGM::Parameters param(10, 120, 0.95f, opt.subpixel, path_type, 0, 1, census_type);
+	const sgm::ExecuteInOut inout = opt.host ? sgm::EXECUTE_INOUT_HOST2HOST : sgm::EXECUTE_INOUT_CUDA2CUDA;
+	const int output_depth = 16;
+	sgm::StereoSGM sgm(width, height, disp_size, opt.depth, output_depth, inout, param);
+
+	const size_t src_bytes = scene.left.size();
+	const size_t dst_bytes = sizeof(uint16_t) * width * height;
+	std::vector<uint16_t> h_disparity(static_cast<size_t>(width) * height);
+	void *srcL = scene.left.data(), *srcR = scene.right.data(), *dst = h_disparity.data();
+	if (!opt.host) {
+		check_cuda(cudaMalloc(&srcL, src_bytes), "cudaMalloc");
+		check_cuda(cudaMalloc(&srcR, src_bytes), "cudaMalloc");
+		check_cuda(cudaMalloc(&dst, dst_bytes), "cudaMalloc");
+		check_cuda(cudaMemcpy(srcL, scene.left.data(), src_bytes, cudaMemcpyHostToDevice), "cudaMemcpy");
+		check_cuda(cudaMemcpy(srcR, scene.right.data(), src_bytes, cudaMemcpyHostToDevice), "cudaMemcpy");
+	}
+
+	std::vector<double> latencies;
+	latencies.reserve(opt.iterations);
+	for (int i = 0; i < opt.warmup + opt.iterations; i++) {
+		const auto t1 = std::chrono::steady_clock::now();
+		sgm.execute(srcL, srcR, dst);
+		check_cuda(cudaDeviceSynchronize(), "cudaDeviceSynchronize");
+		const auto t2 = std::chrono::steady_clock::now();
+		if (i >= opt.warmup)
+			latencies.push_back(std::chrono::duration<double, std::milli>(t2 - t1).count());
+	}
+
+	if (!opt.host) {
+		cudaFree(srcL);
+		cudaFree(srcR);
+		cudaFree(dst);
+	}
+
+	Result r;
+	r.scene = sgm::scene_name(scene_type);
+	r.width = width;
+	r.height = height;
+	r.disparity = disp_size;
+	r.paths = num_paths;
+	r.census = census_type_name(census_type);
+	r.input_depth = opt.depth;
+	r.output_depth = output_depth;
+	r.subpixel = opt.subpixel;
+	r.host = opt.host;
+	r.iterations = opt.iterations;
+
+	double sum = 0;
+	for (double t : latencies)
+		sum += t;
+	std::sort(latencies.begin(), latencies.end());
+	r.mean_ms = sum / latencies.size();
+	r.p50_ms = sgm::percentile(latencies.data(), latencies.size(), 0.50);
+	r.p90_ms = sgm::percentile(latencies.data(), latencies.size(), 0.90);
+	r.p99_ms = sgm::percentile(latencies.data(), latencies.size(), 0.99);
+	r.max_ms = latencies.back();
+
+	const double mpix = 1e-6 * width * height;
+	r.mpix_per_sec = 1e3 * mpix / r.mean_ms;
+	r.mpix_disp_per_sec = r.mpix_per_sec * disp_size;
+	return r;
+}
+
+// one result object per line, so results are read back without a JSON library
+static bool write_json(const std::string& path, const Options& opt, const std::vector<Result>& results)
+{
+	FILE* fp = fopen(path.c_str(), "w");
+	if (!fp)
+		return false;
+
+	cudaDeviceProp prop;
+	check_cuda(cudaGetDeviceProperties(&prop, 0), "cudaGetDeviceProperties");
+	fprintf(fp, "{\n\"device\": \"%s\",\n\"depth\": %d,\n\"subpixel\": %s,\n\"host\": %s,\n\"results\": [\n",
+		prop.name, opt.depth, opt.subpixel ? "true" : "false", opt.host ? "true" : "false");
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result& r = results[i];
+		fprintf(fp, "{\"scene\": \"%s\", \"width\": %d, \"height\": %d, \"disparity\": %d, \"paths\": %d, \"census\": \"%s\", "
+			"\"input_depth\": %d, \"output_depth\": %d, \"subpixel\": %s, \"host\": %s, \"iterations\": %d, \"mean_ms\": %.4f, \"p50_ms\": %.4f, \"p90_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f, "
+			"\"mpix_per_sec\": %.3f, \"mpix_disp_per_sec\": %.3f}%s\n",
+			r.scene.c_str(), r.width, r.height, r.disparity, r.paths, r.census.c_str(),
+			r.input_depth, r.output_depth, r.subpixel ? "true" : "false", r.host ? "true" : "false", r.iterations,
+			r.mean_ms, r.p50_ms, r.p90_ms, r.p99_ms, r.max_ms, r.mpix_per_sec, r.mpix_disp_per_sec, i + 1 < results.size() ? "," : "");
+	}
+	fprintf(fp, "]\n}\n");
+	fclose(fp);
+	return true;
+}
+
+static std::string json_string(const std::string& line, const std::string& key)
+{
+	const size_t pos = line.find("\"" + key + "\": \"");
+	if (pos == std::string::npos)
+		return "";
+	const size_t begin = pos + key.size() + 5;
+	return line.substr(begin, line.find('"', begin) - begin);
+}
+
+static double json_number(const std::string& line, const std::string& key)
+{
+	const size_t pos = line.find("\"" + key + "\": ");
+	return pos == std::string::npos ? 0 : std::atof(line.c_str() + pos + key.size() + 4);
+}
+
+static bool json_bool(const std::string& line, const std::string& key)
+{
+	return line.find("\"" + key + "\": true") != std::string::npos;
+}
+
+static bool read_json(const std::string& path, std::map<std::string, Result>& results)
+{
+	std::ifstream ifs(path);
+	if (!ifs)
+		return false;
+
+	std::string line;
+	while (std::getline(ifs, line)) {
+		if (line.find("\"scene\"") == std::string::npos)
+			continue;
+		Result r;
+		r.scene = json_string(line, "scene");
+		r.width = static_cast<int>(json_number(line, "width"));
+		r.height = static_cast<int>(json_number(line, "height"));
+		r.disparity = static_cast<int>(json_number(line, "disparity"));
+		r.paths = static_cast<int>(json_number(line, "paths"));
+		r.census = json_string(line, "census");
+		r.input_depth = static_cast<int>(json_number(line, "input_depth"));
+		r.output_depth = static_cast<int>(json_number(line, "output_depth"));
+		r.subpixel = json_bool(line, "subpixel");
+		r.host = json_bool(line, "host");
+		r.p50_ms = json_number(line, "p50_ms");
+		r.p99_ms = json_number(line, "p99_ms");
+		r.mpix_per_sec = json_number(line, "mpix_per_sec");
+		results[r.key()] = r;
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	Options opt;
+	if (!parse_options(argc, argv, opt)) {
+		std::cerr << USAGE;
+		return EXIT_FAILURE;
+	}
+
+	std::vector<Result> results;
+	printf("%-88s %9s %9s %9s %9s %9s %10s %14s\n", "configuration", "mean[ms]", "p50[ms]", "p90[ms]", "p99[ms]", "max[ms]", "Mpix/s", "Mpix*disp/s");
+	for (const auto& scene : opt.scenes) {
+		sgm::SceneType scene_type;
+		if (!sgm::parse_scene(scene.c_str(), scene_type)) {
+			std::cerr << "unknown scene: " << scene << std::endl;
+			return EXIT_FAILURE;
+		}
+		for (const auto& resolution : opt.resolutions) {
+			int width = 0, height = 0;
+			if (sscanf(resolution.c_str(), "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+				std::cerr << "invalid resolution: " << resolution << std::endl;
+				return EXIT_FAILURE;
+			}
+			for (const auto& disparity : opt.disparities) {
+				for (const auto& paths : opt.paths) {
+					for (const auto& census : opt.census) {
+						const Result r = run(opt, scene_type, width, height, parse_int(disparity), parse_int(paths),
+							static_cast<sgm::CensusType>(parse_int(census)));
+						printf("%-88s %9.3f %9.3f %9.3f %9.3f %9.3f %10.1f %14.1f\n", r.key().c_str(),
+							r.mean_ms, r.p50_ms, r.p90_ms, r.p99_ms, r.max_ms, r.mpix_per_sec, r.mpix_disp_per_sec);
+						results.push_back(r);
+					}
+				}
+			}
+		}
+	}
+
+	if (!opt.output.empty() && !write_json(opt.output, opt, results)) {
+		std::cerr << "failed to write " << opt.output << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if (opt.baseline.empty())
+		return EXIT_SUCCESS;
+
+	std::map<std::string, Result> baseline;
+	if (!read_json(opt.baseline, baseline)) {
+		std::cerr << "failed to read " << opt.baseline << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// p50 and p99 latency are compared with the same tolerance, results are matched by their full configuration
+	int regressions = 0;
+	printf("\n# Compared with %s\n", opt.baseline.c_str());
+	for (const Result& r : results) {
+		const auto it = baseline.find(r.key());
+		if (it == baseline.end()) {
+			printf("%-88s not in baseline\n", r.key().c_str());
+			continue;
+		}
+		const Result& b = it->second;
+		const double p50_ratio = r.p50_ms / b.p50_ms;
+		const double p99_ratio = r.p99_ms / b.p99_ms;
+		const bool regressed = p50_ratio > 1 + opt.tolerance || p99_ratio > 1 + opt.tolerance;
+		printf("%-88s p50 %+6.1f%% p99 %+6.1f%% %s\n", r.key().c_str(), 100 * (p50_ratio - 1), 100 * (p99_ratio - 1),
+			regressed ? "REGRESSION" : "ok");
+		regressions += regressed;
+	}
+	return regressions > 0 ? 2 : EXIT_SUCCESS;
+}
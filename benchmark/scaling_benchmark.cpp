@@ -0,0 +1,368 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <cuda_runtime.h>
+
+#include <libsgm.h>
+
+#include "synthetic_scene.h"
+
+static const char* USAGE =
+"usage: sgm-scaling-bench [options]\n"
+"  --threads=LIST     numbers of concurrent instances, each driven by its own host thread [1,2,4,...,hardware threads]\n"
+"  --pinning=MODE     none, compact (fill a NUMA node first), scatter (round robin over nodes) or node:K [none]\n"
+"  --resolution=WxH   image size                                                         [1280x720]\n"
+"  --disparity=N      disparity size                                                     [128]\n"
+"  --paths=N          number of scanlines                                                [8]\n"
+"  --census=N         census type (0:9x7 1:SYMMETRIC_9x7 2:5x5 3:11x9 4:13x11 5:SPARSE_13x11) [1]\n"
+"  --host             pass host buffers, so every frame includes transfers\n"
+"  --frames=N         frames per instance                                                [100]\n"
+"  --format=FORMAT    csv or json                                                        [csv]\n"
+"  --output=PATH      write results to a file instead of stdout\n";
+
+struct Options
+{
+	std::vector<int> threads;
+	std::string pinning = "none";
+	int width = 1280;
+	int height = 720;
+	int disparity = 128;
+	int paths = 8;
+	int census = 1;
+	bool host = false;
+	int frames = 100;
+	std::string format = "csv";
+	std::string output;
+};
+
+struct Result
+{
+	int threads;
+	double seconds;
+	double mpix_per_sec;
+	double speedup;
+	double efficiency;
+	std::vector<std::string> stages; // empty unless built with LIBSGM_ENABLE_PROFILING
+	std::vector<float> stage_ms;     // mean over instances
+};
+
+static bool parse_options(int argc, char* argv[], Options& opt)
+{
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		const size_t eq = arg.find('=');
+		const std::string key = arg.substr(0, eq);
+		const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+		if (key == "--threads") {
+			std::istringstream is(value);
+			std::string item;
+			while (std::getline(is, item, ','))
+				opt.threads.push_back(std::atoi(item.c_str()));
+		}
+		else if (key == "--pinning") opt.pinning = value;
+		else if (key == "--resolution") { if (sscanf(value.c_str(), "%dx%d", &opt.width, &opt.height) != 2) return false; }
+		else if (key == "--disparity") opt.disparity = std::atoi(value.c_str());
+		else if (key == "--paths") opt.paths = std::atoi(value.c_str());
+		else if (key == "--census") opt.census = std::atoi(value.c_str());
+		else if (key == "--host") opt.host = true;
+		else if (key == "--frames") opt.frames = std::atoi(value.c_str());
+		else if (key == "--format") opt.format = value;
+		else if (key == "--output") opt.output = value;
+		else return false;
+	}
+
+	if (opt.threads.empty()) {
+		const int max_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+		for (int t = 1; t < max_threads; t *= 2)
+			opt.threads.push_back(t);
+		opt.threads.push_back(max_threads);
+	}
+	for (int t : opt.threads)
+		if (t <= 0)
+			return false;
+	return opt.frames > 0 && (opt.format == "csv" || opt.format == "json");
+}
+
+// online CPUs of each NUMA node, a single node with all CPUs where the topology is unknown
+static std::vector<std::vector<int>> numa_nodes()
+{
+	std::vector<std::vector<int>> nodes;
+#if defined(__linux__)
+	for (int node = 0;; node++) {
+		std::ifstream ifs("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+		if (!ifs)
+			break;
+		std::vector<int> cpus;
+		std::string range;
+		while (std::getline(ifs, range, ',')) {
+			int first = 0, last = 0;
+			const int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+			if (n == 1)
+				last = first;
+			for (int cpu = first; n >= 1 && cpu <= last; cpu++)
+				cpus.push_back(cpu);
+		}
+		if (!cpus.empty())
+			nodes.push_back(cpus);
+	}
+#endif
+	if (nodes.empty()) {
+		nodes.emplace_back();
+		for (int cpu = 0; cpu < static_cast<int>(std::thread::hardware_concurrency()); cpu++)
+			nodes.back().push_back(cpu);
+	}
+	return nodes;
+}
+
+// CPU of each thread in the pinning order, empty for no pinning
+static bool pinning_order(const std::string& mode, std::vector<int>& order)
+{
+	const auto nodes = numa_nodes();
+	order.clear();
+	if (mode == "none")
+		return true;
+	if (mode == "compact") {
+		for (const auto& cpus : nodes)
+			order.insert(order.end(), cpus.begin(), cpus.end());
+		return true;
+	}
+	if (mode == "scatter") {
+		size_t max_cpus = 0;
+		for (const auto& cpus : nodes)
+			max_cpus = std::max(max_cpus, cpus.size());
+		for (size_t i = 0; i < max_cpus; i++)
+			for (const auto& cpus : nodes)
+				if (i < cpus.size())
+					order.push_back(cpus[i]);
+		return true;
+	}
+	int node = -1;
+	if (sscanf(mode.c_str(), "node:%d", &node) == 1 && node >= 0 && node < static_cast<int>(nodes.size())) {
+		order = nodes[node];
+		return true;
+	}
+	return false;
+}
+
+static void pin_thread(std::thread& thread, int cpu)
+{
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+	(void)thread;
+	(void)cpu;
+#endif
+}
+
+struct Instance
+{
+	std::unique_ptr<sgm::StereoSGM> sgm;
+	void* srcL = nullptr;
+	void* srcR = nullptr;
+	void* dst = nullptr;
+};
+
+static Result run(const Options& opt, const sgm::SyntheticScene& scene, int num_threads, const std::vector<int>& cpus)
+{
+	const sgm::PathType path_type = opt.paths == 8 ? sgm::PathType::SCAN_8PATH : sgm::PathType::SCAN_4PATH;
+	const sgm::StereoSGM::Parameters param(10, 120, 0.95f, false, path_type, 0, 1, static_cast<sgm::CensusType>(opt.census));
+	const sgm::ExecuteInOut inout = opt.host ? sgm::EXECUTE_INOUT_HOST2HOST : sgm::EXECUTE_INOUT_CUDA2CUDA;
+	const size_t src_bytes = scene.left.size();
+	const size_t dst_bytes = sizeof(uint16_t) * opt.width * opt.height;
+
+	// instances and buffers are set up before timing, only execution is measured
+	std::vector<Instance> instances(num_threads);
+	std::vector<std::vector<uint16_t>> h_dst(num_threads);
+	for (int i = 0; i < num_threads; i++) {
+		Instance& inst = instances[i];
+		inst.sgm.reset(new sgm::StereoSGM(opt.width, opt.height, opt.disparity, scene.depth_bits, 16, inout, param));
+		if (opt.host) {
+			h_dst[i].resize(static_cast<size_t>(opt.width) * opt.height);
+			inst.srcL = const_cast<uint8_t*>(scene.left.data());
+			inst.srcR = const_cast<uint8_t*>(scene.right.data());
+			inst.dst = h_dst[i].data();
+		}
+		else {
+			cudaMalloc(&inst.srcL, src_bytes);
+			cudaMalloc(&inst.srcR, src_bytes);
+			cudaMalloc(&inst.dst, dst_bytes);
+			cudaMemcpy(inst.srcL, scene.left.data(), src_bytes, cudaMemcpyHostToDevice);
+			cudaMemcpy(inst.srcR, scene.right.data(), src_bytes, cudaMemcpyHostToDevice);
+		}
+		inst.sgm->execute(inst.srcL, inst.srcR, inst.dst);
+	}
+	cudaDeviceSynchronize();
+
+	// the warm-up frame includes first launches, stage times cover the measured frames only
+	for (Instance& inst : instances)
+		inst.sgm->reset_stage_stats();
+
+	std::atomic<int> ready(0);
+	std::atomic<bool> start(false);
+	std::vector<std::thread> threads;
+	for (int i = 0; i < num_threads; i++) {
+		threads.emplace_back([&, i] {
+			Instance& inst = instances[i];
+			ready++;
+			while (!start.load())
+				std::this_thread::yield();
+			for (int f = 0; f < opt.frames; f++)
+				inst.sgm->execute(inst.srcL, inst.srcR, inst.dst);
+			cudaDeviceSynchronize();
+		});
+		if (!cpus.empty())
+			pin_thread(threads.back(), cpus[i % cpus.size()]);
+	}
+	while (ready.load() < num_threads)
+		std::this_thread::yield();
+
+	const auto t1 = std::chrono::steady_clock::now();
+	start = true;
+	for (auto& thread : threads)
+		thread.join();
+	const auto t2 = std::chrono::steady_clock::now();
+
+	Result r;
+	r.threads = num_threads;
+	r.seconds = std::chrono::duration<double>(t2 - t1).count();
+	r.mpix_per_sec = 1e-6 * opt.width * opt.height * opt.frames * num_threads / r.seconds;
+	r.speedup = r.efficiency = 0;
+
+	// per-stage times show which stage degrades under contention
+	for (Instance& inst : instances) {
+		sgm::StageStats stats[32];
+		const int num_stats = std::min(inst.sgm->get_stage_stats(stats, 32), 32);
+		r.stages.resize(num_stats);
+		r.stage_ms.resize(num_stats, 0.f);
+		for (int s = 0; s < num_stats; s++) {
+			r.stages[s] = stats[s].name;
+			r.stage_ms[s] += stats[s].mean / num_threads;
+		}
+		if (!opt.host) {
+			cudaFree(inst.srcL);
+			cudaFree(inst.srcR);
+			cudaFree(inst.dst);
+		}
+	}
+	return r;
+}
+
+static void write_csv(std::ostream& os, const std::vector<Result>& results, const std::vector<std::string>& stages)
+{
+	os << "threads,seconds,mpix_per_sec,speedup,efficiency";
+	for (const auto& name : stages)
+		os << "," << name << "_ms";
+	os << "\n";
+	for (const Result& r : results) {
+		os << r.threads << "," << r.seconds << "," << r.mpix_per_sec << "," << r.speedup << "," << r.efficiency;
+		for (size_t s = 0; s < stages.size(); s++)
+			os << "," << (s < r.stage_ms.size() ? r.stage_ms[s] : 0.f);
+		os << "\n";
+	}
+}
+
+static void write_json(std::ostream& os, const Options& opt, const std::vector<Result>& results, const std::vector<std::string>& stages,
+	int saturation)
+{
+	cudaDeviceProp prop;
+	cudaGetDeviceProperties(&prop, 0);
+	os << "{\n\"device\": \"" << prop.name << "\",\n\"width\": " << opt.width << ",\n\"height\": " << opt.height
+		<< ",\n\"disparity\": " << opt.disparity << ",\n\"paths\": " << opt.paths << ",\n\"pinning\": \"" << opt.pinning
+		<< "\",\n\"saturation_threads\": " << saturation << ",\n\"results\": [\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result& r = results[i];
+		os << "{\"threads\": " << r.threads << ", \"seconds\": " << r.seconds << ", \"mpix_per_sec\": " << r.mpix_per_sec
+			<< ", \"speedup\": " << r.speedup << ", \"efficiency\": " << r.efficiency << ", \"stages_ms\": {";
+		for (size_t s = 0; s < stages.size(); s++)
+			os << (s ? ", " : "") << "\"" << stages[s] << "\": " << (s < r.stage_ms.size() ? r.stage_ms[s] : 0.f);
+		os << "}}" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	os << "]\n}\n";
+}
+
+int main(int argc, char* argv[])
+{
+	Options opt;
+	std::vector<int> cpus;
+	if (!parse_options(argc, argv, opt) || !pinning_order(opt.pinning, cpus)) {
+		std::cerr << USAGE;
+		return EXIT_FAILURE;
+	}
+
+	sgm::SyntheticScene scene;
+	sgm::render_scene(sgm::SceneType::SLANTED_PLANES, opt.width, opt.height, opt.disparity, 8, 1, scene);
+
+	std::vector<Result> results;
+	for (int t : opt.threads) {
+		results.push_back(run(opt, scene, t, cpus));
+		const Result& r = results.back();
+		std::cerr << "threads " << r.threads << ": " << r.mpix_per_sec << " Mpix/s" << std::endl;
+	}
+
+	// speedup is relative to the smallest thread count, saturation is the first count adding less than 10% throughput
+	const Result& base = *std::min_element(results.begin(), results.end(),
+		[](const Result& a, const Result& b) { return a.threads < b.threads; });
+	int saturation = 0;
+	for (size_t i = 0; i < results.size(); i++) {
+		Result& r = results[i];
+		r.speedup = r.mpix_per_sec / base.mpix_per_sec;
+		r.efficiency = r.speedup * base.threads / r.threads;
+		if (!saturation && i > 0 && r.threads > results[i - 1].threads && r.mpix_per_sec < 1.1 * results[i - 1].mpix_per_sec)
+			saturation = results[i - 1].threads;
+	}
+	if (saturation)
+		std::cerr << "throughput saturates at " << saturation << " threads" << std::endl;
+
+	const std::vector<std::string>& stages = results.front().stages;
+
+	std::ofstream ofs;
+	if (!opt.output.empty()) {
+		ofs.open(opt.output);
+		if (!ofs) {
+			std::cerr << "failed to write " << opt.output << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	std::ostream& os = opt.output.empty() ? std::cout : ofs;
+	if (opt.format == "csv")
+		write_csv(os, results, stages);
+	else
+		write_json(os, opt, results, stages, saturation);
+
+	return EXIT_SUCCESS;
+}
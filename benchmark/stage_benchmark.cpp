@@ -0,0 +1,279 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <algorithm>
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+#include <cuda_runtime.h>
+
+#include "host_image.h"
+#include "device_image.h"
+#include "test_utility.h"
+#include "internal.h"
+#include "constants.h"
+#include "host_utility.h"
+#include "profiler.h"
+
+using namespace sgm;
+using namespace details;
+
+// stages run on the device, so each iteration is timed by CUDA events around the stage only
+template <typename Setup, typename Run>
+static void run_stage(benchmark::State& state, int pixels, Setup setup, Run run)
+{
+	cudaEvent_t begin, end;
+	CUDA_CHECK(cudaEventCreate(&begin));
+	CUDA_CHECK(cudaEventCreate(&end));
+
+	// warm up, which also allocates outputs
+	setup();
+	run();
+	CUDA_CHECK(cudaDeviceSynchronize());
+
+	for (auto _ : state) {
+		setup();
+		CUDA_CHECK(cudaEventRecord(begin));
+		run();
+		CUDA_CHECK(cudaEventRecord(end));
+		CUDA_CHECK(cudaEventSynchronize(end));
+
+		float ms = 0.f;
+		CUDA_CHECK(cudaEventElapsedTime(&ms, begin, end));
+		state.SetIterationTime(1e-3 * ms);
+	}
+	state.counters["Mpix/s"] = benchmark::Counter(1e-6 * pixels, benchmark::Counter::kIsIterationInvariantRate);
+
+	CUDA_CHECK(cudaEventDestroy(begin));
+	CUDA_CHECK(cudaEventDestroy(end));
+}
+
+static void no_setup()
+{
+}
+
+static const int RESOLUTIONS[][2] = { { 640, 480 }, { 1280, 720 }, { 1920, 1080 } };
+static const int DISP_SIZES[] = { 64, 128, 256 };
+
+// width, height
+static void resolution_args(benchmark::internal::Benchmark* b)
+{
+	for (const auto& r : RESOLUTIONS)
+		b->Args({ r[0], r[1] });
+}
+
+// width, height, disparity size
+static void disparity_args(benchmark::internal::Benchmark* b)
+{
+	for (const auto& r : RESOLUTIONS)
+		for (int disp_size : DISP_SIZES)
+			b->Args({ r[0], r[1], disp_size });
+}
+
+// cost volumes reach gigabytes, so a random block of at most 16MB is tiled over the image
+static void random_image(DeviceImage& d_image, int rows, int cols, ImageType type, int maxv = -1)
+{
+	d_image.create(rows, cols, type);
+
+	const size_t total = elemSize(type) * rows * d_image.step;
+	const int block_cols = static_cast<int>(std::min(total, static_cast<size_t>(16 << 20)) / elemSize(type));
+	HostImage h_block(1, block_cols, type);
+	if (maxv < 0)
+		random_fill(h_block);
+	else
+		random_fill(h_block, 0, maxv);
+
+	const size_t block_bytes = elemSize(type) * block_cols;
+	for (size_t offset = 0; offset < total; offset += block_bytes) {
+		CUDA_CHECK(cudaMemcpy(static_cast<uint8_t*>(d_image.data) + offset, h_block.data, std::min(block_bytes, total - offset),
+			cudaMemcpyHostToDevice));
+	}
+}
+
+// skips configurations whose buffers exceed the device memory instead of aborting the whole run
+static bool fits_device(benchmark::State& state, size_t bytes)
+{
+	size_t free_bytes = 0, total_bytes = 0;
+	CUDA_CHECK(cudaMemGetInfo(&free_bytes, &total_bytes));
+	if (bytes < free_bytes)
+		return true;
+	state.SkipWithError("buffers do not fit device memory");
+	return false;
+}
+
+// width, height, census type, input depth
+static void BM_CensusTransform(benchmark::State& state)
+{
+	const int w = static_cast<int>(state.range(0));
+	const int h = static_cast<int>(state.range(1));
+	const auto census_type = static_cast<CensusType>(state.range(2));
+	const ImageType src_type = state.range(3) == 8 ? SGM_8U : SGM_16U;
+
+	DeviceImage d_src, d_dst;
+	random_image(d_src, h, w, src_type);
+
+	run_stage(state, w * h, no_setup, [&] { census_transform(d_src, d_dst, census_type); });
+}
+BENCHMARK(BM_CensusTransform)->Apply([](benchmark::internal::Benchmark* b) {
+	for (const auto& r : RESOLUTIONS)
+		for (int type = 0; type <= static_cast<int>(CensusType::SPARSE_CENSUS_13x11); type++)
+			for (int depth : { 8, 16 })
+				b->Args({ r[0], r[1], type, depth });
+})->ArgNames({ "w", "h", "census", "depth" })->UseManualTime()->Unit(benchmark::kMicrosecond);
+
+// width, height, disparity size, census type, number of paths, vertical epipolar lines
+// the Hamming cost is computed inside the path recurrence, so the census type gives the cost of wider descriptors;
+// vertical epipolar lines read the census images with a column stride, which gives the cost of their uncoalesced loads
+static void BM_CostAggregation(benchmark::State& state)
+{
+	const int w = static_cast<int>(state.range(0));
+	const int h = static_cast<int>(state.range(1));
+	const int disp_size = static_cast<int>(state.range(2));
+	const auto census_type = static_cast<CensusType>(state.range(3));
+	const auto path_type = state.range(4) == 8 ? PathType::SCAN_8PATH : PathType::SCAN_4PATH;
+	const auto direction = state.range(5) ? EpipolarDirection::VERTICAL : EpipolarDirection::HORIZONTAL;
+
+	const int num_paths = static_cast<int>(state.range(4));
+	if (!fits_device(state, static_cast<size_t>(num_paths) * w * h * disp_size))
+		return;
+
+	DeviceImage d_censusL, d_censusR, d_cost;
+	random_image(d_censusL, h, w, census_image_type(census_type));
+	random_image(d_censusR, h, w, census_image_type(census_type));
+
+	const auto aggregate = [&] {
+		cost_aggregation(d_censusL, d_censusR, d_cost, disp_size, 10, 120, path_type, 0, direction, DeviceImage());
+	};
+	run_stage(state, w * h, no_setup, aggregate);
+	state.counters["Gcell/s"] = benchmark::Counter(1e-9 * w * h * disp_size * num_paths,
+		benchmark::Counter::kIsIterationInvariantRate);
+
+#ifdef LIBSGM_ENABLE_PROFILING
+	// directions run concurrently on their own streams, their times are taken by the stage profiler in a separate pass
+	StageProfiler profiler;
+	for (int i = 0; i < 10; i++) {
+		ProfilerScope scope(profiler);
+		aggregate();
+	}
+	StageStats stats[static_cast<int>(Stage::NUM_STAGES)];
+	const int num_stats = std::min(profiler.get_stats(stats, static_cast<int>(Stage::NUM_STAGES)), static_cast<int>(Stage::NUM_STAGES));
+	for (int i = 0; i < num_stats; i++)
+		state.counters[std::string(stats[i].name) + "_ms"] = stats[i].mean;
+#endif
+}
+BENCHMARK(BM_CostAggregation)->Apply([](benchmark::internal::Benchmark* b) {
+	for (const auto& r : RESOLUTIONS)
+		for (int disp_size : DISP_SIZES)
+			for (int type : { static_cast<int>(CensusType::CENSUS_5x5), static_cast<int>(CensusType::CENSUS_9x7), static_cast<int>(CensusType::CENSUS_13x11) })
+				for (int paths : { 4, 8 })
+					for (int vertical : { 0, 1 })
+						b->Args({ r[0], r[1], disp_size, type, paths, vertical });
+})->ArgNames({ "w", "h", "disp", "census", "paths", "vertical" })->UseManualTime()->Unit(benchmark::kMicrosecond);
+
+// width, height, disparity size, subpixel, vertical epipolar lines
+// vertical epipolar lines write disparities of a scanline down an image column
+static void BM_WinnerTakesAll(benchmark::State& state)
+{
+	const int w = static_cast<int>(state.range(0));
+	const int h = static_cast<int>(state.range(1));
+	const int disp_size = static_cast<int>(state.range(2));
+	const bool subpixel = state.range(3) != 0;
+	const auto direction = state.range(4) ? EpipolarDirection::VERTICAL : EpipolarDirection::HORIZONTAL;
+	const int num_paths = 8;
+	if (!fits_device(state, static_cast<size_t>(num_paths) * w * h * disp_size))
+		return;
+
+	DeviceImage d_cost, d_dispL(h, w, SGM_16U), d_dispR(h, w, SGM_16U);
+	random_image(d_cost, num_paths, h * w * disp_size, SGM_8U);
+
+	run_stage(state, w * h, no_setup, [&] {
+		winner_takes_all(d_cost, d_dispL, d_dispR, disp_size, 0.95f, subpixel, PathType::SCAN_8PATH, direction, DeviceImage(),
+			FrameCounters());
+	});
+}
+BENCHMARK(BM_WinnerTakesAll)->Apply([](benchmark::internal::Benchmark* b) {
+	for (const auto& r : RESOLUTIONS)
+		for (int disp_size : DISP_SIZES)
+			for (int subpixel : { 0, 1 })
+				for (int vertical : { 0, 1 })
+					b->Args({ r[0], r[1], disp_size, subpixel, vertical });
+})->ArgNames({ "w", "h", "disp", "subpixel", "vertical" })->UseManualTime()->Unit(benchmark::kMicrosecond);
+
+// width, height, depth
+static void BM_MedianFilter(benchmark::State& state)
+{
+	const int w = static_cast<int>(state.range(0));
+	const int h = static_cast<int>(state.range(1));
+	const ImageType type = state.range(2) == 8 ? SGM_8U : SGM_16U;
+
+	DeviceImage d_src, d_dst;
+	random_image(d_src, h, w, type);
+
+	run_stage(state, w * h, no_setup, [&] { median_filter(d_src, d_dst); });
+}
+BENCHMARK(BM_MedianFilter)->Apply([](benchmark::internal::Benchmark* b) {
+	for (const auto& r : RESOLUTIONS)
+		for (int depth : { 8, 16 })
+			b->Args({ r[0], r[1], depth });
+})->ArgNames({ "w", "h", "depth" })->UseManualTime()->Unit(benchmark::kMicrosecond);
+
+// width, height, disparity size
+static void BM_CheckConsistency(benchmark::State& state)
+{
+	const int w = static_cast<int>(state.range(0));
+	const int h = static_cast<int>(state.range(1));
+	const int disp_size = static_cast<int>(state.range(2));
+
+	DeviceImage d_src, d_dispL_org, d_dispL, d_dispR;
+	random_image(d_src, h, w, SGM_8U);
+	random_image(d_dispL_org, h, w, SGM_16U, disp_size - 1);
+	random_image(d_dispR, h, w, SGM_16U, disp_size - 1);
+	d_dispL.create(h, w, SGM_16U);
+
+	// the check invalidates pixels in place, so every iteration starts from the same disparities
+	const auto setup = [&] {
+		CUDA_CHECK(cudaMemcpy(d_dispL.data, d_dispL_org.data, sizeof(uint16_t) * h * d_dispL.step, cudaMemcpyDeviceToDevice));
+	};
+	run_stage(state, w * h, setup, [&] { check_consistency(d_dispL, d_dispR, d_src, false, 1); });
+}
+BENCHMARK(BM_CheckConsistency)->Apply(disparity_args)->ArgNames({ "w", "h", "disp" })->UseManualTime()->Unit(benchmark::kMicrosecond);
+
+static void BM_Cast16To8(benchmark::State& state)
+{
+	const int w = static_cast<int>(state.range(0));
+	const int h = static_cast<int>(state.range(1));
+
+	DeviceImage d_src, d_dst;
+	random_image(d_src, h, w, SGM_16U);
+
+	run_stage(state, w * h, no_setup, [&] { cast_16bit_to_8bit(d_src, d_dst); });
+}
+BENCHMARK(BM_Cast16To8)->Apply(resolution_args)->ArgNames({ "w", "h" })->UseManualTime()->Unit(benchmark::kMicrosecond);
+
+static void BM_Cast8To16(benchmark::State& state)
+{
+	const int w = static_cast<int>(state.range(0));
+	const int h = static_cast<int>(state.range(1));
+
+	DeviceImage d_src, d_dst;
+	random_image(d_src, h, w, SGM_8U);
+
+	run_stage(state, w * h, no_setup, [&] { cast_8bit_to_16bit(d_src, d_dst); });
+}
+BENCHMARK(BM_Cast8To16)->Apply(resolution_args)->ArgNames({ "w", "h" })->UseManualTime()->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,215 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "synthetic_scene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+namespace sgm
+{
+
+namespace
+{
+
+// plane in disparity space, d = a * x + b * y + c in left image coordinates
+struct Plane
+{
+	float a, b, c;
+	float operator()(float x, float y) const { return a * x + b * y + c; }
+};
+
+// rectangle in left image coordinates, the background covers the whole plane
+struct Surface
+{
+	int x0, y0, x1, y1;
+	Plane d;
+	uint32_t seed;
+};
+
+uint32_t hash(uint32_t x)
+{
+	x ^= x >> 16; x *= 0x7feb352du;
+	x ^= x >> 15; x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+float lattice(uint32_t seed, int i, int j)
+{
+	return (hash(seed ^ hash(static_cast<uint32_t>(i) ^ hash(static_cast<uint32_t>(j)))) & 0xffffff) / 16777216.f;
+}
+
+float value_noise(uint32_t seed, float u, float v, float scale)
+{
+	const float fu = u / scale, fv = v / scale;
+	const int iu = static_cast<int>(std::floor(fu)), iv = static_cast<int>(std::floor(fv));
+	const float tu = fu - iu, tv = fv - iv;
+	const float top = (1 - tu) * lattice(seed, iu, iv) + tu * lattice(seed, iu + 1, iv);
+	const float bottom = (1 - tu) * lattice(seed, iu, iv + 1) + tu * lattice(seed, iu + 1, iv + 1);
+	return (1 - tv) * top + tv * bottom;
+}
+
+// texture coordinates are right image coordinates, so both views sample a visible point at the same (u, y)
+float texture(SceneType type, uint32_t seed, float u, int y)
+{
+	if (type == SceneType::RANDOM_DOT)
+		return lattice(seed, static_cast<int>(std::floor(u)), y) > 0.5f ? 1.f : 0.f;
+
+	if (type == SceneType::TEXTURELESS && lattice(seed ^ 0x5bd1e995u, static_cast<int>(std::floor(u / 48)), y / 48) < 0.4f)
+		return 0.5f;
+
+	return 0.6f * value_noise(seed, u, static_cast<float>(y), 4.f) + 0.4f * value_noise(seed + 1, u, static_cast<float>(y), 1.f);
+}
+
+void layout(SceneType type, int width, int height, int max_disparity, uint32_t seed, std::vector<Surface>& surfaces)
+{
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+	const float D = static_cast<float>(max_disparity);
+
+	surfaces.clear();
+	if (type == SceneType::RANDOM_DOT) {
+		// integer disparities on fronto-parallel planes
+		surfaces.push_back({ 0, 0, width, height, { 0.f, 0.f, std::floor(0.2f * D) }, hash(seed) });
+		for (int i = 0; i < 3; i++) {
+			const int size = std::max(8, static_cast<int>((0.15f + 0.1f * uniform(rng)) * std::min(width, height)));
+			const int x0 = static_cast<int>(uniform(rng) * (width - size));
+			const int y0 = static_cast<int>(uniform(rng) * (height - size));
+			surfaces.push_back({ x0, y0, x0 + size, y0 + size, { 0.f, 0.f, std::floor((0.4f + 0.2f * i) * D) }, hash(seed + i + 1) });
+		}
+		return;
+	}
+
+	// slopes stay below one pixel per pixel so planes remain visible in the right view
+	const float ax = std::min(0.3f * D / width, 0.5f);
+	const float ay = std::min(0.1f * D / height, 0.5f);
+	surfaces.push_back({ 0, 0, width, height, { ax, ay, 0.05f * D }, hash(seed) });
+	for (int i = 0; i < 4; i++) {
+		const int w = std::max(8, static_cast<int>((0.2f + 0.2f * uniform(rng)) * width));
+		const int h = std::max(8, static_cast<int>((0.2f + 0.2f * uniform(rng)) * height));
+		const int x0 = static_cast<int>(uniform(rng) * (width - w));
+		const int y0 = static_cast<int>(uniform(rng) * (height - h));
+		const float a = (uniform(rng) - 0.5f) * 2 * ax;
+		const float b = (uniform(rng) - 0.5f) * 2 * ay;
+		// nearer than the background everywhere inside the rectangle, and below max_disparity
+		const float center = (0.5f + 0.1f * i) * D;
+		const float c = center - a * (x0 + 0.5f * w) - b * (y0 + 0.5f * h);
+		surfaces.push_back({ x0, y0, x0 + w, y0 + h, { a, b, c }, hash(seed + i + 1) });
+	}
+}
+
+void store(std::vector<uint8_t>& image, int depth_bits, size_t i, float t)
+{
+	const int max_value = (1 << depth_bits) - 1;
+	const int v = static_cast<int>(std::lround((0.1f + 0.8f * t) * max_value));
+	if (depth_bits == 8) {
+		image[i] = static_cast<uint8_t>(v);
+	}
+	else {
+		const uint16_t v16 = static_cast<uint16_t>(v);
+		memcpy(&image[2 * i], &v16, sizeof(v16));
+	}
+}
+
+} // namespace
+
+const char* scene_name(SceneType type)
+{
+	static const char* names[] = { "random_dot", "slanted_planes", "textureless" };
+	static_assert(sizeof(names) / sizeof(names[0]) == static_cast<size_t>(SceneType::NUM_SCENES), "scene names must cover all scenes");
+	return names[static_cast<int>(type)];
+}
+
+bool parse_scene(const char* name, SceneType& type)
+{
+	for (int i = 0; i < static_cast<int>(SceneType::NUM_SCENES); i++) {
+		if (strcmp(name, scene_name(static_cast<SceneType>(i))) == 0) {
+			type = static_cast<SceneType>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+void render_scene(SceneType type, int width, int height, int max_disparity, int depth_bits, uint32_t seed, SyntheticScene& scene)
+{
+	std::vector<Surface> surfaces;
+	layout(type, width, height, max_disparity, seed, surfaces);
+
+	const size_t pixels = static_cast<size_t>(width) * height;
+	const int elem_size = depth_bits == 8 ? 1 : 2;
+	scene.width = width;
+	scene.height = height;
+	scene.depth_bits = depth_bits;
+	scene.left.assign(elem_size * pixels, 0);
+	scene.right.assign(elem_size * pixels, 0);
+	scene.disparity.assign(pixels, 0.f);
+	scene.occluded.assign(pixels, 0);
+
+	std::vector<float> right_disp(width);
+	std::vector<int> right_surface(width);
+
+	for (int y = 0; y < height; y++) {
+		// left view, the nearest surface containing the pixel is visible
+		for (int x = 0; x < width; x++) {
+			int visible = 0;
+			for (int s = 1; s < static_cast<int>(surfaces.size()); s++) {
+				const Surface& r = surfaces[s];
+				if (x >= r.x0 && x < r.x1 && y >= r.y0 && y < r.y1 && r.d(x, y) > surfaces[visible].d(x, y))
+					visible = s;
+			}
+			const float d = surfaces[visible].d(x, y);
+			scene.disparity[y * width + x] = d;
+			store(scene.left, depth_bits, y * width + x, texture(type, surfaces[visible].seed, x - d, y));
+		}
+
+		// right view by depth test, each surface maps its span of the row to xr = x - d(x), inverted per right pixel
+		for (int xr = 0; xr < width; xr++) {
+			right_disp[xr] = -1.f;
+			right_surface[xr] = 0;
+		}
+		for (int s = 0; s < static_cast<int>(surfaces.size()); s++) {
+			const Surface& r = surfaces[s];
+			if (y < r.y0 || y >= r.y1)
+				continue;
+			const bool background = s == 0;
+			const int xr0 = background ? 0 : std::max(0, static_cast<int>(std::ceil(r.x0 - r.d(r.x0, y))));
+			const int xr1 = background ? width : std::min(width, static_cast<int>(std::ceil(r.x1 - r.d(r.x1, y))));
+			for (int xr = xr0; xr < xr1; xr++) {
+				const float x = (xr + r.d.b * y + r.d.c) / (1 - r.d.a);
+				const float d = r.d(x, y);
+				if (d > right_disp[xr]) {
+					right_disp[xr] = d;
+					right_surface[xr] = s;
+				}
+			}
+		}
+		for (int xr = 0; xr < width; xr++)
+			store(scene.right, depth_bits, y * width + xr, texture(type, surfaces[right_surface[xr]].seed, static_cast<float>(xr), y));
+
+		// occluded where the matching point leaves the right view or a nearer surface covers it
+		for (int x = 0; x < width; x++) {
+			const float d = scene.disparity[y * width + x];
+			const int xr = static_cast<int>(std::lround(x - d));
+			scene.occluded[y * width + x] = xr < 0 || xr >= width || right_disp[xr] > d + 0.5f;
+		}
+	}
+}
+
+} // namespace sgm
@@ -0,0 +1,61 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __SYNTHETIC_SCENE_H__
+#define __SYNTHETIC_SCENE_H__
+
+#include <cstdint>
+#include <vector>
+
+namespace sgm
+{
+
+enum class SceneType
+{
+	RANDOM_DOT,     //>! binary random dots with raised fronto-parallel squares, the easiest case
+	SLANTED_PLANES, //>! smooth texture on slanted planes with depth steps and occlusions
+	TEXTURELESS,    //>! slanted planes with patches of constant intensity, where matching is ambiguous
+	NUM_SCENES
+};
+
+const char* scene_name(SceneType type);
+bool parse_scene(const char* name, SceneType& type);
+
+/**
+* Rectified stereo pair with exact ground truth.
+* Surfaces are planes in disparity space, textured in right image coordinates, so every visible point
+* has the same intensity in both views. Left pixels hidden in the right view by a nearer surface are marked occluded.
+*/
+struct SyntheticScene
+{
+	int width;
+	int height;
+	int depth_bits;                // 8 or 16, images are packed without padding
+	std::vector<uint8_t> left;
+	std::vector<uint8_t> right;
+	std::vector<float> disparity;  // ground truth of the left view
+	std::vector<uint8_t> occluded; // 1 if the left pixel is not visible in the right view
+};
+
+/**
+* Render a scene with disparities inside [0, max_disparity).
+* @param seed Same seed gives the same scene.
+*/
+void render_scene(SceneType type, int width, int height, int max_disparity, int depth_bits, uint32_t seed, SyntheticScene& scene);
+
+} // namespace sgm
+
+#endif // !__SYNTHETIC_SCENE_H__
@@ -27,6 +27,9 @@ limitations under the License.
 * stereo-sgm main header
 */
 
+#include <cstddef>
+#include <cstdint>
+
 #include "libsgm_config.h"
 
 #if defined(LIBSGM_SHARED)
@@ -71,8 +74,214 @@ enum class PathType
 */
 enum class CensusType
 {
-	CENSUS_9x7,
-	SYMMETRIC_CENSUS_9x7
+	CENSUS_9x7,           //>! 9x7 window, 48 bits descriptor.
+	SYMMETRIC_CENSUS_9x7, //>! 9x7 window, symmetric pairs, 31 bits descriptor.
+	CENSUS_5x5,           //>! 5x5 window, 16 bits descriptor.
+	CENSUS_11x9,          //>! 11x9 window, 80 bits descriptor.
+	CENSUS_13x11,         //>! 13x11 window, 120 bits descriptor.
+	SPARSE_CENSUS_13x11   //>! 13x11 window sampled every other pixel, symmetric pairs, 21 bits descriptor.
+};
+
+/**
+* @brief Indicates how input pixels are stored.
+* Color and packed formats are converted to intensity while the census transform loads them.
+*/
+enum class InputFormat
+{
+	GRAY,        //>! Single channel, input_depth_bits per pixel.
+	BGR,         //>! 3 channels interleaved in B, G, R order, 8 bits per channel.
+	RGB,         //>! 3 channels interleaved in R, G, B order, 8 bits per channel.
+	BAYER,       //>! Bayer mosaic of any phase (RGGB, BGGR, GRBG, GBRG), input_depth_bits per pixel.
+	RAW10,       //>! MIPI CSI-2 RAW10, 4 pixels packed in 5 bytes.
+	RAW12,       //>! MIPI CSI-2 RAW12, 2 pixels packed in 3 bytes.
+	BAYER_RAW10, //>! Bayer mosaic stored in MIPI CSI-2 RAW10.
+	BAYER_RAW12  //>! Bayer mosaic stored in MIPI CSI-2 RAW12.
+};
+
+/**
+* @brief Indicates direction of epipolar lines along which disparities are searched.
+*/
+enum class EpipolarDirection
+{
+	HORIZONTAL, //>! Left and right cameras. Pixel (x, y) of left image matches (x - d, y) of right image.
+	VERTICAL    //>! Top and bottom cameras, given as left and right images. Pixel (x, y) of top image matches (x, y - d) of bottom image.
+};
+
+/**
+* @brief Indicates element type of images.
+*/
+enum ImageType : int
+{
+	SGM_8U,
+	SGM_16U,
+	SGM_32U,
+};
+
+/**
+* @brief Strided view of an image which is written in place.
+*/
+struct ImageView
+{
+	void* ptr;        //>! Pointer to the first pixel of the first row.
+	int width;        //>! Image width in pixels.
+	int height;       //>! Image height in pixels.
+	int stride_bytes; //>! Byte offset from a row to the next one. Negative for images stored bottom up.
+	ImageType type;   //>! Element type.
+};
+
+/**
+* @brief Strided view of an image which is only read, e.g. from a read-only mapping.
+*/
+struct ConstImageView
+{
+	ConstImageView(const void* ptr, int width, int height, int stride_bytes, ImageType type)
+		: ptr(ptr), width(width), height(height), stride_bytes(stride_bytes), type(type) {}
+	ConstImageView(const ImageView& view)
+		: ptr(view.ptr), width(view.width), height(view.height), stride_bytes(view.stride_bytes), type(view.type) {}
+
+	const void* ptr;  //>! Pointer to the first pixel of the first row.
+	int width;        //>! Image width in pixels.
+	int height;       //>! Image height in pixels.
+	int stride_bytes; //>! Byte offset from a row to the next one. Negative for images stored bottom up.
+	ImageType type;   //>! Element type, SGM_8U for color and packed input formats.
+};
+
+/**
+* @brief Left and right views packed in one buffer, such as side by side or top and bottom frames.
+* Offsets and pitches are in bytes, so each view is read in place wherever it starts.
+*/
+struct PackedStereoImage
+{
+	const void* data;    //>! Pointer to the packed buffer.
+	size_t left_offset;  //>! Byte offset of the left view's first pixel.
+	size_t right_offset; //>! Byte offset of the right view's first pixel.
+	int left_pitch;      //>! Byte pitch of the left view.
+	int right_pitch;     //>! Byte pitch of the right view.
+
+	/**
+	* @param data Pointer to the packed buffer.
+	* @param pitch Byte pitch of the packed buffer.
+	* @param view_width_bytes Bytes of one row of the left view, the right view starts right after it.
+	*/
+	static PackedStereoImage side_by_side(const void* data, int pitch, size_t view_width_bytes)
+	{
+		return { data, 0, view_width_bytes, pitch, pitch };
+	}
+
+	/**
+	* @param data Pointer to the packed buffer.
+	* @param pitch Byte pitch of the packed buffer.
+	* @param view_height Rows of the left view, the right view starts right below it.
+	*/
+	static PackedStereoImage top_bottom(const void* data, int pitch, int view_height)
+	{
+		return { data, 0, static_cast<size_t>(pitch) * view_height, pitch, pitch };
+	}
+};
+
+/**
+* @brief Execution time statistics of a pipeline stage in milliseconds, over the most recent frames.
+*/
+struct StageStats
+{
+	const char* name; //>! Stage name, such as "census_left" or "aggregation_up2down".
+	int count;        //>! Number of frames the statistics are taken over.
+	float min;        //>! Minimum time.
+	float mean;       //>! Mean time.
+	float p50;        //>! Median time.
+	float p99;        //>! 99th percentile time.
+};
+
+/**
+* Nearest rank percentile, the smallest sample not exceeded by a fraction p of all samples.
+* StageStats and the benchmarks report percentiles by this definition.
+* @param sorted Samples in ascending order.
+* @param count  Number of samples, at least 1.
+* @param p      Fraction in [0, 1], e.g. 0.99.
+*/
+template <typename T>
+inline T percentile(const T* sorted, size_t count, double p)
+{
+	// index of the ceil(p * count)-th smallest sample
+	const double rank = p * count;
+	size_t index = static_cast<size_t>(rank);
+	if (index > 0 && static_cast<double>(index) == rank)
+		index--;
+	return sorted[index < count ? index : count - 1];
+}
+
+/**
+* @brief Host hardware counters of a pipeline stage, as means per frame.
+* Counters count the thread executing StereoSGM, i.e. argument checks, copies and kernel launches of each stage,
+* not the kernels themselves, which run asynchronously on the device.
+* Counters which are unavailable, e.g. unsupported by the CPU or failing to read, are -1, as are values derived from them.
+*/
+struct PerfCounterStats
+{
+	const char* name;           //>! Stage name, same as StageStats::name.
+	int count;                  //>! Number of frames the counters are summed over.
+	double cycles;              //>! CPU cycles.
+	double instructions;        //>! Retired instructions.
+	double llc_misses;          //>! Last level cache misses.
+	double stalled_cycles;      //>! Cycles stalled in the backend.
+	double ipc;                 //>! Instructions per cycle.
+};
+
+/**
+* @brief Work and achieved throughput of a pipeline stage per frame.
+* Work is derived analytically from the configuration, throughput from the mean time of StageStats.
+* Aggregation directions overlap on parallel streams, so aggregation is reported as the single "aggregation" stage.
+*/
+struct StageThroughput
+{
+	const char* name;       //>! Stage name, same as StageStats::name.
+	double bytes;           //>! Bytes read and written.
+	double cell_updates;    //>! Pixel x disparity x path updates of the aggregation recurrence.
+	double hamming_ops;     //>! Hamming distances of census features.
+	double gb_per_sec;      //>! Achieved memory throughput.
+	double gcells_per_sec;  //>! Achieved cell updates in giga per second.
+	double bandwidth_ratio; //>! gb_per_sec relative to the measured device copy bandwidth.
+};
+
+/**
+* @brief Quality counters of the most recent frame, accumulated by the pipeline kernels.
+*/
+struct FrameStats
+{
+	int pixels;                //>! Number of output pixels.
+	int invalid_pixels;        //>! Pixels output with invalid disparity.
+	int uniqueness_rejections; //>! Pixels rejected by the uniqueness check of winner-takes-all, before median filtering.
+	int lr_rejections;         //>! Pixels rejected by the left-right consistency check.
+};
+
+/**
+* @brief Header of a cost volume written by StereoSGM::get_cost_volume, stored little endian.
+* The left input image follows at image_offset, height rows of image_bytes / height bytes in the input format.
+* The costs follow at cost_offset, num_volumes volumes of scanlines x positions x disp_size elements.
+* Scanlines are image rows, or image columns for vertical epipolar lines, and positions run along them.
+* Elements are uint8 costs of each scanline direction, or their uint16 sum over directions.
+*/
+struct CostVolumeHeader
+{
+	char magic[8];             //>! "SGMCOST" followed by a zero byte.
+	uint32_t version;          //>! Format version, currently 1.
+	uint32_t width;            //>! Image width in pixels.
+	uint32_t height;           //>! Image height in pixels.
+	uint32_t disp_size;        //>! Disparity size.
+	int32_t min_disp;          //>! Minimum disparity the costs were computed for.
+	uint32_t num_paths;        //>! Number of scanline directions aggregated, 4 or 8.
+	uint32_t num_volumes;      //>! num_paths, or 1 for summed costs.
+	uint32_t element_bits;     //>! 8, or 16 for summed costs.
+	uint32_t vertical;         //>! 1 for vertical epipolar lines.
+	uint32_t input_format;     //>! InputFormat of the left image.
+	uint32_t input_depth_bits; //>! input_depth_bits the instance was created with.
+	uint32_t P1;               //>! Penalty used in aggregation, for reference.
+	uint32_t P2;               //>! Penalty used in aggregation, for reference.
+	uint32_t census_type;      //>! CensusType used for matching costs, for reference.
+	uint64_t image_offset;     //>! Byte offset of the left image.
+	uint64_t image_bytes;      //>! Bytes of the left image.
+	uint64_t cost_offset;      //>! Byte offset of the costs.
+	uint64_t cost_bytes;       //>! Bytes of the costs.
 };
 
 /**
@@ -98,6 +307,9 @@ public:
 		int min_disp;
 		int LR_max_diff;
 		CensusType census_type;
+		bool fused_census;
+		InputFormat input_format;
+		EpipolarDirection epipolar_direction;
 
 		/**
 		* @param P1 Penalty on the disparity change by plus or minus 1 between nieghbor pixels.
@@ -108,16 +320,20 @@ public:
 		* @param min_disp Minimum possible disparity value.
 		* @param LR_max_diff Acceptable difference pixels which is used in LR check consistency. LR check consistency will be disabled if this value is set to negative.
 		* @param census_type Type of census transform.
+		* @param fused_census Compute census features inside cost aggregation instead of storing census images.
+		* @param input_format Storage format of input images. Only InputFormat::GRAY can be used with fused_census.
+		* @param epipolar_direction Direction of epipolar lines. EpipolarDirection::VERTICAL cannot be used with fused_census.
 		*/
 		LIBSGM_API Parameters(int P1 = 10, int P2 = 120, float uniqueness = 0.95f, bool subpixel = false, PathType path_type = PathType::SCAN_8PATH,
-			int min_disp = 0, int LR_max_diff = 1, CensusType census_type = CensusType::SYMMETRIC_CENSUS_9x7);
+			int min_disp = 0, int LR_max_diff = 1, CensusType census_type = CensusType::SYMMETRIC_CENSUS_9x7, bool fused_census = false,
+			InputFormat input_format = InputFormat::GRAY, EpipolarDirection epipolar_direction = EpipolarDirection::HORIZONTAL);
 	};
 
 	/**
 	* @param width Processed image's width.
 	* @param height Processed image's height.
 	* @param disparity_size It must be 64, 128 or 256.
-	* @param input_depth_bits Processed image's bits per pixel. It must be 8, 16 or 32.
+	* @param input_depth_bits Processed image's bits per pixel. It must be 8, 16 or 32 for GRAY, 8 or 16 for BAYER, 8 for BGR and RGB, 16 for RAW formats.
 	* @param output_depth_bits Disparity image's bits per pixel. It must be 8 or 16.
 	* @param inout_type Specify input/output pointer type. See sgm::EXECUTE_TYPE.
 	* @attention
@@ -130,9 +346,9 @@ public:
 	* @param width Processed image's width.
 	* @param height Processed image's height.
 	* @param disparity_size It must be 64, 128 or 256.
-	* @param input_depth_bits Processed image's bits per pixel. It must be 8, 16 or 32.
+	* @param input_depth_bits Processed image's bits per pixel. It must be 8, 16 or 32 for GRAY, 8 or 16 for BAYER, 8 for BGR and RGB, 16 for RAW formats.
 	* @param output_depth_bits Disparity image's bits per pixel. It must be 8 or 16.
-	* @param src_pitch Source image's pitch (pixels).
+	* @param src_pitch Source image's pitch (pixels for GRAY and BAYER, bytes for the other input formats).
 	* @param dst_pitch Destination image's pitch (pixels).
 	* @param inout_type Specify input/output pointer type. See sgm::EXECUTE_TYPE.
 	* @attention
@@ -156,6 +372,68 @@ public:
 	*/
 	LIBSGM_API void execute(const void* left_pixels, const void* right_pixels, void* dst);
 
+	/**
+	* Execute stereo semi global matching on views packed in one buffer.
+	* @param src Packed input. Each view has the size and format given at construction.
+	* @param dst Output pointer, same as above.
+	* @attention
+	* Device views are read in place if pitches and offsets are multiples of the element size,
+	* which is input_depth_bits / 8 for GRAY and BAYER and 1 otherwise. The src_pitch given at construction is not used.
+	*/
+	LIBSGM_API void execute(const PackedStereoImage& src, void* dst);
+
+	/**
+	* Execute stereo semi global matching on strided views.
+	* Left and right views may have different strides, be ROIs of larger buffers or be stored bottom up.
+	* @param left  Left image view. Its size and type must match the values given at construction.
+	* @param right Right image view.
+	* @param dst   Disparity image view. Its type must be SGM_8U or SGM_16U according to output_depth_bits.
+	* @attention
+	* Device views aligned to their element size are read in place, others are copied once.
+	* A device output view is written in place if its stride equals dst_pitch given at construction.
+	*/
+	LIBSGM_API void execute(const ConstImageView& left, const ConstImageView& right, const ImageView& dst);
+
+	/**
+	* Rectify input images on the fly with precomputed remap tables.
+	* Each table has width x height elements in the fixed-point format of cv::convertMaps with CV_16SC2:
+	* xy holds int16 source coordinates as (x, y) pairs and frac holds uint16 (fy << 5) | fx,
+	* where fx and fy are 5-bit bilinear weights. Tables are host pointers and copied to the device.
+	* @param mapL_xy   Integer part of the remap table for the left image, or nullptr to disable rectification.
+	* @param mapL_frac Fractional part of the remap table for the left image.
+	* @param mapR_xy   Integer part of the remap table for the right image.
+	* @param mapR_frac Fractional part of the remap table for the right image.
+	* @attention
+	* Rectification cannot be used with Parameters::fused_census.
+	*/
+	LIBSGM_API void set_rectification(const void* mapL_xy, const void* mapL_frac, const void* mapR_xy, const void* mapR_frac);
+
+	/**
+	* Restrict matching to the pixels of the left image marked valid by a mask.
+	* Masked pixels are written as invalid disparity without computation, fully masked rows and tiles are skipped
+	* and aggregation paths restart at mask boundaries.
+	* @param mask           Nonzero for valid pixels, or nullptr to disable masking.
+	*                       Host or device pointer as specified for input images at construction.
+	* @param pitch_bytes    Row pitch of the mask in bytes.
+	* @param bits_per_pixel 8 for one byte per pixel, or 1 for bits packed LSB first within each byte.
+	* @attention
+	* The mask is copied, call again whenever it changes. It cannot be used with Parameters::fused_census.
+	*/
+	LIBSGM_API void set_mask(const void* mask, int pitch_bytes, int bits_per_pixel);
+
+	/**
+	* Write a validity mask of the output disparity on every execute, instead of comparing it with get_invalid_disparity().
+	* The mask is written by the final post-processing pass together with the number of valid pixels per row.
+	* @param mask        Buffer of height rows with one bit per pixel packed LSB first, set for valid disparity,
+	*                    or nullptr to disable. Host or device pointer as specified for output at construction.
+	* @param pitch_bytes Row pitch of the mask in bytes, at least (width + 7) / 8.
+	* @param row_counts  Buffer of height elements receiving the number of valid pixels per row, or nullptr.
+	*                    Same kind of pointer as mask.
+	* @attention
+	* Buffers must stay valid until the output is disabled again.
+	*/
+	LIBSGM_API void set_validity_output(void* mask, int pitch_bytes, int* row_counts);
+
 	/**
 	* Generate invalid disparity value from Parameter::min_disp and Parameter::subpixel
 	* @attention
@@ -164,6 +442,113 @@ public:
 	*/
 	LIBSGM_API int get_invalid_disparity() const;
 
+	/**
+	* Get execution time statistics of each pipeline stage, measured by GPU events.
+	* Aggregation directions run concurrently and are measured from the start of aggregation,
+	* "aggregation" spans all directions from their start to their join.
+	* @param stats     Array receiving statistics of stages executed so far.
+	* @param max_stats Number of elements of stats.
+	* @return Number of stages with statistics, which may exceed max_stats.
+	* @attention
+	* Available only if the library is built with LIBSGM_ENABLE_PROFILING, otherwise returns 0.
+	*/
+	LIBSGM_API int get_stage_stats(StageStats* stats, int max_stats) const;
+
+	/**
+	* Discard the stage times and host counters collected so far, e.g. those of warm-up frames.
+	* Call between executions, not concurrently with execute.
+	*/
+	LIBSGM_API void reset_stage_stats();
+
+	/**
+	* Start recording a timeline of pipeline stages of the following executions.
+	* The timeline keeps the most recent 65536 stages, so long recordings drop their oldest frames.
+	* @attention
+	* Available only if the library is built with LIBSGM_ENABLE_PROFILING.
+	* Must not be called while another thread executes this instance.
+	*/
+	LIBSGM_API void begin_trace();
+
+	/**
+	* Stop recording and write the timeline in Chrome Trace Event JSON format, viewable in chrome://tracing or Perfetto.
+	* Each instance is a process of the trace, with the default stream and each aggregation stream as threads.
+	* @param path Output file path.
+	* @return false if no trace was recording or the file could not be written.
+	*/
+	LIBSGM_API bool end_trace(const char* path);
+
+	/**
+	* Enable or disable host hardware counters per stage, opened by perf_event_open on Linux.
+	* @return true if at least one counter is available, false if disabled or counters cannot be opened,
+	* e.g. on other platforms or in containers without perf access. Stage timing keeps working either way.
+	* @attention
+	* Available only if the library is built with LIBSGM_ENABLE_PROFILING.
+	*/
+	LIBSGM_API bool enable_perf_counters(bool enable);
+
+	/**
+	* Get host hardware counters of each stage since counters were enabled.
+	* @param stats     Array receiving counters of stages executed so far.
+	* @param max_stats Number of elements of stats.
+	* @return Number of stages with counters, which may exceed max_stats.
+	*/
+	LIBSGM_API int get_perf_counter_stats(PerfCounterStats* stats, int max_stats) const;
+
+	/**
+	* Get bytes moved, cell updates and hamming distances of each stage with the achieved throughput,
+	* for comparing stages with the roofline of the device.
+	* @param throughput       Array receiving throughput of stages executed so far.
+	* @param max_throughput   Number of elements of throughput.
+	* @param device_bandwidth If not nullptr, receives the device copy bandwidth in GB/s,
+	*                         measured STREAM copy style on first call.
+	* @return Number of stages with throughput, which may exceed max_throughput.
+	* @attention
+	* Available only if the library is built with LIBSGM_ENABLE_PROFILING, otherwise returns 0.
+	*/
+	LIBSGM_API int get_stage_throughput(StageThroughput* throughput, int max_throughput, double* device_bandwidth) const;
+
+	/**
+	* Enable or disable per-frame quality counters.
+	* Counters are reduced per block inside the winner-takes-all, consistency check and final kernels,
+	* without extra passes over the output.
+	*/
+	LIBSGM_API void enable_frame_stats(bool enable);
+
+	/**
+	* Get quality counters and the disparity histogram of the most recent frame.
+	* Waits for the frame to complete.
+	* @param stats     Receives the counters, or nullptr.
+	* @param histogram Array receiving the number of valid pixels per integer disparity,
+	*                  element i counts disparity Parameters::min_disp + i. May be nullptr.
+	* @param max_bins  Number of elements of histogram.
+	* @return Number of histogram bins, i.e. disparity_size, which may exceed max_bins,
+	* or 0 if frame stats are disabled or no frame has been executed since enabling.
+	*/
+	LIBSGM_API int get_frame_stats(FrameStats* stats, int* histogram, int max_bins) const;
+
+	/**
+	* Get the aggregated cost volume of the most recent frame, with the header and left image needed to reuse it.
+	* Waits for the frame to complete. With device input pointers the left image is read from the caller's buffer,
+	* which must stay valid and unchanged until then.
+	* @param buffer Host buffer receiving a CostVolumeHeader followed by the data it describes, written only if all fits.
+	*               May be nullptr to query the size.
+	* @param size   Size of buffer in bytes.
+	* @param summed Write the uint16 sum over scanline directions instead of the uint8 costs of each direction.
+	* @return Size of the whole cost volume in bytes, or 0 if no frame has been executed.
+	*/
+	LIBSGM_API size_t get_cost_volume(void* buffer, size_t size, bool summed = false) const;
+
+	/**
+	* Run winner-takes-all and the following stages on a cost volume written by get_cost_volume,
+	* skipping census transform and cost aggregation, e.g. on a memory mapped file to vary post-processing parameters.
+	* The volume must have the size, disparity size, minimum disparity, epipolar direction and input format of this instance.
+	* Uniqueness, subpixel and LR_max_diff are taken from this instance, as is a mask if set.
+	* @param volume Host pointer to the cost volume.
+	* @param size   Size of the volume in bytes.
+	* @param dst    Output pointer, same as execute.
+	*/
+	LIBSGM_API void execute_cost_volume(const void* volume, size_t size, void* dst);
+
 private:
 
 	StereoSGM(const StereoSGM&);
@@ -173,6 +558,81 @@ private:
 	Impl* impl_;
 };
 
+/**
+* Enable or disable process-wide metrics of all StereoSGM instances, disabled by default.
+* Counts frames processed and dropped by exceptions, executions in flight, device memory allocated
+* and latency histograms of frames and, if built with LIBSGM_ENABLE_PROFILING, of each stage.
+* Updates are lock-free, so executing threads never wait on exporting ones.
+*/
+LIBSGM_API void enable_metrics(bool enable);
+
+/**
+* Write metrics in Prometheus text exposition format.
+* @param buffer Buffer receiving the null-terminated text, truncated to fit. May be nullptr to query the size.
+* @param size   Size of buffer in bytes.
+* @return Length of the whole text without the terminating null.
+*/
+LIBSGM_API int export_metrics(char* buffer, int size);
+
+/**
+* Serve metrics on a unix-domain socket from a background thread, e.g. for `curl --unix-socket <path> http://localhost/metrics`.
+* Every connection receives an HTTP/1.0 response with the current text.
+* Clients which disconnect before the response is written are dropped without raising SIGPIPE.
+* @param socket_path Path of the socket, a stale socket at the path is replaced.
+* @return false if already serving, the socket cannot be created or the platform has no unix-domain sockets.
+* @attention
+* Throws std::logic_error if the path exists and is not a socket, such files are never removed.
+*/
+LIBSGM_API bool serve_metrics(const char* socket_path);
+
+/**
+* Stop serving metrics and remove the socket.
+*/
+LIBSGM_API void stop_metrics_server();
+
+/**
+* Encode a host disparity map losslessly.
+* Rows are coded in bands of 16 rows, which may be coded in parallel, with canonical Huffman codes of at most 12 bits
+* built per band. Runs of invalid pixels are coded as lengths, valid pixels as deltas predicted from the pixel above
+* or the left neighbor, and runs of zero deltas as lengths, so all values including the invalid one are restored exactly.
+* @param disparity         Host pointer to the disparity map.
+* @param width             Width in pixels.
+* @param height            Height in pixels.
+* @param pitch             Pitch of the disparity map in pixels.
+* @param depth_bits        Bits per pixel, 8 or 16.
+* @param invalid_disparity Value of invalid pixels, see StereoSGM::get_invalid_disparity.
+* @param dst               Buffer receiving the encoded bytes, written only if the whole stream fits. May be nullptr to query the size,
+*                          a buffer of encoded_disparity_bound bytes always fits.
+* @param dst_size          Size of dst in bytes.
+* @param num_threads       Number of host threads coding bands, the calling thread included.
+* @return Size of the encoded stream in bytes.
+*/
+LIBSGM_API size_t encode_disparity(const void* disparity, int width, int height, int pitch, int depth_bits, int invalid_disparity,
+	void* dst, size_t dst_size, int num_threads = 1);
+
+/**
+* Worst-case size in bytes of a disparity map encoded by encode_disparity, to encode in a single call.
+* @return 0 if the arguments are invalid.
+*/
+LIBSGM_API size_t encoded_disparity_bound(int width, int height, int depth_bits);
+
+/**
+* Read the image size of an encoded disparity map.
+* @return false if src is not a stream written by encode_disparity.
+*/
+LIBSGM_API bool get_encoded_disparity_info(const void* src, size_t src_size, int* width, int* height, int* depth_bits);
+
+/**
+* Decode a disparity map written by encode_disparity.
+* @param src         Encoded stream.
+* @param src_size    Size of src in bytes.
+* @param disparity   Host buffer of height rows of pitch pixels, with the depth given by get_encoded_disparity_info.
+* @param pitch       Pitch of the disparity buffer in pixels, at least the width.
+* @param num_threads Number of host threads decoding bands, the calling thread included.
+* @return false if the stream is malformed.
+*/
+LIBSGM_API bool decode_disparity(const void* src, size_t src_size, void* disparity, int pitch, int num_threads = 1);
+
 } // namespace sgm
 
 #endif // !__LIBSGM_H__
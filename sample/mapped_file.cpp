@@ -0,0 +1,219 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile() : data_(nullptr), size_(0), file_(INVALID_HANDLE_VALUE), mapping_(nullptr)
+{
+}
+
+bool MappedFile::open(const std::string& path, bool writable)
+{
+	close();
+	file_ = CreateFileA(path.c_str(), GENERIC_READ | (writable ? GENERIC_WRITE : 0), FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file_ == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file_, &size)) {
+		close();
+		return false;
+	}
+	size_ = static_cast<size_t>(size.QuadPart);
+	return map(writable);
+}
+
+bool MappedFile::create(const std::string& path, size_t size)
+{
+	close();
+	file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file_ == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER offset;
+	offset.QuadPart = static_cast<LONGLONG>(size);
+	if (!SetFilePointerEx(file_, offset, nullptr, FILE_BEGIN) || !SetEndOfFile(file_)) {
+		close();
+		return false;
+	}
+	size_ = size;
+	return map(true);
+}
+
+bool MappedFile::map(bool writable)
+{
+	if (size_ == 0)
+		return true;
+
+	mapping_ = CreateFileMappingA(file_, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+	if (mapping_)
+		data_ = static_cast<uint8_t*>(MapViewOfFile(mapping_, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+	if (!data_) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (data_)
+		UnmapViewOfFile(data_);
+	if (mapping_)
+		CloseHandle(mapping_);
+	if (file_ != INVALID_HANDLE_VALUE)
+		CloseHandle(file_);
+	data_ = nullptr;
+	size_ = 0;
+	file_ = INVALID_HANDLE_VALUE;
+	mapping_ = nullptr;
+}
+
+void MappedFile::prefetch(size_t offset, size_t size) const
+{
+	if (!data_ || offset >= size_)
+		return;
+	WIN32_MEMORY_RANGE_ENTRY range{ data_ + offset, offset + size < size_ ? size : size_ - offset };
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+void MappedFile::advise_sequential() const
+{
+}
+
+void MappedFile::release(size_t offset, size_t size) const
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	const size_t page = info.dwPageSize;
+	const size_t begin = (offset + page - 1) / page * page;
+	const size_t end = (offset + size < size_ ? offset + size : size_) / page * page;
+	if (!data_ || begin >= end)
+		return;
+
+	// unlocking pages which are not locked removes them from the working set
+	FlushViewOfFile(data_ + begin, end - begin);
+	VirtualUnlock(data_ + begin, end - begin);
+}
+
+#else
+
+MappedFile::MappedFile() : data_(nullptr), size_(0), fd_(-1)
+{
+}
+
+bool MappedFile::open(const std::string& path, bool writable)
+{
+	close();
+	fd_ = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+	if (fd_ < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd_, &st) != 0) {
+		close();
+		return false;
+	}
+	size_ = static_cast<size_t>(st.st_size);
+	return map(writable);
+}
+
+bool MappedFile::create(const std::string& path, size_t size)
+{
+	close();
+	fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd_ < 0 || ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+		close();
+		return false;
+	}
+	size_ = size;
+	return map(true);
+}
+
+bool MappedFile::map(bool writable)
+{
+	if (size_ == 0)
+		return true;
+
+	void* data = mmap(nullptr, size_, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd_, 0);
+	if (data == MAP_FAILED) {
+		close();
+		return false;
+	}
+	data_ = static_cast<uint8_t*>(data);
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (data_)
+		munmap(data_, size_);
+	if (fd_ >= 0)
+		::close(fd_);
+	data_ = nullptr;
+	size_ = 0;
+	fd_ = -1;
+}
+
+void MappedFile::prefetch(size_t offset, size_t size) const
+{
+	if (!data_ || offset >= size_)
+		return;
+
+	// madvise needs a page aligned start
+	const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	const size_t begin = offset / page * page;
+	const size_t end = offset + size < size_ ? offset + size : size_;
+	madvise(data_ + begin, end - begin, MADV_WILLNEED);
+}
+
+void MappedFile::advise_sequential() const
+{
+	if (data_)
+		madvise(data_, size_, MADV_SEQUENTIAL);
+}
+
+void MappedFile::release(size_t offset, size_t size) const
+{
+	const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	const size_t begin = (offset + page - 1) / page * page;
+	const size_t end = (offset + size < size_ ? offset + size : size_) / page * page;
+	if (!data_ || begin >= end)
+		return;
+
+	msync(data_ + begin, end - begin, MS_SYNC);
+	madvise(data_ + begin, end - begin, MADV_DONTNEED);
+}
+
+#endif
+
+MappedFile::~MappedFile()
+{
+	close();
+}
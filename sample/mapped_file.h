@@ -0,0 +1,70 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __MAPPED_FILE_H__
+#define __MAPPED_FILE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+* @brief File mapped into the address space, read only or read write.
+*/
+class MappedFile
+{
+public:
+
+	MappedFile();
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// maps an existing file
+	bool open(const std::string& path, bool writable = false);
+
+	// creates or truncates a file of the given size and maps it read write
+	bool create(const std::string& path, size_t size);
+
+	void close();
+
+	// hints that the range will be accessed soon, or that pages are read in order
+	void prefetch(size_t offset, size_t size) const;
+	void advise_sequential() const;
+
+	// writes back and drops the pages entirely inside the range from memory, they are read again on access
+	void release(size_t offset, size_t size) const;
+
+	// pages of a read only mapping must only be read through the const overload
+	uint8_t* data() { return data_; }
+	const uint8_t* data() const { return data_; }
+	size_t size() const { return size_; }
+
+private:
+
+	bool map(bool writable);
+
+	uint8_t* data_;
+	size_t size_;
+#ifdef _WIN32
+	void* file_;
+	void* mapping_;
+#else
+	int fd_;
+#endif
+};
+
+#endif // !__MAPPED_FILE_H__
@@ -0,0 +1,149 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "stereo_sequence.h"
+
+#include <cstring>
+#include <vector>
+
+static const char SEQUENCE_MAGIC[8] = { 'S', 'G', 'M', 'S', 'E', 'Q', 0, 0 };
+static const uint32_t SEQUENCE_VERSION = 1;
+static const uint32_t SEQUENCE_ALIGNMENT = 4096;
+static const uint32_t ROW_ALIGNMENT = 64;
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+StereoSequenceWriter::StereoSequenceWriter() : file_(nullptr), header_()
+{
+}
+
+StereoSequenceWriter::~StereoSequenceWriter()
+{
+	close();
+}
+
+bool StereoSequenceWriter::open(const std::string& path, int width, int height, int depth_bits)
+{
+	close();
+	if (width <= 0 || height <= 0 || (depth_bits != 8 && depth_bits != 16))
+		return false;
+
+	header_ = StereoSequenceHeader();
+	std::memcpy(header_.magic, SEQUENCE_MAGIC, sizeof(SEQUENCE_MAGIC));
+	header_.version = SEQUENCE_VERSION;
+	header_.width = width;
+	header_.height = height;
+	header_.depth_bits = depth_bits;
+	header_.pitch = static_cast<uint32_t>(align_up(static_cast<uint64_t>(width) * depth_bits / 8, ROW_ALIGNMENT));
+	header_.alignment = SEQUENCE_ALIGNMENT;
+	header_.frame_count = 0;
+	header_.view_stride = align_up(static_cast<uint64_t>(header_.pitch) * height, SEQUENCE_ALIGNMENT);
+	header_.frame_stride = 2 * header_.view_stride;
+	header_.data_offset = SEQUENCE_ALIGNMENT;
+
+	file_ = fopen(path.c_str(), "wb");
+	if (!file_)
+		return false;
+
+	// the header is padded to the first frame
+	std::vector<uint8_t> block(header_.data_offset, 0);
+	std::memcpy(block.data(), &header_, sizeof(header_));
+	return fwrite(block.data(), 1, block.size(), file_) == block.size();
+}
+
+bool StereoSequenceWriter::write_view(const void* data, size_t step)
+{
+	const size_t row_bytes = static_cast<size_t>(header_.width) * header_.depth_bits / 8;
+	std::vector<uint8_t> row(header_.pitch, 0);
+	for (uint32_t y = 0; y < header_.height; y++) {
+		std::memcpy(row.data(), static_cast<const uint8_t*>(data) + y * step, row_bytes);
+		if (fwrite(row.data(), 1, row.size(), file_) != row.size())
+			return false;
+	}
+
+	const std::vector<uint8_t> padding(header_.view_stride - static_cast<uint64_t>(header_.pitch) * header_.height, 0);
+	return fwrite(padding.data(), 1, padding.size(), file_) == padding.size();
+}
+
+bool StereoSequenceWriter::append(const void* left, size_t left_step, const void* right, size_t right_step)
+{
+	if (!file_ || !write_view(left, left_step) || !write_view(right, right_step))
+		return false;
+	header_.frame_count++;
+	return true;
+}
+
+bool StereoSequenceWriter::close()
+{
+	if (!file_)
+		return true;
+
+	const bool ok = fseek(file_, 0, SEEK_SET) == 0 && fwrite(&header_, sizeof(header_), 1, file_) == 1;
+	const bool closed = fclose(file_) == 0;
+	file_ = nullptr;
+	return ok && closed;
+}
+
+bool StereoSequenceReader::open(const std::string& path)
+{
+	frame_count_ = 0;
+	if (!file_.open(path) || file_.size() < sizeof(header_))
+		return false;
+
+	std::memcpy(&header_, file_.data(), sizeof(header_));
+	const uint64_t bytes_per_row = static_cast<uint64_t>(header_.width) * header_.depth_bits / 8;
+	// a frame must hold both views, which are never empty, compared without sums a crafted stride could wrap
+	if (std::memcmp(header_.magic, SEQUENCE_MAGIC, sizeof(SEQUENCE_MAGIC)) != 0 || header_.version != SEQUENCE_VERSION ||
+		header_.width == 0 || header_.height == 0 || (header_.depth_bits != 8 && header_.depth_bits != 16) ||
+		header_.pitch < bytes_per_row || header_.view_stride < static_cast<uint64_t>(header_.pitch) * header_.height ||
+		header_.frame_stride == 0 || header_.view_stride > header_.frame_stride / 2 ||
+		header_.data_offset < sizeof(header_) || header_.data_offset > file_.size()) {
+		file_.close();
+		return false;
+	}
+
+	// frames written before an unfinished writer stopped are still readable
+	const size_t complete_frames = (file_.size() - header_.data_offset) / header_.frame_stride;
+	frame_count_ = header_.frame_count > 0 && header_.frame_count < complete_frames ? header_.frame_count : complete_frames;
+	file_.advise_sequential();
+	return true;
+}
+
+const uint8_t* StereoSequenceReader::left(size_t frame_no) const
+{
+	return file_.data() + header_.data_offset + frame_no * header_.frame_stride;
+}
+
+const uint8_t* StereoSequenceReader::right(size_t frame_no) const
+{
+	return left(frame_no) + header_.view_stride;
+}
+
+sgm::PackedStereoImage StereoSequenceReader::frame(size_t frame_no) const
+{
+	const size_t offset = header_.data_offset + frame_no * header_.frame_stride;
+	const int pitch = static_cast<int>(header_.pitch);
+	return { file_.data(), offset, offset + header_.view_stride, pitch, pitch };
+}
+
+void StereoSequenceReader::prefetch(size_t frame_no) const
+{
+	if (frame_no < frame_count_)
+		file_.prefetch(header_.data_offset + frame_no * header_.frame_stride, header_.frame_stride);
+}
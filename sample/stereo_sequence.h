@@ -0,0 +1,111 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __STEREO_SEQUENCE_H__
+#define __STEREO_SEQUENCE_H__
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include <libsgm.h>
+
+#include "mapped_file.h"
+
+/**
+* @brief Header of a raw stereo sequence file, stored little endian at offset 0.
+* Frames start at data_offset, each one is the left view followed by the right view.
+* Rows are padded to pitch bytes, views and frames start at multiples of alignment bytes
+* so that every view can be read in place from a mapping of the file.
+*/
+struct StereoSequenceHeader
+{
+	char magic[8];         //>! "SGMSEQ" followed by two zero bytes.
+	uint32_t version;      //>! Format version, currently 1.
+	uint32_t width;        //>! Image width in pixels.
+	uint32_t height;       //>! Image height in pixels.
+	uint32_t depth_bits;   //>! Bits per pixel, 8 or 16.
+	uint32_t pitch;        //>! Bytes per row.
+	uint32_t alignment;    //>! Alignment of views and frames in bytes.
+	uint64_t frame_count;  //>! Number of frames, 0 if the writer did not finish.
+	uint64_t view_stride;  //>! Bytes from the left view to the right view.
+	uint64_t frame_stride; //>! Bytes from a frame to the next one.
+	uint64_t data_offset;  //>! Byte offset of the first frame.
+};
+
+static_assert(sizeof(StereoSequenceHeader) == 64, "unexpected header layout");
+
+/**
+* @brief Appends frames to a stereo sequence file.
+*/
+class StereoSequenceWriter
+{
+public:
+
+	StereoSequenceWriter();
+	~StereoSequenceWriter();
+
+	bool open(const std::string& path, int width, int height, int depth_bits);
+
+	// step is the byte pitch of the given views
+	bool append(const void* left, size_t left_step, const void* right, size_t right_step);
+
+	// writes the final frame count, called by the destructor
+	bool close();
+
+	const StereoSequenceHeader& header() const { return header_; }
+
+private:
+
+	bool write_view(const void* data, size_t step);
+
+	FILE* file_;
+	StereoSequenceHeader header_;
+};
+
+/**
+* @brief Maps a stereo sequence file and gives views of its frames without copying.
+*/
+class StereoSequenceReader
+{
+public:
+
+	bool open(const std::string& path);
+
+	const StereoSequenceHeader& header() const { return header_; }
+	int width() const { return header_.width; }
+	int height() const { return header_.height; }
+	int depth_bits() const { return header_.depth_bits; }
+	int pitch() const { return header_.pitch; }
+	size_t frame_count() const { return frame_count_; }
+
+	const uint8_t* left(size_t frame_no) const;
+	const uint8_t* right(size_t frame_no) const;
+
+	// both views of a frame as offsets into the mapping, to be passed to StereoSGM::execute
+	sgm::PackedStereoImage frame(size_t frame_no) const;
+
+	// asks the OS to read a frame ahead of its use
+	void prefetch(size_t frame_no) const;
+
+private:
+
+	MappedFile file_;
+	StereoSequenceHeader header_ = {};
+	size_t frame_count_ = 0;
+};
+
+#endif // !__STEREO_SEQUENCE_H__
@@ -0,0 +1,313 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <limits>
+#include <condition_variable>
+#include <fstream>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/highgui.hpp>
+
+#include <libsgm.h>
+
+#include "sample_common.h"
+
+static const std::string keys =
+"{ @left-image-format  | <none> | format string for path to input left image                                           }"
+"{ @right-image-format | <none> | format string for path to input right image                                          }"
+"{ output_path         | .      | path to output directory for disparity maps                                          }"
+"{ disp_size           | 128    | maximum possible disparity value                                                     }"
+"{ subpixel            |        | enable subpixel estimation                                                           }"
+"{ num_paths           | 8      | number of scanlines used in cost aggregation                                         }"
+"{ census_type         | 1      | type of census transform (0:9x7 1:SYMMETRIC_9x7 2:5x5 3:11x9 4:13x11 5:SPARSE_13x11) }"
+"{ start_number        | 0      | index to start reading                                                               }"
+"{ total_number        | 0      | number of image pairs to process, 0 processes until a pair fails to read             }"
+"{ decoders            | 2      | number of threads reading input pairs                                                }"
+"{ encoders            | 2      | number of threads writing disparity maps                                             }"
+"{ jobs                | 1      | number of StereoSGM instances running concurrently                                   }"
+"{ queue_size          | 8      | capacity of the queues between stages                                                }"
+"{ format              | png    | output format, png as stereosgm_movie or sgmd for losslessly encoded raw disparities }"
+"{ help h              |        | display this help and exit                                                           }";
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds_since(const Clock::time_point& t)
+{
+	return std::chrono::duration<double>(Clock::now() - t).count();
+}
+
+// bounded FIFO between two stages, closed once every producer has finished
+template <typename T>
+class BoundedQueue
+{
+public:
+
+	BoundedQueue(size_t capacity, int producers) : capacity_(capacity), producers_(producers) {}
+
+	void push(T&& item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		pushes_++;
+		if (items_.size() >= capacity_)
+			full_++;
+		not_full_.wait(lock, [&] { return items_.size() < capacity_; });
+		items_.push_back(std::move(item));
+		occupancy_ += items_.size();
+		not_empty_.notify_one();
+	}
+
+	bool pop(T& item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		pops_++;
+		if (items_.empty() && producers_ > 0)
+			empty_++;
+		not_empty_.wait(lock, [&] { return !items_.empty() || producers_ == 0; });
+		if (items_.empty())
+			return false;
+		item = std::move(items_.front());
+		items_.pop_front();
+		not_full_.notify_one();
+		return true;
+	}
+
+	void producer_done()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (--producers_ == 0)
+			not_empty_.notify_all();
+	}
+
+	// mean number of queued items seen by producers, and how often producers blocked or consumers starved
+	void report(const char* name) const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::cout << "  " << std::left << std::setw(14) << name << std::right << std::fixed << std::setprecision(2)
+			<< " mean occupancy " << std::setw(5) << (pushes_ ? 1. * occupancy_ / pushes_ : 0.) << "/" << capacity_
+			<< ", full on push " << std::setw(6) << (pushes_ ? 100. * full_ / pushes_ : 0.) << "%"
+			<< ", empty on pop " << std::setw(6) << (pops_ ? 100. * empty_ / pops_ : 0.) << "%" << std::endl;
+	}
+
+private:
+
+	mutable std::mutex mutex_;
+	std::condition_variable not_full_, not_empty_;
+	std::deque<T> items_;
+	size_t capacity_;
+	int producers_;
+	uint64_t pushes_ = 0, pops_ = 0, full_ = 0, empty_ = 0, occupancy_ = 0;
+};
+
+struct StereoPair
+{
+	int frame_no;
+	cv::Mat I1, I2;
+};
+
+struct Disparity
+{
+	int frame_no;
+	int invalid_disp;
+	cv::Mat disparity;
+};
+
+// accumulated time a stage spent working, excluding waits on queues
+struct StageTime
+{
+	std::atomic<int64_t> busy_us{ 0 };
+	std::atomic<int> frames{ 0 };
+
+	void add(const Clock::time_point& t)
+	{
+		busy_us += std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t).count();
+		frames++;
+	}
+};
+
+static void report_stage(const char* name, const StageTime& stage, int threads, double wall)
+{
+	const double busy = 1e-6 * stage.busy_us;
+	std::cout << "  " << std::left << std::setw(14) << name << std::right << std::fixed << std::setprecision(2)
+		<< " threads " << std::setw(2) << threads << ", frames " << std::setw(6) << stage.frames
+		<< ", mean " << std::setw(8) << (stage.frames ? 1e3 * busy / stage.frames : 0.) << " ms"
+		<< ", utilization " << std::setw(6) << 100. * busy / (threads * wall) << "%" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	cv::CommandLineParser parser(argc, argv, keys);
+	if (parser.has("help")) {
+		parser.printMessage();
+		return 0;
+	}
+
+	const std::string image_format_L = parser.get<cv::String>("@left-image-format");
+	const std::string image_format_R = parser.get<cv::String>("@right-image-format");
+	const std::string output_path = parser.get<cv::String>("output_path");
+	const int disp_size = parser.get<int>("disp_size");
+	const bool subpixel = parser.has("subpixel");
+	const auto path_type = parser.get<int>("num_paths") == 8 ? sgm::PathType::SCAN_8PATH : sgm::PathType::SCAN_4PATH;
+	const auto census_type = static_cast<sgm::CensusType>(parser.get<int>("census_type"));
+	const int start_number = parser.get<int>("start_number");
+	const int total_number = parser.get<int>("total_number");
+	const int num_decoders = parser.get<int>("decoders");
+	const int num_encoders = parser.get<int>("encoders");
+	const int num_jobs = parser.get<int>("jobs");
+	const int queue_size = parser.get<int>("queue_size");
+	const std::string format = parser.get<cv::String>("format");
+
+	if (!parser.check()) {
+		parser.printErrors();
+		parser.printMessage();
+		std::exit(EXIT_FAILURE);
+	}
+
+	const cv::Mat first = cv::imread(cv::format(image_format_L.c_str(), start_number), cv::IMREAD_UNCHANGED);
+	ASSERT_MSG(!first.empty(), "imread failed. Check start_number and image paths.");
+	ASSERT_MSG(first.type() == CV_8U || first.type() == CV_16U, "input image format must be CV_8U or CV_16U.");
+	ASSERT_MSG(disp_size == 64 || disp_size == 128 || disp_size == 256, "disparity size must be 64, 128 or 256.");
+	ASSERT_MSG(format == "png" || format == "sgmd", "output format must be png or sgmd.");
+	ASSERT_MSG(num_decoders > 0 && num_encoders > 0 && num_jobs > 0 && queue_size > 0, "thread counts and queue size must be positive.");
+
+	const int width = first.cols;
+	const int height = first.rows;
+	const int type = first.type();
+	const int src_depth = type == CV_8U ? 8 : 16;
+	const int dst_depth = 16;
+	const size_t src_bytes = static_cast<size_t>(src_depth) * width * height / 8;
+	const size_t dst_bytes = static_cast<size_t>(dst_depth) * width * height / 8;
+	const sgm::StereoSGM::Parameters param(10, 120, 0.95f, subpixel, path_type, 0, 1, census_type);
+	const double disp_scale = 100. / (subpixel ? sgm::StereoSGM::SUBPIXEL_SCALE : 1);
+
+	BoundedQueue<StereoPair> input_queue(queue_size, num_decoders);
+	BoundedQueue<Disparity> output_queue(queue_size, num_jobs);
+	StageTime decode_time, compute_time, encode_time;
+
+	// decoders claim frame numbers in order, the first pair that fails to read ends the sequence
+	std::atomic<int> next_frame{ start_number };
+	std::atomic<int> end_frame{ total_number > 0 ? start_number + total_number : std::numeric_limits<int>::max() };
+	auto decode = [&] {
+		for (int frame_no = next_frame++; frame_no < end_frame; frame_no = next_frame++) {
+			const auto t = Clock::now();
+			StereoPair pair{ frame_no,
+				cv::imread(cv::format(image_format_L.c_str(), frame_no), cv::IMREAD_UNCHANGED),
+				cv::imread(cv::format(image_format_R.c_str(), frame_no), cv::IMREAD_UNCHANGED) };
+			if (pair.I1.empty() || pair.I2.empty()) {
+				int end = end_frame;
+				while (frame_no < end && !end_frame.compare_exchange_weak(end, frame_no));
+				break;
+			}
+			if (pair.I1.size() != first.size() || pair.I2.size() != first.size() || pair.I1.type() != type || pair.I2.type() != type) {
+				std::cerr << "Skipping frame " << frame_no << ": size or type differs from the first frame." << std::endl;
+				continue;
+			}
+			decode_time.add(t);
+			// a pair claimed concurrently with the failed read lies past the end of the sequence
+			if (frame_no >= end_frame)
+				break;
+			input_queue.push(std::move(pair));
+		}
+		input_queue.producer_done();
+	};
+
+	// each job owns a StereoSGM instance and its device buffers
+	auto compute = [&] {
+		sgm::StereoSGM sgm(width, height, disp_size, src_depth, dst_depth, sgm::EXECUTE_INOUT_CUDA2CUDA, param);
+		device_buffer d_I1(src_bytes), d_I2(src_bytes), d_disparity(dst_bytes);
+		const int invalid_disp = sgm.get_invalid_disparity();
+
+		StereoPair pair;
+		while (input_queue.pop(pair)) {
+			const auto t = Clock::now();
+			d_I1.upload(pair.I1.data);
+			d_I2.upload(pair.I2.data);
+			sgm.execute(d_I1.data, d_I2.data, d_disparity.data);
+
+			Disparity result{ pair.frame_no, invalid_disp, cv::Mat(height, width, CV_16S) };
+			d_disparity.download(result.disparity.data);
+			compute_time.add(t);
+			output_queue.push(std::move(result));
+		}
+		output_queue.producer_done();
+	};
+
+	auto encode = [&] {
+		Disparity result;
+		while (output_queue.pop(result)) {
+			const auto t = Clock::now();
+			const std::string path = output_path + "/" + cv::format("disparity_%04d.", result.frame_no) + format;
+			if (format == "sgmd") {
+				const cv::Mat& disparity = result.disparity;
+				const int pitch = static_cast<int>(disparity.step[0] / disparity.elemSize());
+				std::vector<uint8_t> bytes(sgm::encoded_disparity_bound(width, height, dst_depth));
+				bytes.resize(sgm::encode_disparity(disparity.data, width, height, pitch, dst_depth, result.invalid_disp, bytes.data(), bytes.size()));
+				std::ofstream ofs(path, std::ios::binary);
+				if (!ofs.write(reinterpret_cast<const char*>(bytes.data()), bytes.size()))
+					std::cerr << "Error saving frame " << result.frame_no << " to " << path << "." << std::endl;
+			}
+			else {
+				// same encoding as stereosgm_movie: disparity times 100, invalid pixels set to 0
+				cv::Mat output;
+				result.disparity.convertTo(output, CV_16U, disp_scale);
+				output.setTo(0, result.disparity == result.invalid_disp);
+				try {
+					cv::imwrite(path, output);
+				}
+				catch (const cv::Exception& ex) {
+					std::cerr << "Error saving frame " << result.frame_no << " to " << path << ". " << ex.what() << std::endl;
+				}
+			}
+			encode_time.add(t);
+		}
+	};
+
+	const auto t0 = Clock::now();
+	std::vector<std::thread> threads;
+	for (int i = 0; i < num_decoders; i++)
+		threads.emplace_back(decode);
+	for (int i = 0; i < num_jobs; i++)
+		threads.emplace_back(compute);
+	for (int i = 0; i < num_encoders; i++)
+		threads.emplace_back(encode);
+	for (auto& thread : threads)
+		thread.join();
+	const double wall = seconds_since(t0);
+
+	const int frames = encode_time.frames;
+	std::cout << "Processed " << frames << " frames in " << std::fixed << std::setprecision(2) << wall << " s ("
+		<< (wall > 0 ? frames / wall : 0.) << " FPS)" << std::endl;
+
+	// the stage with the highest utilization is the bottleneck, its input queue stays full and its output queue empty
+	std::cout << "Stages:" << std::endl;
+	report_stage("decode", decode_time, num_decoders, wall);
+	report_stage("compute", compute_time, num_jobs, wall);
+	report_stage("encode", encode_time, num_encoders, wall);
+	std::cout << "Queues:" << std::endl;
+	input_queue.report("decode->compute");
+	output_queue.report("compute->encode");
+
+	return 0;
+}
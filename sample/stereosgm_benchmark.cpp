@@ -17,6 +17,7 @@ limitations under the License.
 #include <iostream>
 #include <iomanip>
 #include <chrono>
+#include <algorithm>
 
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
@@ -27,15 +28,30 @@ limitations under the License.
 #include "sample_common.h"
 
 static const std::string keys =
-"{ @left_img   | <none> | path to input left image                                       }"
-"{ @right_img  | <none> | path to input right image                                      }"
-"{ disp_size   |    128 | maximum possible disparity value                               }"
-"{ out_depth   |      8 | disparity image's bits per pixel                               }"
-"{ subpixel    |        | enable subpixel estimation                                     }"
-"{ num_paths   |      8 | number of scanlines used in cost aggregation                   }"
-"{ census_type |      1 | type of census transform (0:CENSUS_9x7 1:SYMMETRIC_CENSUS_9x7) }"
-"{ iterations  |    100 | number of iterations for measuring performance                 }"
-"{ help h      |        | display this help and exit                                     }";
+"{ @left_img   | <none> | path to input left image                                                             }"
+"{ @right_img  | <none> | path to input right image                                                            }"
+"{ disp_size   |    128 | maximum possible disparity value                                                     }"
+"{ out_depth   |      8 | disparity image's bits per pixel                                                     }"
+"{ subpixel    |        | enable subpixel estimation                                                           }"
+"{ num_paths   |      8 | number of scanlines used in cost aggregation                                         }"
+"{ census_type |      1 | type of census transform (0:9x7 1:SYMMETRIC_9x7 2:5x5 3:11x9 4:13x11 5:SPARSE_13x11) }"
+"{ iterations  |    100 | number of iterations for measuring performance                                       }"
+"{ trace       |        | write a stage timeline in Chrome Trace Event JSON to this path (profiling builds)    }"
+"{ perf        |        | collect host hardware counters per stage (profiling builds on Linux)                 }"
+"{ help h      |        | display this help and exit                                                           }";
+
+static const char* census_type_name(sgm::CensusType census_type)
+{
+	switch (census_type) {
+	case sgm::CensusType::CENSUS_9x7: return "CENSUS_9x7";
+	case sgm::CensusType::SYMMETRIC_CENSUS_9x7: return "SYMMETRIC_CENSUS_9x7";
+	case sgm::CensusType::CENSUS_5x5: return "CENSUS_5x5";
+	case sgm::CensusType::CENSUS_11x9: return "CENSUS_11x9";
+	case sgm::CensusType::CENSUS_13x11: return "CENSUS_13x11";
+	case sgm::CensusType::SPARSE_CENSUS_13x11: return "SPARSE_CENSUS_13x11";
+	}
+	return "";
+}
 
 int main(int argc, char* argv[])
 {
@@ -54,6 +70,8 @@ int main(int argc, char* argv[])
 	const int num_paths = parser.get<int>("num_paths");
 	const auto census_type = static_cast<sgm::CensusType>(parser.get<int>("census_type"));
 	const int iterations = parser.get<int>("iterations");
+	const cv::String trace_path = parser.get<cv::String>("trace");
+	const bool perf = parser.has("perf");
 
 	if (!parser.check()) {
 		parser.printErrors();
@@ -66,7 +84,7 @@ int main(int argc, char* argv[])
 	ASSERT_MSG(I1.type() == CV_8U || I1.type() == CV_16U, "input image format must be CV_8U or CV_16U.");
 	ASSERT_MSG(disp_size == 64 || disp_size == 128 || disp_size == 256, "disparity size must be 64, 128 or 256.");
 	ASSERT_MSG(num_paths == 4 || num_paths == 8, "number of scanlines must be 4 or 8.");
-	ASSERT_MSG(census_type == sgm::CensusType::CENSUS_9x7 || census_type == sgm::CensusType::SYMMETRIC_CENSUS_9x7, "census type must be 0 or 1.");
+	ASSERT_MSG(0 <= static_cast<int>(census_type) && census_type <= sgm::CensusType::SPARSE_CENSUS_13x11, "census type must be 0, 1, 2, 3, 4 or 5.");
 	ASSERT_MSG(dst_depth == 8 || dst_depth == 16, "output depth bits must be 8 or 16");
 	if (subpixel)
 		ASSERT_MSG(dst_depth == 16, "output depth bits must be 16 if subpixel option is enabled.");
@@ -102,13 +120,17 @@ int main(int argc, char* argv[])
 	std::cout << "output depth        : " << dst_depth << std::endl;
 	std::cout << "subpixel option     : " << (subpixel ? "true" : "false") << std::endl;
 	std::cout << "sgm path            : " << num_paths << " path" << std::endl;
-	std::cout << "census type         : " << (census_type == sgm::CensusType::CENSUS_9x7 ? "CENSUS_9x7" : "SYMMETRIC_CENSUS_9x7") << std::endl;
+	std::cout << "census type         : " << census_type_name(census_type) << std::endl;
 	std::cout << "iterations          : " << iterations << std::endl;
 	std::cout << std::endl;
 
 	// run benchmark
 	std::cout << "Running benchmark..." << std::endl;
 	uint64_t sum = 0;
+	if (perf && !sgm.enable_perf_counters(true))
+		std::cerr << "hardware counters are not available." << std::endl;
+	if (!trace_path.empty())
+		sgm.begin_trace();
 	for (int i = 0; i <= iterations; i++) {
 		const auto t1 = std::chrono::system_clock::now();
 
@@ -120,6 +142,8 @@ int main(int argc, char* argv[])
 			sum += std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
 	}
 	std::cout << "Done." << std::endl << std::endl;
+	if (!trace_path.empty() && !sgm.end_trace(trace_path.c_str()))
+		std::cerr << "failed to write trace, libSGM must be built with LIBSGM_ENABLE_PROFILING." << std::endl;
 
 	// show results
 	const double time_millisec = 1e-3 * sum / iterations;
@@ -130,6 +154,54 @@ int main(int argc, char* argv[])
 	std::cout << std::setprecision(1) << "FPS                          : " << fps << std::endl;
 	std::cout << std::endl;
 
+	// show per-stage times, available if libSGM is built with LIBSGM_ENABLE_PROFILING
+	sgm::StageStats stats[32];
+	const int num_stats = std::min(sgm.get_stage_stats(stats, 32), 32);
+	if (num_stats > 0) {
+		std::cout << "# Stages[Milliseconds]" << std::endl;
+		std::cout << std::setw(30) << std::left << "stage" << std::right
+			<< std::setw(8) << "min" << std::setw(8) << "mean" << std::setw(8) << "p50" << std::setw(8) << "p99" << std::endl;
+		for (int i = 0; i < num_stats; i++) {
+			std::cout << std::setw(30) << std::left << stats[i].name << std::right << std::setprecision(3)
+				<< std::setw(8) << stats[i].min << std::setw(8) << stats[i].mean
+				<< std::setw(8) << stats[i].p50 << std::setw(8) << stats[i].p99 << std::endl;
+		}
+		std::cout << std::endl;
+	}
+
+	sgm::StageThroughput throughput[32];
+	double device_bandwidth = 0;
+	const int num_throughput = std::min(sgm.get_stage_throughput(throughput, 32, &device_bandwidth), 32);
+	if (num_throughput > 0) {
+		std::cout << "# Throughput" << std::endl;
+		std::cout << std::setprecision(1) << "device copy bandwidth[GB/s]: " << device_bandwidth << std::endl;
+		std::cout << std::setw(30) << std::left << "stage" << std::right
+			<< std::setw(10) << "MB" << std::setw(10) << "GB/s" << std::setw(10) << "Gcell/s" << std::setw(10) << "of peak" << std::endl;
+		for (int i = 0; i < num_throughput; i++) {
+			const auto& t = throughput[i];
+			std::cout << std::setw(30) << std::left << t.name << std::right << std::setprecision(1)
+				<< std::setw(10) << 1e-6 * t.bytes << std::setw(10) << t.gb_per_sec << std::setw(10) << t.gcells_per_sec
+				<< std::setw(9) << 100 * t.bandwidth_ratio << "%" << std::endl;
+		}
+		std::cout << std::endl;
+	}
+
+	sgm::PerfCounterStats counters[32];
+	const int num_counters = std::min(sgm.get_perf_counter_stats(counters, 32), 32);
+	if (num_counters > 0) {
+		std::cout << "# Host Counters[Per Frame]" << std::endl;
+		std::cout << std::setw(30) << std::left << "stage" << std::right
+			<< std::setw(12) << "cycles" << std::setw(12) << "instr" << std::setw(8) << "IPC"
+			<< std::setw(12) << "LLC miss" << std::setw(12) << "stalled" << std::endl;
+		for (int i = 0; i < num_counters; i++) {
+			const auto& c = counters[i];
+			std::cout << std::setw(30) << std::left << c.name << std::right << std::setprecision(0)
+				<< std::setw(12) << c.cycles << std::setw(12) << c.instructions << std::setprecision(2) << std::setw(8) << c.ipc
+				<< std::setprecision(0) << std::setw(12) << c.llc_misses << std::setw(12) << c.stalled_cycles << std::endl;
+		}
+		std::cout << std::endl;
+	}
+
 	// save disparity image
 	const int disp_scale = subpixel ? sgm::StereoSGM::SUBPIXEL_SCALE : 1;
 	d_disparity.download(disparity.data);
@@ -0,0 +1,81 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <iostream>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/highgui.hpp>
+
+#include "sample_common.h"
+#include "stereo_sequence.h"
+
+static const std::string keys =
+"{ @left-image-format  | <none> | format string for path to input left image                               }"
+"{ @right-image-format | <none> | format string for path to input right image                              }"
+"{ @output             | <none> | path to the raw stereo sequence to write                                 }"
+"{ start_number        | 0      | index to start reading                                                   }"
+"{ total_number        | 0      | number of image pairs to convert, 0 converts until a pair fails to read  }"
+"{ help h              |        | display this help and exit                                               }";
+
+int main(int argc, char* argv[])
+{
+	cv::CommandLineParser parser(argc, argv, keys);
+	if (parser.has("help")) {
+		parser.printMessage();
+		return 0;
+	}
+
+	const std::string image_format_L = parser.get<cv::String>("@left-image-format");
+	const std::string image_format_R = parser.get<cv::String>("@right-image-format");
+	const std::string output = parser.get<cv::String>("@output");
+	const int start_number = parser.get<int>("start_number");
+	const int total_number = parser.get<int>("total_number");
+
+	if (!parser.check()) {
+		parser.printErrors();
+		parser.printMessage();
+		std::exit(EXIT_FAILURE);
+	}
+
+	StereoSequenceWriter writer;
+	for (int frame_no = start_number; total_number <= 0 || frame_no - start_number < total_number; frame_no++) {
+
+		const cv::Mat I1 = cv::imread(cv::format(image_format_L.c_str(), frame_no), cv::IMREAD_UNCHANGED);
+		const cv::Mat I2 = cv::imread(cv::format(image_format_R.c_str(), frame_no), cv::IMREAD_UNCHANGED);
+		if (I1.empty() || I2.empty())
+			break;
+
+		ASSERT_MSG(I1.size() == I2.size() && I1.type() == I2.type(), "input images must be same size and type.");
+		ASSERT_MSG(I1.type() == CV_8U || I1.type() == CV_16U, "input image format must be CV_8U or CV_16U.");
+
+		if (frame_no == start_number) {
+			const int depth_bits = I1.type() == CV_8U ? 8 : 16;
+			ASSERT_MSG(writer.open(output, I1.cols, I1.rows, depth_bits), "failed to create " << output << ".");
+		}
+
+		ASSERT_MSG(I1.cols == static_cast<int>(writer.header().width) && I1.rows == static_cast<int>(writer.header().height)
+			&& (I1.type() == CV_8U ? 8u : 16u) == writer.header().depth_bits, "frame " << frame_no << " differs from the first frame.");
+		ASSERT_MSG(writer.append(I1.data, I1.step[0], I2.data, I2.step[0]), "failed to write frame " << frame_no << ".");
+	}
+
+	const auto frame_count = writer.header().frame_count;
+	ASSERT_MSG(frame_count > 0, "imread failed. Check start_number and image paths.");
+	ASSERT_MSG(writer.close(), "failed to finish " << output << ".");
+
+	std::cout << "Wrote " << frame_count << " frames to " << output << "." << std::endl;
+	return 0;
+}
@@ -0,0 +1,168 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <sstream>
+#include <cstring>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include <libsgm.h>
+
+#include "sample_common.h"
+#include "mapped_file.h"
+
+static const std::string keys =
+"{ @volume     | <none> | path to a cost volume file                                                           }"
+"{ left        |        | left image, computes the cost volume and writes it to @volume                        }"
+"{ right       |        | right image, computes the cost volume and writes it to @volume                       }"
+"{ summed      |        | write the 16 bit sum over scanlines instead of the costs of each scanline            }"
+"{ disp_size   |    128 | maximum possible disparity value                                                     }"
+"{ P1          |     10 | penalty on the disparity change by plus or minus 1 between nieghbor pixels           }"
+"{ P2          |    120 | penalty on the disparity change by more than 1 between neighbor pixels               }"
+"{ num_paths   |      8 | number of scanlines used in cost aggregation                                         }"
+"{ min_disp    |      0 | minimum disparity value                                                              }"
+"{ census_type |      1 | type of census transform (0:9x7 1:SYMMETRIC_9x7 2:5x5 3:11x9 4:13x11 5:SPARSE_13x11) }"
+"{ uniqueness  |   0.95 | comma separated uniqueness values post-processing is run with                        }"
+"{ LR_max_diff |      1 | comma separated LR_max_diff values post-processing is run with                       }"
+"{ subpixel    |        | enable subpixel estimation in post-processing                                        }"
+"{ output      |        | write each disparity map as <output>_u<uniqueness>_lr<LR_max_diff>.png               }"
+"{ help h      |        | display this help and exit                                                           }";
+
+template <typename T>
+static std::vector<T> split(const std::string& list)
+{
+	std::vector<T> values;
+	std::stringstream ss(list);
+	std::string item;
+	while (std::getline(ss, item, ','))
+		values.push_back(static_cast<T>(std::stod(item)));
+	return values;
+}
+
+static void dump(const cv::CommandLineParser& parser, const std::string& path)
+{
+	const cv::Mat I1 = cv::imread(parser.get<cv::String>("left"), cv::IMREAD_UNCHANGED);
+	const cv::Mat I2 = cv::imread(parser.get<cv::String>("right"), cv::IMREAD_UNCHANGED);
+	const int disp_size = parser.get<int>("disp_size");
+	const int num_paths = parser.get<int>("num_paths");
+	const auto census_type = static_cast<sgm::CensusType>(parser.get<int>("census_type"));
+	const bool summed = parser.has("summed");
+
+	ASSERT_MSG(!I1.empty() && !I2.empty(), "imread failed.");
+	ASSERT_MSG(I1.size() == I2.size() && I1.type() == I2.type(), "input images must be same size and type.");
+	ASSERT_MSG(I1.type() == CV_8U || I1.type() == CV_16U, "input image format must be CV_8U or CV_16U.");
+	ASSERT_MSG(disp_size == 64 || disp_size == 128 || disp_size == 256, "disparity size must be 64, 128 or 256.");
+	ASSERT_MSG(num_paths == 4 || num_paths == 8, "number of scanlines must be 4 or 8.");
+
+	const int src_depth = I1.type() == CV_8U ? 8 : 16;
+	const auto path_type = num_paths == 8 ? sgm::PathType::SCAN_8PATH : sgm::PathType::SCAN_4PATH;
+	const sgm::StereoSGM::Parameters param(parser.get<int>("P1"), parser.get<int>("P2"), 0.95f, false, path_type,
+		parser.get<int>("min_disp"), 1, census_type);
+	sgm::StereoSGM sgm(I1.cols, I1.rows, disp_size, src_depth, 16, sgm::EXECUTE_INOUT_HOST2HOST, param);
+
+	cv::Mat disparity(I1.size(), CV_16U);
+	sgm.execute(I1.data, I2.data, disparity.data);
+
+	// the volume is written straight into the mapping, no second host copy is needed
+	const size_t size = sgm.get_cost_volume(nullptr, 0, summed);
+	MappedFile file;
+	ASSERT_MSG(file.create(path, size), "failed to create " << path << ".");
+	sgm.get_cost_volume(file.data(), file.size(), summed);
+
+	std::cout << "Wrote " << (summed ? "summed" : std::to_string(num_paths) + " path") << " cost volume of " << I1.cols << "x" << I1.rows
+		<< "x" << disp_size << " to " << path << " (" << std::fixed << std::setprecision(1) << size / 1e6 << " MB)" << std::endl;
+}
+
+static void reload(const cv::CommandLineParser& parser, const std::string& path)
+{
+	const std::vector<float> uniqueness_values = split<float>(parser.get<cv::String>("uniqueness"));
+	const std::vector<int> LR_max_diff_values = split<int>(parser.get<cv::String>("LR_max_diff"));
+	const bool subpixel = parser.has("subpixel");
+	const std::string output = parser.has("output") ? parser.get<cv::String>("output") : "";
+
+	MappedFile file;
+	ASSERT_MSG(file.open(path), "failed to open " << path << ".");
+	ASSERT_MSG(file.size() >= sizeof(sgm::CostVolumeHeader), path << " is too small for a cost volume.");
+	sgm::CostVolumeHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+	ASSERT_MSG(memcmp(header.magic, "SGMCOST", 8) == 0, path << " is not a cost volume.");
+	file.advise_sequential();
+
+	const int width = header.width;
+	const int height = header.height;
+	const auto path_type = header.num_paths == 8 ? sgm::PathType::SCAN_8PATH : sgm::PathType::SCAN_4PATH;
+	const auto census_type = static_cast<sgm::CensusType>(header.census_type);
+	const auto input_format = static_cast<sgm::InputFormat>(header.input_format);
+	const auto direction = header.vertical ? sgm::EpipolarDirection::VERTICAL : sgm::EpipolarDirection::HORIZONTAL;
+
+	std::cout << "Cost volume of " << width << "x" << height << "x" << header.disp_size << ", " << header.num_paths << " paths, P1 "
+		<< header.P1 << ", P2 " << header.P2 << (header.element_bits == 16 ? ", summed" : "") << std::endl;
+	std::cout << std::setw(12) << "uniqueness" << std::setw(13) << "LR_max_diff" << std::setw(10) << "density" << std::setw(11) << "time[ms]"
+		<< std::endl;
+
+	// uniqueness and LR_max_diff are fixed at construction, so each setting gets its own instance
+	cv::Mat disparity(height, width, CV_16U);
+	for (const float uniqueness : uniqueness_values) {
+		for (const int LR_max_diff : LR_max_diff_values) {
+			const sgm::StereoSGM::Parameters param(header.P1, header.P2, uniqueness, subpixel, path_type, header.min_disp, LR_max_diff,
+				census_type, false, input_format, direction);
+			sgm::StereoSGM sgm(width, height, header.disp_size, header.input_depth_bits, 16, sgm::EXECUTE_INOUT_HOST2HOST, param);
+
+			const auto t1 = std::chrono::steady_clock::now();
+			sgm.execute_cost_volume(file.data(), file.size(), disparity.data);
+			const auto t2 = std::chrono::steady_clock::now();
+
+			const int valid = cv::countNonZero(disparity != static_cast<uint16_t>(sgm.get_invalid_disparity()));
+			std::cout << std::setw(12) << std::setprecision(3) << uniqueness << std::setw(13) << LR_max_diff << std::setw(9)
+				<< std::fixed << std::setprecision(1) << 100. * valid / disparity.total() << "%" << std::setw(11)
+				<< std::chrono::duration<double, std::milli>(t2 - t1).count() << std::defaultfloat << std::endl;
+
+			if (!output.empty()) {
+				std::ostringstream name;
+				name << output << "_u" << uniqueness << "_lr" << LR_max_diff << ".png";
+				ASSERT_MSG(cv::imwrite(name.str(), disparity), "failed to write " << name.str() << ".");
+			}
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	cv::CommandLineParser parser(argc, argv, keys);
+	if (parser.has("help")) {
+		parser.printMessage();
+		return 0;
+	}
+
+	const std::string path = parser.get<cv::String>("@volume");
+	if (!parser.check()) {
+		parser.printErrors();
+		parser.printMessage();
+		std::exit(EXIT_FAILURE);
+	}
+
+	if (parser.has("left") || parser.has("right"))
+		dump(parser, path);
+	else
+		reload(parser, path);
+
+	return 0;
+}
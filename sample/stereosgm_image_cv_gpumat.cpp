@@ -25,17 +25,17 @@ limitations under the License.
 #include "sample_common.h"
 
 static const std::string keys =
-"{ @left_img   | <none> | path to input left image                                                            }"
-"{ @right_img  | <none> | path to input right image                                                           }"
-"{ disp_size   |     64 | maximum possible disparity value                                                    }"
-"{ P1          |     10 | penalty on the disparity change by plus or minus 1 between nieghbor pixels          }"
-"{ P2          |    120 | penalty on the disparity change by more than 1 between neighbor pixels              }"
-"{ uniqueness  |   0.95 | margin in ratio by which the best cost function value should be at least second one }"
-"{ num_paths   |      8 | number of scanlines used in cost aggregation                                        }"
-"{ min_disp    |      0 | minimum disparity value                                                             }"
-"{ LR_max_diff |      1 | maximum allowed difference between left and right disparity                         }"
-"{ census_type |      1 | type of census transform (0:CENSUS_9x7 1:SYMMETRIC_CENSUS_9x7)                      }"
-"{ help h      |        | display this help and exit                                                          }";
+"{ @left_img   | <none> | path to input left image                                                             }"
+"{ @right_img  | <none> | path to input right image                                                            }"
+"{ disp_size   |     64 | maximum possible disparity value                                                     }"
+"{ P1          |     10 | penalty on the disparity change by plus or minus 1 between nieghbor pixels           }"
+"{ P2          |    120 | penalty on the disparity change by more than 1 between neighbor pixels               }"
+"{ uniqueness  |   0.95 | margin in ratio by which the best cost function value should be at least second one  }"
+"{ num_paths   |      8 | number of scanlines used in cost aggregation                                         }"
+"{ min_disp    |      0 | minimum disparity value                                                              }"
+"{ LR_max_diff |      1 | maximum allowed difference between left and right disparity                          }"
+"{ census_type |      1 | type of census transform (0:9x7 1:SYMMETRIC_9x7 2:5x5 3:11x9 4:13x11 5:SPARSE_13x11) }"
+"{ help h      |        | display this help and exit                                                           }";
 
 int main(int argc, char* argv[])
 {
@@ -68,7 +68,7 @@ int main(int argc, char* argv[])
 	ASSERT_MSG(I1.type() == CV_8U || I1.type() == CV_16U, "input image format must be CV_8U or CV_16U.");
 	ASSERT_MSG(disp_size == 64 || disp_size == 128 || disp_size == 256, "disparity size must be 64, 128 or 256.");
 	ASSERT_MSG(num_paths == 4 || num_paths == 8, "number of scanlines must be 4 or 8.");
-	ASSERT_MSG(census_type == sgm::CensusType::CENSUS_9x7 || census_type == sgm::CensusType::SYMMETRIC_CENSUS_9x7, "census type must be 0 or 1.");
+	ASSERT_MSG(0 <= static_cast<int>(census_type) && census_type <= sgm::CensusType::SPARSE_CENSUS_13x11, "census type must be 0, 1, 2, 3, 4 or 5.");
 
 	const sgm::PathType path_type = num_paths == 8 ? sgm::PathType::SCAN_8PATH : sgm::PathType::SCAN_4PATH;
 	sgm::LibSGMWrapper sgm(disp_size, P1, P2, uniqueness, false, path_type, min_disp, LR_max_diff, census_type);
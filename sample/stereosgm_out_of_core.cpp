@@ -0,0 +1,270 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <future>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include <libsgm.h>
+
+#include "sample_common.h"
+#include "mapped_file.h"
+
+static const std::string keys =
+"{ @left         | <none> | path to a raw left image, rows stored top to bottom without padding                   }"
+"{ @right        | <none> | path to a raw right image of the same layout                                           }"
+"{ @output       | <none> | path to the raw 16 bit disparity map which is created                                  }"
+"{ width         |        | image width                                                                            }"
+"{ height        |        | image height                                                                           }"
+"{ depth         |      8 | bits per pixel of the input images (8 or 16)                                           }"
+"{ offset        |      0 | bytes to skip at the start of the input files, e.g. a header                           }"
+"{ disp_size     |    128 | maximum possible disparity value                                                       }"
+"{ min_disp      |      0 | minimum disparity value                                                                }"
+"{ P1            |     10 | penalty on the disparity change by plus or minus 1 between nieghbor pixels             }"
+"{ P2            |    120 | penalty on the disparity change by more than 1 between neighbor pixels                 }"
+"{ uniqueness    |   0.95 | margin in ratio by which the best cost function value should be at least second one    }"
+"{ LR_max_diff   |      1 | maximum allowed difference between left and right disparity                            }"
+"{ num_paths     |      8 | number of scanlines used in cost aggregation                                           }"
+"{ census_type   |      1 | type of census transform (0:9x7 1:SYMMETRIC_9x7 2:5x5 3:11x9 4:13x11 5:SPARSE_13x11)   }"
+"{ subpixel      |        | enable subpixel estimation                                                             }"
+"{ tile          |   4096 | output pixels of a tile in each direction, reduced to fit the memory limits            }"
+"{ overlap       |    128 | pixels each tile is extended by so that scanlines entering it have converged            }"
+"{ memory_limit  |   2048 | resident host memory for mapped strips and buffers in MB                               }"
+"{ device_limit  |      0 | device memory for one tile in MB, 0 for the free device memory                         }"
+"{ help h        |        | display this help and exit                                                             }";
+
+// tiles of core_w x core_h output pixels are computed on windows of tile_w x tile_h input pixels,
+// extended by the overlap and, on the left, by the disparity range the right image is searched in.
+// aggregation restarts in each window, the overlap stands in for handing path costs over between tiles,
+// which the paths running up or left could not take from tiles that are not computed yet anyway
+struct TileLayout
+{
+	int width, height;
+	int core_w, core_h;
+	int tile_w, tile_h;
+	int margin_left, margin_right, margin_y;
+
+	void fit()
+	{
+		tile_w = std::min(width, core_w + margin_left + margin_right);
+		tile_h = std::min(height, core_h + 2 * margin_y);
+	}
+
+	// window origin of the tile whose core starts at (x, y), shifted inside the image at its borders
+	int window_x(int x) const { return std::max(0, std::min(x - margin_left, width - tile_w)); }
+	int window_y(int y) const { return std::max(0, std::min(y - margin_y, height - tile_h)); }
+
+	// two strips of both inputs are mapped at a time, the current one and the prefetched next one
+	size_t host_bytes(int elem_size) const
+	{
+		const size_t input_strip = static_cast<size_t>(tile_h) * width * elem_size * 2;
+		const size_t output_strip = static_cast<size_t>(core_h) * width * sizeof(uint16_t);
+		const size_t tile_buffer = static_cast<size_t>(tile_w) * tile_h * sizeof(uint16_t);
+		return 2 * input_strip + output_strip + tile_buffer;
+	}
+
+	// cost volume, census of both images, both inputs and a few 16 bit disparity buffers per pixel
+	size_t device_bytes(int elem_size, int disp_size, int num_paths, int census_bytes) const
+	{
+		const size_t per_pixel = static_cast<size_t>(disp_size) * num_paths + 2 * census_bytes + 2 * elem_size + 8 * sizeof(uint16_t);
+		return per_pixel * tile_w * tile_h;
+	}
+};
+
+// faults the pages of the range in, so that reading them later does not wait for the disk
+static void touch(const MappedFile& file, size_t offset, size_t size)
+{
+	file.prefetch(offset, size);
+	const size_t end = std::min(offset + size, file.size());
+	volatile uint8_t sink = 0;
+	for (size_t i = offset; i < end; i += 4096)
+		sink = sink + file.data()[i];
+}
+
+int main(int argc, char* argv[])
+{
+	cv::CommandLineParser parser(argc, argv, keys);
+	if (parser.has("help")) {
+		parser.printMessage();
+		return 0;
+	}
+
+	const std::string left_path = parser.get<cv::String>("@left");
+	const std::string right_path = parser.get<cv::String>("@right");
+	const std::string output_path = parser.get<cv::String>("@output");
+	const int width = parser.get<int>("width");
+	const int height = parser.get<int>("height");
+	const int depth = parser.get<int>("depth");
+	const size_t offset = parser.get<int>("offset");
+	const int disp_size = parser.get<int>("disp_size");
+	const int min_disp = parser.get<int>("min_disp");
+	const int num_paths = parser.get<int>("num_paths");
+	const auto census_type = static_cast<sgm::CensusType>(parser.get<int>("census_type"));
+	const bool subpixel = parser.has("subpixel");
+	const int tile = parser.get<int>("tile");
+	const int overlap = parser.get<int>("overlap");
+	const size_t memory_limit = static_cast<size_t>(parser.get<int>("memory_limit")) << 20;
+	size_t device_limit = static_cast<size_t>(parser.get<int>("device_limit")) << 20;
+
+	if (!parser.check()) {
+		parser.printErrors();
+		parser.printMessage();
+		std::exit(EXIT_FAILURE);
+	}
+
+	ASSERT_MSG(width > 0 && height > 0, "image width and height must be given.");
+	ASSERT_MSG(depth == 8 || depth == 16, "input depth must be 8 or 16.");
+	ASSERT_MSG(disp_size == 64 || disp_size == 128 || disp_size == 256, "disparity size must be 64, 128 or 256.");
+	ASSERT_MSG(num_paths == 4 || num_paths == 8, "number of scanlines must be 4 or 8.");
+	ASSERT_MSG(tile > 0 && overlap >= 0, "tile must be positive and overlap must not be negative.");
+
+	const int elem_size = depth / 8;
+	const size_t image_bytes = static_cast<size_t>(width) * height * elem_size;
+	const size_t row_bytes = static_cast<size_t>(width) * elem_size;
+
+	MappedFile left, right, output;
+	ASSERT_MSG(left.open(left_path) && right.open(right_path), "failed to open the input images.");
+	ASSERT_MSG(left.size() >= offset + image_bytes && right.size() >= offset + image_bytes,
+		"input images must hold " << width << "x" << height << " pixels of " << depth << " bits after " << offset << " bytes.");
+	ASSERT_MSG(output.create(output_path, static_cast<size_t>(width) * height * sizeof(uint16_t)), "failed to create " << output_path << ".");
+	left.advise_sequential();
+	right.advise_sequential();
+
+	if (device_limit == 0) {
+		size_t free_bytes = 0, total_bytes = 0;
+		cudaMemGetInfo(&free_bytes, &total_bytes);
+		device_limit = free_bytes / 10 * 9;
+	}
+
+	// shrink tiles until one fits on the device and its strips fit in the host memory limit
+	TileLayout layout;
+	layout.width = width;
+	layout.height = height;
+	layout.core_w = std::min(tile, width);
+	layout.core_h = std::min(tile, height);
+	layout.margin_left = overlap + std::max(0, min_disp + disp_size - 1);
+	layout.margin_right = overlap + std::max(0, -min_disp);
+	layout.margin_y = overlap;
+	layout.fit();
+
+	const int census_bytes = census_type == sgm::CensusType::CENSUS_11x9 || census_type == sgm::CensusType::CENSUS_13x11 ? 16 : 8;
+	const int min_core = 16;
+	while (layout.device_bytes(elem_size, disp_size, num_paths, census_bytes) > device_limit) {
+		ASSERT_MSG(layout.core_w > min_core || layout.core_h > min_core, "device memory limit is too small for a single tile.");
+		if (layout.core_w >= layout.core_h)
+			layout.core_w = std::max(min_core, layout.core_w / 2);
+		else
+			layout.core_h = std::max(min_core, layout.core_h / 2);
+		layout.fit();
+	}
+	while (layout.host_bytes(elem_size) > memory_limit) {
+		ASSERT_MSG(layout.core_h > min_core, "memory limit is too small for a strip of " << width << " pixels wide images.");
+		layout.core_h = std::max(min_core, layout.core_h / 2);
+		layout.fit();
+	}
+
+	const int tiles_x = (width + layout.core_w - 1) / layout.core_w;
+	const int strips = (height + layout.core_h - 1) / layout.core_h;
+	const double redundancy = static_cast<double>(layout.tile_w) * layout.tile_h * tiles_x * strips / (static_cast<double>(width) * height);
+
+	std::cout << "Image " << width << "x" << height << ", " << strips << " strips of " << tiles_x << " tiles" << std::endl;
+	std::cout << "Tile " << layout.core_w << "x" << layout.core_h << " computed on " << layout.tile_w << "x" << layout.tile_h
+		<< " pixels (" << std::fixed << std::setprecision(2) << redundancy << "x the image)" << std::endl;
+	std::cout << "Memory bound: host " << (layout.host_bytes(elem_size) >> 20) << " MB, device about "
+		<< (layout.device_bytes(elem_size, disp_size, num_paths, census_bytes) >> 20) << " MB" << std::endl;
+
+	const auto path_type = num_paths == 8 ? sgm::PathType::SCAN_8PATH : sgm::PathType::SCAN_4PATH;
+	const sgm::StereoSGM::Parameters param(parser.get<int>("P1"), parser.get<int>("P2"), parser.get<float>("uniqueness"), subpixel,
+		path_type, min_disp, parser.get<int>("LR_max_diff"), census_type);
+	sgm::StereoSGM sgm(layout.tile_w, layout.tile_h, disp_size, depth, 16, sgm::EXECUTE_INOUT_HOST2HOST, param);
+
+	const sgm::ImageType src_type = depth == 8 ? sgm::SGM_8U : sgm::SGM_16U;
+	std::vector<uint16_t> tile_disparity(static_cast<size_t>(layout.tile_w) * layout.tile_h);
+	const sgm::ImageView tile_view{ tile_disparity.data(), layout.tile_w, layout.tile_h,
+		static_cast<int>(layout.tile_w * sizeof(uint16_t)), sgm::SGM_16U };
+	uint16_t* disparity = reinterpret_cast<uint16_t*>(output.data());
+	const uint8_t* inputL = left.data();
+	const uint8_t* inputR = right.data();
+
+	// rows [y, y + tile_h) of the window the strip starting at core row y is computed on
+	auto prefetch_strip = [&](int strip) {
+		const size_t begin = offset + layout.window_y(strip * layout.core_h) * row_bytes;
+		const size_t size = static_cast<size_t>(layout.tile_h) * row_bytes;
+		return std::async(std::launch::async, [&left, &right, begin, size] {
+			touch(left, begin, size);
+			touch(right, begin, size);
+		});
+	};
+
+	double compute_ms = 0, wait_ms = 0;
+	size_t released_rows = 0;
+	const auto t0 = std::chrono::steady_clock::now();
+
+	std::future<void> next = prefetch_strip(0);
+	for (int strip = 0; strip < strips; strip++) {
+		const int cy = strip * layout.core_h;
+		const int ch = std::min(layout.core_h, height - cy);
+		const int wy = layout.window_y(cy);
+
+		const auto t1 = std::chrono::steady_clock::now();
+		next.get();
+		if (strip + 1 < strips)
+			next = prefetch_strip(strip + 1);
+		const auto t2 = std::chrono::steady_clock::now();
+		wait_ms += std::chrono::duration<double, std::milli>(t2 - t1).count();
+
+		for (int cx = 0; cx < width; cx += layout.core_w) {
+			const int cw = std::min(layout.core_w, width - cx);
+			const int wx = layout.window_x(cx);
+
+			// both windows are read in place from the mappings
+			const size_t window_offset = offset + wy * row_bytes + static_cast<size_t>(wx) * elem_size;
+			const sgm::ConstImageView left_view{ inputL + window_offset, layout.tile_w, layout.tile_h, static_cast<int>(row_bytes), src_type };
+			const sgm::ConstImageView right_view{ inputR + window_offset, layout.tile_w, layout.tile_h, static_cast<int>(row_bytes), src_type };
+			sgm.execute(left_view, right_view, tile_view);
+
+			for (int y = cy; y < cy + ch; y++)
+				memcpy(disparity + static_cast<size_t>(y) * width + cx, &tile_disparity[static_cast<size_t>(y - wy) * layout.tile_w + cx - wx],
+					cw * sizeof(uint16_t));
+		}
+		compute_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t2).count();
+
+		// input rows above the next window and the finished output rows are written back and dropped
+		const size_t keep_from = strip + 1 < strips ? layout.window_y(cy + ch) : height;
+		if (keep_from > released_rows) {
+			left.release(offset + released_rows * row_bytes, (keep_from - released_rows) * row_bytes);
+			right.release(offset + released_rows * row_bytes, (keep_from - released_rows) * row_bytes);
+			released_rows = keep_from;
+		}
+		output.release(static_cast<size_t>(cy) * width * sizeof(uint16_t), static_cast<size_t>(ch) * width * sizeof(uint16_t));
+
+		std::cout << "\rstrip " << strip + 1 << "/" << strips << std::flush;
+	}
+	const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	std::cout << std::endl << "Processed in " << wall << " s (" << static_cast<double>(width) * height / wall / 1e6 << " MP/s), compute "
+		<< compute_ms / 1e3 << " s, waiting for input " << wait_ms / 1e3 << " s" << std::endl;
+	std::cout << "Wrote uint16 disparity to " << output_path << ", invalid value " << static_cast<uint16_t>(sgm.get_invalid_disparity())
+		<< (subpixel ? ", 4 fractional bits" : "") << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,123 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+
+#include <libsgm.h>
+
+#include "sample_common.h"
+#include "stereo_sequence.h"
+
+static const std::string keys =
+"{ @sequence   | <none> | path to a raw stereo sequence written by stereosgm_convert_sequence                   }"
+"{ disp_size   |    128 | maximum possible disparity value                                                     }"
+"{ subpixel    |        | enable subpixel estimation                                                           }"
+"{ num_paths   |      8 | number of scanlines used in cost aggregation                                         }"
+"{ census_type |      1 | type of census transform (0:9x7 1:SYMMETRIC_9x7 2:5x5 3:11x9 4:13x11 5:SPARSE_13x11) }"
+"{ loops       |      1 | number of times the sequence is replayed                                             }"
+"{ checksums   |        | write a checksum of each disparity map to this path for regression tests             }"
+"{ help h      |        | display this help and exit                                                           }";
+
+// FNV-1a over the disparity bytes
+static uint64_t checksum(const std::vector<uint16_t>& disparity)
+{
+	uint64_t hash = 14695981039346656037ull;
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(disparity.data());
+	for (size_t i = 0; i < disparity.size() * sizeof(uint16_t); i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	return hash;
+}
+
+int main(int argc, char* argv[])
+{
+	cv::CommandLineParser parser(argc, argv, keys);
+	if (parser.has("help")) {
+		parser.printMessage();
+		return 0;
+	}
+
+	const std::string path = parser.get<cv::String>("@sequence");
+	const int disp_size = parser.get<int>("disp_size");
+	const bool subpixel = parser.has("subpixel");
+	const auto path_type = parser.get<int>("num_paths") == 8 ? sgm::PathType::SCAN_8PATH : sgm::PathType::SCAN_4PATH;
+	const auto census_type = static_cast<sgm::CensusType>(parser.get<int>("census_type"));
+	const int loops = parser.get<int>("loops");
+	const std::string checksums = parser.has("checksums") ? parser.get<cv::String>("checksums") : "";
+
+	if (!parser.check()) {
+		parser.printErrors();
+		parser.printMessage();
+		std::exit(EXIT_FAILURE);
+	}
+
+	StereoSequenceReader reader;
+	ASSERT_MSG(reader.open(path), "failed to open " << path << " as a raw stereo sequence.");
+	ASSERT_MSG(reader.frame_count() > 0, path << " contains no frames.");
+	ASSERT_MSG(disp_size == 64 || disp_size == 128 || disp_size == 256, "disparity size must be 64, 128 or 256.");
+
+	const int width = reader.width();
+	const int height = reader.height();
+	const int dst_depth = 16;
+
+	// frames are read in place from the mapping, only the output stays on the device
+	const sgm::StereoSGM::Parameters param(10, 120, 0.95f, subpixel, path_type, 0, 1, census_type);
+	sgm::StereoSGM sgm(width, height, disp_size, reader.depth_bits(), dst_depth, sgm::EXECUTE_INOUT_HOST2CUDA, param);
+	device_buffer d_disparity(static_cast<size_t>(dst_depth / 8) * width * height);
+
+	std::ofstream ofs;
+	if (!checksums.empty()) {
+		ofs.open(checksums);
+		ASSERT_MSG(ofs, "failed to write " << checksums << ".");
+	}
+	std::vector<uint16_t> disparity(static_cast<size_t>(width) * height);
+
+	std::vector<double> times;
+	const auto t0 = std::chrono::steady_clock::now();
+	for (int loop = 0; loop < loops; loop++) {
+		for (size_t frame_no = 0; frame_no < reader.frame_count(); frame_no++) {
+			reader.prefetch(frame_no + 1);
+
+			const auto t1 = std::chrono::steady_clock::now();
+			sgm.execute(reader.frame(frame_no), d_disparity.data);
+			cudaDeviceSynchronize();
+			const auto t2 = std::chrono::steady_clock::now();
+			times.push_back(std::chrono::duration<double, std::milli>(t2 - t1).count());
+
+			if (ofs.is_open() && loop == 0) {
+				d_disparity.download(disparity.data());
+				ofs << frame_no << " " << std::hex << std::setw(16) << std::setfill('0') << checksum(disparity) << std::dec << "\n";
+			}
+		}
+	}
+	const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	std::sort(times.begin(), times.end());
+	auto percentile = [&](double p) { return sgm::percentile(times.data(), times.size(), p); };
+
+	std::cout << "Replayed " << times.size() << " frames of " << width << "x" << height << " in " << std::fixed << std::setprecision(2)
+		<< wall << " s (" << times.size() / wall << " FPS)" << std::endl;
+	std::cout << "Frame time [ms]: p50 " << percentile(0.5) << ", p99 " << percentile(0.99) << ", max " << times.back() << std::endl;
+
+	return 0;
+}
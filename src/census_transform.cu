@@ -19,6 +19,9 @@ limitations under the License.
 #include <cuda_runtime.h>
 
 #include "types.h"
+#include "census_utility.h"
+#include "device_utility.h"
+#include "pixel_loader.h"
 #include "host_utility.h"
 
 namespace sgm
@@ -26,18 +29,31 @@ namespace sgm
 namespace
 {
 
-static constexpr int WINDOW_WIDTH  = 9;
-static constexpr int WINDOW_HEIGHT = 7;
-
 static constexpr int BLOCK_SIZE = 128;
 static constexpr int LINES_PER_BLOCK = 16;
 
-template <typename T>
-__global__ void census_transform_kernel(uint64_t* dest, const T* src, int width, int height, int pitch)
+template <typename T, int SMEM_BUFFER_SIZE>
+struct SharedPixelAccessor
 {
-	using pixel_type = T;
-	using feature_type = uint64_t;
+	const T (*lines)[BLOCK_SIZE];
+	int x, y;
+
+	__device__ SharedPixelAccessor(const T (*lines)[BLOCK_SIZE], int x, int y) : lines(lines), x(x), y(y) {}
+	__device__ T operator()(int dx, int dy) const
+	{
+		return lines[(y + dy + SMEM_BUFFER_SIZE) % SMEM_BUFFER_SIZE][x + dx];
+	}
+};
 
+template <CensusType CENSUS_TYPE, typename PIXEL_LOADER>
+__global__ void census_transform_kernel(typename Census<CENSUS_TYPE>::feature_type* dest, PIXEL_LOADER src, int width, int height,
+	MaskBits mask)
+{
+	using pixel_type = typename PIXEL_LOADER::pixel_type;
+	using census = Census<CENSUS_TYPE>;
+
+	static const int WINDOW_WIDTH = census::WINDOW_WIDTH;
+	static const int WINDOW_HEIGHT = census::WINDOW_HEIGHT;
 	static const int SMEM_BUFFER_SIZE = WINDOW_HEIGHT + 1;
 
 	const int half_kw = WINDOW_WIDTH / 2;
@@ -49,11 +65,25 @@ __global__ void census_transform_kernel(uint64_t* dest, const T* src, int width,
 	const int x0 = blockIdx.x * (BLOCK_SIZE - WINDOW_WIDTH + 1) - half_kw;
 	const int y0 = blockIdx.y * LINES_PER_BLOCK;
 
+	// skip tiles without any valid pixel
+	if (mask.bits) {
+		bool any_valid = false;
+		const int x = x0 + tid;
+		if (half_kw <= tid && tid < BLOCK_SIZE - half_kw && x < width) {
+			for (int i = 0; i < LINES_PER_BLOCK && y0 + i < height; ++i) {
+				any_valid |= mask(x, y0 + i);
+			}
+		}
+		if (!__syncthreads_or(any_valid)) {
+			return;
+		}
+	}
+
 	for (int i = 0; i < WINDOW_HEIGHT; ++i) {
 		const int x = x0 + tid, y = y0 - half_kh + i;
 		pixel_type value = 0;
 		if (0 <= x && x < width && 0 <= y && y < height) {
-			value = src[x + y * pitch];
+			value = src(x, y);
 		}
 		smem_lines[i][tid] = value;
 	}
@@ -66,7 +96,7 @@ __global__ void census_transform_kernel(uint64_t* dest, const T* src, int width,
 			const int x = x0 + tid, y = y0 + half_kh + i + 1;
 			pixel_type value = 0;
 			if (0 <= x && x < width && 0 <= y && y < height) {
-				value = src[x + y * pitch];
+				value = src(x, y);
 			}
 			const int smem_x = tid;
 			const int smem_y = (WINDOW_HEIGHT + i) % SMEM_BUFFER_SIZE;
@@ -76,99 +106,47 @@ __global__ void census_transform_kernel(uint64_t* dest, const T* src, int width,
 		if (half_kw <= tid && tid < BLOCK_SIZE - half_kw) {
 			// Compute and store
 			const int x = x0 + tid, y = y0 + i;
-			if (half_kw <= x && x < width - half_kw && half_kh <= y && y < height - half_kh) {
+			if (half_kw <= x && x < width - half_kw && half_kh <= y && y < height - half_kh && mask(x, y)) {
 				const int smem_x = tid;
 				const int smem_y = (half_kh + i) % SMEM_BUFFER_SIZE;
-				const auto a = smem_lines[smem_y][smem_x];
-				feature_type f = 0;
-				for (int dy = -half_kh; dy <= half_kh; ++dy) {
-					for (int dx = -half_kw; dx <= half_kw; ++dx) {
-						if (dx != 0 && dy != 0) {
-							const int smem_y1 = (smem_y + dy + SMEM_BUFFER_SIZE) % SMEM_BUFFER_SIZE;
-							const int smem_x1 = smem_x + dx;
-							const auto b = smem_lines[smem_y1][smem_x1];
-							f = (f << 1) | (a > b);
-						}
-					}
-				}
-				dest[x + y * width] = f;
+				const SharedPixelAccessor<pixel_type, SMEM_BUFFER_SIZE> pixel(smem_lines, smem_x, smem_y);
+				dest[x + y * width] = census::compute(pixel);
 			}
 		}
 		__syncthreads();
 	}
 }
 
-template <typename T>
-__global__ void symmetric_census_kernel(uint32_t* dest, const T* src, int width, int height, int pitch)
+template <CensusType CENSUS_TYPE>
+struct CensusTransformLauncher
 {
-	using pixel_type = T;
-	using feature_type = uint32_t;
+	using feature_type = typename Census<CENSUS_TYPE>::feature_type;
 
-	static const int SMEM_BUFFER_SIZE = WINDOW_HEIGHT + 1;
+	DeviceImage& dst;
+	const DeviceImage& mask;
 
-	const int half_kw = WINDOW_WIDTH  / 2;
-	const int half_kh = WINDOW_HEIGHT / 2;
-
-	__shared__ pixel_type smem_lines[SMEM_BUFFER_SIZE][BLOCK_SIZE];
+	template <typename PIXEL_LOADER>
+	void operator()(const PIXEL_LOADER& src) const
+	{
+		const int w = dst.cols;
+		const int h = dst.rows;
 
-	const int tid = threadIdx.x;
-	const int x0 = blockIdx.x * (BLOCK_SIZE - WINDOW_WIDTH + 1) - half_kw;
-	const int y0 = blockIdx.y * LINES_PER_BLOCK;
+		const int w_per_block = BLOCK_SIZE - Census<CENSUS_TYPE>::WINDOW_WIDTH + 1;
+		const int h_per_block = LINES_PER_BLOCK;
+		const dim3 gdim(divUp(w, w_per_block), divUp(h, h_per_block));
+		const dim3 bdim(BLOCK_SIZE);
 
-	for(int i = 0; i < WINDOW_HEIGHT; ++i){
-		const int x = x0 + tid, y = y0 - half_kh + i;
-		pixel_type value = 0;
-		if(0 <= x && x < width && 0 <= y && y < height){
-			value = src[x + y * pitch];
-		}
-		smem_lines[i][tid] = value;
+		census_transform_kernel<CENSUS_TYPE><<<gdim, bdim>>>(dst.ptr<feature_type>(), src, w, h,
+			MaskBits{ mask.ptr<uint32_t>(), mask.step });
 	}
-	__syncthreads();
+};
 
-#pragma unroll
-	for(int i = 0; i < LINES_PER_BLOCK; ++i){
-		if(i + 1 < LINES_PER_BLOCK){
-			// Load to smem
-			const int x = x0 + tid, y = y0 + half_kh + i + 1;
-			pixel_type value = 0;
-			if(0 <= x && x < width && 0 <= y && y < height){
-				value = src[x + y * pitch];
-			}
-			const int smem_x = tid;
-			const int smem_y = (WINDOW_HEIGHT + i) % SMEM_BUFFER_SIZE;
-			smem_lines[smem_y][smem_x] = value;
-		}
-
-		if(half_kw <= tid && tid < BLOCK_SIZE - half_kw){
-			// Compute and store
-			const int x = x0 + tid, y = y0 + i;
-			if(half_kw <= x && x < width - half_kw && half_kh <= y && y < height - half_kh){
-				const int smem_x = tid;
-				const int smem_y = (half_kh + i) % SMEM_BUFFER_SIZE;
-				feature_type f = 0;
-				for(int dy = -half_kh; dy < 0; ++dy){
-					const int smem_y1 = (smem_y + dy + SMEM_BUFFER_SIZE) % SMEM_BUFFER_SIZE;
-					const int smem_y2 = (smem_y - dy + SMEM_BUFFER_SIZE) % SMEM_BUFFER_SIZE;
-					for(int dx = -half_kw; dx <= half_kw; ++dx){
-						const int smem_x1 = smem_x + dx;
-						const int smem_x2 = smem_x - dx;
-						const auto a = smem_lines[smem_y1][smem_x1];
-						const auto b = smem_lines[smem_y2][smem_x2];
-						f = (f << 1) | (a > b);
-					}
-				}
-				for(int dx = -half_kw; dx < 0; ++dx){
-					const int smem_x1 = smem_x + dx;
-					const int smem_x2 = smem_x - dx;
-					const auto a = smem_lines[smem_y][smem_x1];
-					const auto b = smem_lines[smem_y][smem_x2];
-					f = (f << 1) | (a > b);
-				}
-				dest[x + y * width] = f;
-			}
-		}
-		__syncthreads();
-	}
+template <CensusType CENSUS_TYPE>
+void census_transform_(const DeviceImage& src, DeviceImage& dst, InputFormat format,
+	const DeviceImage& map_xy, const DeviceImage& map_frac, const DeviceImage& mask)
+{
+	dst.create(src.rows, src.cols, details::census_image_type(CENSUS_TYPE));
+	dispatch_pixel_loader(src, format, map_xy, map_frac, CensusTransformLauncher<CENSUS_TYPE>{ dst, mask });
 }
 
 } // namespace
@@ -176,34 +154,48 @@ __global__ void symmetric_census_kernel(uint32_t* dest, const T* src, int width,
 namespace details
 {
 
+ImageType census_image_type(CensusType type)
+{
+	if (type == CensusType::SYMMETRIC_CENSUS_9x7 || type == CensusType::CENSUS_5x5 || type == CensusType::SPARSE_CENSUS_13x11)
+		return SGM_32U;
+	if (type == CensusType::CENSUS_9x7)
+		return SGM_64U;
+	return SGM_128U;
+}
+
 void census_transform(const DeviceImage& src, DeviceImage& dst, CensusType type)
 {
-	const int w = src.cols;
-	const int h = src.rows;
-
-	const int w_per_block = BLOCK_SIZE - WINDOW_WIDTH + 1;
-	const int h_per_block = LINES_PER_BLOCK;
-	const dim3 gdim(divUp(w, w_per_block), divUp(h, h_per_block));
-	const dim3 bdim(BLOCK_SIZE);
-
-	dst.create(h, w, type == CensusType::CENSUS_9x7 ? SGM_64U : SGM_32U);
-
-	if (type == CensusType::CENSUS_9x7) {
-		if (src.type == SGM_8U)
-			census_transform_kernel<<<gdim, bdim>>>(dst.ptr<uint64_t>(), src.ptr<uint8_t>(), w, h, src.step);
-		else if (src.type == SGM_16U)
-			census_transform_kernel<<<gdim, bdim>>>(dst.ptr<uint64_t>(), src.ptr<uint16_t>(), w, h, src.step);
-		else
-			census_transform_kernel<<<gdim, bdim>>>(dst.ptr<uint64_t>(), src.ptr<uint32_t>(), w, h, src.step);
-	}
-	else if (type == CensusType::SYMMETRIC_CENSUS_9x7) {
-		if (src.type == SGM_8U)
-			symmetric_census_kernel<<<gdim, bdim>>>(dst.ptr<uint32_t>(), src.ptr<uint8_t>(), w, h, src.step);
-		else if (src.type == SGM_16U)
-			symmetric_census_kernel<<<gdim, bdim>>>(dst.ptr<uint32_t>(), src.ptr<uint16_t>(), w, h, src.step);
-		else
-			symmetric_census_kernel<<<gdim, bdim>>>(dst.ptr<uint32_t>(), src.ptr<uint32_t>(), w, h, src.step);
-	}
+	census_transform(src, dst, type, InputFormat::GRAY);
+}
+
+void census_transform(const DeviceImage& src, DeviceImage& dst, CensusType type, InputFormat format)
+{
+	census_transform(src, dst, type, format, DeviceImage(), DeviceImage());
+}
+
+void census_transform(const DeviceImage& src, DeviceImage& dst, CensusType type, InputFormat format,
+	const DeviceImage& map_xy, const DeviceImage& map_frac)
+{
+	census_transform(src, dst, type, format, map_xy, map_frac, DeviceImage());
+}
+
+void census_transform(const DeviceImage& src, DeviceImage& dst, CensusType type, InputFormat format,
+	const DeviceImage& map_xy, const DeviceImage& map_frac, const DeviceImage& mask)
+{
+	SGM_ASSERT(mask.data == nullptr || mask.rows == src.rows, "mask size must be same as image size.");
+
+	if (type == CensusType::CENSUS_9x7)
+		census_transform_<CensusType::CENSUS_9x7>(src, dst, format, map_xy, map_frac, mask);
+	else if (type == CensusType::SYMMETRIC_CENSUS_9x7)
+		census_transform_<CensusType::SYMMETRIC_CENSUS_9x7>(src, dst, format, map_xy, map_frac, mask);
+	else if (type == CensusType::CENSUS_5x5)
+		census_transform_<CensusType::CENSUS_5x5>(src, dst, format, map_xy, map_frac, mask);
+	else if (type == CensusType::CENSUS_11x9)
+		census_transform_<CensusType::CENSUS_11x9>(src, dst, format, map_xy, map_frac, mask);
+	else if (type == CensusType::CENSUS_13x11)
+		census_transform_<CensusType::CENSUS_13x11>(src, dst, format, map_xy, map_frac, mask);
+	else if (type == CensusType::SPARSE_CENSUS_13x11)
+		census_transform_<CensusType::SPARSE_CENSUS_13x11>(src, dst, format, map_xy, map_frac, mask);
 
 	CUDA_CHECK(cudaGetLastError());
 }
@@ -0,0 +1,311 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __CENSUS_UTILITY_H__
+#define __CENSUS_UTILITY_H__
+
+#include <cuda.h>
+
+#include "libsgm.h"
+#include "types.h"
+
+#if CUDA_VERSION >= 9000
+#define SHFL_UP_FEATURE(mask, var, delta, w) __shfl_up_sync((mask), (var), (delta), (w))
+#define SHFL_DOWN_FEATURE(mask, var, delta, w) __shfl_down_sync((mask), (var), (delta), (w))
+#else
+#define SHFL_UP_FEATURE(mask, var, delta, w) __shfl_up((var), (delta), (w))
+#define SHFL_DOWN_FEATURE(mask, var, delta, w) __shfl_down((var), (delta), (w))
+#endif
+
+namespace sgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// feature type selection
+////////////////////////////////////////////////////////////////////////////////
+
+template <int BITS, bool FITS_32 = (BITS <= 32), bool FITS_64 = (BITS <= 64)>
+struct feature_of_bits { using type = census_words<(BITS + 63) / 64>; };
+
+template <int BITS>
+struct feature_of_bits<BITS, true, true> { using type = uint32_t; };
+
+template <int BITS>
+struct feature_of_bits<BITS, false, true> { using type = uint64_t; };
+
+////////////////////////////////////////////////////////////////////////////////
+// feature operations
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+struct FeatureBuilder
+{
+	T f;
+
+	__device__ FeatureBuilder() : f(0) {}
+	__device__ inline void push(bool bit) { f = (f << 1) | bit; }
+};
+
+template <int WORDS>
+struct FeatureBuilder<census_words<WORDS>>
+{
+	census_words<WORDS> f;
+	int bits;
+
+	__device__ FeatureBuilder() : bits(0)
+	{
+		for (int i = 0; i < WORDS; ++i) { f.data[i] = 0; }
+	}
+
+	__device__ inline void push(bool bit)
+	{
+		uint64_t& word = f.data[bits / 64];
+		word = (word << 1) | bit;
+		++bits;
+	}
+};
+
+__device__ inline int hamming_distance(uint32_t a, uint32_t b) { return __popc(a ^ b); }
+__device__ inline int hamming_distance(uint64_t a, uint64_t b) { return __popcll(a ^ b); }
+
+template <int WORDS>
+__device__ inline int hamming_distance(const census_words<WORDS>& a, const census_words<WORDS>& b)
+{
+	int d = 0;
+#pragma unroll
+	for (int i = 0; i < WORDS; ++i) {
+		d += __popcll(a.data[i] ^ b.data[i]);
+	}
+	return d;
+}
+
+template <typename T>
+__device__ inline T load_feature(const T* ptr) { return __ldg(ptr); }
+
+template <int WORDS>
+__device__ inline census_words<WORDS> load_feature(const census_words<WORDS>* ptr)
+{
+	census_words<WORDS> f;
+#pragma unroll
+	for (int i = 0; i < WORDS; ++i) {
+		f.data[i] = __ldg(&ptr->data[i]);
+	}
+	return f;
+}
+
+template <typename T>
+__device__ inline T shfl_up_feature(uint32_t mask, T x, unsigned int delta, int width)
+{
+	return SHFL_UP_FEATURE(mask, x, delta, width);
+}
+
+template <int WORDS>
+__device__ inline census_words<WORDS> shfl_up_feature(uint32_t mask, census_words<WORDS> x, unsigned int delta, int width)
+{
+#pragma unroll
+	for (int i = 0; i < WORDS; ++i) {
+		x.data[i] = SHFL_UP_FEATURE(mask, x.data[i], delta, width);
+	}
+	return x;
+}
+
+template <typename T>
+__device__ inline T shfl_down_feature(uint32_t mask, T x, unsigned int delta, int width)
+{
+	return SHFL_DOWN_FEATURE(mask, x, delta, width);
+}
+
+template <int WORDS>
+__device__ inline census_words<WORDS> shfl_down_feature(uint32_t mask, census_words<WORDS> x, unsigned int delta, int width)
+{
+#pragma unroll
+	for (int i = 0; i < WORDS; ++i) {
+		x.data[i] = SHFL_DOWN_FEATURE(mask, x.data[i], delta, width);
+	}
+	return x;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// census definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+* Compares the center with every pixel which shares neither its row nor its column.
+* Descriptors are computed from an accessor which returns the pixel at (dx, dy) relative to the center.
+*/
+template <int W, int H>
+struct CensusTransform
+{
+	static_assert(W % 2 == 1 && H % 2 == 1, "window size must be odd");
+
+	static constexpr int WINDOW_WIDTH = W;
+	static constexpr int WINDOW_HEIGHT = H;
+	static constexpr int BITS = (W - 1) * (H - 1);
+
+	using feature_type = typename feature_of_bits<BITS>::type;
+
+	template <typename Accessor>
+	static __device__ inline feature_type compute(const Accessor& pixel)
+	{
+		const int half_kw = WINDOW_WIDTH / 2;
+		const int half_kh = WINDOW_HEIGHT / 2;
+
+		const auto a = pixel(0, 0);
+		FeatureBuilder<feature_type> builder;
+#pragma unroll
+		for (int dy = -half_kh; dy <= half_kh; ++dy) {
+#pragma unroll
+			for (int dx = -half_kw; dx <= half_kw; ++dx) {
+				if (dx != 0 && dy != 0) {
+					builder.push(a > pixel(dx, dy));
+				}
+			}
+		}
+		return builder.f;
+	}
+};
+
+/**
+* Compares pixel pairs which are point symmetric about the center.
+*/
+template <int W, int H>
+struct SymmetricCensusTransform
+{
+	static_assert(W % 2 == 1 && H % 2 == 1, "window size must be odd");
+
+	static constexpr int WINDOW_WIDTH = W;
+	static constexpr int WINDOW_HEIGHT = H;
+	static constexpr int BITS = (H / 2) * W + W / 2;
+
+	using feature_type = typename feature_of_bits<BITS>::type;
+
+	template <typename Accessor>
+	static __device__ inline feature_type compute(const Accessor& pixel)
+	{
+		const int half_kw = WINDOW_WIDTH / 2;
+		const int half_kh = WINDOW_HEIGHT / 2;
+
+		FeatureBuilder<feature_type> builder;
+#pragma unroll
+		for (int dy = -half_kh; dy < 0; ++dy) {
+#pragma unroll
+			for (int dx = -half_kw; dx <= half_kw; ++dx) {
+				builder.push(pixel(dx, dy) > pixel(-dx, -dy));
+			}
+		}
+#pragma unroll
+		for (int dx = -half_kw; dx < 0; ++dx) {
+			builder.push(pixel(dx, 0) > pixel(-dx, 0));
+		}
+		return builder.f;
+	}
+};
+
+/**
+* One comparison of a census pattern, pixel(X0, Y0) > pixel(X1, Y1).
+*/
+template <int X0, int Y0, int X1, int Y1>
+struct ComparePair
+{
+	static constexpr int RADIUS_X = (X0 < 0 ? -X0 : X0) > (X1 < 0 ? -X1 : X1) ? (X0 < 0 ? -X0 : X0) : (X1 < 0 ? -X1 : X1);
+	static constexpr int RADIUS_Y = (Y0 < 0 ? -Y0 : Y0) > (Y1 < 0 ? -Y1 : Y1) ? (Y0 < 0 ? -Y0 : Y0) : (Y1 < 0 ? -Y1 : Y1);
+
+	template <typename Builder, typename Accessor>
+	static __device__ inline void apply(Builder& builder, const Accessor& pixel)
+	{
+		builder.push(pixel(X0, Y0) > pixel(X1, Y1));
+	}
+};
+
+template <typename... PAIRS>
+struct ComparePairList;
+
+template <>
+struct ComparePairList<>
+{
+	static constexpr int RADIUS_X = 0;
+	static constexpr int RADIUS_Y = 0;
+
+	template <typename Builder, typename Accessor>
+	static __device__ inline void apply(Builder&, const Accessor&) {}
+};
+
+template <typename PAIR, typename... REST>
+struct ComparePairList<PAIR, REST...>
+{
+	using rest = ComparePairList<REST...>;
+
+	static constexpr int RADIUS_X = PAIR::RADIUS_X > rest::RADIUS_X ? PAIR::RADIUS_X : rest::RADIUS_X;
+	static constexpr int RADIUS_Y = PAIR::RADIUS_Y > rest::RADIUS_Y ? PAIR::RADIUS_Y : rest::RADIUS_Y;
+
+	template <typename Builder, typename Accessor>
+	static __device__ inline void apply(Builder& builder, const Accessor& pixel)
+	{
+		PAIR::apply(builder, pixel);
+		rest::apply(builder, pixel);
+	}
+};
+
+/**
+* Compares a fixed list of pixel pairs, the first pair goes to the most significant bit.
+* The window is the smallest odd rectangle which covers every offset of the list.
+*/
+template <typename... PAIRS>
+struct PatternCensusTransform
+{
+	using pattern = ComparePairList<PAIRS...>;
+
+	static constexpr int WINDOW_WIDTH = 2 * pattern::RADIUS_X + 1;
+	static constexpr int WINDOW_HEIGHT = 2 * pattern::RADIUS_Y + 1;
+	static constexpr int BITS = sizeof...(PAIRS);
+
+	using feature_type = typename feature_of_bits<BITS>::type;
+
+	template <typename Accessor>
+	static __device__ inline feature_type compute(const Accessor& pixel)
+	{
+		FeatureBuilder<feature_type> builder;
+		pattern::apply(builder, pixel);
+		return builder.f;
+	}
+};
+
+/**
+* Every other pixel of a 13x11 window compared with its point symmetric counterpart.
+* 21 pairs, so the descriptor stays a single 32-bit word.
+*/
+using SparseCensus13x11Pattern = PatternCensusTransform<
+	ComparePair<-6, -5, 6, 5>, ComparePair<-4, -5, 4, 5>, ComparePair<-2, -5, 2, 5>, ComparePair<0, -5, 0, 5>,
+	ComparePair<2, -5, -2, 5>, ComparePair<4, -5, -4, 5>, ComparePair<6, -5, -6, 5>,
+	ComparePair<-6, -3, 6, 3>, ComparePair<-4, -3, 4, 3>, ComparePair<-2, -3, 2, 3>, ComparePair<0, -3, 0, 3>,
+	ComparePair<2, -3, -2, 3>, ComparePair<4, -3, -4, 3>, ComparePair<6, -3, -6, 3>,
+	ComparePair<-6, -1, 6, 1>, ComparePair<-4, -1, 4, 1>, ComparePair<-2, -1, 2, 1>, ComparePair<0, -1, 0, 1>,
+	ComparePair<2, -1, -2, 1>, ComparePair<4, -1, -4, 1>, ComparePair<6, -1, -6, 1>
+>;
+
+template <CensusType TYPE>
+struct Census;
+
+template <> struct Census<CensusType::CENSUS_9x7> : CensusTransform<9, 7> {};
+template <> struct Census<CensusType::SYMMETRIC_CENSUS_9x7> : SymmetricCensusTransform<9, 7> {};
+template <> struct Census<CensusType::CENSUS_5x5> : CensusTransform<5, 5> {};
+template <> struct Census<CensusType::CENSUS_11x9> : CensusTransform<11, 9> {};
+template <> struct Census<CensusType::CENSUS_13x11> : CensusTransform<13, 11> {};
+template <> struct Census<CensusType::SPARSE_CENSUS_13x11> : SparseCensus13x11Pattern {};
+
+} // namespace sgm
+
+#endif // !__CENSUS_UTILITY_H__
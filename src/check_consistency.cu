@@ -19,66 +19,115 @@ limitations under the License.
 #include <cuda_runtime.h>
 
 #include "constants.h"
+#include "device_utility.h"
+#include "pixel_loader.h"
 #include "host_utility.h"
 
 namespace
 {
 
-template<typename SRC_T, typename DST_T>
-__global__ void check_consistency_kernel(DST_T* dispL, const DST_T* dispR, const SRC_T* srcL, int width, int height, int src_pitch, int dst_pitch, bool subpixel, int LR_max_diff)
+template<typename PIXEL_LOADER, typename DST_T>
+__global__ void check_consistency_kernel(DST_T* dispL, const DST_T* dispR, PIXEL_LOADER srcL, int width, int height, int dst_pitch, bool subpixel, int LR_max_diff,
+	bool vertical, sgm::MaskBits valid, uint32_t* lr_rejections)
 {
 	const int x = blockIdx.x * blockDim.x + threadIdx.x;
 	const int y = blockIdx.y * blockDim.y + threadIdx.y;
 	if (x >= width || y >= height)
 		return;
 
+	if (!valid(x, y)) {
+		// pixel outside the validity mask, written without any computation
+		dispL[y * dst_pitch + x] = static_cast<DST_T>(sgm::INVALID_DISP);
+		return;
+	}
+
 	// left-right consistency check, only on leftDisp, but could be done for rightDisp too
 
-	SRC_T mask = srcL[y * src_pitch + x];
+	const auto mask = srcL(x, y);
 	DST_T org = dispL[y * dst_pitch + x];
 	int d = org;
 	if (subpixel) {
 		d >>= sgm::StereoSGM::SUBPIXEL_SHIFT;
 	}
-	const int k = x - d;
-	if (mask == 0 || org == sgm::INVALID_DISP || (k >= 0 && k < width && LR_max_diff >= 0 && abs(dispR[y * dst_pitch + k] - d) > LR_max_diff)) {
+	// matching pixel is searched along the row, or along the column for vertical epipolar lines
+	const int k = (vertical ? y : x) - d;
+	const int k_max = vertical ? height : width;
+	const int r = vertical ? k * dst_pitch + x : y * dst_pitch + k;
+	const bool inconsistent = mask != 0 && org != sgm::INVALID_DISP && k >= 0 && k < k_max && LR_max_diff >= 0 && abs(dispR[r] - d) > LR_max_diff;
+	if (mask == 0 || inconsistent) {
 		// masked or left-right inconsistent pixel -> invalid
 		dispL[y * dst_pitch + x] = static_cast<DST_T>(sgm::INVALID_DISP);
 	}
+
+	if (lr_rejections) {
+		// one atomic per warp, lanes which returned early do not take part
+#if CUDA_VERSION >= 9000
+		const unsigned active = __activemask();
+		const unsigned votes = __ballot_sync(active, inconsistent);
+#else
+		const unsigned active = __ballot(1);
+		const unsigned votes = __ballot(inconsistent);
+#endif
+		const int lane = (threadIdx.y * blockDim.x + threadIdx.x) % sgm::WARP_SIZE;
+		if (lane == __ffs(active) - 1 && votes)
+			atomicAdd(lr_rejections, static_cast<uint32_t>(__popc(votes)));
+	}
 }
 
 } // namespace
 
 namespace sgm
 {
+
+struct CheckConsistencyLauncher
+{
+	DeviceImage& dispL;
+	const DeviceImage& dispR;
+	bool subpixel;
+	int LR_max_diff;
+	bool vertical;
+	const DeviceImage& mask;
+	uint32_t* lr_rejections;
+
+	template <typename PIXEL_LOADER>
+	void operator()(const PIXEL_LOADER& srcL) const
+	{
+		const int w = dispL.cols;
+		const int h = dispL.rows;
+
+		const dim3 block(16, 16);
+		const dim3 grid(divUp(w, block.x), divUp(h, block.y));
+
+		check_consistency_kernel<<<grid, block>>>(dispL.ptr<uint16_t>(), dispR.ptr<uint16_t>(),
+			srcL, w, h, dispL.step, subpixel, LR_max_diff, vertical,
+			MaskBits{ mask.ptr<uint32_t>(), mask.step }, lr_rejections);
+	}
+};
+
 namespace details
 {
 
 void check_consistency(DeviceImage& dispL, const DeviceImage& dispR, const DeviceImage& srcL, bool subpixel, int LR_max_diff)
 {
-	SGM_ASSERT(dispL.type == SGM_16U && dispR.type == SGM_16U, "");
+	check_consistency(dispL, dispR, srcL, subpixel, LR_max_diff, InputFormat::GRAY);
+}
 
-	const int w = srcL.cols;
-	const int h = srcL.rows;
+void check_consistency(DeviceImage& dispL, const DeviceImage& dispR, const DeviceImage& srcL, bool subpixel, int LR_max_diff,
+	InputFormat format)
+{
+	check_consistency(dispL, dispR, srcL, subpixel, LR_max_diff, format, DeviceImage(), DeviceImage(), EpipolarDirection::HORIZONTAL,
+		DeviceImage(), FrameCounters());
+}
 
-	const dim3 block(16, 16);
-	const dim3 grid(divUp(w, block.x), divUp(h, block.y));
+void check_consistency(DeviceImage& dispL, const DeviceImage& dispR, const DeviceImage& srcL, bool subpixel, int LR_max_diff,
+	InputFormat format, const DeviceImage& map_xy, const DeviceImage& map_frac, EpipolarDirection direction,
+	const DeviceImage& mask, const FrameCounters& counters)
+{
+	SGM_ASSERT(dispL.type == SGM_16U && dispR.type == SGM_16U, "");
+	SGM_ASSERT(mask.data == nullptr || mask.rows == dispL.rows, "mask size must be same as image size.");
 
-	if (srcL.type == SGM_8U) {
-		using SRC_T = uint8_t;
-		check_consistency_kernel<SRC_T><<<grid, block>>>(dispL.ptr<uint16_t>(), dispR.ptr<uint16_t>(),
-			srcL.ptr<SRC_T>(), w, h, srcL.step, dispL.step, subpixel, LR_max_diff);
-	}
-	else if (srcL.type == SGM_16U) {
-		using SRC_T = uint16_t;
-		check_consistency_kernel<SRC_T><<<grid, block>>>(dispL.ptr<uint16_t>(), dispR.ptr<uint16_t>(),
-			srcL.ptr<SRC_T>(), w, h, srcL.step, dispL.step, subpixel, LR_max_diff);
-	}
-	else {
-		using SRC_T = uint32_t;
-		check_consistency_kernel<SRC_T><<<grid, block>>>(dispL.ptr<uint16_t>(), dispR.ptr<uint16_t>(),
-			srcL.ptr<SRC_T>(), w, h, srcL.step, dispL.step, subpixel, LR_max_diff);
-	}
+	dispatch_pixel_loader(srcL, format, map_xy, map_frac, CheckConsistencyLauncher{ dispL, dispR, subpixel, LR_max_diff,
+		direction == EpipolarDirection::VERTICAL, mask, counters.lr_rejections });
 
 	CUDA_CHECK(cudaGetLastError());
 }
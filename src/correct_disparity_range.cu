@@ -16,6 +16,7 @@ limitations under the License.
 
 #include "internal.h"
 
+#include <cuda.h>
 #include <cuda_runtime.h>
 
 #include "constants.h"
@@ -24,16 +25,61 @@ limitations under the License.
 namespace
 {
 
-__global__ void correct_disparity_range_kernel(uint16_t* d_disp, int width, int height, int pitch, int min_disp_scaled, int invalid_disp_scaled)
+// each warp covers 32 pixels of a row, so a warp vote gives one word of the validity mask
+__global__ void correct_disparity_range_kernel(uint16_t* d_disp, int width, int height, int pitch, int min_disp_scaled, int invalid_disp_scaled,
+	uint32_t* valid_bits, uint32_t* valid_rows, int valid_pitch, int disp_shift, uint32_t* histogram, uint32_t* invalid_pixels)
 {
+	__shared__ uint32_t smem_histogram[sgm::details::FRAME_HISTOGRAM_BINS];
+
 	const int x = blockIdx.x * blockDim.x + threadIdx.x;
 	const int y = blockIdx.y * blockDim.y + threadIdx.y;
+	const int tid = threadIdx.y * blockDim.x + threadIdx.x;
+	const int num_threads = blockDim.x * blockDim.y;
+
+	// the block reduces the histogram in shared memory, so every thread has to reach the barriers below
+	if (histogram) {
+		for (int i = tid; i < sgm::details::FRAME_HISTOGRAM_BINS; i += num_threads)
+			smem_histogram[i] = 0;
+		__syncthreads();
+	}
+
+	const bool inside = x < width && y < height;
+	uint16_t d = inside ? d_disp[y * pitch + x] : sgm::INVALID_DISP;
+
+	if (valid_bits && y < height) {
+#if CUDA_VERSION >= 9000
+		const uint32_t word = __ballot_sync(0xffffffffu, d != sgm::INVALID_DISP);
+#else
+		const uint32_t word = __ballot(d != sgm::INVALID_DISP);
+#endif
+		if (threadIdx.x == 0) {
+			valid_bits[y * valid_pitch + x / 32] = word;
+			if (word) {
+				atomicAdd(&valid_rows[y], static_cast<uint32_t>(__popc(word)));
+			}
+		}
+	}
 
-	if (x >= width || y >= height) {
+	if (histogram) {
+		if (d != sgm::INVALID_DISP)
+			atomicAdd(&smem_histogram[min(d >> disp_shift, sgm::details::FRAME_HISTOGRAM_BINS - 1)], 1u);
+#if CUDA_VERSION >= 9000
+		const uint32_t invalid = __ballot_sync(0xffffffffu, inside && d == sgm::INVALID_DISP);
+#else
+		const uint32_t invalid = __ballot(inside && d == sgm::INVALID_DISP);
+#endif
+		if (threadIdx.x == 0 && invalid)
+			atomicAdd(invalid_pixels, static_cast<uint32_t>(__popc(invalid)));
+		__syncthreads();
+		for (int i = tid; i < sgm::details::FRAME_HISTOGRAM_BINS; i += num_threads)
+			if (smem_histogram[i])
+				atomicAdd(&histogram[i], smem_histogram[i]);
+	}
+
+	if (!inside) {
 		return;
 	}
 
-	uint16_t d = d_disp[y * pitch + x];
 	if (d == sgm::INVALID_DISP) {
 		d = invalid_disp_scaled;
 	} else {
@@ -49,25 +95,55 @@ namespace sgm
 namespace details
 {
 
-void correct_disparity_range(DeviceImage& disp, bool subpixel, int min_disp)
+static void correct_disparity_range_(DeviceImage& disp, bool subpixel, int min_disp, uint32_t* valid_bits, uint32_t* valid_rows, int valid_pitch,
+	const FrameCounters& counters)
 {
-	if (!subpixel && min_disp == 0) {
-		return;
-	}
+	// the histogram and the invalid count are accumulated together
+	SGM_ASSERT((counters.histogram == nullptr) == (counters.invalid_pixels == nullptr), "histogram and invalid count must be given together.");
 
 	const int w = disp.cols;
 	const int h = disp.rows;
-	constexpr int SIZE = 16;
-	const dim3 blocks(divUp(w, SIZE), divUp(h, SIZE));
-	const dim3 threads(SIZE, SIZE);
+	const dim3 blocks(divUp(w, 32), divUp(h, 8));
+	const dim3 threads(32, 8);
 
 	const int scale = subpixel ? StereoSGM::SUBPIXEL_SCALE : 1;
 	const int     min_disp_scaled =  min_disp      * scale;
 	const int invalid_disp_scaled = (min_disp - 1) * scale;
 
-	correct_disparity_range_kernel<<<blocks, threads>>>(disp.ptr<uint16_t>(), w, h, disp.step, min_disp_scaled, invalid_disp_scaled);
+	correct_disparity_range_kernel<<<blocks, threads>>>(disp.ptr<uint16_t>(), w, h, disp.step, min_disp_scaled, invalid_disp_scaled,
+		valid_bits, valid_rows, valid_pitch, subpixel ? StereoSGM::SUBPIXEL_SHIFT : 0, counters.histogram, counters.invalid_pixels);
 	CUDA_CHECK(cudaGetLastError());
 }
 
+void correct_disparity_range(DeviceImage& disp, bool subpixel, int min_disp)
+{
+	if (!subpixel && min_disp == 0) {
+		return;
+	}
+
+	correct_disparity_range_(disp, subpixel, min_disp, nullptr, nullptr, 0, FrameCounters());
+}
+
+void correct_disparity_range(DeviceImage& disp, bool subpixel, int min_disp, DeviceImage& valid_bits, DeviceImage& valid_rows)
+{
+	correct_disparity_range(disp, subpixel, min_disp, &valid_bits, &valid_rows, FrameCounters());
+}
+
+void correct_disparity_range(DeviceImage& disp, bool subpixel, int min_disp, DeviceImage* valid_bits, DeviceImage* valid_rows,
+	const FrameCounters& counters)
+{
+	SGM_ASSERT((valid_bits == nullptr) == (valid_rows == nullptr), "validity mask and row counts must be given together.");
+
+	if (valid_bits) {
+		// packed one bit per pixel, bit (x % 32) of word (x / 32)
+		valid_bits->create(disp.rows, divUp(disp.cols, 32), SGM_32U);
+		valid_rows->create(1, disp.rows, SGM_32U);
+		valid_rows->fill_zero();
+	}
+
+	correct_disparity_range_(disp, subpixel, min_disp, valid_bits ? valid_bits->ptr<uint32_t>() : nullptr,
+		valid_rows ? valid_rows->ptr<uint32_t>() : nullptr, valid_bits ? valid_bits->step : 0, counters);
+}
+
 } // namespace details
 } // namespace sgm
@@ -19,7 +19,10 @@ limitations under the License.
 #include <cuda_runtime.h>
 
 #include "device_utility.h"
+#include "census_utility.h"
+#include "pixel_loader.h"
 #include "host_utility.h"
+#include "profiler.h"
 
 #if CUDA_VERSION >= 9000
 #define SHFL_UP(mask, var, delta, w) __shfl_up_sync((mask), (var), (delta), (w))
@@ -37,10 +40,6 @@ using COST_TYPE = cost_type;
 namespace cost_aggregation
 {
 
-template <typename T> __device__ inline int popcnt(T x) { return 0; }
-template <> __device__ inline int popcnt(uint32_t x) { return __popc(x); }
-template <> __device__ inline int popcnt(uint64_t x) { return __popcll(x); }
-
 template <unsigned int DP_BLOCK_SIZE, unsigned int SUBGROUP_SIZE>
 struct DynamicProgramming
 {
@@ -55,6 +54,13 @@ struct DynamicProgramming
 		for (unsigned int i = 0; i < DP_BLOCK_SIZE; ++i) { dp[i] = 0; }
 	}
 
+	// starts a new path, used where the path crosses masked pixels
+	__device__ void reset()
+	{
+		last_min = 0;
+		for (unsigned int i = 0; i < DP_BLOCK_SIZE; ++i) { dp[i] = 0; }
+	}
+
 	__device__ void update(uint32_t *local_costs, uint32_t p1, uint32_t p2, uint32_t mask)
 	{
 		const unsigned int lane_id = threadIdx.x % SUBGROUP_SIZE;
@@ -100,29 +106,123 @@ __device__ unsigned int generate_mask()
 	return static_cast<unsigned int>((1ull << SIZE) - 1u);
 }
 
-template <typename CENSUS_T>
-__device__ inline CENSUS_T load_census_with_check(const CENSUS_T* ptr, int x, int w)
+// Costs stored for masked pixels, so that they never win a match for the right image.
+template <unsigned int DP_BLOCK_SIZE>
+__device__ inline void store_masked_costs(uint8_t *dest)
 {
-	return x >= 0 && x < w ? __ldg(ptr + x) : 0;
+	uint32_t costs[DP_BLOCK_SIZE];
+	for (unsigned int i = 0; i < DP_BLOCK_SIZE; ++i) { costs[i] = 0xffu; }
+	store_uint8_vector<DP_BLOCK_SIZE>(dest, costs);
 }
 
+// Reads features from a census image computed in advance.
+template <typename CENSUS_T>
+struct CensusImage
+{
+	using feature_type = CENSUS_T;
+
+	const CENSUS_T* data;
+	int width;
+	MaskBits mask;
+
+	__device__ inline feature_type load(int x, int y) const
+	{
+		return load_feature(&data[x + y * width]);
+	}
+
+	__device__ inline bool is_valid(int x, int y) const
+	{
+		return mask(x, y);
+	}
+
+	__device__ inline feature_type load_with_check(int x, int y) const
+	{
+		return x >= 0 && x < width ? load(x, y) : feature_type();
+	}
+};
+
+// Reads a census image computed in advance with rows and columns swapped,
+// so that paths and disparities run along the columns of the image.
+// Neighboring positions of a scanline are a column stride apart, so paths along the scanlines, whose warps cover
+// neighboring scanlines, stay coalesced, while vertical and oblique paths, whose warps cover neighboring positions,
+// do not. This trades bandwidth for not transposing the images, its cost is measured by BM_CostAggregation.
+template <typename CENSUS_T>
+struct TransposedCensusImage
+{
+	using feature_type = CENSUS_T;
+
+	const CENSUS_T* data;
+	int width;  // width of the transposed image, i.e. height of the census image
+	int pitch;  // width of the census image
+	MaskBits mask;
+
+	__device__ inline feature_type load(int x, int y) const
+	{
+		return load_feature(&data[y + x * pitch]);
+	}
+
+	__device__ inline bool is_valid(int x, int y) const
+	{
+		return mask(y, x);
+	}
+
+	__device__ inline feature_type load_with_check(int x, int y) const
+	{
+		return x >= 0 && x < width ? load(x, y) : feature_type();
+	}
+};
+
+// Computes features from source pixels as they are consumed, so no census image is materialized.
+// Neighboring paths share the source rows through the read-only data cache.
+template <CensusType TYPE, typename PIXEL_LOADER>
+struct FusedCensus
+{
+	using feature_type = typename Census<TYPE>::feature_type;
+
+	PIXEL_LOADER src;
+	int width;
+	int height;
+
+	__device__ inline feature_type load(int x, int y) const
+	{
+		const int half_kw = Census<TYPE>::WINDOW_WIDTH / 2;
+		const int half_kh = Census<TYPE>::WINDOW_HEIGHT / 2;
+		if (x < half_kw || x >= width - half_kw || y < half_kh || y >= height - half_kh) {
+			return feature_type();
+		}
+		return Census<TYPE>::compute(LoaderPixelAccessor<PIXEL_LOADER>(src, x, y));
+	}
+
+	__device__ inline feature_type load_with_check(int x, int y) const
+	{
+		return load(x, y);
+	}
+
+	__device__ inline bool is_valid(int, int) const
+	{
+		return true;
+	}
+};
+
 namespace vertical
 {
 
 static constexpr unsigned int DP_BLOCK_SIZE = 16u;
 static constexpr unsigned int BLOCK_SIZE = WARP_SIZE * 8u;
 
-template <typename CENSUS_TYPE, int DIRECTION, unsigned int MAX_DISPARITY>
+template <typename CENSUS_SOURCE, int DIRECTION, unsigned int MAX_DISPARITY>
 __global__ void aggregate_vertical_path_kernel(
 	uint8_t *dest,
-	const CENSUS_TYPE *left,
-	const CENSUS_TYPE *right,
+	const CENSUS_SOURCE left,
+	const CENSUS_SOURCE right,
 	int width,
 	int height,
 	unsigned int p1,
 	unsigned int p2,
 	int min_disp)
 {
+	using CENSUS_TYPE = typename CENSUS_SOURCE::feature_type;
+
 	static const unsigned int SUBGROUP_SIZE = MAX_DISPARITY / DP_BLOCK_SIZE;
 	static const unsigned int PATHS_PER_WARP = WARP_SIZE / SUBGROUP_SIZE;
 	static const unsigned int PATHS_PER_BLOCK = BLOCK_SIZE / SUBGROUP_SIZE;
@@ -160,15 +260,16 @@ __global__ void aggregate_vertical_path_kernel(
 		const unsigned int y = (DIRECTION > 0 ? iter : height - 1 - iter);
 		// Load left to register
 		CENSUS_TYPE left_value;
-		if (x < width) {
-			left_value = left[x + y * width];
+		const bool valid = x < width && left.is_valid(x, y);
+		if (valid) {
+			left_value = left.load(x, y);
 		}
 		// Load right to smem
 		for (unsigned int i0 = 0; i0 < RIGHT_BUFFER_SIZE; i0 += BLOCK_SIZE) {
 			const unsigned int i = i0 + threadIdx.x;
 			if (i < RIGHT_BUFFER_SIZE) {
 				const int right_x = static_cast<int>(right_x0 + PATHS_PER_BLOCK - 1 - i - min_disp);
-				const CENSUS_TYPE right_value = load_census_with_check(&right[y * width], right_x, width);
+				const CENSUS_TYPE right_value = right.load_with_check(right_x, y);
 				const unsigned int lo = i % DP_BLOCK_SIZE;
 				const unsigned int hi = i / DP_BLOCK_SIZE;
 				right_buffer[lo][hi] = right_value;
@@ -179,14 +280,20 @@ __global__ void aggregate_vertical_path_kernel(
 		}
 		__syncthreads();
 		// Compute
-		if (x < width) {
+		if (x < width && !valid) {
+			// masked pixel, the path restarts after it
+			dp.reset();
+			store_masked_costs<DP_BLOCK_SIZE>(
+				&dest[dp_offset + x * MAX_DISPARITY + y * MAX_DISPARITY * width]);
+		}
+		else if (x < width) {
 			CENSUS_TYPE right_values[DP_BLOCK_SIZE];
 			for (unsigned int j = 0; j < DP_BLOCK_SIZE; ++j) {
 				right_values[j] = right_buffer[right0_addr_lo + j][right0_addr_hi];
 			}
 			uint32_t local_costs[DP_BLOCK_SIZE];
 			for (unsigned int j = 0; j < DP_BLOCK_SIZE; ++j) {
-				local_costs[j] = popcnt(left_value ^ right_values[j]);
+				local_costs[j] = hamming_distance(left_value, right_values[j]);
 			}
 			dp.update(local_costs, p1, p2, shfl_mask);
 			store_uint8_vector<DP_BLOCK_SIZE>(
@@ -197,11 +304,11 @@ __global__ void aggregate_vertical_path_kernel(
 	}
 }
 
-template <typename CENSUS_TYPE, unsigned int MAX_DISPARITY>
+template <typename CENSUS_SOURCE, unsigned int MAX_DISPARITY>
 void aggregate_up2down(
 	COST_TYPE *dest,
-	const CENSUS_TYPE *left,
-	const CENSUS_TYPE *right,
+	const CENSUS_SOURCE& left,
+	const CENSUS_SOURCE& right,
 	int width,
 	int height,
 	unsigned int p1,
@@ -214,16 +321,16 @@ void aggregate_up2down(
 
 	const int gdim = (width + PATHS_PER_BLOCK - 1) / PATHS_PER_BLOCK;
 	const int bdim = BLOCK_SIZE;
-	aggregate_vertical_path_kernel<CENSUS_TYPE, 1, MAX_DISPARITY><<<gdim, bdim, 0, stream>>>(
+	aggregate_vertical_path_kernel<CENSUS_SOURCE, 1, MAX_DISPARITY><<<gdim, bdim, 0, stream>>>(
 		dest, left, right, width, height, p1, p2, min_disp);
 	CUDA_CHECK(cudaGetLastError());
 }
 
-template <typename CENSUS_TYPE, unsigned int MAX_DISPARITY>
+template <typename CENSUS_SOURCE, unsigned int MAX_DISPARITY>
 void aggregate_down2up(
 	COST_TYPE *dest,
-	const CENSUS_TYPE *left,
-	const CENSUS_TYPE *right,
+	const CENSUS_SOURCE& left,
+	const CENSUS_SOURCE& right,
 	int width,
 	int height,
 	unsigned int p1,
@@ -236,7 +343,7 @@ void aggregate_down2up(
 
 	const int gdim = (width + PATHS_PER_BLOCK - 1) / PATHS_PER_BLOCK;
 	const int bdim = BLOCK_SIZE;
-	aggregate_vertical_path_kernel<CENSUS_TYPE, -1, MAX_DISPARITY><<<gdim, bdim, 0, stream>>>(
+	aggregate_vertical_path_kernel<CENSUS_SOURCE, -1, MAX_DISPARITY><<<gdim, bdim, 0, stream>>>(
 		dest, left, right, width, height, p1, p2, min_disp);
 	CUDA_CHECK(cudaGetLastError());
 }
@@ -252,17 +359,19 @@ static constexpr unsigned int DP_BLOCKS_PER_THREAD = 1u;
 static constexpr unsigned int WARPS_PER_BLOCK = 4u;
 static constexpr unsigned int BLOCK_SIZE = WARP_SIZE * WARPS_PER_BLOCK;
 
-template <typename CENSUS_TYPE, int DIRECTION, unsigned int MAX_DISPARITY>
+template <typename CENSUS_SOURCE, int DIRECTION, unsigned int MAX_DISPARITY>
 __global__ void aggregate_horizontal_path_kernel(
 	uint8_t *dest,
-	const CENSUS_TYPE *left,
-	const CENSUS_TYPE *right,
+	const CENSUS_SOURCE left,
+	const CENSUS_SOURCE right,
 	int width,
 	int height,
 	unsigned int p1,
 	unsigned int p2,
 	int min_disp)
 {
+	using CENSUS_TYPE = typename CENSUS_SOURCE::feature_type;
+
 	static const unsigned int SUBGROUP_SIZE = MAX_DISPARITY / DP_BLOCK_SIZE;
 	static const unsigned int SUBGROUPS_PER_WARP = WARP_SIZE / SUBGROUP_SIZE;
 	static const unsigned int PATHS_PER_WARP =
@@ -288,11 +397,8 @@ __global__ void aggregate_horizontal_path_kernel(
 		PATHS_PER_BLOCK * blockIdx.x +
 		PATHS_PER_WARP * warp_id +
 		group_id;
-	const unsigned int feature_step = SUBGROUPS_PER_WARP * width;
 	const unsigned int dest_step = SUBGROUPS_PER_WARP * MAX_DISPARITY * width;
 	const unsigned int dp_offset = lane_id * DP_BLOCK_SIZE;
-	left += y0 * width;
-	right += y0 * width;
 	dest += y0 * MAX_DISPARITY * width;
 
 	if (y0 >= height) {
@@ -304,7 +410,7 @@ __global__ void aggregate_horizontal_path_kernel(
 		const int x0 = (DIRECTION > 0 ? -1 : width) - (min_disp + static_cast<int>(dp_offset));
 		for (int dy = 0; dy < DP_BLOCKS_PER_THREAD; ++dy)
 			for (int dx = 0; dx < DP_BLOCK_SIZE; ++dx)
-				right_buffer[dy][dx] = load_census_with_check(&right[dy * feature_step], x0 - dx, width);
+				right_buffer[dy][dx] = right.load_with_check(x0 - dx, y0 + dy * SUBGROUPS_PER_WARP);
 	}
 
 	int x0 = (DIRECTION > 0) ? 0 : static_cast<int>((width - 1) & ~(DP_BLOCK_SIZE - 1));
@@ -319,15 +425,14 @@ __global__ void aggregate_horizontal_path_kernel(
 				if (y >= height) {
 					continue;
 				}
-				const CENSUS_TYPE left_value = __ldg(&left[j * feature_step + x]);
 				if (DIRECTION > 0) {
 					const CENSUS_TYPE t = right_buffer[j][DP_BLOCK_SIZE - 1];
 					for (unsigned int k = DP_BLOCK_SIZE - 1; k > 0; --k) {
 						right_buffer[j][k] = right_buffer[j][k - 1];
 					}
-					right_buffer[j][0] = SHFL_UP(shfl_mask, t, 1, SUBGROUP_SIZE);
+					right_buffer[j][0] = shfl_up_feature(shfl_mask, t, 1, SUBGROUP_SIZE);
 					if (lane_id == 0) {
-						right_buffer[j][0] = load_census_with_check(&right[j * feature_step], x - min_disp, width);
+						right_buffer[j][0] = right.load_with_check(x - min_disp, y);
 					}
 				}
 				else {
@@ -335,14 +440,21 @@ __global__ void aggregate_horizontal_path_kernel(
 					for (unsigned int k = 1; k < DP_BLOCK_SIZE; ++k) {
 						right_buffer[j][k - 1] = right_buffer[j][k];
 					}
-					right_buffer[j][DP_BLOCK_SIZE - 1] = SHFL_DOWN(shfl_mask, t, 1, SUBGROUP_SIZE);
+					right_buffer[j][DP_BLOCK_SIZE - 1] = shfl_down_feature(shfl_mask, t, 1, SUBGROUP_SIZE);
 					if (lane_id + 1 == SUBGROUP_SIZE) {
-						right_buffer[j][DP_BLOCK_SIZE - 1] = load_census_with_check(&right[j * feature_step], x - (min_disp + dp_offset + DP_BLOCK_SIZE - 1), width);
+						right_buffer[j][DP_BLOCK_SIZE - 1] = right.load_with_check(x - (min_disp + dp_offset + DP_BLOCK_SIZE - 1), y);
 					}
 				}
+				if (!left.is_valid(x, y)) {
+					// masked pixel, the path restarts after it
+					dp[j].reset();
+					store_masked_costs<DP_BLOCK_SIZE>(&dest[j * dest_step + x * MAX_DISPARITY + dp_offset]);
+					continue;
+				}
+				const CENSUS_TYPE left_value = left.load(x, y);
 				uint32_t local_costs[DP_BLOCK_SIZE];
 				for (unsigned int k = 0; k < DP_BLOCK_SIZE; ++k) {
-					local_costs[k] = popcnt(left_value ^ right_buffer[j][k]);
+					local_costs[k] = hamming_distance(left_value, right_buffer[j][k]);
 				}
 				dp[j].update(local_costs, p1, p2, shfl_mask);
 				store_uint8_vector<DP_BLOCK_SIZE>(
@@ -355,11 +467,11 @@ __global__ void aggregate_horizontal_path_kernel(
 }
 
 
-template <typename CENSUS_TYPE, unsigned int MAX_DISPARITY>
+template <typename CENSUS_SOURCE, unsigned int MAX_DISPARITY>
 void aggregate_left2right(
 	COST_TYPE *dest,
-	const CENSUS_TYPE *left,
-	const CENSUS_TYPE *right,
+	const CENSUS_SOURCE& left,
+	const CENSUS_SOURCE& right,
 	int width,
 	int height,
 	unsigned int p1,
@@ -373,16 +485,16 @@ void aggregate_left2right(
 
 	const int gdim = (height + PATHS_PER_BLOCK - 1) / PATHS_PER_BLOCK;
 	const int bdim = BLOCK_SIZE;
-	aggregate_horizontal_path_kernel<CENSUS_TYPE, 1, MAX_DISPARITY><<<gdim, bdim, 0, stream>>>(
+	aggregate_horizontal_path_kernel<CENSUS_SOURCE, 1, MAX_DISPARITY><<<gdim, bdim, 0, stream>>>(
 		dest, left, right, width, height, p1, p2, min_disp);
 	CUDA_CHECK(cudaGetLastError());
 }
 
-template <typename CENSUS_TYPE, unsigned int MAX_DISPARITY>
+template <typename CENSUS_SOURCE, unsigned int MAX_DISPARITY>
 void aggregate_right2left(
 	COST_TYPE *dest,
-	const CENSUS_TYPE *left,
-	const CENSUS_TYPE *right,
+	const CENSUS_SOURCE& left,
+	const CENSUS_SOURCE& right,
 	int width,
 	int height,
 	unsigned int p1,
@@ -396,7 +508,7 @@ void aggregate_right2left(
 
 	const int gdim = (height + PATHS_PER_BLOCK - 1) / PATHS_PER_BLOCK;
 	const int bdim = BLOCK_SIZE;
-	aggregate_horizontal_path_kernel<CENSUS_TYPE, -1, MAX_DISPARITY><<<gdim, bdim, 0, stream>>>(
+	aggregate_horizontal_path_kernel<CENSUS_SOURCE, -1, MAX_DISPARITY><<<gdim, bdim, 0, stream>>>(
 		dest, left, right, width, height, p1, p2, min_disp);
 	CUDA_CHECK(cudaGetLastError());
 }
@@ -409,17 +521,19 @@ namespace oblique
 static constexpr unsigned int DP_BLOCK_SIZE = 16u;
 static constexpr unsigned int BLOCK_SIZE = WARP_SIZE * 8u;
 
-template <typename CENSUS_TYPE, int X_DIRECTION, int Y_DIRECTION, unsigned int MAX_DISPARITY>
+template <typename CENSUS_SOURCE, int X_DIRECTION, int Y_DIRECTION, unsigned int MAX_DISPARITY>
 __global__ void aggregate_oblique_path_kernel(
 	uint8_t *dest,
-	const CENSUS_TYPE *left,
-	const CENSUS_TYPE *right,
+	const CENSUS_SOURCE left,
+	const CENSUS_SOURCE right,
 	int width,
 	int height,
 	unsigned int p1,
 	unsigned int p2,
 	int min_disp)
 {
+	using CENSUS_TYPE = typename CENSUS_SOURCE::feature_type;
+
 	static const unsigned int SUBGROUP_SIZE = MAX_DISPARITY / DP_BLOCK_SIZE;
 	static const unsigned int PATHS_PER_WARP = WARP_SIZE / SUBGROUP_SIZE;
 	static const unsigned int PATHS_PER_BLOCK = BLOCK_SIZE / SUBGROUP_SIZE;
@@ -466,7 +580,7 @@ __global__ void aggregate_oblique_path_kernel(
 			const unsigned int i = i0 + threadIdx.x;
 			if (i < RIGHT_BUFFER_SIZE) {
 				const int right_x = static_cast<int>(right_x0 + PATHS_PER_BLOCK - 1 - i - min_disp);
-				const CENSUS_TYPE right_value = load_census_with_check(&right[y * width], right_x, width);
+				const CENSUS_TYPE right_value = right.load_with_check(right_x, y);
 				const unsigned int lo = i % DP_BLOCK_SIZE;
 				const unsigned int hi = i / DP_BLOCK_SIZE;
 				right_buffer[lo][hi] = right_value;
@@ -477,15 +591,21 @@ __global__ void aggregate_oblique_path_kernel(
 		}
 		__syncthreads();
 		// Compute
-		if (0 <= x && x < static_cast<int>(width)) {
-			const CENSUS_TYPE left_value = __ldg(&left[x + y * width]);
+		if (0 <= x && x < static_cast<int>(width) && !left.is_valid(x, y)) {
+			// masked pixel, the path restarts after it
+			dp.reset();
+			store_masked_costs<DP_BLOCK_SIZE>(
+				&dest[dp_offset + x * MAX_DISPARITY + y * MAX_DISPARITY * width]);
+		}
+		else if (0 <= x && x < static_cast<int>(width)) {
+			const CENSUS_TYPE left_value = left.load(x, y);
 			CENSUS_TYPE right_values[DP_BLOCK_SIZE];
 			for (unsigned int j = 0; j < DP_BLOCK_SIZE; ++j) {
 				right_values[j] = right_buffer[right0_addr_lo + j][right0_addr_hi];
 			}
 			uint32_t local_costs[DP_BLOCK_SIZE];
 			for (unsigned int j = 0; j < DP_BLOCK_SIZE; ++j) {
-				local_costs[j] = popcnt(left_value ^ right_values[j]);
+				local_costs[j] = hamming_distance(left_value, right_values[j]);
 			}
 			dp.update(local_costs, p1, p2, shfl_mask);
 			store_uint8_vector<DP_BLOCK_SIZE>(
@@ -497,11 +617,11 @@ __global__ void aggregate_oblique_path_kernel(
 }
 
 
-template <typename CENSUS_TYPE, unsigned int MAX_DISPARITY>
+template <typename CENSUS_SOURCE, unsigned int MAX_DISPARITY>
 void aggregate_upleft2downright(
 	COST_TYPE *dest,
-	const CENSUS_TYPE *left,
-	const CENSUS_TYPE *right,
+	const CENSUS_SOURCE& left,
+	const CENSUS_SOURCE& right,
 	int width,
 	int height,
 	unsigned int p1,
@@ -514,16 +634,16 @@ void aggregate_upleft2downright(
 
 	const int gdim = (width + height + PATHS_PER_BLOCK - 2) / PATHS_PER_BLOCK;
 	const int bdim = BLOCK_SIZE;
-	aggregate_oblique_path_kernel<CENSUS_TYPE, 1, 1, MAX_DISPARITY><<<gdim, bdim, 0, stream>>>(
+	aggregate_oblique_path_kernel<CENSUS_SOURCE, 1, 1, MAX_DISPARITY><<<gdim, bdim, 0, stream>>>(
 		dest, left, right, width, height, p1, p2, min_disp);
 	CUDA_CHECK(cudaGetLastError());
 }
 
-template <typename CENSUS_TYPE, unsigned int MAX_DISPARITY>
+template <typename CENSUS_SOURCE, unsigned int MAX_DISPARITY>
 void aggregate_upright2downleft(
 	COST_TYPE *dest,
-	const CENSUS_TYPE *left,
-	const CENSUS_TYPE *right,
+	const CENSUS_SOURCE& left,
+	const CENSUS_SOURCE& right,
 	int width,
 	int height,
 	unsigned int p1,
@@ -536,16 +656,16 @@ void aggregate_upright2downleft(
 
 	const int gdim = (width + height + PATHS_PER_BLOCK - 2) / PATHS_PER_BLOCK;
 	const int bdim = BLOCK_SIZE;
-	aggregate_oblique_path_kernel<CENSUS_TYPE, -1, 1, MAX_DISPARITY><<<gdim, bdim, 0, stream>>>(
+	aggregate_oblique_path_kernel<CENSUS_SOURCE, -1, 1, MAX_DISPARITY><<<gdim, bdim, 0, stream>>>(
 		dest, left, right, width, height, p1, p2, min_disp);
 	CUDA_CHECK(cudaGetLastError());
 }
 
-template <typename CENSUS_TYPE, unsigned int MAX_DISPARITY>
+template <typename CENSUS_SOURCE, unsigned int MAX_DISPARITY>
 void aggregate_downright2upleft(
 	COST_TYPE *dest,
-	const CENSUS_TYPE *left,
-	const CENSUS_TYPE *right,
+	const CENSUS_SOURCE& left,
+	const CENSUS_SOURCE& right,
 	int width,
 	int height,
 	unsigned int p1,
@@ -558,16 +678,16 @@ void aggregate_downright2upleft(
 
 	const int gdim = (width + height + PATHS_PER_BLOCK - 2) / PATHS_PER_BLOCK;
 	const int bdim = BLOCK_SIZE;
-	aggregate_oblique_path_kernel<CENSUS_TYPE, -1, -1, MAX_DISPARITY><<<gdim, bdim, 0, stream>>>(
+	aggregate_oblique_path_kernel<CENSUS_SOURCE, -1, -1, MAX_DISPARITY><<<gdim, bdim, 0, stream>>>(
 		dest, left, right, width, height, p1, p2, min_disp);
 	CUDA_CHECK(cudaGetLastError());
 }
 
-template <typename CENSUS_TYPE, unsigned int MAX_DISPARITY>
+template <typename CENSUS_SOURCE, unsigned int MAX_DISPARITY>
 void aggregate_downleft2upright(
 	COST_TYPE *dest,
-	const CENSUS_TYPE *left,
-	const CENSUS_TYPE *right,
+	const CENSUS_SOURCE& left,
+	const CENSUS_SOURCE& right,
 	int width,
 	int height,
 	unsigned int p1,
@@ -580,7 +700,7 @@ void aggregate_downleft2upright(
 
 	const int gdim = (width + height + PATHS_PER_BLOCK - 2) / PATHS_PER_BLOCK;
 	const int bdim = BLOCK_SIZE;
-	aggregate_oblique_path_kernel<CENSUS_TYPE, 1, -1, MAX_DISPARITY><<<gdim, bdim, 0, stream>>>(
+	aggregate_oblique_path_kernel<CENSUS_SOURCE, 1, -1, MAX_DISPARITY><<<gdim, bdim, 0, stream>>>(
 		dest, left, right, width, height, p1, p2, min_disp);
 	CUDA_CHECK(cudaGetLastError());
 }
@@ -592,75 +712,168 @@ void aggregate_downleft2upright(
 namespace details
 {
 
-template <typename CENSUS_TYPE, int MAX_DISPARITY>
-void cost_aggregation_(const DeviceImage& srcL, const DeviceImage& srcR, DeviceImage& dst,
-	int P1, int P2, PathType path_type, int min_disp)
+template <typename CENSUS_SOURCE, int MAX_DISPARITY>
+void cost_aggregation_(const CENSUS_SOURCE& left, const CENSUS_SOURCE& right, DeviceImage& dst,
+	int width, int height, int P1, int P2, PathType path_type, int min_disp)
 {
-	const int width = srcL.cols;
-	const int height = srcL.rows;
 	const int num_paths = path_type == PathType::SCAN_4PATH ? 4 : 8;
 
 	dst.create(num_paths, height * width * MAX_DISPARITY, SGM_8U);
 
-	const CENSUS_TYPE* left = srcL.ptr<CENSUS_TYPE>();
-	const CENSUS_TYPE* right = srcR.ptr<CENSUS_TYPE>();
-
 	cudaStream_t streams[8];
 	for (int i = 0; i < num_paths; i++)
 		cudaStreamCreate(&streams[i]);
 
-	cost_aggregation::vertical::aggregate_up2down<CENSUS_TYPE, MAX_DISPARITY>(
+	cost_aggregation::vertical::aggregate_up2down<CENSUS_SOURCE, MAX_DISPARITY>(
 		dst.ptr<COST_TYPE>(0), left, right, width, height, P1, P2, min_disp, streams[0]);
-	cost_aggregation::vertical::aggregate_down2up<CENSUS_TYPE, MAX_DISPARITY>(
+	SGM_PROFILE_STAGE(Stage::AGGREGATION_UP2DOWN, streams[0]);
+	cost_aggregation::vertical::aggregate_down2up<CENSUS_SOURCE, MAX_DISPARITY>(
 		dst.ptr<COST_TYPE>(1), left, right, width, height, P1, P2, min_disp, streams[1]);
-	cost_aggregation::horizontal::aggregate_left2right<CENSUS_TYPE, MAX_DISPARITY>(
+	SGM_PROFILE_STAGE(Stage::AGGREGATION_DOWN2UP, streams[1]);
+	cost_aggregation::horizontal::aggregate_left2right<CENSUS_SOURCE, MAX_DISPARITY>(
 		dst.ptr<COST_TYPE>(2), left, right, width, height, P1, P2, min_disp, streams[2]);
-	cost_aggregation::horizontal::aggregate_right2left<CENSUS_TYPE, MAX_DISPARITY>(
+	SGM_PROFILE_STAGE(Stage::AGGREGATION_LEFT2RIGHT, streams[2]);
+	cost_aggregation::horizontal::aggregate_right2left<CENSUS_SOURCE, MAX_DISPARITY>(
 		dst.ptr<COST_TYPE>(3), left, right, width, height, P1, P2, min_disp, streams[3]);
+	SGM_PROFILE_STAGE(Stage::AGGREGATION_RIGHT2LEFT, streams[3]);
 
 	if (path_type == PathType::SCAN_8PATH) {
-		cost_aggregation::oblique::aggregate_upleft2downright<CENSUS_TYPE, MAX_DISPARITY>(
+		cost_aggregation::oblique::aggregate_upleft2downright<CENSUS_SOURCE, MAX_DISPARITY>(
 			dst.ptr<COST_TYPE>(4), left, right, width, height, P1, P2, min_disp, streams[4]);
-		cost_aggregation::oblique::aggregate_upright2downleft<CENSUS_TYPE, MAX_DISPARITY>(
+		SGM_PROFILE_STAGE(Stage::AGGREGATION_UPLEFT2DOWNRIGHT, streams[4]);
+		cost_aggregation::oblique::aggregate_upright2downleft<CENSUS_SOURCE, MAX_DISPARITY>(
 			dst.ptr<COST_TYPE>(5), left, right, width, height, P1, P2, min_disp, streams[5]);
-		cost_aggregation::oblique::aggregate_downright2upleft<CENSUS_TYPE, MAX_DISPARITY>(
+		SGM_PROFILE_STAGE(Stage::AGGREGATION_UPRIGHT2DOWNLEFT, streams[5]);
+		cost_aggregation::oblique::aggregate_downright2upleft<CENSUS_SOURCE, MAX_DISPARITY>(
 			dst.ptr<COST_TYPE>(6), left, right, width, height, P1, P2, min_disp, streams[6]);
-		cost_aggregation::oblique::aggregate_downleft2upright<CENSUS_TYPE, MAX_DISPARITY>(
+		SGM_PROFILE_STAGE(Stage::AGGREGATION_DOWNRIGHT2UPLEFT, streams[6]);
+		cost_aggregation::oblique::aggregate_downleft2upright<CENSUS_SOURCE, MAX_DISPARITY>(
 			dst.ptr<COST_TYPE>(7), left, right, width, height, P1, P2, min_disp, streams[7]);
+		SGM_PROFILE_STAGE(Stage::AGGREGATION_DOWNLEFT2UPRIGHT, streams[7]);
 	}
 
 	for (int i = 0; i < num_paths; i++)
 		cudaStreamSynchronize(streams[i]);
+	SGM_PROFILE_STAGE(Stage::AGGREGATION, 0);
 	for (int i = 0; i < num_paths; i++)
 		cudaStreamDestroy(streams[i]);
 }
 
+template <typename CENSUS_SOURCE>
+void cost_aggregation_(const CENSUS_SOURCE& left, const CENSUS_SOURCE& right, DeviceImage& dst,
+	int width, int height, int disp_size, int P1, int P2, PathType path_type, int min_disp)
+{
+	if (disp_size == 64) {
+		cost_aggregation_<CENSUS_SOURCE, 64>(left, right, dst, width, height, P1, P2, path_type, min_disp);
+	}
+	else if (disp_size == 128) {
+		cost_aggregation_<CENSUS_SOURCE, 128>(left, right, dst, width, height, P1, P2, path_type, min_disp);
+	}
+	else if (disp_size == 256) {
+		cost_aggregation_<CENSUS_SOURCE, 256>(left, right, dst, width, height, P1, P2, path_type, min_disp);
+	}
+}
+
+template <typename CENSUS_TYPE>
+void cost_aggregation_(const DeviceImage& srcL, const DeviceImage& srcR, DeviceImage& dst,
+	int disp_size, int P1, int P2, PathType path_type, int min_disp, EpipolarDirection direction,
+	const DeviceImage& mask)
+{
+	const int width = srcL.cols;
+	const int height = srcL.rows;
+	const MaskBits maskL{ mask.ptr<uint32_t>(), mask.step };
+
+	if (direction == EpipolarDirection::VERTICAL) {
+		// aggregate on the transposed image, the cost volume is laid out in transposed order
+		using CENSUS_SOURCE = cost_aggregation::TransposedCensusImage<CENSUS_TYPE>;
+		const CENSUS_SOURCE left{ srcL.ptr<CENSUS_TYPE>(), height, width, maskL };
+		const CENSUS_SOURCE right{ srcR.ptr<CENSUS_TYPE>(), height, width, MaskBits{ nullptr, 0 } };
+		cost_aggregation_(left, right, dst, height, width, disp_size, P1, P2, path_type, min_disp);
+	}
+	else {
+		using CENSUS_SOURCE = cost_aggregation::CensusImage<CENSUS_TYPE>;
+		const CENSUS_SOURCE left{ srcL.ptr<CENSUS_TYPE>(), width, maskL };
+		const CENSUS_SOURCE right{ srcR.ptr<CENSUS_TYPE>(), width, MaskBits{ nullptr, 0 } };
+		cost_aggregation_(left, right, dst, width, height, disp_size, P1, P2, path_type, min_disp);
+	}
+}
+
+template <CensusType CENSUS_TYPE, typename PIXEL_TYPE>
+void fused_cost_aggregation_(const DeviceImage& srcL, const DeviceImage& srcR, DeviceImage& dst,
+	int disp_size, int P1, int P2, PathType path_type, int min_disp)
+{
+	using CENSUS_SOURCE = cost_aggregation::FusedCensus<CENSUS_TYPE, GrayLoader<PIXEL_TYPE>>;
+
+	const int width = srcL.cols;
+	const int height = srcL.rows;
+	const CENSUS_SOURCE left{ { srcL.ptr<PIXEL_TYPE>(), srcL.step }, width, height };
+	const CENSUS_SOURCE right{ { srcR.ptr<PIXEL_TYPE>(), srcR.step }, width, height };
+
+	cost_aggregation_(left, right, dst, width, height, disp_size, P1, P2, path_type, min_disp);
+}
+
+template <CensusType CENSUS_TYPE>
+void fused_cost_aggregation_(const DeviceImage& srcL, const DeviceImage& srcR, DeviceImage& dst,
+	int disp_size, int P1, int P2, PathType path_type, int min_disp)
+{
+	if (srcL.type == SGM_8U) {
+		fused_cost_aggregation_<CENSUS_TYPE, uint8_t>(srcL, srcR, dst, disp_size, P1, P2, path_type, min_disp);
+	}
+	else if (srcL.type == SGM_16U) {
+		fused_cost_aggregation_<CENSUS_TYPE, uint16_t>(srcL, srcR, dst, disp_size, P1, P2, path_type, min_disp);
+	}
+	else if (srcL.type == SGM_32U) {
+		fused_cost_aggregation_<CENSUS_TYPE, uint32_t>(srcL, srcR, dst, disp_size, P1, P2, path_type, min_disp);
+	}
+}
+
 void cost_aggregation(const DeviceImage& srcL, const DeviceImage& srcR, DeviceImage& dst,
 	int disp_size, int P1, int P2, PathType path_type, int min_disp)
+{
+	cost_aggregation(srcL, srcR, dst, disp_size, P1, P2, path_type, min_disp, EpipolarDirection::HORIZONTAL, DeviceImage());
+}
+
+void cost_aggregation(const DeviceImage& srcL, const DeviceImage& srcR, DeviceImage& dst,
+	int disp_size, int P1, int P2, PathType path_type, int min_disp, EpipolarDirection direction,
+	const DeviceImage& mask)
 {
 	SGM_ASSERT(srcL.type == srcR.type, "left and right image type must be same.");
+	SGM_ASSERT(mask.data == nullptr || mask.rows == srcL.rows, "mask size must be same as image size.");
 
 	if (srcL.type == SGM_32U) {
-		if (disp_size == 64) {
-			cost_aggregation_<uint32_t, 64>(srcL, srcR, dst, P1, P2, path_type, min_disp);
-		}
-		else if (disp_size == 128) {
-			cost_aggregation_<uint32_t, 128>(srcL, srcR, dst, P1, P2, path_type, min_disp);
-		}
-		else if (disp_size == 256) {
-			cost_aggregation_<uint32_t, 256>(srcL, srcR, dst, P1, P2, path_type, min_disp);
-		}
+		cost_aggregation_<uint32_t>(srcL, srcR, dst, disp_size, P1, P2, path_type, min_disp, direction, mask);
 	}
 	else if (srcL.type == SGM_64U) {
-		if (disp_size == 64) {
-			cost_aggregation_<uint64_t, 64>(srcL, srcR, dst, P1, P2, path_type, min_disp);
-		}
-		else if (disp_size == 128) {
-			cost_aggregation_<uint64_t, 128>(srcL, srcR, dst, P1, P2, path_type, min_disp);
-		}
-		else if (disp_size == 256) {
-			cost_aggregation_<uint64_t, 256>(srcL, srcR, dst, P1, P2, path_type, min_disp);
-		}
+		cost_aggregation_<uint64_t>(srcL, srcR, dst, disp_size, P1, P2, path_type, min_disp, direction, mask);
+	}
+	else if (srcL.type == SGM_128U) {
+		cost_aggregation_<census128_t>(srcL, srcR, dst, disp_size, P1, P2, path_type, min_disp, direction, mask);
+	}
+}
+
+void fused_cost_aggregation(const DeviceImage& srcL, const DeviceImage& srcR, DeviceImage& dst,
+	int disp_size, int P1, int P2, PathType path_type, int min_disp, CensusType census_type)
+{
+	SGM_ASSERT(srcL.type == srcR.type, "left and right image type must be same.");
+	SGM_ASSERT(srcL.rows == srcR.rows && srcL.cols == srcR.cols, "left and right image size must be same.");
+
+	if (census_type == CensusType::CENSUS_9x7) {
+		fused_cost_aggregation_<CensusType::CENSUS_9x7>(srcL, srcR, dst, disp_size, P1, P2, path_type, min_disp);
+	}
+	else if (census_type == CensusType::SYMMETRIC_CENSUS_9x7) {
+		fused_cost_aggregation_<CensusType::SYMMETRIC_CENSUS_9x7>(srcL, srcR, dst, disp_size, P1, P2, path_type, min_disp);
+	}
+	else if (census_type == CensusType::CENSUS_5x5) {
+		fused_cost_aggregation_<CensusType::CENSUS_5x5>(srcL, srcR, dst, disp_size, P1, P2, path_type, min_disp);
+	}
+	else if (census_type == CensusType::CENSUS_11x9) {
+		fused_cost_aggregation_<CensusType::CENSUS_11x9>(srcL, srcR, dst, disp_size, P1, P2, path_type, min_disp);
+	}
+	else if (census_type == CensusType::CENSUS_13x11) {
+		fused_cost_aggregation_<CensusType::CENSUS_13x11>(srcL, srcR, dst, disp_size, P1, P2, path_type, min_disp);
+	}
+	else if (census_type == CensusType::SPARSE_CENSUS_13x11) {
+		fused_cost_aggregation_<CensusType::SPARSE_CENSUS_13x11>(srcL, srcR, dst, disp_size, P1, P2, path_type, min_disp);
 	}
 }
 
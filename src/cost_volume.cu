@@ -0,0 +1,85 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "internal.h"
+
+#include <cuda_runtime.h>
+
+#include "host_utility.h"
+
+namespace
+{
+
+__global__ void sum_cost_paths_kernel(uint16_t* dst, const uint8_t* src, size_t volume_size, size_t src_pitch, int num_paths)
+{
+	const size_t i = static_cast<size_t>(blockIdx.x) * blockDim.x + threadIdx.x;
+	if (i >= volume_size)
+		return;
+
+	uint32_t sum = 0;
+	for (int p = 0; p < num_paths; p++)
+		sum += src[p * src_pitch + i];
+	dst[i] = static_cast<uint16_t>(sum);
+}
+
+// the sum is spread over the paths so that winner-takes-all adds it up exactly, e.g. 600 = 255 + 255 + 90 + 0 + ...
+__global__ void split_cost_sum_kernel(uint8_t* dst, const uint16_t* src, size_t volume_size, size_t dst_pitch, int num_paths)
+{
+	const size_t i = static_cast<size_t>(blockIdx.x) * blockDim.x + threadIdx.x;
+	if (i >= volume_size)
+		return;
+
+	int rest = src[i];
+	for (int p = 0; p < num_paths; p++) {
+		const int part = min(rest, 255);
+		dst[p * dst_pitch + i] = static_cast<uint8_t>(part);
+		rest -= part;
+	}
+}
+
+} // namespace
+
+namespace sgm
+{
+namespace details
+{
+
+void sum_cost_paths(const DeviceImage& src, DeviceImage& dst)
+{
+	SGM_ASSERT(src.type == SGM_8U, "costs of each path must be stored in bytes.");
+
+	dst.create(1, src.cols, SGM_16U);
+
+	const int block = 256;
+	const int grid = divUp(src.cols, block);
+	sum_cost_paths_kernel<<<grid, block>>>(dst.ptr<uint16_t>(), src.ptr<uint8_t>(), src.cols, src.step, src.rows);
+	CUDA_CHECK(cudaGetLastError());
+}
+
+void split_cost_sum(const DeviceImage& src, DeviceImage& dst, int num_paths)
+{
+	SGM_ASSERT(src.type == SGM_16U, "summed costs must be stored in 16 bits.");
+
+	dst.create(num_paths, src.cols, SGM_8U);
+
+	const int block = 256;
+	const int grid = divUp(src.cols, block);
+	split_cost_sum_kernel<<<grid, block>>>(dst.ptr<uint8_t>(), src.ptr<uint16_t>(), src.cols, dst.step, num_paths);
+	CUDA_CHECK(cudaGetLastError());
+}
+
+} // namespace details
+} // namespace sgm
@@ -19,6 +19,7 @@ limitations under the License.
 #include <cuda_runtime.h>
 
 #include "host_utility.h"
+#include "metrics.h"
 
 namespace sgm
 {
@@ -50,6 +51,7 @@ void* DeviceAllocator::allocate(size_t size)
 		CUDA_CHECK(cudaMalloc(&data_, size));
 		ref_count_ = new int(1);
 		capacity_ = size;
+		Metrics::instance().add_allocated(static_cast<int64_t>(size));
 	}
 	return data_;
 }
@@ -67,6 +69,7 @@ void DeviceAllocator::release()
 	{
 		CUDA_CHECK(cudaFree(data_));
 		delete ref_count_;
+		Metrics::instance().add_allocated(-static_cast<int64_t>(capacity_));
 	}
 
 	data_ = ref_count_ = nullptr;
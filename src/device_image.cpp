@@ -16,6 +16,8 @@ limitations under the License.
 
 #include "device_image.h"
 
+#include <cstdlib>
+
 #include <cuda_runtime.h>
 
 #include "host_utility.h"
@@ -33,6 +35,8 @@ static size_t elemSize(ImageType type)
 		return 4;
 	if (type == SGM_64U)
 		return 8;
+	if (type == SGM_128U)
+		return 16;
 	return 0;
 }
 
@@ -52,10 +56,10 @@ DeviceImage::DeviceImage(void* data, int rows, int cols, ImageType type, int ste
 
 void DeviceImage::create(int _rows, int _cols, ImageType _type, int _step)
 {
-	if (_step < 0)
+	if (_step == 0)
 		_step = _cols;
 
-	data = allocator_.allocate(elemSize(_type) * _rows * _step);
+	data = allocator_.allocate(elemSize(_type) * _rows * std::abs(_step));
 	rows = _rows;
 	cols = _cols;
 	step = _step;
@@ -64,10 +68,11 @@ void DeviceImage::create(int _rows, int _cols, ImageType _type, int _step)
 
 void DeviceImage::create(void* _data, int _rows, int _cols, ImageType _type, int _step)
 {
-	if (_step < 0)
+	if (_step == 0)
 		_step = _cols;
 
-	allocator_.assign(_data, elemSize(_type) * _rows * _step);
+	// step can be negative for images stored bottom up
+	allocator_.assign(_data, elemSize(_type) * _rows * std::abs(_step));
 	data = _data;
 	rows = _rows;
 	cols = _cols;
@@ -17,36 +17,35 @@ limitations under the License.
 #ifndef __DEVICE_IMAGE_H__
 #define __DEVICE_IMAGE_H__
 
+#include <cstddef>
+
+#include "libsgm.h"
 #include "device_allocator.h"
 
 namespace sgm
 {
 
-enum ImageType
-{
-	SGM_8U,
-	SGM_16U,
-	SGM_32U,
-	SGM_64U,
-};
+// census features wider than 32 bits, internal to the pipeline and not accepted as input or output
+constexpr ImageType SGM_64U = static_cast<ImageType>(3);
+constexpr ImageType SGM_128U = static_cast<ImageType>(4);
 
 class DeviceImage
 {
 public:
 
 	DeviceImage();
-	DeviceImage(int rows, int cols, ImageType type, int step = -1);
-	DeviceImage(void* data, int rows, int cols, ImageType type, int step = -1);
+	DeviceImage(int rows, int cols, ImageType type, int step = 0);
+	DeviceImage(void* data, int rows, int cols, ImageType type, int step = 0);
 
-	void create(int rows, int cols, ImageType type, int step = -1);
-	void create(void* data, int rows, int cols, ImageType type, int step = -1);
+	void create(int rows, int cols, ImageType type, int step = 0);
+	void create(void* data, int rows, int cols, ImageType type, int step = 0);
 
 	void upload(const void* data);
 	void download(void* data) const;
 	void fill_zero();
 
-	template <typename T> T* ptr(int y = 0) { return (T*)data + y * (size_t)step; }
-	template <typename T> const T* ptr(int y = 0) const { return (T*)data + y * (size_t)step; }
+	template <typename T> T* ptr(int y = 0) { return (T*)data + y * (ptrdiff_t)step; }
+	template <typename T> const T* ptr(int y = 0) const { return (T*)data + y * (ptrdiff_t)step; }
 
 	void* data;
 	int rows, cols, step;
@@ -86,6 +86,21 @@ __device__ inline bool subgroup_and(bool x, uint32_t mask)
 	return detail::subgroup_and_impl<GROUP_SIZE, GROUP_SIZE>::call(x, mask);
 }
 
+/**
+* Packed validity mask, bit (x % 32) of word (x / 32) in row y is set for valid pixels.
+* A null mask marks every pixel valid.
+*/
+struct MaskBits
+{
+	const uint32_t* bits;
+	int pitch;
+
+	__device__ inline bool operator()(int x, int y) const
+	{
+		return bits == nullptr || ((__ldg(&bits[y * pitch + (x >> 5)]) >> (x & 31)) & 1u);
+	}
+};
+
 template <typename T, typename S>
 __device__ inline T load_as(const S *p)
 {
@@ -0,0 +1,640 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <libsgm.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace sgm
+{
+
+/*
+* Stream layout, little endian:
+*   "SGMD", version (u8), depth bits (u8), invalid value (u16), width (u32), height (u32), rows per band (u32),
+*   encoded size of each band (u32), band payloads.
+*
+* Bands are coded independently. A band starts with the 4-bit code lengths of its two canonical Huffman codes,
+* one for deltas and one for lengths, followed by the codes of its rows.
+* A row alternates runs of valid and invalid pixels, the first valid run may be empty.
+* Valid pixels are coded as zigzagged deltas to the left neighbor. At the start of a run the pixel above is used
+* if valid, otherwise the last valid pixel of the band. After a zero delta, the number of following zero deltas
+* is coded as one length, as in JPEG-LS run mode, and the delta ending the run is coded minus one.
+* Small deltas are symbols of their own, larger values and lengths are coded by bit length and raw low bits.
+*/
+
+static const uint8_t CODEC_MAGIC[4] = { 'S', 'G', 'M', 'D' };
+static const uint8_t CODEC_VERSION = 1;
+static const size_t CODEC_HEADER_SIZE = 20;
+static const int BAND_ROWS = 16;
+
+static const int MAX_CODE_LENGTH = 12;
+static const int DIRECT_DELTAS = 128;
+static const int NUM_DELTA_SYMBOLS = DIRECT_DELTAS + 10; // bit lengths 8 to 17 of larger deltas
+static const int NUM_LENGTH_SYMBOLS = 33;                 // bit lengths 0 to 32
+
+namespace
+{
+
+enum Alphabet { DELTA, LENGTH, NUM_ALPHABETS };
+
+const int ALPHABET_SIZES[NUM_ALPHABETS] = { NUM_DELTA_SYMBOLS, NUM_LENGTH_SYMBOLS };
+
+inline int bit_length(uint32_t v)
+{
+	int n = 0;
+	for (; v; v >>= 1)
+		n++;
+	return n;
+}
+
+inline uint32_t zigzag(int32_t v)
+{
+	return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31);
+}
+
+inline int32_t unzigzag(uint32_t v)
+{
+	return static_cast<int32_t>(v >> 1) ^ -static_cast<int32_t>(v & 1);
+}
+
+// a value as a symbol and low bits stored raw
+struct Token
+{
+	uint8_t alphabet;
+	uint8_t extra_bits;
+	uint16_t symbol;
+	uint32_t extra;
+};
+
+inline Token delta_token(uint32_t s)
+{
+	if (s < DIRECT_DELTAS)
+		return { DELTA, 0, static_cast<uint16_t>(s), 0 };
+	const int n = bit_length(s);
+	return { DELTA, static_cast<uint8_t>(n - 1), static_cast<uint16_t>(DIRECT_DELTAS + n - 8), s & ((1u << (n - 1)) - 1) };
+}
+
+inline Token length_token(uint32_t v)
+{
+	const int n = bit_length(v);
+	return { LENGTH, static_cast<uint8_t>(n > 0 ? n - 1 : 0), static_cast<uint16_t>(n), n > 0 ? v & ((1u << (n - 1)) - 1) : 0 };
+}
+
+class BitWriter
+{
+public:
+
+	explicit BitWriter(std::vector<uint8_t>& bytes) : bytes_(bytes), acc_(0), bits_(0) {}
+
+	// n <= 32
+	void put(uint32_t value, int n)
+	{
+		acc_ = (acc_ << n) | value;
+		bits_ += n;
+		while (bits_ >= 8) {
+			bits_ -= 8;
+			bytes_.push_back(static_cast<uint8_t>(acc_ >> bits_));
+		}
+	}
+
+	void flush()
+	{
+		if (bits_ > 0)
+			put(0, 8 - bits_);
+	}
+
+private:
+
+	std::vector<uint8_t>& bytes_;
+	uint64_t acc_;
+	int bits_;
+};
+
+class BitReader
+{
+public:
+
+	BitReader(const uint8_t* data, size_t size) : ptr_(data), end_(data + size), acc_(0), bits_(0), padding_(0) {}
+
+	// n <= 32
+	uint32_t get(int n)
+	{
+		if (n == 0)
+			return 0;
+		if (bits_ < n)
+			refill();
+		const uint32_t value = static_cast<uint32_t>(acc_ >> (64 - n));
+		acc_ <<= n;
+		bits_ -= n;
+		return value;
+	}
+
+	uint32_t peek(int n)
+	{
+		if (bits_ < n)
+			refill();
+		return static_cast<uint32_t>(acc_ >> (64 - n));
+	}
+
+	void skip(int n)
+	{
+		acc_ <<= n;
+		bits_ -= n;
+	}
+
+	// true if bits beyond the end of the payload were consumed
+	bool overrun() const { return bits_ < 8 * padding_; }
+
+private:
+
+	// keeps the next bits MSB aligned in acc_, zero bytes are appended past the end
+	void refill()
+	{
+		while (bits_ <= 56) {
+			uint64_t byte = 0;
+			if (ptr_ < end_)
+				byte = *ptr_++;
+			else
+				padding_++;
+			acc_ |= byte << (56 - bits_);
+			bits_ += 8;
+		}
+	}
+
+	const uint8_t* ptr_;
+	const uint8_t* end_;
+	uint64_t acc_;
+	int bits_;
+	int padding_;
+};
+
+// Huffman code lengths limited to MAX_CODE_LENGTH by halving counts until the tree is shallow enough
+void build_code_lengths(std::vector<uint32_t> counts, std::vector<uint8_t>& lengths)
+{
+	const int n = static_cast<int>(counts.size());
+	lengths.assign(n, 0);
+
+	for (;;) {
+		using Node = std::pair<uint64_t, int>;
+		std::priority_queue<Node, std::vector<Node>, std::greater<Node>> heap;
+		std::vector<int> parent(2 * n, -1);
+		for (int i = 0; i < n; i++)
+			if (counts[i] > 0)
+				heap.push({ counts[i], i });
+
+		if (heap.empty())
+			return;
+		if (heap.size() == 1) {
+			lengths[heap.top().second] = 1;
+			return;
+		}
+
+		int next = n;
+		while (heap.size() > 1) {
+			const Node a = heap.top(); heap.pop();
+			const Node b = heap.top(); heap.pop();
+			parent[a.second] = parent[b.second] = next;
+			heap.push({ a.first + b.first, next++ });
+		}
+
+		int max_length = 0;
+		for (int i = 0; i < n; i++) {
+			int length = 0;
+			if (counts[i] > 0)
+				for (int node = i; parent[node] >= 0; node = parent[node])
+					length++;
+			lengths[i] = static_cast<uint8_t>(length);
+			max_length = std::max(max_length, length);
+		}
+		if (max_length <= MAX_CODE_LENGTH)
+			return;
+
+		for (auto& count : counts)
+			if (count > 0)
+				count = (count + 1) / 2;
+	}
+}
+
+// codes assigned in order of length then symbol
+void canonical_codes(const std::vector<uint8_t>& lengths, std::vector<uint16_t>& codes)
+{
+	codes.assign(lengths.size(), 0);
+	uint32_t code = 0;
+	for (int length = 1; length <= MAX_CODE_LENGTH; length++) {
+		for (size_t i = 0; i < lengths.size(); i++)
+			if (lengths[i] == length)
+				codes[i] = static_cast<uint16_t>(code++);
+		code <<= 1;
+	}
+}
+
+// lookup of the next MAX_CODE_LENGTH bits, entries pack symbol << 4 | length
+bool build_decode_table(const std::vector<uint8_t>& lengths, std::vector<uint16_t>& table)
+{
+	// code lengths of a malformed stream may be too long or oversubscribed, i.e. have a Kraft sum over 1
+	uint32_t kraft = 0;
+	for (uint8_t length : lengths) {
+		if (length > MAX_CODE_LENGTH)
+			return false;
+		if (length > 0)
+			kraft += 1u << (MAX_CODE_LENGTH - length);
+	}
+	if (kraft > (1u << MAX_CODE_LENGTH))
+		return false;
+
+	std::vector<uint16_t> codes;
+	canonical_codes(lengths, codes);
+	table.assign(1 << MAX_CODE_LENGTH, 0);
+	for (size_t i = 0; i < lengths.size(); i++) {
+		if (lengths[i] == 0)
+			continue;
+		const int shift = MAX_CODE_LENGTH - lengths[i];
+		const uint32_t beg = static_cast<uint32_t>(codes[i]) << shift;
+		std::fill(table.begin() + beg, table.begin() + beg + (1u << shift), static_cast<uint16_t>((i << 4) | lengths[i]));
+	}
+	return true;
+}
+
+template <typename T>
+class BandEncoder
+{
+public:
+
+	void encode(const T* disparity, int width, int pitch, int y_beg, int y_end, T invalid, std::vector<uint8_t>& bytes)
+	{
+		tokens_.clear();
+		bool last_zero = false;
+		int32_t last = 0;
+
+		for (int y = y_beg; y < y_end; y++) {
+			const T* row = disparity + static_cast<size_t>(y) * pitch;
+			const T* above = y > y_beg ? row - pitch : nullptr;
+
+			for (int x = 0; x < width; ) {
+				int n = 0;
+				while (x + n < width && row[x + n] != invalid)
+					n++;
+				tokens_.push_back(length_token(x == 0 ? n : n - 1));
+
+				int32_t pred = above && above[x] != invalid ? above[x] : last;
+				for (int i = x; i < x + n; ) {
+					if (last_zero) {
+						int z = 0;
+						while (i + z < x + n && row[i + z] == pred)
+							z++;
+						tokens_.push_back(length_token(z));
+						i += z;
+						if (i == x + n)
+							break;
+
+						// the run ends at a nonzero delta
+						tokens_.push_back(delta_token(zigzag(static_cast<int32_t>(row[i]) - pred) - 1));
+						last_zero = false;
+						pred = row[i++];
+						continue;
+					}
+
+					const uint32_t s = zigzag(static_cast<int32_t>(row[i]) - pred);
+					tokens_.push_back(delta_token(s));
+					last_zero = s == 0;
+					pred = row[i++];
+				}
+				last = pred;
+				x += n;
+				if (x == width)
+					break;
+
+				int m = 0;
+				while (x + m < width && row[x + m] == invalid)
+					m++;
+				tokens_.push_back(length_token(m - 1));
+				x += m;
+			}
+		}
+		write(bytes);
+	}
+
+private:
+
+	void write(std::vector<uint8_t>& bytes)
+	{
+		BitWriter writer(bytes);
+		std::vector<uint8_t> lengths[NUM_ALPHABETS];
+		std::vector<uint16_t> codes[NUM_ALPHABETS];
+		for (int a = 0; a < NUM_ALPHABETS; a++) {
+			std::vector<uint32_t> counts(ALPHABET_SIZES[a], 0);
+			for (const Token& token : tokens_)
+				if (token.alphabet == a)
+					counts[token.symbol]++;
+			build_code_lengths(counts, lengths[a]);
+			canonical_codes(lengths[a], codes[a]);
+			for (uint8_t length : lengths[a])
+				writer.put(length, 4);
+		}
+
+		for (const Token& token : tokens_) {
+			writer.put(codes[token.alphabet][token.symbol], lengths[token.alphabet][token.symbol]);
+			writer.put(token.extra, token.extra_bits);
+		}
+		writer.flush();
+	}
+
+	std::vector<Token> tokens_;
+};
+
+template <typename T>
+class BandDecoder
+{
+public:
+
+	BandDecoder(const uint8_t* data, size_t size) : reader_(data, size) {}
+
+	bool decode(T* disparity, int width, int pitch, int y_beg, int y_end, T invalid)
+	{
+		for (int a = 0; a < NUM_ALPHABETS; a++) {
+			std::vector<uint8_t> lengths(ALPHABET_SIZES[a]);
+			for (auto& length : lengths)
+				length = static_cast<uint8_t>(reader_.get(4));
+			if (!build_decode_table(lengths, tables_[a]))
+				return false;
+		}
+
+		// the predictor is accumulated in 64 bits, deltas of malformed streams may leave the range of T
+		const int64_t max_value = std::numeric_limits<T>::max();
+		bool last_zero = false;
+		int64_t last = 0;
+
+		for (int y = y_beg; y < y_end; y++) {
+			T* row = disparity + static_cast<size_t>(y) * pitch;
+			const T* above = y > y_beg ? row - pitch : nullptr;
+
+			for (int x = 0; x < width; ) {
+				const uint32_t n = length() + (x == 0 ? 0 : 1);
+				if (n > static_cast<uint32_t>(width - x))
+					return false;
+
+				const int end = x + static_cast<int>(n);
+				int64_t pred = above && above[x] != invalid ? above[x] : last;
+				for (int i = x; i < end; ) {
+					if (last_zero) {
+						const uint32_t z = length();
+						if (z > static_cast<uint32_t>(end - i))
+							return false;
+						std::fill(row + i, row + i + z, static_cast<T>(pred));
+						i += z;
+						if (i == end)
+							break;
+
+						pred += unzigzag(delta() + 1);
+						if (pred < 0 || pred > max_value)
+							return false;
+						last_zero = false;
+						row[i++] = static_cast<T>(pred);
+						continue;
+					}
+
+					const uint32_t s = delta();
+					pred += unzigzag(s);
+					if (pred < 0 || pred > max_value)
+						return false;
+					last_zero = s == 0;
+					row[i++] = static_cast<T>(pred);
+				}
+				last = pred;
+				x = end;
+				if (x == width)
+					break;
+
+				const uint32_t m = length() + 1;
+				if (m > static_cast<uint32_t>(width - x))
+					return false;
+				std::fill(row + x, row + x + m, invalid);
+				x += m;
+			}
+
+			if (reader_.overrun())
+				return false;
+		}
+		return true;
+	}
+
+private:
+
+	uint32_t symbol(Alphabet alphabet)
+	{
+		const uint16_t entry = tables_[alphabet][reader_.peek(MAX_CODE_LENGTH)];
+		// an unused code has length 0 and is consumed as one bit so that malformed streams end
+		reader_.skip(std::max(1, entry & 15));
+		return entry >> 4;
+	}
+
+	uint32_t delta()
+	{
+		const uint32_t s = symbol(DELTA);
+		if (s < DIRECT_DELTAS)
+			return s;
+		const int n = static_cast<int>(s) - DIRECT_DELTAS + 8;
+		return (1u << (n - 1)) | reader_.get(n - 1);
+	}
+
+	uint32_t length()
+	{
+		const int n = static_cast<int>(symbol(LENGTH));
+		if (n == 0)
+			return 0;
+		return (1u << (n - 1)) | reader_.get(n - 1);
+	}
+
+	BitReader reader_;
+	std::vector<uint16_t> tables_[NUM_ALPHABETS];
+};
+
+// runs body(band) for every band on up to num_threads threads, the calling thread included
+template <typename Body>
+void parallel_bands(int num_bands, int num_threads, Body body)
+{
+	num_threads = std::min(num_bands, std::max(1, num_threads));
+	std::atomic<int> next{ 0 };
+	auto worker = [&] {
+		for (int band = next++; band < num_bands; band = next++)
+			body(band);
+	};
+
+	std::vector<std::thread> threads;
+	for (int i = 1; i < num_threads; i++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto& thread : threads)
+		thread.join();
+}
+
+void put_u16(uint8_t* p, uint32_t v) { p[0] = v & 0xff; p[1] = (v >> 8) & 0xff; }
+void put_u32(uint8_t* p, uint32_t v) { put_u16(p, v & 0xffff); put_u16(p + 2, v >> 16); }
+uint32_t get_u16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+uint32_t get_u32(const uint8_t* p) { return get_u16(p) | (get_u16(p + 2) << 16); }
+
+struct CodecHeader
+{
+	int depth_bits;
+	uint32_t invalid;
+	int width;
+	int height;
+	int band_rows;
+	int num_bands;
+};
+
+bool read_header(const uint8_t* src, size_t src_size, CodecHeader& header)
+{
+	if (!src || src_size < CODEC_HEADER_SIZE || std::memcmp(src, CODEC_MAGIC, sizeof(CODEC_MAGIC)) != 0 || src[4] != CODEC_VERSION)
+		return false;
+
+	header.depth_bits = src[5];
+	header.invalid = get_u16(src + 6);
+	const uint32_t width = get_u32(src + 8);
+	const uint32_t height = get_u32(src + 12);
+	const uint32_t band_rows = get_u32(src + 16);
+	if ((header.depth_bits != 8 && header.depth_bits != 16) || width == 0 || width > INT32_MAX || height == 0 || height > INT32_MAX
+		|| band_rows == 0)
+		return false;
+
+	header.width = static_cast<int>(width);
+	header.height = static_cast<int>(height);
+	header.band_rows = static_cast<int>(std::min(band_rows, height));
+	header.num_bands = static_cast<int>((height + band_rows - 1) / band_rows);
+	return src_size >= CODEC_HEADER_SIZE + 4 * static_cast<size_t>(header.num_bands);
+}
+
+template <typename T>
+size_t encode(const T* disparity, int width, int height, int pitch, int depth_bits, T invalid, uint8_t* dst, size_t dst_size,
+	int num_threads)
+{
+	const int num_bands = (height + BAND_ROWS - 1) / BAND_ROWS;
+	std::vector<std::vector<uint8_t>> bands(num_bands);
+	parallel_bands(num_bands, num_threads, [&](int band) {
+		bands[band].reserve(static_cast<size_t>(width) * BAND_ROWS / 2);
+		BandEncoder<T>().encode(disparity, width, pitch, band * BAND_ROWS, std::min(height, (band + 1) * BAND_ROWS), invalid, bands[band]);
+	});
+
+	size_t total = CODEC_HEADER_SIZE + 4 * static_cast<size_t>(num_bands);
+	for (const auto& band : bands)
+		total += band.size();
+	if (!dst || dst_size < total)
+		return total;
+
+	std::memcpy(dst, CODEC_MAGIC, sizeof(CODEC_MAGIC));
+	dst[4] = CODEC_VERSION;
+	dst[5] = static_cast<uint8_t>(depth_bits);
+	put_u16(dst + 6, invalid);
+	put_u32(dst + 8, width);
+	put_u32(dst + 12, height);
+	put_u32(dst + 16, BAND_ROWS);
+
+	uint8_t* payload = dst + CODEC_HEADER_SIZE + 4 * static_cast<size_t>(num_bands);
+	for (int band = 0; band < num_bands; band++) {
+		put_u32(dst + CODEC_HEADER_SIZE + 4 * band, static_cast<uint32_t>(bands[band].size()));
+		std::memcpy(payload, bands[band].data(), bands[band].size());
+		payload += bands[band].size();
+	}
+	return total;
+}
+
+template <typename T>
+bool decode(const uint8_t* src, size_t src_size, const CodecHeader& header, T* disparity, int pitch, int num_threads)
+{
+	std::vector<size_t> offsets(header.num_bands + 1);
+	offsets[0] = CODEC_HEADER_SIZE + 4 * static_cast<size_t>(header.num_bands);
+	for (int band = 0; band < header.num_bands; band++)
+		offsets[band + 1] = offsets[band] + get_u32(src + CODEC_HEADER_SIZE + 4 * band);
+	if (offsets[header.num_bands] > src_size)
+		return false;
+
+	std::atomic<bool> ok{ true };
+	parallel_bands(header.num_bands, num_threads, [&](int band) {
+		const int y_beg = band * header.band_rows;
+		const int y_end = std::min(header.height, y_beg + header.band_rows);
+		BandDecoder<T> decoder(src + offsets[band], offsets[band + 1] - offsets[band]);
+		if (!decoder.decode(disparity, header.width, pitch, y_beg, y_end, static_cast<T>(header.invalid)))
+			ok = false;
+	});
+	return ok;
+}
+
+} // namespace
+
+size_t encoded_disparity_bound(int width, int height, int depth_bits)
+{
+	if (width <= 0 || height <= 0 || (depth_bits != 8 && depth_bits != 16))
+		return 0;
+
+	// a row codes at most a delta and a zero run per valid pixel and a length per run, the first run may be empty,
+	// so at most 2 * width + 2 tokens of a code and the raw bits of a delta or a length
+	const uint64_t table_bits = 4 * (NUM_DELTA_SYMBOLS + NUM_LENGTH_SYMBOLS);
+	const uint64_t token_bits = MAX_CODE_LENGTH + std::max(depth_bits, bit_length(static_cast<uint32_t>(width)) - 1);
+	const uint64_t num_bands = (static_cast<uint64_t>(height) + BAND_ROWS - 1) / BAND_ROWS;
+	const uint64_t row_bits = (2 * static_cast<uint64_t>(width) + 2) * token_bits;
+	return static_cast<size_t>(CODEC_HEADER_SIZE + 4 * num_bands + num_bands * ((table_bits + 7) / 8 + 1)
+		+ (static_cast<uint64_t>(height) * row_bits + 7) / 8);
+}
+
+size_t encode_disparity(const void* disparity, int width, int height, int pitch, int depth_bits, int invalid_disparity,
+	void* dst, size_t dst_size, int num_threads)
+{
+	if (!disparity || width <= 0 || height <= 0 || pitch < width || (depth_bits != 8 && depth_bits != 16))
+		return 0;
+
+	uint8_t* bytes = static_cast<uint8_t*>(dst);
+	if (depth_bits == 8)
+		return encode(static_cast<const uint8_t*>(disparity), width, height, pitch, depth_bits, static_cast<uint8_t>(invalid_disparity),
+			bytes, dst_size, num_threads);
+	return encode(static_cast<const uint16_t*>(disparity), width, height, pitch, depth_bits, static_cast<uint16_t>(invalid_disparity),
+		bytes, dst_size, num_threads);
+}
+
+bool get_encoded_disparity_info(const void* src, size_t src_size, int* width, int* height, int* depth_bits)
+{
+	CodecHeader header;
+	if (!read_header(static_cast<const uint8_t*>(src), src_size, header))
+		return false;
+	if (width)
+		*width = header.width;
+	if (height)
+		*height = header.height;
+	if (depth_bits)
+		*depth_bits = header.depth_bits;
+	return true;
+}
+
+bool decode_disparity(const void* src, size_t src_size, void* disparity, int pitch, int num_threads)
+{
+	const uint8_t* bytes = static_cast<const uint8_t*>(src);
+	CodecHeader header;
+	if (!disparity || !read_header(bytes, src_size, header) || pitch < header.width)
+		return false;
+
+	if (header.depth_bits == 8)
+		return decode(bytes, src_size, header, static_cast<uint8_t*>(disparity), pitch, num_threads);
+	return decode(bytes, src_size, header, static_cast<uint16_t*>(disparity), pitch, num_threads);
+}
+
+} // namespace sgm
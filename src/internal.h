@@ -25,19 +25,62 @@ namespace sgm
 namespace details
 {
 
+static constexpr int FRAME_HISTOGRAM_BINS = 256;
+
+// per-frame counters accumulated by the pipeline kernels, a null pointer leaves the counter untouched
+struct FrameCounters
+{
+	uint32_t* uniqueness_rejections;
+	uint32_t* lr_rejections;
+	uint32_t* invalid_pixels;
+	uint32_t* histogram; // FRAME_HISTOGRAM_BINS bins of integer disparity before range correction
+
+	FrameCounters() : uniqueness_rejections(nullptr), lr_rejections(nullptr), invalid_pixels(nullptr), histogram(nullptr) {}
+};
+
+ImageType census_image_type(CensusType type);
+
 void census_transform(const DeviceImage& src, DeviceImage& dst, CensusType type);
+void census_transform(const DeviceImage& src, DeviceImage& dst, CensusType type, InputFormat format);
+void census_transform(const DeviceImage& src, DeviceImage& dst, CensusType type, InputFormat format,
+	const DeviceImage& map_xy, const DeviceImage& map_frac);
+void census_transform(const DeviceImage& src, DeviceImage& dst, CensusType type, InputFormat format,
+	const DeviceImage& map_xy, const DeviceImage& map_frac, const DeviceImage& mask);
 
 void cost_aggregation(const DeviceImage& srcL, const DeviceImage& srcR, DeviceImage& dst,
 	int disp_size, int P1, int P2, PathType path_type, int min_disp);
+void cost_aggregation(const DeviceImage& srcL, const DeviceImage& srcR, DeviceImage& dst,
+	int disp_size, int P1, int P2, PathType path_type, int min_disp, EpipolarDirection direction,
+	const DeviceImage& mask);
+
+void fused_cost_aggregation(const DeviceImage& srcL, const DeviceImage& srcR, DeviceImage& dst,
+	int disp_size, int P1, int P2, PathType path_type, int min_disp, CensusType census_type);
 
 void winner_takes_all(const DeviceImage& src, DeviceImage& dstL, DeviceImage& dstR,
 	int disp_size, float uniqueness, bool subpixel, PathType path_type);
+void winner_takes_all(const DeviceImage& src, DeviceImage& dstL, DeviceImage& dstR,
+	int disp_size, float uniqueness, bool subpixel, PathType path_type, EpipolarDirection direction,
+	const DeviceImage& row_counts, const FrameCounters& counters);
 
 void median_filter(const DeviceImage& src, DeviceImage& dst);
 
 void check_consistency(DeviceImage& dispL, const DeviceImage& dispR, const DeviceImage& srcL, bool subpixel, int LR_max_diff);
+void check_consistency(DeviceImage& dispL, const DeviceImage& dispR, const DeviceImage& srcL, bool subpixel, int LR_max_diff,
+	InputFormat format);
+void check_consistency(DeviceImage& dispL, const DeviceImage& dispR, const DeviceImage& srcL, bool subpixel, int LR_max_diff,
+	InputFormat format, const DeviceImage& map_xy, const DeviceImage& map_frac, EpipolarDirection direction,
+	const DeviceImage& mask, const FrameCounters& counters);
 
 void correct_disparity_range(DeviceImage& disp, bool subpixel, int min_disp);
+void correct_disparity_range(DeviceImage& disp, bool subpixel, int min_disp, DeviceImage& valid_bits, DeviceImage& valid_rows);
+void correct_disparity_range(DeviceImage& disp, bool subpixel, int min_disp, DeviceImage* valid_bits, DeviceImage* valid_rows,
+	const FrameCounters& counters);
+
+void pack_mask(const DeviceImage& src, int width, int bits_per_pixel, DeviceImage& dst, DeviceImage& row_counts);
+
+// sums the rows of a cost volume, one per path, and spreads a sum back over num_paths rows
+void sum_cost_paths(const DeviceImage& src, DeviceImage& dst);
+void split_cost_sum(const DeviceImage& src, DeviceImage& dst, int num_paths);
 
 void cast_16bit_to_8bit(const DeviceImage& src, DeviceImage& dst);
 void cast_8bit_to_16bit(const DeviceImage& src, DeviceImage& dst);
@@ -16,14 +16,28 @@ limitations under the License.
 
 #include <libsgm.h>
 
-#include <iostream>
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <cuda_runtime.h>
 
 #include "internal.h"
 #include "host_utility.h"
+#include "metrics.h"
+#include "profiler.h"
 
 namespace sgm
 {
 
+static const char COST_VOLUME_MAGIC[8] = { 'S', 'G', 'M', 'C', 'O', 'S', 'T', 0 };
+static const uint32_t COST_VOLUME_VERSION = 1;
+static_assert(sizeof(CostVolumeHeader) == 96 && offsetof(CostVolumeHeader, image_offset) == 64,
+	"cost volume header must have no implicit padding");
+
 static bool has_enough_depth(int dst_depth, int disparity_size, int min_disp, bool subpixel)
 {
 	// simulate minimum/maximum value
@@ -51,6 +65,39 @@ static bool has_enough_depth(int dst_depth, int disparity_size, int min_disp, bo
 	return true;
 }
 
+static bool is_valid_src_depth(InputFormat format, int src_depth)
+{
+	switch (format) {
+	case InputFormat::GRAY:
+		return src_depth == 8 || src_depth == 16 || src_depth == 32;
+	case InputFormat::BAYER:
+		return src_depth == 8 || src_depth == 16;
+	case InputFormat::BGR:
+	case InputFormat::RGB:
+		return src_depth == 8;
+	default:
+		return src_depth == 16;
+	}
+}
+
+// minimum source pitch in the unit of src_pitch, pixels for GRAY and BAYER, bytes otherwise
+static int min_src_pitch(InputFormat format, int width)
+{
+	switch (format) {
+	case InputFormat::BGR:
+	case InputFormat::RGB:
+		return 3 * width;
+	case InputFormat::RAW10:
+	case InputFormat::BAYER_RAW10:
+		return width / 4 * 5;
+	case InputFormat::RAW12:
+	case InputFormat::BAYER_RAW12:
+		return width / 2 * 3;
+	default:
+		return width;
+	}
+}
+
 class StereoSGM::Impl
 {
 public:
@@ -60,138 +107,619 @@ public:
 		width_(width),
 		height_(height),
 		disp_size_(disparity_size),
+		src_depth_(src_depth),
 		src_pitch_(src_pitch),
 		dst_pitch_(dst_pitch),
 		param_(param)
 	{
 		// check values
-		SGM_ASSERT(src_depth == 8 || src_depth == 16 || src_depth == 32, "src depth bits must be 8, 16 or 32");
+		const InputFormat format = param_.input_format;
+		SGM_ASSERT(is_valid_src_depth(format, src_depth), "src depth bits must be 8, 16 or 32 for GRAY, 8 or 16 for BAYER, 8 for BGR and RGB, 16 for RAW formats");
+		SGM_ASSERT((format != InputFormat::RAW10 && format != InputFormat::BAYER_RAW10) || width % 4 == 0, "width must be a multiple of 4 for RAW10");
+		SGM_ASSERT((format != InputFormat::RAW12 && format != InputFormat::BAYER_RAW12) || width % 2 == 0, "width must be a multiple of 2 for RAW12");
+		SGM_ASSERT(src_pitch >= min_src_pitch(format, width), "src pitch is too small for the input format");
+		SGM_ASSERT(!param_.fused_census || format == InputFormat::GRAY, "fused census supports only GRAY input");
+		SGM_ASSERT(!param_.fused_census || param_.epipolar_direction == EpipolarDirection::HORIZONTAL,
+			"fused census supports only horizontal epipolar lines");
 		SGM_ASSERT(dst_depth == 8 || dst_depth == 16, "dst depth bits must be 8 or 16");
 		SGM_ASSERT(disparity_size == 64 || disparity_size == 128 || disparity_size == 256, "disparity size must be 64 or 128 or 256");
 		SGM_ASSERT(has_enough_depth(dst_depth, disparity_size, param_.min_disp, param_.subpixel),
 			"output depth bits must be sufficient for representing output value");
 
-		src_type_ = src_depth == 8 ? SGM_8U : src_depth == 16 ? SGM_16U : SGM_32U;
+		// color and packed formats are stored as bytes and decoded by the census transform
+		const bool is_byte_format = format != InputFormat::GRAY && format != InputFormat::BAYER;
+		src_type_ = src_depth == 8 || is_byte_format ? SGM_8U : src_depth == 16 ? SGM_16U : SGM_32U;
+		src_elem_size_ = is_byte_format ? 1 : src_depth / 8;
 		dst_type_ = dst_depth == 8 ? SGM_8U : SGM_16U;
 
 		is_src_devptr_ = (inout_type & 0x01) > 0;
 		is_dst_devptr_ = (inout_type & 0x02) > 0;
 
 		if (!is_src_devptr_) {
-			d_srcL_.create(height, width, src_type_, src_pitch);
-			d_srcR_.create(height, width, src_type_, src_pitch);
+			d_srcL_buf_.create(height, width, src_type_, src_pitch);
+			d_srcR_buf_.create(height, width, src_type_, src_pitch);
 		}
 
-		const ImageType census_type = param.census_type == CensusType::CENSUS_9x7 ? SGM_64U : SGM_32U;
-		d_censusL_.create(height, width, census_type);
-		d_censusR_.create(height, width, census_type);
-		d_censusL_.fill_zero();
-		d_censusR_.fill_zero();
+		if (!param.fused_census) {
+			const ImageType census_type = details::census_image_type(param.census_type);
+			d_censusL_.create(height, width, census_type);
+			d_censusR_.create(height, width, census_type);
+			d_censusL_.fill_zero();
+			d_censusR_.fill_zero();
+		}
 
 		d_tmpL_.create(height, width, SGM_16U, dst_pitch);
 		d_tmpR_.create(height, width, SGM_16U, dst_pitch);
 
 		if (!(is_dst_devptr_ && dst_type_ == SGM_16U)) {
-			d_dispL_.create(height, width, SGM_16U, dst_pitch);
+			d_dispL_buf_.create(height, width, SGM_16U, dst_pitch);
 		}
 		d_dispR_.create(height, width, SGM_16U, dst_pitch);
+
+		update_stage_work();
 	}
 
 	void execute(const void* srcL, const void* srcR, void* dst)
 	{
-		if (is_src_devptr_) {
-			d_srcL_.create((void*)srcL, height_, width_, src_type_, src_pitch_);
-			d_srcR_.create((void*)srcR, height_, width_, src_type_, src_pitch_);
+		const int src_pitch_bytes = src_pitch_ * src_elem_size_;
+		const int dst_pitch_bytes = dst_pitch_ * (dst_type_ == SGM_8U ? 1 : 2);
+		execute(ConstImageView{ srcL, width_, height_, src_pitch_bytes, src_type_ },
+			ConstImageView{ srcR, width_, height_, src_pitch_bytes, src_type_ },
+			ImageView{ dst, width_, height_, dst_pitch_bytes, dst_type_ });
+	}
+
+	void execute(const PackedStereoImage& src, void* dst)
+	{
+		const uint8_t* data = static_cast<const uint8_t*>(src.data);
+		const int dst_pitch_bytes = dst_pitch_ * (dst_type_ == SGM_8U ? 1 : 2);
+		execute(ConstImageView{ data + src.left_offset, width_, height_, src.left_pitch, src_type_ },
+			ConstImageView{ data + src.right_offset, width_, height_, src.right_pitch, src_type_ },
+			ImageView{ dst, width_, height_, dst_pitch_bytes, dst_type_ });
+	}
+
+	void execute(const ConstImageView& srcL, const ConstImageView& srcR, const ImageView& dst)
+	{
+		MetricsFrame metrics;
+		ProfilerScope scope(profiler_);
+
+		set_input(d_srcL_, d_srcL_buf_, srcL);
+		set_input(d_srcR_, d_srcR_buf_, srcR);
+		set_output(dst);
+		SGM_PROFILE_STAGE(Stage::INPUT, 0);
+		compute();
+		write_output(dst);
+		SGM_PROFILE_STAGE(Stage::OUTPUT, 0);
+	}
+
+	size_t get_cost_volume(void* buffer, size_t size, bool summed)
+	{
+		if (d_cost_.data == nullptr) {
+			return 0;
+		}
+
+		CostVolumeHeader header = cost_volume_header(d_cost_.rows, summed);
+		const size_t total = static_cast<size_t>(header.cost_offset + header.cost_bytes);
+		if (buffer == nullptr || size < total) {
+			return total;
+		}
+
+		uint8_t* dst = static_cast<uint8_t*>(buffer);
+		memcpy(dst, &header, sizeof(header));
+
+		// left image rows are packed, a bottom up input is copied in memory order and flipped on the host
+		const size_t row_bytes = header.image_bytes / height_;
+		const ptrdiff_t step_bytes = static_cast<ptrdiff_t>(d_srcL_.step) * src_elem_size_;
+		const bool bottom_up = step_bytes < 0;
+		const uint8_t* first = d_srcL_.ptr<uint8_t>() + (bottom_up ? (height_ - 1) * step_bytes : 0);
+		uint8_t* image = dst + header.image_offset;
+		CUDA_CHECK(cudaMemcpy2D(image, row_bytes, first, std::abs(step_bytes), row_bytes, height_, cudaMemcpyDeviceToHost));
+		if (bottom_up) {
+			for (int y = 0; y < height_ / 2; y++) {
+				std::swap_ranges(image + y * row_bytes, image + (y + 1) * row_bytes, image + (height_ - 1 - y) * row_bytes);
+			}
+		}
+
+		if (summed) {
+			details::sum_cost_paths(d_cost_, d_cost_sum_);
+			CUDA_CHECK(cudaMemcpy(dst + header.cost_offset, d_cost_sum_.data, header.cost_bytes, cudaMemcpyDeviceToHost));
 		}
 		else {
-			d_srcL_.upload(srcL);
-			d_srcR_.upload(srcR);
+			CUDA_CHECK(cudaMemcpy2D(dst + header.cost_offset, d_cost_.cols, d_cost_.data, d_cost_.step, d_cost_.cols, d_cost_.rows,
+				cudaMemcpyDeviceToHost));
 		}
-		if (is_dst_devptr_ && dst_type_ == SGM_16U) {
-			// when threre is no device-host copy or type conversion, use passed buffer
-			d_dispL_.create((void*)dst, height_, width_, SGM_16U, dst_pitch_);
+		return total;
+	}
+
+	void execute_cost_volume(const void* volume, size_t size, void* dst)
+	{
+		MetricsFrame metrics;
+		ProfilerScope scope(profiler_);
+
+		SGM_ASSERT(volume && size >= sizeof(CostVolumeHeader), "cost volume is too small");
+		CostVolumeHeader header;
+		memcpy(&header, volume, sizeof(header));
+
+		SGM_ASSERT(memcmp(header.magic, COST_VOLUME_MAGIC, sizeof(header.magic)) == 0 && header.version == COST_VOLUME_VERSION,
+			"not a cost volume of a supported version");
+		SGM_ASSERT(header.num_paths == 4 || header.num_paths == 8, "cost volume must be aggregated along 4 or 8 paths");
+		SGM_ASSERT(header.element_bits == 8 || header.element_bits == 16, "cost volume elements must be 8 or 16 bits");
+		const bool summed = header.element_bits == 16;
+		const CostVolumeHeader expected = cost_volume_header(header.num_paths, summed);
+		SGM_ASSERT(header.width == expected.width && header.height == expected.height && header.disp_size == expected.disp_size,
+			"cost volume size must be same as image size and disparity size");
+		SGM_ASSERT(header.min_disp == expected.min_disp && header.vertical == expected.vertical,
+			"cost volume must have the minimum disparity and epipolar direction of this instance");
+		SGM_ASSERT(header.input_format == expected.input_format && header.input_depth_bits == expected.input_depth_bits,
+			"cost volume must have the input format and depth of this instance");
+		SGM_ASSERT(header.num_volumes == expected.num_volumes && header.image_bytes == expected.image_bytes
+			&& header.cost_bytes == expected.cost_bytes, "cost volume layout is inconsistent");
+		// offsets come from the file, compared without sums which a crafted offset could wrap
+		SGM_ASSERT(header.image_offset <= size && header.image_bytes <= size - header.image_offset
+			&& header.cost_offset <= size && header.cost_bytes <= size - header.cost_offset, "cost volume is truncated");
+
+		const uint8_t* src = static_cast<const uint8_t*>(volume);
+		if (d_srcL_buf_.data == nullptr) {
+			d_srcL_buf_.create(height_, width_, src_type_, src_pitch_);
+		}
+		const size_t row_bytes = header.image_bytes / height_;
+		CUDA_CHECK(cudaMemcpy2D(d_srcL_buf_.data, static_cast<size_t>(d_srcL_buf_.step) * src_elem_size_, src + header.image_offset,
+			row_bytes, row_bytes, height_, cudaMemcpyHostToDevice));
+		d_srcL_ = d_srcL_buf_;
+
+		// summed costs are spread over the paths, so winner-takes-all reads both layouts
+		const int cols = width_ * height_ * disp_size_;
+		if (summed) {
+			d_cost_sum_.create(1, cols, SGM_16U);
+			CUDA_CHECK(cudaMemcpy(d_cost_sum_.data, src + header.cost_offset, header.cost_bytes, cudaMemcpyHostToDevice));
+			details::split_cost_sum(d_cost_sum_, d_cost_, header.num_paths);
+		}
+		else {
+			d_cost_.create(header.num_paths, cols, SGM_8U);
+			CUDA_CHECK(cudaMemcpy2D(d_cost_.data, d_cost_.step, src + header.cost_offset, cols, cols, header.num_paths,
+				cudaMemcpyHostToDevice));
 		}
 
-		// census transform
-		details::census_transform(d_srcL_, d_censusL_, param_.census_type);
-		details::census_transform(d_srcR_, d_censusR_, param_.census_type);
+		const int dst_pitch_bytes = dst_pitch_ * (dst_type_ == SGM_8U ? 1 : 2);
+		const ImageView view{ dst, width_, height_, dst_pitch_bytes, dst_type_ };
+		set_output(view);
+		SGM_PROFILE_STAGE(Stage::INPUT, 0);
+		post_process(header.num_paths == 4 ? PathType::SCAN_4PATH : PathType::SCAN_8PATH);
+		write_output(view);
+		SGM_PROFILE_STAGE(Stage::OUTPUT, 0);
+	}
 
-		// cost aggregation
-		details::cost_aggregation(d_censusL_, d_censusR_, d_cost_, disp_size_,
-			param_.P1, param_.P2, param_.path_type, param_.min_disp);
+	void set_rectification(const void* mapL_xy, const void* mapL_frac, const void* mapR_xy, const void* mapR_frac)
+	{
+		if (mapL_xy == nullptr) {
+			d_mapL_xy_ = DeviceImage();
+			d_mapR_xy_ = DeviceImage();
+			update_stage_work();
+			return;
+		}
 
-		// winner-takes-all
-		details::winner_takes_all(d_cost_, d_tmpL_, d_tmpR_, disp_size_,
-			param_.uniqueness, param_.subpixel, param_.path_type);
+		SGM_ASSERT(!param_.fused_census, "rectification cannot be used with fused census");
+		SGM_ASSERT(mapL_frac && mapR_xy && mapR_frac, "all remap tables must be given");
 
-		// post filtering
-		details::median_filter(d_tmpL_, d_dispL_);
-		details::median_filter(d_tmpR_, d_dispR_);
+		// (x, y) pairs of int16 are stored as one 32-bit element
+		d_mapL_xy_.create(height_, width_, SGM_32U);
+		d_mapR_xy_.create(height_, width_, SGM_32U);
+		d_mapL_frac_.create(height_, width_, SGM_16U);
+		d_mapR_frac_.create(height_, width_, SGM_16U);
 
-		// consistency check
-		details::check_consistency(d_dispL_, d_dispR_, d_srcL_, param_.subpixel, param_.LR_max_diff);
-		details::correct_disparity_range(d_dispL_, param_.subpixel, param_.min_disp);
+		d_mapL_xy_.upload(mapL_xy);
+		d_mapR_xy_.upload(mapR_xy);
+		d_mapL_frac_.upload(mapL_frac);
+		d_mapR_frac_.upload(mapR_frac);
 
-		if (!is_dst_devptr_ && dst_type_ == SGM_8U) {
-			details::cast_16bit_to_8bit(d_dispL_, d_tmpL_);
-			d_tmpL_.download(dst);
+		update_stage_work();
+	}
+
+	void set_mask(const void* mask, int pitch_bytes, int bits_per_pixel)
+	{
+		if (mask == nullptr) {
+			d_mask_ = DeviceImage();
+			d_mask_rows_ = DeviceImage();
+			return;
 		}
-		else if (is_dst_devptr_ && dst_type_ == SGM_8U) {
-			DeviceImage d_dst(dst, height_, width_, SGM_8U, dst_pitch_);
-			details::cast_16bit_to_8bit(d_dispL_, d_dst);
+
+		SGM_ASSERT(!param_.fused_census, "mask cannot be used with fused census");
+		SGM_ASSERT(bits_per_pixel == 1 || bits_per_pixel == 8, "mask must be 1 or 8 bits per pixel");
+		const int width_bytes = bits_per_pixel == 1 ? (width_ + 7) / 8 : width_;
+		SGM_ASSERT(pitch_bytes >= width_bytes, "mask pitch is too small");
+
+		// the mask is copied and packed to one bit per pixel, so it may change between frames
+		d_mask_src_.create(height_, width_bytes, SGM_8U);
+		const cudaMemcpyKind kind = is_src_devptr_ ? cudaMemcpyDeviceToDevice : cudaMemcpyHostToDevice;
+		CUDA_CHECK(cudaMemcpy2D(d_mask_src_.data, d_mask_src_.step, mask, pitch_bytes, width_bytes, height_, kind));
+		details::pack_mask(d_mask_src_, width_, bits_per_pixel, d_mask_, d_mask_rows_);
+	}
+
+	void set_validity_output(void* mask, int pitch_bytes, int* row_counts)
+	{
+		SGM_ASSERT(mask == nullptr || pitch_bytes >= (width_ + 7) / 8, "validity mask pitch is too small");
+		valid_mask_ = mask;
+		valid_mask_pitch_ = pitch_bytes;
+		valid_rows_ = row_counts;
+	}
+
+	int get_invalid_disparity() const
+	{
+		return (param_.min_disp - 1) * (param_.subpixel ? SUBPIXEL_SCALE : 1);
+	}
+
+	int get_stage_stats(StageStats* stats, int max_stats)
+	{
+		return profiler_.get_stats(stats, max_stats);
+	}
+
+	void reset_stage_stats()
+	{
+		profiler_.reset_stats();
+	}
+
+	void begin_trace()
+	{
+		profiler_.begin_trace();
+	}
+
+	bool end_trace(const char* path)
+	{
+		return profiler_.end_trace(path);
+	}
+
+	bool enable_perf_counters(bool enable)
+	{
+		return profiler_.enable_perf_counters(enable);
+	}
+
+	int get_perf_counter_stats(PerfCounterStats* stats, int max_stats)
+	{
+		return profiler_.get_perf_stats(stats, max_stats);
+	}
+
+	int get_stage_throughput(StageThroughput* throughput, int max_throughput, double* device_bandwidth)
+	{
+		return profiler_.get_throughput(throughput, max_throughput, device_bandwidth);
+	}
+
+	void enable_frame_stats(bool enable)
+	{
+		frame_stats_ = enable;
+		has_frame_stats_ = false;
+		if (enable) {
+			d_frame_stats_.create(1, NUM_FRAME_COUNTERS + details::FRAME_HISTOGRAM_BINS, SGM_32U);
+		}
+		else {
+			d_frame_stats_ = DeviceImage();
 		}
-		else if (!is_dst_devptr_ && dst_type_ == SGM_16U) {
-			d_dispL_.download(dst);
+	}
+
+	int get_frame_stats(FrameStats* stats, int* histogram, int max_bins)
+	{
+		if (!has_frame_stats_) {
+			return 0;
+		}
+
+		uint32_t h_stats[NUM_FRAME_COUNTERS + details::FRAME_HISTOGRAM_BINS];
+		CUDA_CHECK(cudaMemcpy(h_stats, d_frame_stats_.data, sizeof(h_stats), cudaMemcpyDeviceToHost));
+
+		if (stats) {
+			stats->pixels = width_ * height_;
+			stats->invalid_pixels = static_cast<int>(h_stats[FRAME_INVALID_PIXELS]);
+			stats->uniqueness_rejections = static_cast<int>(h_stats[FRAME_UNIQUENESS_REJECTIONS]);
+			stats->lr_rejections = static_cast<int>(h_stats[FRAME_LR_REJECTIONS]);
+		}
+		for (int i = 0; histogram && i < std::min(max_bins, disp_size_); i++) {
+			histogram[i] = static_cast<int>(h_stats[NUM_FRAME_COUNTERS + i]);
+		}
+		return disp_size_;
+	}
+
+private:
+
+	// layout of d_frame_stats_, counters followed by the disparity histogram
+	enum FrameCounter
+	{
+		FRAME_UNIQUENESS_REJECTIONS,
+		FRAME_LR_REJECTIONS,
+		FRAME_INVALID_PIXELS,
+		NUM_FRAME_COUNTERS
+	};
+
+	// the left image and costs start at page boundaries, so they can be used in place from a mapped file
+	CostVolumeHeader cost_volume_header(int num_paths, bool summed) const
+	{
+		const uint64_t alignment = 4096;
+		const uint64_t cost_count = static_cast<uint64_t>(width_) * height_ * disp_size_;
+
+		CostVolumeHeader header = {};
+		memcpy(header.magic, COST_VOLUME_MAGIC, sizeof(header.magic));
+		header.version = COST_VOLUME_VERSION;
+		header.width = width_;
+		header.height = height_;
+		header.disp_size = disp_size_;
+		header.min_disp = param_.min_disp;
+		header.num_paths = num_paths;
+		header.num_volumes = summed ? 1 : num_paths;
+		header.element_bits = summed ? 16 : 8;
+		header.vertical = param_.epipolar_direction == EpipolarDirection::VERTICAL;
+		header.input_format = static_cast<uint32_t>(param_.input_format);
+		header.input_depth_bits = src_depth_;
+		header.P1 = param_.P1;
+		header.P2 = param_.P2;
+		header.census_type = static_cast<uint32_t>(param_.census_type);
+		header.image_offset = alignment;
+		header.image_bytes = static_cast<uint64_t>(min_src_pitch(param_.input_format, width_)) * src_elem_size_ * height_;
+		header.cost_offset = (header.image_offset + header.image_bytes + alignment - 1) / alignment * alignment;
+		header.cost_bytes = cost_count * header.num_volumes * header.element_bits / 8;
+		return header;
+	}
+
+	details::FrameCounters frame_counters()
+	{
+		details::FrameCounters counters;
+		if (frame_stats_) {
+			uint32_t* base = d_frame_stats_.ptr<uint32_t>();
+			counters.uniqueness_rejections = base + FRAME_UNIQUENESS_REJECTIONS;
+			counters.lr_rejections = base + FRAME_LR_REJECTIONS;
+			counters.invalid_pixels = base + FRAME_INVALID_PIXELS;
+			counters.histogram = base + NUM_FRAME_COUNTERS;
+		}
+		return counters;
+	}
+
+	// memory traffic and operations of each stage per frame, counting every element once as kernels read it
+	void update_stage_work()
+	{
+		const double pixels = static_cast<double>(width_) * height_;
+		const double cells = pixels * disp_size_;
+		const double src_bytes = pixels * min_src_pitch(param_.input_format, width_) / width_ * src_elem_size_;
+		// rectification reads 6 bytes of tables and 4 source pixels per pixel
+		const double census_src_bytes = d_mapL_xy_.data ? 4 * src_bytes + 6 * pixels : src_bytes;
+		const ImageType census_type = details::census_image_type(param_.census_type);
+		const double census_bytes = pixels * (census_type == SGM_32U ? 4 : census_type == SGM_64U ? 8 : 16);
+		const double disp_bytes = 2 * pixels;
+		const int num_paths = param_.path_type == PathType::SCAN_8PATH ? 8 : 4;
+
+		profiler_.set_work(Stage::INPUT, { is_src_devptr_ ? 0 : 2 * src_bytes, 0, 0 });
+		if (!param_.fused_census) {
+			profiler_.set_work(Stage::CENSUS_LEFT, { census_src_bytes + census_bytes, 0, 0 });
+			profiler_.set_work(Stage::CENSUS_RIGHT, { census_src_bytes + census_bytes, 0, 0 });
+		}
+		// each direction reads both census images, or both sources for fused census, and writes its cost volume;
+		// directions run concurrently, so their work is rated over the joined aggregation span only
+		const double aggregation_src_bytes = param_.fused_census ? 2 * src_bytes : 2 * census_bytes;
+		profiler_.set_work(Stage::AGGREGATION,
+			{ num_paths * (aggregation_src_bytes + cells), num_paths * cells, num_paths * cells });
+		profiler_.set_work(Stage::WINNER_TAKES_ALL, { num_paths * cells + 2 * disp_bytes, 0, 0 });
+		profiler_.set_work(Stage::MEDIAN_LEFT, { 2 * disp_bytes, 0, 0 });
+		profiler_.set_work(Stage::MEDIAN_RIGHT, { 2 * disp_bytes, 0, 0 });
+		profiler_.set_work(Stage::CONSISTENCY_CHECK, { 3 * disp_bytes + src_bytes, 0, 0 });
+		profiler_.set_work(Stage::RANGE_CORRECTION, { 2 * disp_bytes, 0, 0 });
+		profiler_.set_work(Stage::OUTPUT, { pixels * (dst_type_ == SGM_8U ? 1 : 2), 0, 0 });
+	}
+
+	// binds d_src to a view, which is read in place if it is device memory aligned to the element size
+	void set_input(DeviceImage& d_src, DeviceImage& d_buf, const ConstImageView& view)
+	{
+		const int width_bytes = min_src_pitch(param_.input_format, width_) * src_elem_size_;
+		SGM_ASSERT(view.width == width_ && view.height == height_, "input view size must be same as image size");
+		SGM_ASSERT(view.type == src_type_, "input view type must match input depth and format");
+		SGM_ASSERT(std::abs(view.stride_bytes) >= width_bytes, "input view stride is too small for the input format");
+
+		const bool aligned = reinterpret_cast<uintptr_t>(view.ptr) % src_elem_size_ == 0 && view.stride_bytes % src_elem_size_ == 0;
+		if (is_src_devptr_ && aligned) {
+			// the pipeline only reads its inputs
+			d_src.create(const_cast<void*>(view.ptr), height_, width_, src_type_, view.stride_bytes / src_elem_size_);
+			return;
+		}
+
+		if (d_buf.data == nullptr) {
+			d_buf.create(height_, width_, src_type_, src_pitch_);
 		}
-		else if (is_dst_devptr_ && dst_type_ == SGM_16U) {
-			// optimize! no-copy!
+
+		// rows of a bottom up view are copied in memory order and read with a negative step
+		const bool bottom_up = view.stride_bytes < 0;
+		const uint8_t* first = static_cast<const uint8_t*>(view.ptr) + (bottom_up ? static_cast<ptrdiff_t>(height_ - 1) * view.stride_bytes : 0);
+		const cudaMemcpyKind kind = is_src_devptr_ ? cudaMemcpyDeviceToDevice : cudaMemcpyHostToDevice;
+		CUDA_CHECK(cudaMemcpy2D(d_buf.data, static_cast<size_t>(d_buf.step) * src_elem_size_, first, std::abs(view.stride_bytes),
+			width_bytes, height_, kind));
+
+		if (bottom_up) {
+			d_src.create(d_buf.ptr<uint8_t>() + static_cast<ptrdiff_t>(height_ - 1) * d_buf.step * src_elem_size_,
+				height_, width_, src_type_, -d_buf.step);
 		}
 		else {
-			std::cerr << "not impl" << std::endl;
+			d_src = d_buf;
 		}
 	}
 
-	int get_invalid_disparity() const
+	// filters write the disparity with the pitch of d_tmpL_, so only a device view with the same pitch is written in place
+	void set_output(const ImageView& dst)
 	{
-		return (param_.min_disp - 1) * (param_.subpixel ? SUBPIXEL_SCALE : 1);
+		const int elem_size = dst_type_ == SGM_8U ? 1 : 2;
+		SGM_ASSERT(dst.width == width_ && dst.height == height_, "output view size must be same as image size");
+		SGM_ASSERT(dst.type == dst_type_, "output view type must match output depth");
+		SGM_ASSERT(std::abs(dst.stride_bytes) >= width_ * elem_size, "output view stride is too small");
+
+		direct_output_ = is_dst_devptr_ && dst.stride_bytes == dst_pitch_ * elem_size
+			&& reinterpret_cast<uintptr_t>(dst.ptr) % elem_size == 0;
+
+		if (direct_output_ && dst_type_ == SGM_16U) {
+			// when threre is no device-host copy or type conversion, use passed buffer
+			d_dispL_.create(dst.ptr, height_, width_, SGM_16U, dst_pitch_);
+			return;
+		}
+
+		if (d_dispL_buf_.data == nullptr) {
+			d_dispL_buf_.create(height_, width_, SGM_16U, dst_pitch_);
+		}
+		d_dispL_ = d_dispL_buf_;
 	}
 
-private:
+	void write_output(const ImageView& dst)
+	{
+		if (dst_type_ == SGM_8U && direct_output_) {
+			DeviceImage d_dst(dst.ptr, height_, width_, SGM_8U, dst_pitch_);
+			details::cast_16bit_to_8bit(d_dispL_, d_dst);
+		}
+		else if (dst_type_ == SGM_8U) {
+			details::cast_16bit_to_8bit(d_dispL_, d_tmpL_);
+			copy_rows(d_tmpL_, dst, 1);
+		}
+		else if (!direct_output_) {
+			copy_rows(d_dispL_, dst, 2);
+		}
+
+		if (valid_mask_) {
+			// words are little endian, so bit (x % 8) of byte (x / 8) marks pixel x
+			const cudaMemcpyKind kind = is_dst_devptr_ ? cudaMemcpyDeviceToDevice : cudaMemcpyDeviceToHost;
+			CUDA_CHECK(cudaMemcpy2D(valid_mask_, valid_mask_pitch_, d_valid_.data, static_cast<size_t>(d_valid_.step) * sizeof(uint32_t),
+				(width_ + 7) / 8, height_, kind));
+			if (valid_rows_) {
+				CUDA_CHECK(cudaMemcpy(valid_rows_, d_valid_rows_.data, sizeof(int) * height_, kind));
+			}
+		}
+	}
+
+	void copy_rows(const DeviceImage& src, const ImageView& dst, int elem_size)
+	{
+		const size_t width_bytes = static_cast<size_t>(width_) * elem_size;
+		const size_t src_pitch_bytes = static_cast<size_t>(src.step) * elem_size;
+		const cudaMemcpyKind kind = is_dst_devptr_ ? cudaMemcpyDeviceToDevice : cudaMemcpyDeviceToHost;
+
+		if (dst.stride_bytes >= 0) {
+			CUDA_CHECK(cudaMemcpy2D(dst.ptr, dst.stride_bytes, src.data, src_pitch_bytes, width_bytes, height_, kind));
+			return;
+		}
+
+		// bottom up views are written row by row
+		for (int y = 0; y < height_; y++) {
+			uint8_t* row = static_cast<uint8_t*>(dst.ptr) + static_cast<ptrdiff_t>(y) * dst.stride_bytes;
+			CUDA_CHECK(cudaMemcpy(row, src.ptr<uint8_t>() + y * src_pitch_bytes, width_bytes, kind));
+		}
+	}
+
+	void compute()
+	{
+		if (param_.fused_census) {
+			// census transform and cost aggregation
+			details::fused_cost_aggregation(d_srcL_, d_srcR_, d_cost_, disp_size_,
+				param_.P1, param_.P2, param_.path_type, param_.min_disp, param_.census_type);
+		}
+		else {
+			// census transform
+			details::census_transform(d_srcL_, d_censusL_, param_.census_type, param_.input_format, d_mapL_xy_, d_mapL_frac_,
+				d_mask_);
+			SGM_PROFILE_STAGE(Stage::CENSUS_LEFT, 0);
+			details::census_transform(d_srcR_, d_censusR_, param_.census_type, param_.input_format, d_mapR_xy_, d_mapR_frac_);
+			SGM_PROFILE_STAGE(Stage::CENSUS_RIGHT, 0);
+
+			// cost aggregation
+			details::cost_aggregation(d_censusL_, d_censusR_, d_cost_, disp_size_,
+				param_.P1, param_.P2, param_.path_type, param_.min_disp, param_.epipolar_direction, d_mask_);
+		}
+
+		post_process(param_.path_type);
+	}
+
+	// winner-takes-all and the following stages on d_cost_, aggregated along the scanlines of path_type
+	void post_process(PathType path_type)
+	{
+		if (frame_stats_) {
+			d_frame_stats_.fill_zero();
+			has_frame_stats_ = true;
+		}
+		const details::FrameCounters counters = frame_counters();
+
+		// winner-takes-all
+		// valid counts are per image row, so fully masked scanlines are skipped only for horizontal epipolar lines
+		const bool vertical = param_.epipolar_direction == EpipolarDirection::VERTICAL;
+		details::winner_takes_all(d_cost_, d_tmpL_, d_tmpR_, disp_size_,
+			param_.uniqueness, param_.subpixel, path_type, param_.epipolar_direction, vertical ? DeviceImage() : d_mask_rows_,
+			counters);
+		SGM_PROFILE_STAGE(Stage::WINNER_TAKES_ALL, 0);
+
+		// post filtering
+		details::median_filter(d_tmpL_, d_dispL_);
+		SGM_PROFILE_STAGE(Stage::MEDIAN_LEFT, 0);
+		details::median_filter(d_tmpR_, d_dispR_);
+		SGM_PROFILE_STAGE(Stage::MEDIAN_RIGHT, 0);
+
+		// consistency check
+		details::check_consistency(d_dispL_, d_dispR_, d_srcL_, param_.subpixel, param_.LR_max_diff, param_.input_format,
+			d_mapL_xy_, d_mapL_frac_, param_.epipolar_direction, d_mask_, counters);
+		SGM_PROFILE_STAGE(Stage::CONSISTENCY_CHECK, 0);
+		if (valid_mask_ || frame_stats_) {
+			details::correct_disparity_range(d_dispL_, param_.subpixel, param_.min_disp,
+				valid_mask_ ? &d_valid_ : nullptr, valid_mask_ ? &d_valid_rows_ : nullptr, counters);
+		}
+		else {
+			details::correct_disparity_range(d_dispL_, param_.subpixel, param_.min_disp);
+		}
+		SGM_PROFILE_STAGE(Stage::RANGE_CORRECTION, 0);
+	}
 
 	int width_;
 	int height_;
 	int disp_size_;
+	int src_depth_;
 	int src_pitch_;
 	int dst_pitch_;
 	Parameters param_;
 
 	ImageType src_type_;
+	int src_elem_size_;
 	ImageType dst_type_;
 	bool is_src_devptr_;
 	bool is_dst_devptr_;
+	bool direct_output_;
+	void* valid_mask_ = nullptr;
+	int valid_mask_pitch_ = 0;
+	int* valid_rows_ = nullptr;
+	bool frame_stats_ = false;
+	bool has_frame_stats_ = false;
 
 	DeviceImage d_srcL_;
 	DeviceImage d_srcR_;
+	DeviceImage d_srcL_buf_;
+	DeviceImage d_srcR_buf_;
 	DeviceImage d_censusL_;
 	DeviceImage d_censusR_;
 	DeviceImage d_cost_;
+	DeviceImage d_cost_sum_;
 	DeviceImage d_tmpL_;
 	DeviceImage d_tmpR_;
 	DeviceImage d_dispL_;
 	DeviceImage d_dispR_;
+	DeviceImage d_dispL_buf_;
+	DeviceImage d_mapL_xy_;
+	DeviceImage d_mapL_frac_;
+	DeviceImage d_mapR_xy_;
+	DeviceImage d_mapR_frac_;
+	DeviceImage d_mask_src_;
+	DeviceImage d_mask_;
+	DeviceImage d_mask_rows_;
+	DeviceImage d_valid_;
+	DeviceImage d_valid_rows_;
+	DeviceImage d_frame_stats_;
+	StageProfiler profiler_;
 };
 
 StereoSGM::Parameters::Parameters(int P1, int P2, float uniqueness, bool subpixel, PathType path_type,
-	int min_disp, int LR_max_diff, CensusType census_type)
+	int min_disp, int LR_max_diff, CensusType census_type, bool fused_census, InputFormat input_format,
+	EpipolarDirection epipolar_direction)
 	: P1(P1), P2(P2), uniqueness(uniqueness), subpixel(subpixel), path_type(path_type),
-	min_disp(min_disp), LR_max_diff(LR_max_diff), census_type(census_type)
+	min_disp(min_disp), LR_max_diff(LR_max_diff), census_type(census_type), fused_census(fused_census), input_format(input_format),
+	epipolar_direction(epipolar_direction)
 {
 }
 
 StereoSGM::StereoSGM(int width, int height, int disparity_size, int src_depth, int dst_depth,
 	ExecuteInOut inout_type, const Parameters& param)
 {
-	impl_ = new Impl(width, height, disparity_size, src_depth, dst_depth, width, width, inout_type, param);
+	const int src_pitch = min_src_pitch(param.input_format, width);
+	impl_ = new Impl(width, height, disparity_size, src_depth, dst_depth, src_pitch, width, inout_type, param);
 }
 
 StereoSGM::StereoSGM(int width, int height, int disparity_size, int src_depth, int dst_depth, int src_pitch, int dst_pitch,
@@ -210,9 +738,115 @@ void StereoSGM::execute(const void* srcL, const void* srcR, void* dst)
 	impl_->execute(srcL, srcR, dst);
 }
 
+void StereoSGM::execute(const PackedStereoImage& src, void* dst)
+{
+	impl_->execute(src, dst);
+}
+
+void StereoSGM::execute(const ConstImageView& left, const ConstImageView& right, const ImageView& dst)
+{
+	impl_->execute(left, right, dst);
+}
+
+void StereoSGM::set_rectification(const void* mapL_xy, const void* mapL_frac, const void* mapR_xy, const void* mapR_frac)
+{
+	impl_->set_rectification(mapL_xy, mapL_frac, mapR_xy, mapR_frac);
+}
+
+void StereoSGM::set_mask(const void* mask, int pitch_bytes, int bits_per_pixel)
+{
+	impl_->set_mask(mask, pitch_bytes, bits_per_pixel);
+}
+
+void StereoSGM::set_validity_output(void* mask, int pitch_bytes, int* row_counts)
+{
+	impl_->set_validity_output(mask, pitch_bytes, row_counts);
+}
+
 int StereoSGM::get_invalid_disparity() const
 {
 	return impl_->get_invalid_disparity();
 }
 
+int StereoSGM::get_stage_stats(StageStats* stats, int max_stats) const
+{
+	return impl_->get_stage_stats(stats, max_stats);
+}
+
+void StereoSGM::reset_stage_stats()
+{
+	impl_->reset_stage_stats();
+}
+
+void StereoSGM::begin_trace()
+{
+	impl_->begin_trace();
+}
+
+bool StereoSGM::end_trace(const char* path)
+{
+	return impl_->end_trace(path);
+}
+
+bool StereoSGM::enable_perf_counters(bool enable)
+{
+	return impl_->enable_perf_counters(enable);
+}
+
+int StereoSGM::get_perf_counter_stats(PerfCounterStats* stats, int max_stats) const
+{
+	return impl_->get_perf_counter_stats(stats, max_stats);
+}
+
+int StereoSGM::get_stage_throughput(StageThroughput* throughput, int max_throughput, double* device_bandwidth) const
+{
+	return impl_->get_stage_throughput(throughput, max_throughput, device_bandwidth);
+}
+
+void StereoSGM::enable_frame_stats(bool enable)
+{
+	impl_->enable_frame_stats(enable);
+}
+
+int StereoSGM::get_frame_stats(FrameStats* stats, int* histogram, int max_bins) const
+{
+	return impl_->get_frame_stats(stats, histogram, max_bins);
+}
+
+size_t StereoSGM::get_cost_volume(void* buffer, size_t size, bool summed) const
+{
+	return impl_->get_cost_volume(buffer, size, summed);
+}
+
+void StereoSGM::execute_cost_volume(const void* volume, size_t size, void* dst)
+{
+	impl_->execute_cost_volume(volume, size, dst);
+}
+
+void enable_metrics(bool enable)
+{
+	Metrics::instance().enable(enable);
+}
+
+int export_metrics(char* buffer, int size)
+{
+	const std::string text = Metrics::instance().text();
+	if (buffer && size > 0) {
+		const size_t n = std::min(text.size(), static_cast<size_t>(size - 1));
+		memcpy(buffer, text.data(), n);
+		buffer[n] = '\0';
+	}
+	return static_cast<int>(text.size());
+}
+
+bool serve_metrics(const char* socket_path)
+{
+	return Metrics::instance().serve(socket_path);
+}
+
+void stop_metrics_server()
+{
+	Metrics::instance().stop_serving();
+}
+
 } // namespace sgm
@@ -0,0 +1,75 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "internal.h"
+
+#include <cuda_runtime.h>
+
+#include "host_utility.h"
+
+namespace
+{
+
+__global__ void pack_mask_kernel(uint32_t* dst, uint32_t* row_counts, const uint8_t* src,
+	int width, int height, int src_pitch, int dst_pitch, bool packed)
+{
+	const int i = blockIdx.x * blockDim.x + threadIdx.x;
+	const int y = blockIdx.y * blockDim.y + threadIdx.y;
+	if (i >= dst_pitch || y >= height)
+		return;
+
+	const uint8_t* row = src + y * src_pitch;
+	uint32_t word = 0;
+	for (int b = 0; b < 32; b++) {
+		const int x = 32 * i + b;
+		if (x >= width)
+			break;
+		const bool valid = packed ? ((row[x >> 3] >> (x & 7)) & 1) : row[x] != 0;
+		word |= static_cast<uint32_t>(valid) << b;
+	}
+	dst[y * dst_pitch + i] = word;
+	if (word)
+		atomicAdd(&row_counts[y], static_cast<uint32_t>(__popc(word)));
+}
+
+} // namespace
+
+namespace sgm
+{
+namespace details
+{
+
+void pack_mask(const DeviceImage& src, int width, int bits_per_pixel, DeviceImage& dst, DeviceImage& row_counts)
+{
+	SGM_ASSERT(src.type == SGM_8U, "mask must be stored in bytes.");
+	SGM_ASSERT(bits_per_pixel == 1 || bits_per_pixel == 8, "mask must be 1 or 8 bits per pixel.");
+
+	const int h = src.rows;
+	const int words = divUp(width, 32);
+	dst.create(h, words, SGM_32U);
+	row_counts.create(1, h, SGM_32U);
+	row_counts.fill_zero();
+
+	const dim3 block(32, 8);
+	const dim3 grid(divUp(words, block.x), divUp(h, block.y));
+
+	pack_mask_kernel<<<grid, block>>>(dst.ptr<uint32_t>(), row_counts.ptr<uint32_t>(), src.ptr<uint8_t>(),
+		width, h, src.step, dst.step, bits_per_pixel == 1);
+	CUDA_CHECK(cudaGetLastError());
+}
+
+} // namespace details
+} // namespace sgm
@@ -0,0 +1,296 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "metrics.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SGM_HAS_UNIX_SOCKET
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "host_utility.h"
+
+namespace sgm
+{
+
+// upper bounds of latency buckets in seconds, from 100us to 1s, followed by +Inf
+static const double BUCKET_BOUNDS[] = { 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 1e-1, 2.5e-1, 5e-1, 1.0 };
+
+void Metrics::Histogram::observe(double seconds)
+{
+	int bucket = 0;
+	while (bucket < NUM_BUCKETS - 1 && seconds > BUCKET_BOUNDS[bucket])
+		bucket++;
+	counts[bucket].fetch_add(1, std::memory_order_relaxed);
+	sum_ns.fetch_add(static_cast<uint64_t>(seconds * 1e9), std::memory_order_relaxed);
+}
+
+void Metrics::Histogram::write(std::string& out, const char* name, const char* labels) const
+{
+	char line[256];
+	const char* sep = labels[0] ? "," : "";
+
+	// buckets are exposed cumulative
+	uint64_t count = 0;
+	for (int i = 0; i < NUM_BUCKETS; i++) {
+		count += counts[i].load(std::memory_order_relaxed);
+		if (i < NUM_BUCKETS - 1)
+			snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"%g\"} %llu\n", name, labels, sep, BUCKET_BOUNDS[i], (unsigned long long)count);
+		else
+			snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep, (unsigned long long)count);
+		out += line;
+	}
+	const double sum = 1e-9 * sum_ns.load(std::memory_order_relaxed);
+	snprintf(line, sizeof(line), labels[0] ? "%s_sum{%s} %.9f\n" : "%s_sum%s %.9f\n", name, labels, sum);
+	out += line;
+	snprintf(line, sizeof(line), labels[0] ? "%s_count{%s} %llu\n" : "%s_count%s %llu\n", name, labels, (unsigned long long)count);
+	out += line;
+}
+
+Metrics& Metrics::instance()
+{
+	static Metrics metrics;
+	return metrics;
+}
+
+Metrics::Metrics() : enabled_(false), frames_(0), drops_(0), in_flight_(0), allocated_bytes_(0), server_(nullptr)
+{
+	static_assert(sizeof(BUCKET_BOUNDS) / sizeof(BUCKET_BOUNDS[0]) == NUM_BUCKETS - 1, "bounds must cover all finite buckets");
+
+	Histogram* histograms[1 + static_cast<int>(Stage::NUM_STAGES)] = { &frame_seconds_ };
+	for (int s = 0; s < static_cast<int>(Stage::NUM_STAGES); s++)
+		histograms[1 + s] = &stage_seconds_[s];
+	for (Histogram* h : histograms) {
+		for (int i = 0; i < NUM_BUCKETS; i++)
+			h->counts[i].store(0);
+		h->sum_ns.store(0);
+	}
+}
+
+Metrics::~Metrics()
+{
+	stop_serving();
+}
+
+void Metrics::begin_frame()
+{
+	in_flight_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::end_frame(double seconds, bool dropped)
+{
+	in_flight_.fetch_sub(1, std::memory_order_relaxed);
+	if (dropped) {
+		drops_.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	frames_.fetch_add(1, std::memory_order_relaxed);
+	frame_seconds_.observe(seconds);
+}
+
+void Metrics::observe_stage(Stage stage, double seconds)
+{
+	stage_seconds_[static_cast<int>(stage)].observe(seconds);
+}
+
+std::string Metrics::text() const
+{
+	std::string out;
+	char line[256];
+
+	out += "# HELP sgm_frames_processed_total Frames executed to completion.\n";
+	out += "# TYPE sgm_frames_processed_total counter\n";
+	snprintf(line, sizeof(line), "sgm_frames_processed_total %llu\n", (unsigned long long)frames_.load(std::memory_order_relaxed));
+	out += line;
+
+	out += "# HELP sgm_frame_drops_total Frames whose execution failed with an exception.\n";
+	out += "# TYPE sgm_frame_drops_total counter\n";
+	snprintf(line, sizeof(line), "sgm_frame_drops_total %llu\n", (unsigned long long)drops_.load(std::memory_order_relaxed));
+	out += line;
+
+	out += "# HELP sgm_executions_in_flight Execute calls currently running on any thread.\n";
+	out += "# TYPE sgm_executions_in_flight gauge\n";
+	snprintf(line, sizeof(line), "sgm_executions_in_flight %lld\n", (long long)in_flight_.load(std::memory_order_relaxed));
+	out += line;
+
+	out += "# HELP sgm_device_allocated_bytes Device memory allocated by all instances.\n";
+	out += "# TYPE sgm_device_allocated_bytes gauge\n";
+	snprintf(line, sizeof(line), "sgm_device_allocated_bytes %lld\n", (long long)allocated_bytes_.load(std::memory_order_relaxed));
+	out += line;
+
+	out += "# HELP sgm_frame_duration_seconds Host time of execute calls.\n";
+	out += "# TYPE sgm_frame_duration_seconds histogram\n";
+	frame_seconds_.write(out, "sgm_frame_duration_seconds", "");
+
+	// stage durations are measured by GPU events, so only profiling builds observe them
+	out += "# HELP sgm_stage_duration_seconds Device time of pipeline stages.\n";
+	out += "# TYPE sgm_stage_duration_seconds histogram\n";
+	for (int s = 0; s < static_cast<int>(Stage::NUM_STAGES); s++) {
+		snprintf(line, sizeof(line), "stage=\"%s\"", stage_name(static_cast<Stage>(s)));
+		stage_seconds_[s].write(out, "sgm_stage_duration_seconds", line);
+	}
+
+	return out;
+}
+
+static std::mutex server_mutex;
+
+#ifdef SGM_HAS_UNIX_SOCKET
+
+struct Metrics::Server
+{
+	int fd;
+	std::string path;
+	std::atomic<bool> stop;
+	std::thread thread;
+};
+
+#ifdef MSG_NOSIGNAL
+static const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+static const int SEND_FLAGS = 0;
+#endif
+
+// a client which disconnects early must not raise SIGPIPE in the embedding process, it is just dropped
+static bool send_all(int fd, const char* data, size_t size)
+{
+	while (size > 0) {
+		const ssize_t n = ::send(fd, data, size, SEND_FLAGS);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		size -= static_cast<size_t>(n);
+	}
+	return true;
+}
+
+// every connection gets the current text, whatever it requests, so both curl and plain socket readers work
+static void serve_loop(const Metrics* metrics, int listen_fd, const std::atomic<bool>* stop)
+{
+	while (!stop->load()) {
+		pollfd pfd = { listen_fd, POLLIN, 0 };
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+
+		const int fd = accept(listen_fd, nullptr, nullptr);
+		if (fd < 0)
+			continue;
+#ifdef SO_NOSIGPIPE
+		const int on = 1;
+		setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+		// drain the request if there is one, without waiting for clients which send nothing
+		char request[1024];
+		pollfd rfd = { fd, POLLIN, 0 };
+		if (poll(&rfd, 1, 50) > 0) {
+			const ssize_t received = ::read(fd, request, sizeof(request));
+			if (received < 0) {
+				::close(fd);
+				continue;
+			}
+		}
+
+		const std::string body = metrics->text();
+		char header[128];
+		const int header_size = snprintf(header, sizeof(header),
+			"HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", body.size());
+		if (send_all(fd, header, static_cast<size_t>(header_size)))
+			send_all(fd, body.data(), body.size());
+		::close(fd);
+	}
+}
+
+bool Metrics::serve(const char* socket_path)
+{
+	std::lock_guard<std::mutex> lock(server_mutex);
+	if (server_ || socket_path == nullptr)
+		return false;
+
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(addr.sun_path))
+		return false;
+	strcpy(addr.sun_path, socket_path);
+
+	// a stale socket of a previous process would fail bind, any other file at the path is kept
+	struct stat st;
+	const bool exists = lstat(socket_path, &st) == 0;
+	SGM_ASSERT(!exists || S_ISSOCK(st.st_mode), "metrics socket path exists and is not a socket");
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return false;
+
+	if (exists)
+		unlink(socket_path);
+	if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+		::close(fd);
+		return false;
+	}
+
+	server_ = new Server();
+	server_->fd = fd;
+	server_->path = socket_path;
+	server_->stop = false;
+	server_->thread = std::thread(serve_loop, this, fd, &server_->stop);
+	return true;
+}
+
+void Metrics::stop_serving()
+{
+	std::lock_guard<std::mutex> lock(server_mutex);
+	if (!server_)
+		return;
+
+	server_->stop = true;
+	server_->thread.join();
+	::close(server_->fd);
+	unlink(server_->path.c_str());
+	delete server_;
+	server_ = nullptr;
+}
+
+#else
+
+struct Metrics::Server
+{
+};
+
+bool Metrics::serve(const char*)
+{
+	return false;
+}
+
+void Metrics::stop_serving()
+{
+}
+
+#endif
+
+} // namespace sgm
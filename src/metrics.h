@@ -0,0 +1,119 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <string>
+
+#include "profiler.h"
+
+namespace sgm
+{
+
+/**
+* Process-wide metrics of all StereoSGM instances in Prometheus text exposition format.
+* Updates are relaxed atomic increments into fixed arrays, so executing threads never take a lock
+* and exporting only reads a possibly slightly inconsistent snapshot.
+*/
+class Metrics
+{
+public:
+
+	static Metrics& instance();
+
+	void enable(bool enable) { enabled_.store(enable, std::memory_order_relaxed); }
+	bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+	void begin_frame();
+	void end_frame(double seconds, bool dropped);
+	void observe_stage(Stage stage, double seconds);
+
+	// device memory is counted whether or not metrics are enabled, so the gauge is right when enabled later
+	void add_allocated(int64_t bytes) { allocated_bytes_.fetch_add(bytes, std::memory_order_relaxed); }
+
+	std::string text() const;
+
+	// serves text() over HTTP/1.0 on a unix-domain socket from a background thread
+	bool serve(const char* socket_path);
+	void stop_serving();
+
+private:
+
+	static constexpr int NUM_BUCKETS = 14;
+
+	struct Histogram
+	{
+		std::atomic<uint64_t> counts[NUM_BUCKETS]; // per bucket, the last one is +Inf
+		std::atomic<uint64_t> sum_ns;
+
+		void observe(double seconds);
+		void write(std::string& out, const char* name, const char* labels) const;
+	};
+
+	Metrics();
+	~Metrics();
+
+	std::atomic<bool> enabled_;
+	std::atomic<uint64_t> frames_;
+	std::atomic<uint64_t> drops_;
+	std::atomic<int64_t> in_flight_;
+	std::atomic<int64_t> allocated_bytes_;
+	Histogram frame_seconds_;
+	Histogram stage_seconds_[static_cast<int>(Stage::NUM_STAGES)];
+
+	struct Server;
+	Server* server_;
+
+	Metrics(const Metrics&);
+	Metrics& operator=(const Metrics&);
+};
+
+// counts one execution as in flight while in scope, and as dropped if left by an exception
+class MetricsFrame
+{
+public:
+
+	MetricsFrame() : enabled_(Metrics::instance().enabled()), exceptions_(std::uncaught_exceptions())
+	{
+		if (enabled_) {
+			Metrics::instance().begin_frame();
+			begin_ = std::chrono::steady_clock::now();
+		}
+	}
+
+	~MetricsFrame()
+	{
+		if (enabled_) {
+			const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin_;
+			Metrics::instance().end_frame(elapsed.count(), std::uncaught_exceptions() > exceptions_);
+		}
+	}
+
+private:
+
+	bool enabled_;
+	int exceptions_;
+	std::chrono::steady_clock::time_point begin_;
+};
+
+} // namespace sgm
+
+#endif // !__METRICS_H__
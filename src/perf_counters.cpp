@@ -0,0 +1,118 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "perf_counters.h"
+
+#if defined(__linux__)
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace sgm
+{
+
+PerfCounters::PerfCounters()
+{
+	for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+		fds_[i] = -1;
+}
+
+PerfCounters::~PerfCounters()
+{
+	close();
+}
+
+#if defined(__linux__)
+
+static int open_counter(uint32_t type, uint64_t config)
+{
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	// this thread on any CPU
+	return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+bool PerfCounters::open()
+{
+	close();
+
+	fds_[PERF_CYCLES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	fds_[PERF_INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	fds_[PERF_LLC_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	fds_[PERF_STALLED_CYCLES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND);
+	owner_ = std::this_thread::get_id();
+
+	bool any = false;
+	for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+		any |= fds_[i] >= 0;
+	return any;
+}
+
+void PerfCounters::close()
+{
+	for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+		if (fds_[i] >= 0)
+			::close(fds_[i]);
+		fds_[i] = -1;
+	}
+	owner_ = std::thread::id();
+}
+
+uint32_t PerfCounters::read(uint64_t values[NUM_PERF_COUNTERS]) const
+{
+	uint32_t valid = 0;
+	for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+		uint64_t value = 0;
+		if (fds_[i] >= 0 && ::read(fds_[i], &value, sizeof(value)) == sizeof(value)) {
+			values[i] = value;
+			valid |= 1u << i;
+		}
+	}
+	return valid;
+}
+
+#else
+
+bool PerfCounters::open()
+{
+	return false;
+}
+
+void PerfCounters::close()
+{
+}
+
+uint32_t PerfCounters::read(uint64_t*) const
+{
+	return 0;
+}
+
+#endif
+
+bool PerfCounters::is_open_for_this_thread() const
+{
+	return owner_ == std::this_thread::get_id();
+}
+
+} // namespace sgm
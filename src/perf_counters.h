@@ -0,0 +1,67 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __PERF_COUNTERS_H__
+#define __PERF_COUNTERS_H__
+
+#include <cstdint>
+#include <thread>
+
+namespace sgm
+{
+
+enum PerfCounter
+{
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_LLC_MISSES,
+	PERF_STALLED_CYCLES,
+	NUM_PERF_COUNTERS
+};
+
+/**
+* Hardware counters of the calling thread, read through perf_event_open on Linux.
+* Counters which cannot be opened, e.g. in containers without perf access or on other platforms, are never read.
+*/
+class PerfCounters
+{
+public:
+
+	PerfCounters();
+	~PerfCounters();
+
+	// opens counters for the calling thread, returns false if none is available
+	bool open();
+	void close();
+
+	// true if counters are open for the calling thread
+	bool is_open_for_this_thread() const;
+
+	// returns a mask of the counters read, 1 << PerfCounter each, values of other counters are left untouched
+	uint32_t read(uint64_t values[NUM_PERF_COUNTERS]) const;
+
+private:
+
+	int fds_[NUM_PERF_COUNTERS];
+	std::thread::id owner_;
+
+	PerfCounters(const PerfCounters&);
+	PerfCounters& operator=(const PerfCounters&);
+};
+
+} // namespace sgm
+
+#endif // !__PERF_COUNTERS_H__
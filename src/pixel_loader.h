@@ -0,0 +1,261 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __PIXEL_LOADER_H__
+#define __PIXEL_LOADER_H__
+
+#include <type_traits>
+
+#include <cuda.h>
+
+#include "libsgm.h"
+#include "device_image.h"
+#include "host_utility.h"
+
+namespace sgm
+{
+
+/**
+* Pixel loaders return the intensity used for matching at (x, y).
+* Format conversion happens while pixels are loaded, so no converted image is stored.
+*/
+template <typename T>
+struct GrayLoader
+{
+	using pixel_type = T;
+
+	const T* data;
+	int pitch;
+
+	__device__ inline pixel_type operator()(int x, int y) const
+	{
+		return __ldg(&data[x + y * pitch]);
+	}
+};
+
+// 8 bits per channel interleaved color, luma by ITU-R BT.601 weights
+template <int R_OFFSET, int B_OFFSET>
+struct ColorLoader
+{
+	using pixel_type = uint8_t;
+
+	const uint8_t* data;
+	int pitch;
+
+	__device__ inline pixel_type operator()(int x, int y) const
+	{
+		const uint8_t* p = data + y * pitch + 3 * x;
+		const int r = __ldg(p + R_OFFSET);
+		const int g = __ldg(p + 1);
+		const int b = __ldg(p + B_OFFSET);
+		return static_cast<pixel_type>((77 * r + 150 * g + 29 * b + 128) >> 8);
+	}
+};
+
+using BGRLoader = ColorLoader<2, 0>;
+using RGBLoader = ColorLoader<0, 2>;
+
+// MIPI CSI-2 RAW10, 4 pixels packed in 5 bytes
+struct Raw10Loader
+{
+	using pixel_type = uint16_t;
+
+	const uint8_t* data;
+	int pitch;
+
+	__device__ inline pixel_type operator()(int x, int y) const
+	{
+		const uint8_t* p = data + y * pitch + (x >> 2) * 5;
+		const int i = x & 3;
+		return static_cast<pixel_type>((__ldg(p + i) << 2) | ((__ldg(p + 4) >> (2 * i)) & 0x3));
+	}
+};
+
+// MIPI CSI-2 RAW12, 2 pixels packed in 3 bytes
+struct Raw12Loader
+{
+	using pixel_type = uint16_t;
+
+	const uint8_t* data;
+	int pitch;
+
+	__device__ inline pixel_type operator()(int x, int y) const
+	{
+		const uint8_t* p = data + y * pitch + (x >> 1) * 3;
+		const int i = x & 1;
+		return static_cast<pixel_type>((__ldg(p + i) << 4) | ((__ldg(p + 2) >> (4 * i)) & 0xf));
+	}
+};
+
+// Any 2x2 block of a Bayer mosaic holds one R, two G and one B sample regardless of its phase,
+// so (R + 2G + B) / 4 is computed from the block whose top left is (x, y).
+// Both views are shifted by the same half pixel, which leaves disparities unchanged.
+template <typename RAW_LOADER>
+struct BayerLoader
+{
+	using pixel_type = typename RAW_LOADER::pixel_type;
+
+	RAW_LOADER raw;
+	int width;
+	int height;
+
+	__device__ inline pixel_type operator()(int x, int y) const
+	{
+		const int x1 = x + 1 < width ? x + 1 : x - 1;
+		const int y1 = y + 1 < height ? y + 1 : y - 1;
+		const uint32_t sum = raw(x, y) + raw(x1, y) + raw(x, y1) + raw(x1, y1);
+		return static_cast<pixel_type>((sum + 2) >> 2);
+	}
+};
+
+static constexpr int REMAP_FRAC_BITS = 5;
+static constexpr int REMAP_TAB_SIZE = 1 << REMAP_FRAC_BITS;
+
+/**
+* Samples the source bilinearly at the position given by a fixed-point remap table.
+* map_xy holds 16-bit integer source coordinates as (x, y) pairs and map_frac holds (fy << 5) | fx,
+* the same layout as maps converted by cv::convertMaps to CV_16SC2.
+* Positions outside the source read as zero.
+*/
+template <typename PIXEL_LOADER>
+struct RemapLoader
+{
+	using pixel_type = typename PIXEL_LOADER::pixel_type;
+	using acc_type = typename std::conditional<sizeof(pixel_type) < 4, uint32_t, uint64_t>::type;
+
+	PIXEL_LOADER src;
+	const uint32_t* map_xy;
+	const uint16_t* map_frac;
+	int map_pitch;
+	int width;
+	int height;
+
+	__device__ inline acc_type sample(int x, int y) const
+	{
+		return 0 <= x && x < width && 0 <= y && y < height ? static_cast<acc_type>(src(x, y)) : acc_type(0);
+	}
+
+	__device__ inline pixel_type operator()(int x, int y) const
+	{
+		const uint32_t xy = __ldg(&map_xy[x + y * map_pitch]);
+		const int frac = __ldg(&map_frac[x + y * map_pitch]);
+		const int sx = static_cast<int16_t>(xy & 0xffff);
+		const int sy = static_cast<int16_t>(xy >> 16);
+		const acc_type fx = frac & (REMAP_TAB_SIZE - 1);
+		const acc_type fy = (frac >> REMAP_FRAC_BITS) & (REMAP_TAB_SIZE - 1);
+
+		const acc_type top = (REMAP_TAB_SIZE - fx) * sample(sx, sy) + fx * sample(sx + 1, sy);
+		const acc_type bottom = (REMAP_TAB_SIZE - fx) * sample(sx, sy + 1) + fx * sample(sx + 1, sy + 1);
+		const acc_type sum = (REMAP_TAB_SIZE - fy) * top + fy * bottom;
+		return static_cast<pixel_type>((sum + (REMAP_TAB_SIZE * REMAP_TAB_SIZE / 2)) >> (2 * REMAP_FRAC_BITS));
+	}
+};
+
+/**
+* Adapts a pixel loader to the accessor interface of census computation.
+*/
+template <typename LOADER>
+struct LoaderPixelAccessor
+{
+	const LOADER& loader;
+	int x, y;
+
+	__device__ LoaderPixelAccessor(const LOADER& loader, int x, int y) : loader(loader), x(x), y(y) {}
+	__device__ typename LOADER::pixel_type operator()(int dx, int dy) const { return loader(x + dx, y + dy); }
+};
+
+/**
+* Calls f(loader) with the pixel loader which decodes src stored in format.
+*/
+template <typename Functor>
+inline void dispatch_pixel_loader(const DeviceImage& src, InputFormat format, const Functor& f)
+{
+	const int w = src.cols;
+	const int h = src.rows;
+	const int pitch = src.step;
+
+	switch (format) {
+	case InputFormat::GRAY:
+		if (src.type == SGM_8U)
+			f(GrayLoader<uint8_t>{ src.ptr<uint8_t>(), pitch });
+		else if (src.type == SGM_16U)
+			f(GrayLoader<uint16_t>{ src.ptr<uint16_t>(), pitch });
+		else
+			f(GrayLoader<uint32_t>{ src.ptr<uint32_t>(), pitch });
+		break;
+	case InputFormat::BGR:
+		f(BGRLoader{ src.ptr<uint8_t>(), pitch });
+		break;
+	case InputFormat::RGB:
+		f(RGBLoader{ src.ptr<uint8_t>(), pitch });
+		break;
+	case InputFormat::BAYER:
+		if (src.type == SGM_8U)
+			f(BayerLoader<GrayLoader<uint8_t>>{ { src.ptr<uint8_t>(), pitch }, w, h });
+		else
+			f(BayerLoader<GrayLoader<uint16_t>>{ { src.ptr<uint16_t>(), pitch }, w, h });
+		break;
+	case InputFormat::RAW10:
+		f(Raw10Loader{ src.ptr<uint8_t>(), pitch });
+		break;
+	case InputFormat::RAW12:
+		f(Raw12Loader{ src.ptr<uint8_t>(), pitch });
+		break;
+	case InputFormat::BAYER_RAW10:
+		f(BayerLoader<Raw10Loader>{ { src.ptr<uint8_t>(), pitch }, w, h });
+		break;
+	case InputFormat::BAYER_RAW12:
+		f(BayerLoader<Raw12Loader>{ { src.ptr<uint8_t>(), pitch }, w, h });
+		break;
+	}
+}
+
+template <typename Functor>
+struct RemapDispatcher
+{
+	const DeviceImage& map_xy;
+	const DeviceImage& map_frac;
+	int width;
+	int height;
+	const Functor& f;
+
+	template <typename PIXEL_LOADER>
+	void operator()(const PIXEL_LOADER& src) const
+	{
+		f(RemapLoader<PIXEL_LOADER>{ src, map_xy.ptr<uint32_t>(), map_frac.ptr<uint16_t>(), map_xy.step, width, height });
+	}
+};
+
+/**
+* Same as above, but samples src through the remap table if map_xy is not empty.
+*/
+template <typename Functor>
+inline void dispatch_pixel_loader(const DeviceImage& src, InputFormat format,
+	const DeviceImage& map_xy, const DeviceImage& map_frac, const Functor& f)
+{
+	if (map_xy.data == nullptr) {
+		dispatch_pixel_loader(src, format, f);
+		return;
+	}
+
+	SGM_ASSERT(map_xy.rows == src.rows && map_xy.cols == src.cols, "remap table size must be same as image size.");
+	SGM_ASSERT(map_xy.step == map_frac.step, "remap tables must have same pitch.");
+	dispatch_pixel_loader(src, format, RemapDispatcher<Functor>{ map_xy, map_frac, src.cols, src.rows, f });
+}
+
+} // namespace sgm
+
+#endif // !__PIXEL_LOADER_H__
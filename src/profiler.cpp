@@ -0,0 +1,433 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "device_image.h"
+#include "host_utility.h"
+#include "metrics.h"
+
+namespace sgm
+{
+
+const char* stage_name(Stage stage)
+{
+	static const char* names[] =
+	{
+		"input",
+		"census_left",
+		"census_right",
+		"aggregation_up2down",
+		"aggregation_down2up",
+		"aggregation_left2right",
+		"aggregation_right2left",
+		"aggregation_upleft2downright",
+		"aggregation_upright2downleft",
+		"aggregation_downright2upleft",
+		"aggregation_downleft2upright",
+		"aggregation",
+		"winner_takes_all",
+		"median_left",
+		"median_right",
+		"consistency_check",
+		"range_correction",
+		"output",
+	};
+	static_assert(sizeof(names) / sizeof(names[0]) == static_cast<size_t>(Stage::NUM_STAGES), "stage names must cover all stages");
+	return names[static_cast<int>(stage)];
+}
+
+// STREAM copy style: every byte is read once and written once, repeated to amortize launch latency
+double measure_device_bandwidth()
+{
+	const int size = 64 << 20;
+	const int iterations = 10;
+	DeviceImage src(1, size, SGM_8U), dst(1, size, SGM_8U);
+	src.fill_zero();
+
+	cudaEvent_t start, stop;
+	CUDA_CHECK(cudaEventCreate(&start));
+	CUDA_CHECK(cudaEventCreate(&stop));
+
+	CUDA_CHECK(cudaMemcpy(dst.data, src.data, size, cudaMemcpyDeviceToDevice));
+	CUDA_CHECK(cudaEventRecord(start, 0));
+	for (int i = 0; i < iterations; i++)
+		CUDA_CHECK(cudaMemcpy(dst.data, src.data, size, cudaMemcpyDeviceToDevice));
+	CUDA_CHECK(cudaEventRecord(stop, 0));
+	CUDA_CHECK(cudaEventSynchronize(stop));
+
+	float ms = 0.f;
+	CUDA_CHECK(cudaEventElapsedTime(&ms, start, stop));
+	cudaEventDestroy(start);
+	cudaEventDestroy(stop);
+
+	return ms > 0.f ? 2.0 * size * iterations / (1e6 * ms) : 0.0;
+}
+
+#ifdef LIBSGM_ENABLE_PROFILING
+
+StageProfiler::StageProfiler() : current_(0), last_default_(0), tracing_(false), frame_(0), trace_head_(0),
+	perf_enabled_(false), perf_last_valid_(0)
+{
+	static std::atomic<int> instances(0);
+	id_ = instances++;
+
+	for (Frame& frame : frames_) {
+		for (int i = 0; i < MAX_EVENTS; i++)
+			CUDA_CHECK(cudaEventCreate(&frame.events[i]));
+		frame.num_events = 0;
+		frame.num_records = 0;
+		frame.index = 0;
+		frame.traced = false;
+	}
+	CUDA_CHECK(cudaEventCreate(&trace_origin_));
+	for (auto& ring : rings_) {
+		for (auto& sample : ring.samples)
+			sample.store(0.f, std::memory_order_relaxed);
+		ring.head.store(0);
+	}
+	for (int s = 0; s < static_cast<int>(Stage::NUM_STAGES); s++) {
+		for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+			perf_totals_[s][i].store(0);
+			perf_counts_[s][i].store(0);
+		}
+		perf_samples_[s].store(0);
+		work_[s] = StageWork{ 0, 0, 0 };
+	}
+}
+
+StageProfiler::~StageProfiler()
+{
+	for (Frame& frame : frames_)
+		for (int i = 0; i < MAX_EVENTS; i++)
+			cudaEventDestroy(frame.events[i]);
+	cudaEventDestroy(trace_origin_);
+}
+
+StageProfiler*& StageProfiler::current()
+{
+	static thread_local StageProfiler* profiler = nullptr;
+	return profiler;
+}
+
+void StageProfiler::begin_frame()
+{
+	resolve_completed();
+
+	// events of the frame before last are reused, if it is still running its samples are lost rather than waited for
+	current_ ^= 1;
+	Frame& frame = frames_[current_];
+	frame.num_records = 0;
+	frame.index = frame_++;
+	frame.traced = tracing_;
+
+	CUDA_CHECK(cudaEventRecord(frame.events[0], 0));
+	frame.num_events = 1;
+	last_default_ = 0;
+
+	if (perf_enabled_) {
+		// counters count the thread which opened them, follow the executing thread
+		if (!perf_.is_open_for_this_thread())
+			perf_.open();
+		perf_last_valid_ = perf_.read(perf_last_);
+	}
+}
+
+void StageProfiler::end_frame()
+{
+	resolve(frames_[current_]);
+}
+
+void StageProfiler::record(Stage stage, cudaStream_t stream)
+{
+	Frame& frame = frames_[current_];
+	if (frame.num_events >= MAX_EVENTS)
+		return;
+
+	if (perf_enabled_) {
+		// a delta needs two successful reads, a failed read keeps the last value for the next stage
+		uint64_t now[NUM_PERF_COUNTERS];
+		const uint32_t valid = perf_.read(now);
+		const int s = static_cast<int>(stage);
+		for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+			if (!(valid & (1u << i)))
+				continue;
+			if ((perf_last_valid_ & (1u << i)) && now[i] >= perf_last_[i]) {
+				perf_totals_[s][i].fetch_add(now[i] - perf_last_[i], std::memory_order_relaxed);
+				perf_counts_[s][i].fetch_add(1, std::memory_order_relaxed);
+			}
+			perf_last_[i] = now[i];
+		}
+		perf_last_valid_ |= valid;
+		perf_samples_[s].fetch_add(1, std::memory_order_release);
+	}
+
+	const int end = frame.num_events++;
+	CUDA_CHECK(cudaEventRecord(frame.events[end], stream));
+	frame.records[frame.num_records++] = { stage, last_default_, end, stream != 0 };
+	if (stream == 0)
+		last_default_ = end;
+}
+
+// publishes the samples of a frame if all of its events have completed, returns false if some have not
+bool StageProfiler::resolve(Frame& frame)
+{
+	if (frame.num_records == 0)
+		return true;
+
+	for (int i = 0; i < frame.num_records; i++) {
+		const cudaError_t err = cudaEventQuery(frame.events[frame.records[i].end]);
+		if (err == cudaErrorNotReady)
+			return false;
+		CUDA_CHECK(err);
+	}
+
+	for (int i = 0; i < frame.num_records; i++) {
+		const Record& r = frame.records[i];
+		float ms = 0.f;
+		CUDA_CHECK(cudaEventElapsedTime(&ms, frame.events[r.begin], frame.events[r.end]));
+
+		Ring& ring = rings_[static_cast<int>(r.stage)];
+		const uint32_t head = ring.head.load(std::memory_order_relaxed);
+		ring.samples[head % RING_SIZE].store(ms, std::memory_order_relaxed);
+		ring.head.store(head + 1, std::memory_order_release);
+
+		if (Metrics::instance().enabled())
+			Metrics::instance().observe_stage(r.stage, 1e-3 * ms);
+
+		if (frame.traced && tracing_) {
+			float begin = 0.f;
+			CUDA_CHECK(cudaEventElapsedTime(&begin, trace_origin_, frame.events[r.begin]));
+			const TraceEvent e{ r.stage, frame.index, begin, ms, r.forked };
+			if (trace_.size() < MAX_TRACE_EVENTS)
+				trace_.push_back(e);
+			else
+				trace_[trace_head_ % MAX_TRACE_EVENTS] = e;
+			trace_head_++;
+		}
+	}
+	frame.num_records = 0;
+	return true;
+}
+
+void StageProfiler::resolve_completed()
+{
+	// the older frame first, so that samples are published in frame order
+	resolve(frames_[current_ ^ 1]);
+	resolve(frames_[current_]);
+}
+
+void StageProfiler::begin_trace()
+{
+	resolve_completed();
+
+	// frames begun before the trace started are not traced
+	for (Frame& frame : frames_)
+		frame.traced = false;
+	trace_.clear();
+	trace_head_ = 0;
+	frame_ = 0;
+	tracing_ = true;
+	CUDA_CHECK(cudaEventRecord(trace_origin_, 0));
+}
+
+bool StageProfiler::end_trace(const char* path)
+{
+	if (!tracing_)
+		return false;
+
+	CUDA_CHECK(cudaDeviceSynchronize());
+	resolve_completed();
+	tracing_ = false;
+
+	FILE* fp = fopen(path, "w");
+	if (!fp)
+		return false;
+
+	// a full ring keeps the most recent events, oldest first from the next slot to be overwritten
+	if (trace_.size() == MAX_TRACE_EVENTS)
+		std::rotate(trace_.begin(), trace_.begin() + trace_head_ % MAX_TRACE_EVENTS, trace_.end());
+
+	// stages on the default stream share track 0, forked stages get a track each
+	auto track = [](Stage stage, bool forked) { return forked ? static_cast<int>(stage) + 1 : 0; };
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"StereoSGM #%d\"}},\n", id_, id_);
+	fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"default stream\"}}", id_);
+	bool named[static_cast<int>(Stage::NUM_STAGES)] = {};
+	for (const TraceEvent& e : trace_) {
+		if (e.forked && !named[static_cast<int>(e.stage)]) {
+			named[static_cast<int>(e.stage)] = true;
+			fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+				id_, track(e.stage, true), stage_name(e.stage));
+		}
+	}
+	// timestamps are in microseconds from begin_trace
+	for (const TraceEvent& e : trace_) {
+		fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"sgm\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"frame\":%d}}",
+			stage_name(e.stage), 1e3 * e.begin, 1e3 * e.duration, id_, track(e.stage, e.forked), e.frame);
+	}
+	fprintf(fp, "\n]}\n");
+	const bool ok = ferror(fp) == 0;
+	fclose(fp);
+
+	trace_.clear();
+	trace_head_ = 0;
+	return ok;
+}
+
+bool StageProfiler::enable_perf_counters(bool enable)
+{
+	perf_enabled_ = false;
+	perf_.close();
+	if (!enable)
+		return false;
+
+	// unavailable counters, e.g. without perf access in containers, leave profiling by events working
+	perf_enabled_ = perf_.open();
+	return perf_enabled_;
+}
+
+int StageProfiler::get_perf_stats(PerfCounterStats* stats, int max_stats)
+{
+	int num_stats = 0;
+	for (int s = 0; s < static_cast<int>(Stage::NUM_STAGES); s++) {
+		const uint32_t count = perf_samples_[s].load(std::memory_order_acquire);
+		if (count == 0)
+			continue;
+
+		if (num_stats < max_stats) {
+			// counters never read for the stage are unavailable, reported as -1
+			double v[NUM_PERF_COUNTERS];
+			for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+				const uint32_t n = perf_counts_[s][i].load(std::memory_order_relaxed);
+				v[i] = n > 0 ? static_cast<double>(perf_totals_[s][i].load(std::memory_order_relaxed)) / n : -1;
+			}
+
+			PerfCounterStats& st = stats[num_stats];
+			st.name = stage_name(static_cast<Stage>(s));
+			st.count = static_cast<int>(count);
+			st.cycles = v[PERF_CYCLES];
+			st.instructions = v[PERF_INSTRUCTIONS];
+			st.llc_misses = v[PERF_LLC_MISSES];
+			st.stalled_cycles = v[PERF_STALLED_CYCLES];
+			st.ipc = v[PERF_CYCLES] > 0 && v[PERF_INSTRUCTIONS] >= 0 ? v[PERF_INSTRUCTIONS] / v[PERF_CYCLES] : -1;
+		}
+		num_stats++;
+	}
+	return num_stats;
+}
+
+void StageProfiler::set_work(Stage stage, const StageWork& work)
+{
+	work_[static_cast<int>(stage)] = work;
+}
+
+int StageProfiler::get_throughput(StageThroughput* throughput, int max_throughput, double* device_bandwidth)
+{
+	// measured once, on first request, so that construction and execution are not slowed down
+	static const double bandwidth = measure_device_bandwidth();
+	if (device_bandwidth)
+		*device_bandwidth = bandwidth;
+
+	int num_throughput = 0;
+	for (int s = 0; s < static_cast<int>(Stage::NUM_STAGES); s++) {
+		const StageWork& work = work_[s];
+		StageStats st;
+		if ((work.bytes == 0 && work.cell_updates == 0) || !stage_stats(static_cast<Stage>(s), st))
+			continue;
+
+		if (num_throughput < max_throughput) {
+			const double sec = 1e-3 * st.mean;
+			StageThroughput& t = throughput[num_throughput];
+			t.name = st.name;
+			t.bytes = work.bytes;
+			t.cell_updates = work.cell_updates;
+			t.hamming_ops = work.hamming_ops;
+			t.gb_per_sec = sec > 0 ? 1e-9 * work.bytes / sec : 0;
+			t.gcells_per_sec = sec > 0 ? 1e-9 * work.cell_updates / sec : 0;
+			t.bandwidth_ratio = bandwidth > 0 ? t.gb_per_sec / bandwidth : 0;
+		}
+		num_throughput++;
+	}
+	return num_throughput;
+}
+
+bool StageProfiler::stage_stats(Stage stage, StageStats& st) const
+{
+	const Ring& ring = rings_[static_cast<int>(stage)];
+	const uint32_t head = ring.head.load(std::memory_order_acquire);
+	const int count = static_cast<int>(std::min(head, RING_SIZE));
+	if (count == 0)
+		return false;
+
+	std::vector<float> samples(count);
+	for (int i = 0; i < count; i++)
+		samples[i] = ring.samples[i].load(std::memory_order_relaxed);
+	std::sort(samples.begin(), samples.end());
+
+	double sum = 0;
+	for (float v : samples)
+		sum += v;
+
+	st.name = stage_name(stage);
+	st.count = count;
+	st.min = samples.front();
+	st.mean = static_cast<float>(sum / count);
+	st.p50 = percentile(samples.data(), samples.size(), 0.50);
+	st.p99 = percentile(samples.data(), samples.size(), 0.99);
+	return true;
+}
+
+void StageProfiler::reset_stats()
+{
+	// completed frames still reach metrics and the trace
+	resolve_completed();
+	for (Frame& frame : frames_)
+		frame.num_records = 0;
+
+	for (Ring& ring : rings_)
+		ring.head.store(0, std::memory_order_release);
+	for (int s = 0; s < static_cast<int>(Stage::NUM_STAGES); s++) {
+		for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+			perf_totals_[s][i].store(0, std::memory_order_relaxed);
+			perf_counts_[s][i].store(0, std::memory_order_relaxed);
+		}
+		perf_samples_[s].store(0, std::memory_order_release);
+	}
+}
+
+int StageProfiler::get_stats(StageStats* stats, int max_stats)
+{
+	int num_stats = 0;
+	for (int s = 0; s < static_cast<int>(Stage::NUM_STAGES); s++) {
+		StageStats st;
+		if (!stage_stats(static_cast<Stage>(s), st))
+			continue;
+		if (num_stats < max_stats)
+			stats[num_stats] = st;
+		num_stats++;
+	}
+	return num_stats;
+}
+
+#endif // LIBSGM_ENABLE_PROFILING
+
+} // namespace sgm
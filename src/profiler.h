@@ -0,0 +1,238 @@
+/*
+Copyright 2016 Fixstars Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http ://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <cuda_runtime.h>
+
+#include "libsgm.h"
+#include "perf_counters.h"
+
+namespace sgm
+{
+
+enum class Stage
+{
+	INPUT,
+	CENSUS_LEFT,
+	CENSUS_RIGHT,
+	AGGREGATION_UP2DOWN,
+	AGGREGATION_DOWN2UP,
+	AGGREGATION_LEFT2RIGHT,
+	AGGREGATION_RIGHT2LEFT,
+	AGGREGATION_UPLEFT2DOWNRIGHT,
+	AGGREGATION_UPRIGHT2DOWNLEFT,
+	AGGREGATION_DOWNRIGHT2UPLEFT,
+	AGGREGATION_DOWNLEFT2UPRIGHT,
+	AGGREGATION,
+	WINNER_TAKES_ALL,
+	MEDIAN_LEFT,
+	MEDIAN_RIGHT,
+	CONSISTENCY_CHECK,
+	RANGE_CORRECTION,
+	OUTPUT,
+	NUM_STAGES
+};
+
+const char* stage_name(Stage stage);
+
+// work of a stage per frame, known analytically from the configuration
+struct StageWork
+{
+	double bytes;        // bytes read and written
+	double cell_updates; // pixel x disparity updates of the path recurrence
+	double hamming_ops;  // hamming distances of census features
+};
+
+// device to device copy bandwidth in GB/s, the ceiling of memory bound kernels
+double measure_device_bandwidth();
+
+#ifdef LIBSGM_ENABLE_PROFILING
+
+/**
+* Times pipeline stages by one CUDA event recorded at the end of each stage.
+* A stage on the default stream lasts from the previous event on the default stream,
+* a stage on another stream from the last default stream event before it, i.e. the point where the stream was forked.
+* Forked streams are joined by a stage on the default stream, which the next default stream stage starts from.
+* Events of a frame are resolved by querying them at its end or when a later frame begins, so timing never blocks
+* the pipeline; a frame still running when its events are reused two frames later is dropped.
+* Statistics may be read from any thread.
+*/
+class StageProfiler
+{
+public:
+
+	StageProfiler();
+	~StageProfiler();
+
+	void begin_frame();
+	void end_frame();
+	void record(Stage stage, cudaStream_t stream);
+	int get_stats(StageStats* stats, int max_stats);
+
+	// discards samples and counters collected so far, including those of frames still running
+	void reset_stats();
+
+	// stages resolved while tracing are kept as Chrome Trace Event JSON, one track per stream,
+	// up to the most recent MAX_TRACE_EVENTS stages
+	void begin_trace();
+	bool end_trace(const char* path);
+
+	// host hardware counters of the executing thread, read at the same stage boundaries as the events
+	bool enable_perf_counters(bool enable);
+	int get_perf_stats(PerfCounterStats* stats, int max_stats);
+
+	// achieved throughput of stages from their work and mean times
+	void set_work(Stage stage, const StageWork& work);
+	int get_throughput(StageThroughput* throughput, int max_throughput, double* device_bandwidth);
+
+	// the profiler which stages of the calling thread are recorded to
+	static StageProfiler*& current();
+
+private:
+
+	static constexpr int MAX_EVENTS = static_cast<int>(Stage::NUM_STAGES) + 1;
+	static constexpr uint32_t RING_SIZE = 1024;
+	static constexpr size_t MAX_TRACE_EVENTS = 1 << 16;
+
+	struct Record
+	{
+		Stage stage;
+		int begin, end;
+		bool forked;
+	};
+
+	struct TraceEvent
+	{
+		Stage stage;
+		int frame;
+		float begin, duration;
+		bool forked;
+	};
+
+	// events of a frame, double buffered so that a frame is resolved while the next one is recorded
+	struct Frame
+	{
+		cudaEvent_t events[MAX_EVENTS];
+		Record records[MAX_EVENTS];
+		int num_events;
+		int num_records;
+		int index;
+		bool traced;
+	};
+
+	// single writer ring of the most recent samples, readers take a snapshot of what has been published
+	struct Ring
+	{
+		std::atomic<float> samples[RING_SIZE];
+		std::atomic<uint32_t> head;
+	};
+
+	bool resolve(Frame& frame);
+	void resolve_completed();
+	bool stage_stats(Stage stage, StageStats& st) const;
+
+	Frame frames_[2];
+	int current_;
+	int last_default_;
+	Ring rings_[static_cast<int>(Stage::NUM_STAGES)];
+
+	// trace ring of this instance, so tracing never synchronizes instances run by different threads
+	bool tracing_;
+	int id_;
+	int frame_;
+	cudaEvent_t trace_origin_;
+	std::vector<TraceEvent> trace_;
+	size_t trace_head_;
+
+	bool perf_enabled_;
+	PerfCounters perf_;
+	uint64_t perf_last_[NUM_PERF_COUNTERS];
+	uint32_t perf_last_valid_;
+	std::atomic<uint64_t> perf_totals_[static_cast<int>(Stage::NUM_STAGES)][NUM_PERF_COUNTERS];
+	std::atomic<uint32_t> perf_counts_[static_cast<int>(Stage::NUM_STAGES)][NUM_PERF_COUNTERS];
+	std::atomic<uint32_t> perf_samples_[static_cast<int>(Stage::NUM_STAGES)];
+
+	StageWork work_[static_cast<int>(Stage::NUM_STAGES)];
+
+	StageProfiler(const StageProfiler&);
+	StageProfiler& operator=(const StageProfiler&);
+};
+
+// makes a profiler current for the calling thread while in scope
+class ProfilerScope
+{
+public:
+
+	explicit ProfilerScope(StageProfiler& profiler) : profiler_(profiler), prev_(StageProfiler::current())
+	{
+		StageProfiler::current() = &profiler;
+		profiler.begin_frame();
+	}
+
+	~ProfilerScope()
+	{
+		profiler_.end_frame();
+		StageProfiler::current() = prev_;
+	}
+
+private:
+
+	StageProfiler& profiler_;
+	StageProfiler* prev_;
+};
+
+#define SGM_PROFILE_STAGE(stage, stream) \
+do { \
+	if (::sgm::StageProfiler* profiler_ = ::sgm::StageProfiler::current()) \
+		profiler_->record((stage), (stream)); \
+} while (0)
+
+#else
+
+class StageProfiler
+{
+public:
+
+	int get_stats(StageStats*, int) { return 0; }
+	void reset_stats() {}
+	void begin_trace() {}
+	bool end_trace(const char*) { return false; }
+	bool enable_perf_counters(bool) { return false; }
+	int get_perf_stats(PerfCounterStats*, int) { return 0; }
+	void set_work(Stage, const StageWork&) {}
+	int get_throughput(StageThroughput*, int, double*) { return 0; }
+};
+
+class ProfilerScope
+{
+public:
+
+	explicit ProfilerScope(StageProfiler&) {}
+};
+
+#define SGM_PROFILE_STAGE(stage, stream) do {} while (0)
+
+#endif // LIBSGM_ENABLE_PROFILING
+
+} // namespace sgm
+
+#endif // !__PROFILER_H__
@@ -25,6 +25,18 @@ namespace sgm
 using cost_type = uint8_t;
 using output_type = uint16_t;
 
+/**
+* Census feature wider than 64 bits, stored as WORDS 64-bit words.
+* The first 64 comparisons go to data[0], the next 64 to data[1] and so on.
+*/
+template <int WORDS>
+struct census_words
+{
+	uint64_t data[WORDS];
+};
+
+using census128_t = census_words<2>;
+
 } // namespace sgm
 
 #endif // !__TYPES_H__
@@ -80,8 +80,11 @@ __global__ void winner_takes_all_kernel(
 	const cost_type *src,
 	int width,
 	int height,
-	int pitch,
-	float uniqueness)
+	int x_step,
+	int y_step,
+	float uniqueness,
+	const uint32_t *row_counts,
+	uint32_t *uniqueness_rejections)
 {
 	static const unsigned int ACCUMULATION_PER_THREAD = 16u;
 	static const unsigned int REDUCTION_PER_THREAD = MAX_DISPARITY / WARP_SIZE;
@@ -97,15 +100,27 @@ __global__ void winner_takes_all_kernel(
 
 	const unsigned int y = blockIdx.x * WARPS_PER_BLOCK + warp_id;
 	src += y * MAX_DISPARITY * width;
-	left_dest  += y * pitch;
-	right_dest += y * pitch;
+	left_dest  += y * y_step;
+	right_dest += y * y_step;
 
 	if(y >= height){
 		return;
 	}
 
+	// fully masked scanline, nothing to match
+	if(row_counts && row_counts[y] == 0){
+		for(unsigned int x = lane_id; x < width; x += WARP_SIZE){
+			left_dest[x * x_step] = INVALID_DISP;
+			right_dest[x * x_step] = INVALID_DISP;
+		}
+		return;
+	}
+
 	__shared__ uint16_t smem_cost_sum[WARPS_PER_BLOCK][ACCUMULATION_INTERVAL][MAX_DISPARITY];
 
+	// pixels rejected by the uniqueness test, counted by lane 0 and added once per scanline
+	uint32_t rejected = 0;
+
 	uint32_t right_best[REDUCTION_PER_THREAD];
 	for(unsigned int i = 0; i < REDUCTION_PER_THREAD; ++i){
 		right_best[i] = 0xffffffffu;
@@ -181,7 +196,7 @@ __global__ void winner_takes_all_kernel(
 					right_best[i] = min(right_best[i], recv);
 					if(d == MAX_DISPARITY - 1){
 						if(0 <= p){
-							right_dest[p] = compute_disparity_normal(unpack_index(right_best[i]));
+							right_dest[p * x_step] = compute_disparity_normal(unpack_index(right_best[i]));
 						}
 						right_best[i] = 0xffffffffu;
 					}
@@ -198,7 +213,8 @@ __global__ void winner_takes_all_kernel(
 				}
 				uniq = subgroup_and<WARP_SIZE>(uniq, 0xffffffffu);
 				if(lane_id == 0){
-					left_dest[x] = uniq ? compute_disparity(bestDisp, bestCost, smem_cost_sum[warp_id][smem_x]) : INVALID_DISP;
+					left_dest[x * x_step] = uniq ? compute_disparity(bestDisp, bestCost, smem_cost_sum[warp_id][smem_x]) : INVALID_DISP;
+					rejected += uniq ? 0 : 1;
 				}
 			}
 		}
@@ -207,9 +223,12 @@ __global__ void winner_takes_all_kernel(
 		const unsigned int k = lane_id * REDUCTION_PER_THREAD + i;
 		const int p = static_cast<int>(((width - k) & ~(MAX_DISPARITY - 1)) + k);
 		if(0 <= p && p < width){
-			right_dest[p] = compute_disparity_normal(unpack_index(right_best[i]));
+			right_dest[p * x_step] = compute_disparity_normal(unpack_index(right_best[i]));
 		}
 	}
+	if(uniqueness_rejections && lane_id == 0 && rejected > 0){
+		atomicAdd(uniqueness_rejections, rejected);
+	}
 }
 
 } // namespace
@@ -219,11 +238,15 @@ namespace details
 
 template <int MAX_DISPARITY>
 void winner_takes_all_(const DeviceImage& src, DeviceImage& dstL, DeviceImage& dstR,
-	float uniqueness, bool subpixel, PathType path_type)
+	float uniqueness, bool subpixel, PathType path_type, EpipolarDirection direction, const DeviceImage& row_counts,
+	uint32_t* uniqueness_rejections)
 {
-	const int width = dstL.cols;
-	const int height = dstL.rows;
-	const int pitch = dstL.step;
+	// for vertical epipolar lines the cost volume is in transposed order, so scanlines are written to columns
+	const bool vertical = direction == EpipolarDirection::VERTICAL;
+	const int width = vertical ? dstL.rows : dstL.cols;
+	const int height = vertical ? dstL.cols : dstL.rows;
+	const int x_step = vertical ? dstL.step : 1;
+	const int y_step = vertical ? 1 : dstL.step;
 
 	const int gdim = divUp(height, WARPS_PER_BLOCK);
 	const int bdim = BLOCK_SIZE;
@@ -231,22 +254,23 @@ void winner_takes_all_(const DeviceImage& src, DeviceImage& dstL, DeviceImage& d
 	const cost_type* cost = src.ptr<cost_type>();
 	output_type* dispL = dstL.ptr<output_type>();
 	output_type* dispR = dstR.ptr<output_type>();
+	const uint32_t* counts = row_counts.ptr<uint32_t>();
 
 	if (subpixel && path_type == PathType::SCAN_8PATH) {
 		winner_takes_all_kernel<MAX_DISPARITY, 8, compute_disparity_subpixel<MAX_DISPARITY>><<<gdim, bdim>>>(
-			dispL, dispR, cost, width, height, pitch, uniqueness);
+			dispL, dispR, cost, width, height, x_step, y_step, uniqueness, counts, uniqueness_rejections);
 	}
 	else if (subpixel && path_type == PathType::SCAN_4PATH) {
 		winner_takes_all_kernel<MAX_DISPARITY, 4, compute_disparity_subpixel<MAX_DISPARITY>><<<gdim, bdim>>>(
-			dispL, dispR, cost, width, height, pitch, uniqueness);
+			dispL, dispR, cost, width, height, x_step, y_step, uniqueness, counts, uniqueness_rejections);
 	}
 	else if (!subpixel && path_type == PathType::SCAN_8PATH) {
 		winner_takes_all_kernel<MAX_DISPARITY, 8, compute_disparity_normal><<<gdim, bdim>>>(
-			dispL, dispR, cost, width, height, pitch, uniqueness);
+			dispL, dispR, cost, width, height, x_step, y_step, uniqueness, counts, uniqueness_rejections);
 	}
 	else /* if (!subpixel && path_type == PathType::SCAN_4PATH) */ {
 		winner_takes_all_kernel<MAX_DISPARITY, 4, compute_disparity_normal><<<gdim, bdim>>>(
-			dispL, dispR, cost, width, height, pitch, uniqueness);
+			dispL, dispR, cost, width, height, x_step, y_step, uniqueness, counts, uniqueness_rejections);
 	}
 
 	CUDA_CHECK(cudaGetLastError());
@@ -255,14 +279,25 @@ void winner_takes_all_(const DeviceImage& src, DeviceImage& dstL, DeviceImage& d
 void winner_takes_all(const DeviceImage& src, DeviceImage& dstL, DeviceImage& dstR,
 	int disp_size, float uniqueness, bool subpixel, PathType path_type)
 {
+	winner_takes_all(src, dstL, dstR, disp_size, uniqueness, subpixel, path_type, EpipolarDirection::HORIZONTAL, DeviceImage(),
+		FrameCounters());
+}
+
+void winner_takes_all(const DeviceImage& src, DeviceImage& dstL, DeviceImage& dstR,
+	int disp_size, float uniqueness, bool subpixel, PathType path_type, EpipolarDirection direction,
+	const DeviceImage& row_counts, const FrameCounters& counters)
+{
+	// valid counts are per image row, which are not scanlines of the transposed cost volume
+	SGM_ASSERT(row_counts.data == nullptr || direction == EpipolarDirection::HORIZONTAL, "row counts require horizontal scanlines.");
+
 	if (disp_size == 64) {
-		winner_takes_all_<64>(src, dstL, dstR, uniqueness, subpixel, path_type);
+		winner_takes_all_<64>(src, dstL, dstR, uniqueness, subpixel, path_type, direction, row_counts, counters.uniqueness_rejections);
 	}
 	else if (disp_size == 128) {
-		winner_takes_all_<128>(src, dstL, dstR, uniqueness, subpixel, path_type);
+		winner_takes_all_<128>(src, dstL, dstR, uniqueness, subpixel, path_type, direction, row_counts, counters.uniqueness_rejections);
 	}
 	else if (disp_size == 256) {
-		winner_takes_all_<256>(src, dstL, dstR, uniqueness, subpixel, path_type);
+		winner_takes_all_<256>(src, dstL, dstR, uniqueness, subpixel, path_type, direction, row_counts, counters.uniqueness_rejections);
 	}
 }
 
@@ -8,27 +8,41 @@
 namespace sgm
 {
 
-template <typename T>
-static void census_transform_9x7_(const HostImage& src, HostImage& dst)
+template <typename F>
+struct FeatureBuilder
 {
-	constexpr int RADIUS_U = 9 / 2;
-	constexpr int RADIUS_V = 7 / 2;
+	F f = 0;
+	void push(bool bit) { f = (f << 1) | bit; }
+};
+
+template <int WORDS>
+struct FeatureBuilder<census_words<WORDS>>
+{
+	census_words<WORDS> f = {};
+	int bits = 0;
+	void push(bool bit) { f.data[bits / 64] = (f.data[bits / 64] << 1) | bit; bits++; }
+};
+
+template <typename T, typename F>
+static void census_transform_(const HostImage& src, HostImage& dst, int window_w, int window_h)
+{
+	const int RADIUS_U = window_w / 2;
+	const int RADIUS_V = window_h / 2;
 
 	dst.fill_zero();
 
 	for (int v = RADIUS_V; v < src.rows - RADIUS_V; v++) {
-		uint64_t* ptrDst = dst.ptr<uint64_t>(v);
+		F* ptrDst = dst.ptr<F>(v);
 		for (int u = RADIUS_U; u < src.cols - RADIUS_U; u++) {
-			uint64_t f = 0;
+			FeatureBuilder<F> f;
 			for (int dv = -RADIUS_V; dv <= RADIUS_V; dv++) {
 				for (int du = -RADIUS_U; du <= RADIUS_U; du++) {
 					if (du != 0 && dv != 0) {
-						f <<= 1;
-						f |= (src.ptr<T>(v)[u] > src.ptr<T>(v + dv)[u + du]);
+						f.push(src.ptr<T>(v)[u] > src.ptr<T>(v + dv)[u + du]);
 					}
 				}
 			}
-			ptrDst[u] = f;
+			ptrDst[u] = f.f;
 		}
 	}
 }
@@ -56,16 +70,52 @@ static void symmetric_census_9x7_(const HostImage& src, HostImage& dst)
 	}
 }
 
+// every other pixel of 13x11 window, compared with its point symmetric counterpart
+static const int SPARSE_CENSUS_13x11_OFFSETS[][2] = {
+	{ -6, -5 }, { -4, -5 }, { -2, -5 }, { 0, -5 }, { 2, -5 }, { 4, -5 }, { 6, -5 },
+	{ -6, -3 }, { -4, -3 }, { -2, -3 }, { 0, -3 }, { 2, -3 }, { 4, -3 }, { 6, -3 },
+	{ -6, -1 }, { -4, -1 }, { -2, -1 }, { 0, -1 }, { 2, -1 }, { 4, -1 }, { 6, -1 },
+};
+
+template <typename T>
+static void sparse_census_13x11_(const HostImage& src, HostImage& dst)
+{
+	constexpr int RADIUS_U = 13 / 2;
+	constexpr int RADIUS_V = 11 / 2;
+
+	dst.fill_zero();
+
+	for (int v = RADIUS_V; v < src.rows - RADIUS_V; v++) {
+		uint32_t* ptrDst = dst.ptr<uint32_t>(v);
+		for (int u = RADIUS_U; u < src.cols - RADIUS_U; u++) {
+			uint32_t f = 0;
+			for (const auto& offset : SPARSE_CENSUS_13x11_OFFSETS) {
+				const int du = offset[0];
+				const int dv = offset[1];
+				f <<= 1;
+				f |= (src.ptr<T>(v + dv)[u + du] > src.ptr<T>(v - dv)[u - du]);
+			}
+			ptrDst[u] = f;
+		}
+	}
+}
+
+template <typename F>
+static void census_transform(const HostImage& src, HostImage& dst, ImageType type, int window_w, int window_h)
+{
+	dst.create(src.rows, src.cols, type);
+	if (src.type == SGM_8U)
+		census_transform_<uint8_t, F>(src, dst, window_w, window_h);
+	if (src.type == SGM_16U)
+		census_transform_<uint16_t, F>(src, dst, window_w, window_h);
+	if (src.type == SGM_32U)
+		census_transform_<uint32_t, F>(src, dst, window_w, window_h);
+}
+
 void census_transform(const HostImage& src, HostImage& dst, CensusType type)
 {
 	if (type == CensusType::CENSUS_9x7) {
-		dst.create(src.rows, src.cols, SGM_64U);
-		if (src.type == SGM_8U)
-			census_transform_9x7_<uint8_t>(src, dst);
-		if (src.type == SGM_16U)
-			census_transform_9x7_<uint16_t>(src, dst);
-		if (src.type == SGM_32U)
-			census_transform_9x7_<uint32_t>(src, dst);
+		census_transform<uint64_t>(src, dst, SGM_64U, 9, 7);
 	}
 	if (type == CensusType::SYMMETRIC_CENSUS_9x7) {
 		dst.create(src.rows, src.cols, SGM_32U);
@@ -76,6 +126,105 @@ void census_transform(const HostImage& src, HostImage& dst, CensusType type)
 		if (src.type == SGM_32U)
 			symmetric_census_9x7_<uint32_t>(src, dst);
 	}
+	if (type == CensusType::CENSUS_5x5) {
+		census_transform<uint32_t>(src, dst, SGM_32U, 5, 5);
+	}
+	if (type == CensusType::CENSUS_11x9) {
+		census_transform<census128_t>(src, dst, SGM_128U, 11, 9);
+	}
+	if (type == CensusType::CENSUS_13x11) {
+		census_transform<census128_t>(src, dst, SGM_128U, 13, 11);
+	}
+	if (type == CensusType::SPARSE_CENSUS_13x11) {
+		dst.create(src.rows, src.cols, SGM_32U);
+		if (src.type == SGM_8U)
+			sparse_census_13x11_<uint8_t>(src, dst);
+		if (src.type == SGM_16U)
+			sparse_census_13x11_<uint16_t>(src, dst);
+		if (src.type == SGM_32U)
+			sparse_census_13x11_<uint32_t>(src, dst);
+	}
+}
+
+template <typename T>
+static int raw_pixel(const HostImage& src, InputFormat format, int x, int y)
+{
+	const uint8_t* row = src.ptr<uint8_t>() + y * src.step;
+	if (format == InputFormat::RAW10 || format == InputFormat::BAYER_RAW10) {
+		const uint8_t* p = row + (x / 4) * 5;
+		return (p[x % 4] << 2) | ((p[4] >> (2 * (x % 4))) & 0x3);
+	}
+	if (format == InputFormat::RAW12 || format == InputFormat::BAYER_RAW12) {
+		const uint8_t* p = row + (x / 2) * 3;
+		return (p[x % 2] << 4) | ((p[2] >> (4 * (x % 2))) & 0xf);
+	}
+	return src.ptr<T>(y)[x];
+}
+
+// decodes color and packed input to the intensity image used by census transform
+template <typename T>
+static void decode_input_(const HostImage& src, HostImage& dst, InputFormat format)
+{
+	const int w = src.cols;
+	const int h = src.rows;
+	const bool bayer = format == InputFormat::BAYER || format == InputFormat::BAYER_RAW10 || format == InputFormat::BAYER_RAW12;
+
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			int value = 0;
+			if (format == InputFormat::BGR || format == InputFormat::RGB) {
+				const uint8_t* p = src.ptr<uint8_t>() + y * src.step + 3 * x;
+				const int r = format == InputFormat::BGR ? p[2] : p[0];
+				const int b = format == InputFormat::BGR ? p[0] : p[2];
+				value = (77 * r + 150 * p[1] + 29 * b + 128) >> 8;
+			}
+			else if (bayer) {
+				const int x1 = x + 1 < w ? x + 1 : x - 1;
+				const int y1 = y + 1 < h ? y + 1 : y - 1;
+				const int sum = raw_pixel<T>(src, format, x, y) + raw_pixel<T>(src, format, x1, y)
+					+ raw_pixel<T>(src, format, x, y1) + raw_pixel<T>(src, format, x1, y1);
+				value = (sum + 2) >> 2;
+			}
+			else {
+				value = raw_pixel<T>(src, format, x, y);
+			}
+			if (dst.type == SGM_8U)
+				dst.ptr<uint8_t>(y)[x] = static_cast<uint8_t>(value);
+			else
+				dst.ptr<uint16_t>(y)[x] = static_cast<uint16_t>(value);
+		}
+	}
+}
+
+// bilinear remap by fixed-point table, see StereoSGM::set_rectification
+template <typename T>
+static void remap_(const HostImage& src, HostImage& dst, const HostImage& map_xy, const HostImage& map_frac)
+{
+	const int w = src.cols;
+	const int h = src.rows;
+	auto sample = [&](int x, int y) -> uint64_t { return 0 <= x && x < w && 0 <= y && y < h ? src.ptr<T>(y)[x] : 0; };
+
+	dst.create(h, w, src.type);
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			const int16_t* xy = map_xy.ptr<int16_t>() + 2 * (x + y * map_xy.step);
+			const int frac = map_frac.ptr<uint16_t>(y)[x];
+			const uint64_t fx = frac & 31, fy = frac >> 5;
+			const uint64_t top = (32 - fx) * sample(xy[0], xy[1]) + fx * sample(xy[0] + 1, xy[1]);
+			const uint64_t bottom = (32 - fx) * sample(xy[0], xy[1] + 1) + fx * sample(xy[0] + 1, xy[1] + 1);
+			dst.ptr<T>(y)[x] = static_cast<T>(((32 - fy) * top + fy * bottom + 512) >> 10);
+		}
+	}
+}
+
+static void remap(const HostImage& src, HostImage& dst, const HostImage& map_xy, const HostImage& map_frac)
+{
+	if (src.type == SGM_8U)
+		remap_<uint8_t>(src, dst, map_xy, map_frac);
+	if (src.type == SGM_16U)
+		remap_<uint16_t>(src, dst, map_xy, map_frac);
+	if (src.type == SGM_32U)
+		remap_<uint32_t>(src, dst, map_xy, map_frac);
 }
 
 } // namespace sgm
@@ -229,3 +378,283 @@ TEST(SymmetricCensusTest, Random32U)
 
 	EXPECT_TRUE(equals(h_dst, d_dst));
 }
+
+TEST(Census5x5Test, RandomU8)
+{
+	using namespace sgm;
+	using namespace details;
+
+	const int w = 631;
+	const int h = 479;
+	const int pitch = 640;
+	const ImageType stype = SGM_8U;
+	const ImageType dtype = SGM_32U;
+	const CensusType censusType = CensusType::CENSUS_5x5;
+
+	HostImage h_src(h, w, stype, pitch), h_dst(h, w, dtype);
+	DeviceImage d_src(h, w, stype, pitch), d_dst(h, w, dtype);
+
+	random_fill(h_src);
+	d_src.upload(h_src.data);
+	d_dst.fill_zero();
+
+	census_transform(h_src, h_dst, censusType);
+	census_transform(d_src, d_dst, censusType);
+
+	EXPECT_TRUE(equals(h_dst, d_dst));
+}
+
+TEST(Census5x5Test, RandomU16)
+{
+	using namespace sgm;
+	using namespace details;
+
+	const int w = 631;
+	const int h = 479;
+	const int pitch = 640;
+	const ImageType stype = SGM_16U;
+	const ImageType dtype = SGM_32U;
+	const CensusType censusType = CensusType::CENSUS_5x5;
+
+	HostImage h_src(h, w, stype, pitch), h_dst(h, w, dtype);
+	DeviceImage d_src(h, w, stype, pitch), d_dst(h, w, dtype);
+
+	random_fill(h_src);
+	d_src.upload(h_src.data);
+	d_dst.fill_zero();
+
+	census_transform(h_src, h_dst, censusType);
+	census_transform(d_src, d_dst, censusType);
+
+	EXPECT_TRUE(equals(h_dst, d_dst));
+}
+
+TEST(Census11x9Test, RandomU8)
+{
+	using namespace sgm;
+	using namespace details;
+
+	const int w = 631;
+	const int h = 479;
+	const int pitch = 640;
+	const ImageType stype = SGM_8U;
+	const ImageType dtype = SGM_128U;
+	const CensusType censusType = CensusType::CENSUS_11x9;
+
+	HostImage h_src(h, w, stype, pitch), h_dst(h, w, dtype);
+	DeviceImage d_src(h, w, stype, pitch), d_dst(h, w, dtype);
+
+	random_fill(h_src);
+	d_src.upload(h_src.data);
+	d_dst.fill_zero();
+
+	census_transform(h_src, h_dst, censusType);
+	census_transform(d_src, d_dst, censusType);
+
+	EXPECT_TRUE(equals(h_dst, d_dst));
+}
+
+TEST(Census11x9Test, RandomU16)
+{
+	using namespace sgm;
+	using namespace details;
+
+	const int w = 631;
+	const int h = 479;
+	const int pitch = 640;
+	const ImageType stype = SGM_16U;
+	const ImageType dtype = SGM_128U;
+	const CensusType censusType = CensusType::CENSUS_11x9;
+
+	HostImage h_src(h, w, stype, pitch), h_dst(h, w, dtype);
+	DeviceImage d_src(h, w, stype, pitch), d_dst(h, w, dtype);
+
+	random_fill(h_src);
+	d_src.upload(h_src.data);
+	d_dst.fill_zero();
+
+	census_transform(h_src, h_dst, censusType);
+	census_transform(d_src, d_dst, censusType);
+
+	EXPECT_TRUE(equals(h_dst, d_dst));
+}
+
+TEST(Census13x11Test, RandomU8)
+{
+	using namespace sgm;
+	using namespace details;
+
+	const int w = 631;
+	const int h = 479;
+	const int pitch = 640;
+	const ImageType stype = SGM_8U;
+	const ImageType dtype = SGM_128U;
+	const CensusType censusType = CensusType::CENSUS_13x11;
+
+	HostImage h_src(h, w, stype, pitch), h_dst(h, w, dtype);
+	DeviceImage d_src(h, w, stype, pitch), d_dst(h, w, dtype);
+
+	random_fill(h_src);
+	d_src.upload(h_src.data);
+	d_dst.fill_zero();
+
+	census_transform(h_src, h_dst, censusType);
+	census_transform(d_src, d_dst, censusType);
+
+	EXPECT_TRUE(equals(h_dst, d_dst));
+}
+
+TEST(Census13x11Test, RandomU16)
+{
+	using namespace sgm;
+	using namespace details;
+
+	const int w = 631;
+	const int h = 479;
+	const int pitch = 640;
+	const ImageType stype = SGM_16U;
+	const ImageType dtype = SGM_128U;
+	const CensusType censusType = CensusType::CENSUS_13x11;
+
+	HostImage h_src(h, w, stype, pitch), h_dst(h, w, dtype);
+	DeviceImage d_src(h, w, stype, pitch), d_dst(h, w, dtype);
+
+	random_fill(h_src);
+	d_src.upload(h_src.data);
+	d_dst.fill_zero();
+
+	census_transform(h_src, h_dst, censusType);
+	census_transform(d_src, d_dst, censusType);
+
+	EXPECT_TRUE(equals(h_dst, d_dst));
+}
+
+TEST(SparseCensus13x11Test, RandomU8)
+{
+	using namespace sgm;
+	using namespace details;
+
+	const int w = 631;
+	const int h = 479;
+	const int pitch = 640;
+	const ImageType stype = SGM_8U;
+	const ImageType dtype = SGM_32U;
+	const CensusType censusType = CensusType::SPARSE_CENSUS_13x11;
+
+	HostImage h_src(h, w, stype, pitch), h_dst(h, w, dtype);
+	DeviceImage d_src(h, w, stype, pitch), d_dst(h, w, dtype);
+
+	random_fill(h_src);
+	d_src.upload(h_src.data);
+	d_dst.fill_zero();
+
+	census_transform(h_src, h_dst, censusType);
+	census_transform(d_src, d_dst, censusType);
+
+	EXPECT_TRUE(equals(h_dst, d_dst));
+}
+
+TEST(SparseCensus13x11Test, RandomU16)
+{
+	using namespace sgm;
+	using namespace details;
+
+	const int w = 631;
+	const int h = 479;
+	const int pitch = 640;
+	const ImageType stype = SGM_16U;
+	const ImageType dtype = SGM_32U;
+	const CensusType censusType = CensusType::SPARSE_CENSUS_13x11;
+
+	HostImage h_src(h, w, stype, pitch), h_dst(h, w, dtype);
+	DeviceImage d_src(h, w, stype, pitch), d_dst(h, w, dtype);
+
+	random_fill(h_src);
+	d_src.upload(h_src.data);
+	d_dst.fill_zero();
+
+	census_transform(h_src, h_dst, censusType);
+	census_transform(d_src, d_dst, censusType);
+
+	EXPECT_TRUE(equals(h_dst, d_dst));
+}
+
+TEST(CensusTransformTest, InputFormats)
+{
+	using namespace sgm;
+	using namespace details;
+
+	const int w = 632;
+	const int h = 479;
+	const CensusType censusType = CensusType::SYMMETRIC_CENSUS_9x7;
+
+	struct Case { InputFormat format; ImageType stype; int pitch; ImageType ltype; };
+	const Case cases[] = {
+		{ InputFormat::BGR,         SGM_8U,  3 * w + 8, SGM_8U  },
+		{ InputFormat::RGB,         SGM_8U,  3 * w,     SGM_8U  },
+		{ InputFormat::BAYER,       SGM_8U,  640,       SGM_8U  },
+		{ InputFormat::BAYER,       SGM_16U, 640,       SGM_16U },
+		{ InputFormat::RAW10,       SGM_8U,  w / 4 * 5, SGM_16U },
+		{ InputFormat::RAW12,       SGM_8U,  w / 2 * 3, SGM_16U },
+		{ InputFormat::BAYER_RAW10, SGM_8U,  w / 4 * 5, SGM_16U },
+		{ InputFormat::BAYER_RAW12, SGM_8U,  w / 2 * 3, SGM_16U },
+	};
+
+	for (const Case& c : cases) {
+		HostImage h_src(h, w, c.stype, c.pitch), h_luma(h, w, c.ltype), h_dst;
+		DeviceImage d_src(h, w, c.stype, c.pitch), d_dst;
+
+		random_fill(h_src);
+		d_src.upload(h_src.data);
+
+		if (c.stype == SGM_8U)
+			decode_input_<uint8_t>(h_src, h_luma, c.format);
+		else
+			decode_input_<uint16_t>(h_src, h_luma, c.format);
+
+		census_transform(h_luma, h_dst, censusType);
+		census_transform(d_src, d_dst, censusType, c.format);
+
+		EXPECT_TRUE(equals(h_dst, d_dst)) << "format " << static_cast<int>(c.format);
+	}
+}
+
+TEST(CensusTransformTest, Rectification)
+{
+	using namespace sgm;
+	using namespace details;
+
+	const int w = 631;
+	const int h = 479;
+	const int pitch = 640;
+	const CensusType censusType = CensusType::CENSUS_9x7;
+
+	// random source positions including a few pixels outside the image
+	HostImage h_map_xy(h, w, SGM_32U), h_map_frac(h, w, SGM_16U);
+	std::uniform_int_distribution<int> dx(-3, 3), frac(0, 1023);
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			int16_t* xy = h_map_xy.ptr<int16_t>() + 2 * (x + y * w);
+			xy[0] = static_cast<int16_t>(x + dx(g_engine));
+			xy[1] = static_cast<int16_t>(y + dx(g_engine));
+			h_map_frac.ptr<uint16_t>(y)[x] = static_cast<uint16_t>(frac(g_engine));
+		}
+	}
+	DeviceImage d_map_xy(h, w, SGM_32U), d_map_frac(h, w, SGM_16U);
+	d_map_xy.upload(h_map_xy.data);
+	d_map_frac.upload(h_map_frac.data);
+
+	for (ImageType stype : { SGM_8U, SGM_16U, SGM_32U }) {
+		HostImage h_src(h, w, stype, pitch), h_rect, h_dst;
+		DeviceImage d_src(h, w, stype, pitch), d_dst;
+
+		random_fill(h_src);
+		d_src.upload(h_src.data);
+
+		remap(h_src, h_rect, h_map_xy, h_map_frac);
+		census_transform(h_rect, h_dst, censusType);
+		census_transform(d_src, d_dst, censusType, InputFormat::GRAY, d_map_xy, d_map_frac);
+
+		EXPECT_TRUE(equals(h_dst, d_dst)) << "type " << stype;
+	}
+}
@@ -234,3 +234,54 @@ TEST(CheckConsistencyTest, RandomU32_Subpixel)
 
 	EXPECT_TRUE(equals(h_dispL, d_dispL));
 }
+
+TEST(CheckConsistencyTest, LRRejections)
+{
+	using namespace sgm;
+	using namespace details;
+
+	const int w = 631;
+	const int h = 479;
+	const int pitch = 640;
+	const ImageType stype = SGM_8U;
+	const ImageType dtype = SGM_16U;
+	const int LR_max_diff = 5;
+	const bool subpixel = false;
+
+	HostImage h_srcL(h, w, stype, pitch), h_dispL(h, w, dtype, pitch), h_dispR(h, w, dtype, pitch);
+	DeviceImage d_srcL(h, w, stype, pitch), d_dispL(h, w, dtype, pitch), d_dispR(h, w, dtype, pitch);
+
+	// disparities within the image, so that most pixels find their match
+	random_fill(h_srcL);
+	random_fill(h_dispL, 0, 128);
+	random_fill(h_dispR, 0, 128);
+
+	d_srcL.upload(h_srcL.data);
+	d_dispL.upload(h_dispL.data);
+	d_dispR.upload(h_dispR.data);
+
+	// unmasked valid pixels whose match differs by more than LR_max_diff
+	uint32_t rejections = 0;
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			const int d = h_dispL.ptr<uint16_t>(y)[x];
+			const int k = x - d;
+			rejections += h_srcL.ptr<uint8_t>(y)[x] != 0 && k >= 0 && k < w &&
+				std::abs(h_dispR.ptr<uint16_t>(y)[k] - d) > LR_max_diff;
+		}
+	}
+
+	DeviceImage d_count(1, 1, SGM_32U);
+	d_count.fill_zero();
+	FrameCounters counters;
+	counters.lr_rejections = d_count.ptr<uint32_t>();
+
+	check_consistency(h_dispL, h_dispR, h_srcL, subpixel, LR_max_diff);
+	check_consistency(d_dispL, d_dispR, d_srcL, subpixel, LR_max_diff, InputFormat::GRAY, DeviceImage(), DeviceImage(),
+		EpipolarDirection::HORIZONTAL, DeviceImage(), counters);
+
+	uint32_t count = 0;
+	d_count.download(&count);
+	EXPECT_TRUE(equals(h_dispL, d_dispL));
+	EXPECT_EQ(rejections, count);
+}
@@ -43,7 +43,7 @@ using Parameters = std::tuple<int, int, int>;
 
 class CorrectDisparityRangeTest : public ::testing::TestWithParam<Parameters> {};
 INSTANTIATE_TEST_CASE_P(TestWithParams, CorrectDisparityRangeTest,
-	::testing::Combine(::testing::Values(64, 128, 256), ::testing::Values(0, 1), ::testing::Values(0, +16, -16)));
+	::testing::Combine(::testing::Values(64, 128, 256), ::testing::Values(0, 1), ::testing::Values(0, +16, -16, +100)));
 
 TEST_P(CorrectDisparityRangeTest, Random16U)
 {
@@ -58,7 +58,7 @@ TEST_P(CorrectDisparityRangeTest, Random16U)
 	const auto param = GetParam();
 	const int disp_size = std::get<0>(param);
 	const bool subpixel = std::get<1>(param) > 0;
-	const bool min_disp = std::get<2>(param);
+	const int min_disp = std::get<2>(param);
 
 	HostImage h_disp(h, w, dtype, pitch);
 	DeviceImage d_disp(h, w, dtype, pitch);
@@ -71,3 +71,98 @@ TEST_P(CorrectDisparityRangeTest, Random16U)
 
 	EXPECT_TRUE(equals(h_disp, d_disp));
 }
+
+TEST_P(CorrectDisparityRangeTest, ValidityMask)
+{
+	using namespace sgm;
+	using namespace details;
+
+	const int w = 631;
+	const int h = 479;
+	const int pitch = 640;
+	const ImageType dtype = SGM_16U;
+
+	const auto param = GetParam();
+	const int disp_size = std::get<0>(param);
+	const bool subpixel = std::get<1>(param) > 0;
+	const int min_disp = std::get<2>(param);
+
+	HostImage h_disp(h, w, dtype, pitch);
+	DeviceImage d_disp(h, w, dtype, pitch), d_valid, d_valid_rows;
+
+	// values beyond disp_size are made invalid
+	random_fill(h_disp, 0, 2 * disp_size);
+	for (int y = 0; y < h; y++)
+		for (int x = 0; x < w; x++)
+			if (h_disp.ptr<uint16_t>(y)[x] >= disp_size || y == 7)
+				h_disp.ptr<uint16_t>(y)[x] = INVALID_DISP;
+	d_disp.upload(h_disp.data);
+
+	HostImage h_valid(h, (w + 31) / 32, SGM_32U), h_valid_rows(1, h, SGM_32U);
+	for (int y = 0; y < h; y++) {
+		uint32_t count = 0;
+		for (int x = 0; x < w; x++) {
+			const bool valid = h_disp.ptr<uint16_t>(y)[x] != INVALID_DISP;
+			uint32_t& word = h_valid.ptr<uint32_t>(y)[x / 32];
+			word = (x % 32 == 0 ? 0u : word) | (static_cast<uint32_t>(valid) << (x % 32));
+			count += valid;
+		}
+		h_valid_rows.ptr<uint32_t>()[y] = count;
+	}
+
+	correct_disparity_range(h_disp, subpixel, min_disp);
+	correct_disparity_range(d_disp, subpixel, min_disp, d_valid, d_valid_rows);
+
+	EXPECT_TRUE(equals(h_disp, d_disp));
+	EXPECT_TRUE(equals(h_valid, d_valid));
+	EXPECT_TRUE(equals(h_valid_rows, d_valid_rows));
+}
+
+TEST_P(CorrectDisparityRangeTest, FrameCounters)
+{
+	using namespace sgm;
+	using namespace details;
+
+	const int w = 631;
+	const int h = 479;
+	const int pitch = 640;
+	const ImageType dtype = SGM_16U;
+
+	const auto param = GetParam();
+	const int disp_size = std::get<0>(param);
+	const bool subpixel = std::get<1>(param) > 0;
+	const int min_disp = std::get<2>(param);
+	const int shift = subpixel ? StereoSGM::SUBPIXEL_SHIFT : 0;
+
+	HostImage h_disp(h, w, dtype, pitch);
+	DeviceImage d_disp(h, w, dtype, pitch);
+
+	// values beyond the disparity range are made invalid
+	random_fill(h_disp, 0, 2 * (disp_size << shift));
+	HostImage h_stats(1, 1 + FRAME_HISTOGRAM_BINS, SGM_32U);
+	std::fill(h_stats.ptr<uint32_t>(), h_stats.ptr<uint32_t>() + h_stats.cols, 0u);
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			uint16_t& d = h_disp.ptr<uint16_t>(y)[x];
+			if (d >= (disp_size << shift))
+				d = INVALID_DISP;
+			if (d == INVALID_DISP)
+				h_stats.ptr<uint32_t>()[0]++;
+			else
+				h_stats.ptr<uint32_t>()[1 + (d >> shift)]++;
+		}
+	}
+	d_disp.upload(h_disp.data);
+
+	DeviceImage d_stats(1, 1 + FRAME_HISTOGRAM_BINS, SGM_32U);
+	d_stats.fill_zero();
+	FrameCounters counters;
+	counters.invalid_pixels = d_stats.ptr<uint32_t>();
+	counters.histogram = d_stats.ptr<uint32_t>() + 1;
+
+	correct_disparity_range(h_disp, subpixel, min_disp);
+	correct_disparity_range(d_disp, subpixel, min_disp, nullptr, nullptr, counters);
+
+	EXPECT_TRUE(equals(h_disp, d_disp));
+	EXPECT_TRUE(equals(h_stats, d_stats));
+}
@@ -7,6 +7,7 @@
 #include "test_utility.h"
 #include "internal.h"
 #include "constants.h"
+#include "reference.h"
 
 #ifdef _WIN32
 #define popcnt32 __popcnt
@@ -43,6 +44,9 @@ static CostAggregationParam params[] = {
 	{ sgm::SGM_64U, 256, 10, 120,  +0 },
 	{ sgm::SGM_64U, 256, 10, 120, +16 },
 	{ sgm::SGM_64U, 256, 10, 120, -16 },
+	{ sgm::SGM_128U,  64, 10, 120,  +0 },
+	{ sgm::SGM_128U, 128, 10, 120, +16 },
+	{ sgm::SGM_128U, 256, 10, 120, -16 },
 };
 
 namespace sgm
@@ -52,6 +56,10 @@ using COST_TYPE = uint8_t;
 
 static inline int HammingDistance(uint64_t c1, uint64_t c2) { return static_cast<int>(popcnt64(c1 ^ c2)); }
 static inline int HammingDistance(uint32_t c1, uint32_t c2) { return static_cast<int>(popcnt32(c1 ^ c2)); }
+static inline int HammingDistance(const census128_t& c1, const census128_t& c2)
+{
+	return HammingDistance(c1.data[0], c2.data[0]) + HammingDistance(c1.data[1], c2.data[1]);
+}
 
 static inline int min4(int x, int y, int z, int w)
 {
@@ -96,7 +104,7 @@ static void cost_aggregation_(const HostImage& srcL, const HostImage& srcR, Host
 			const COST_TYPE _P1 = P1 - minLp;
 			for (int d = 0; d < n; d++) {
 				const int uR = uc - d - min_disp;
-				const CENSUS_TYPE cR = uR >= 0 && uR < w ? censusR[uR] : 0;
+				const CENSUS_TYPE cR = uR >= 0 && uR < w ? censusR[uR] : CENSUS_TYPE();
 				const COST_TYPE MC = HammingDistance(cL, cR);
 				const COST_TYPE Lp0 = Lp[d] - minLp;
 				const COST_TYPE Lp1 = d > 0 ?     Lp[d - 1] + _P1 : 0xFF;
@@ -115,6 +123,8 @@ static void cost_aggregation(const HostImage& srcL, const HostImage& srcR, HostI
 		cost_aggregation_<uint32_t>(srcL, srcR, dst, disp_size, P1, P2, min_disp, ru, rv);
 	if (srcL.type == SGM_64U)
 		cost_aggregation_<uint64_t>(srcL, srcR, dst, disp_size, P1, P2, min_disp, ru, rv);
+	if (srcL.type == SGM_128U)
+		cost_aggregation_<census128_t>(srcL, srcR, dst, disp_size, P1, P2, min_disp, ru, rv);
 }
 
 void cost_aggregation(const HostImage& srcL, const HostImage& srcR, HostImage& dst,
@@ -183,3 +193,48 @@ TEST_P(CostAggregationTest, AllPathsTest)
 		EXPECT_TRUE(equals(h_cost, d_cost));
 	}
 }
+
+TEST(FusedCostAggregationTest, RandomU8)
+{
+	using namespace sgm;
+	using namespace details;
+
+	const int w = 320;
+	const int h = 240;
+	const int pitch = 336;
+	const int disp_size = 128;
+	const auto path_type = PathType::SCAN_8PATH;
+	const int num_paths = path_type == PathType::SCAN_4PATH ? 4 : 8;
+	const int P1 = 10;
+	const int P2 = 120;
+	const int min_disp = -16;
+
+	const ImageType stype = SGM_8U;
+	const ImageType cost_type = SGM_8U;
+
+	for (auto census_type : { CensusType::CENSUS_9x7, CensusType::SYMMETRIC_CENSUS_9x7,
+		CensusType::CENSUS_5x5, CensusType::CENSUS_11x9, CensusType::CENSUS_13x11, CensusType::SPARSE_CENSUS_13x11 }) {
+
+		HostImage h_srcL(h, w, stype, pitch), h_srcR(h, w, stype, pitch);
+		HostImage h_censusL, h_censusR, h_costs;
+
+		DeviceImage d_srcL(h, w, stype, pitch), d_srcR(h, w, stype, pitch);
+		DeviceImage d_costs;
+
+		random_fill(h_srcL);
+		random_fill(h_srcR);
+		d_srcL.upload(h_srcL.data);
+		d_srcR.upload(h_srcR.data);
+
+		census_transform(h_srcL, h_censusL, census_type);
+		census_transform(h_srcR, h_censusR, census_type);
+		cost_aggregation(h_censusL, h_censusR, h_costs, disp_size, P1, P2, path_type, min_disp);
+		fused_cost_aggregation(d_srcL, d_srcR, d_costs, disp_size, P1, P2, path_type, min_disp, census_type);
+
+		for (int i = 0; i < num_paths; i++) {
+			HostImage h_cost(h_costs.ptr<COST_TYPE>(i), h * w, disp_size, cost_type);
+			DeviceImage d_cost(d_costs.ptr<COST_TYPE>(i), h * w, disp_size, cost_type);
+			EXPECT_TRUE(equals(h_cost, d_cost));
+		}
+	}
+}
@@ -0,0 +1,56 @@
+#include <gtest/gtest.h>
+
+#include "host_image.h"
+#include "device_image.h"
+#include "test_utility.h"
+#include "internal.h"
+
+namespace sgm
+{
+
+void sum_cost_paths(const HostImage& src, HostImage& dst)
+{
+	dst.create(1, src.cols, SGM_16U);
+	for (int i = 0; i < src.cols; i++) {
+		int sum = 0;
+		for (int p = 0; p < src.rows; p++)
+			sum += src.ptr<uint8_t>(p)[i];
+		dst.ptr<uint16_t>()[i] = static_cast<uint16_t>(sum);
+	}
+}
+
+} // namespace sgm
+
+static void test_sum_and_split(int num_paths)
+{
+	using namespace sgm;
+	using namespace details;
+
+	const int volume_size = 97 * 61 * 64;
+
+	HostImage h_cost(num_paths, volume_size, SGM_8U), h_sum, h_resum;
+	DeviceImage d_cost(num_paths, volume_size, SGM_8U), d_sum, d_split, d_resum;
+
+	random_fill(h_cost);
+	d_cost.upload(h_cost.data);
+
+	sum_cost_paths(h_cost, h_sum);
+	sum_cost_paths(d_cost, d_sum);
+	EXPECT_TRUE(equals(h_sum, d_sum));
+
+	// splitting and summing again restores the sum exactly
+	split_cost_sum(d_sum, d_split, num_paths);
+	EXPECT_EQ(num_paths, d_split.rows);
+	sum_cost_paths(d_split, d_resum);
+	EXPECT_TRUE(equals(h_sum, d_resum));
+}
+
+TEST(CostVolumeTest, SumAndSplit4Path)
+{
+	test_sum_and_split(4);
+}
+
+TEST(CostVolumeTest, SumAndSplit8Path)
+{
+	test_sum_and_split(8);
+}
@@ -0,0 +1,161 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <libsgm.h>
+
+#include "host_image.h"
+#include "test_utility.h"
+
+static std::vector<uint8_t> encode(const sgm::HostImage& disp, int depth_bits, int invalid)
+{
+	const size_t size = sgm::encode_disparity(disp.data, disp.cols, disp.rows, disp.step, depth_bits, invalid, nullptr, 0);
+	std::vector<uint8_t> bytes(size);
+	EXPECT_EQ(sgm::encode_disparity(disp.data, disp.cols, disp.rows, disp.step, depth_bits, invalid, bytes.data(), bytes.size()), size);
+	return bytes;
+}
+
+// piecewise planes with runs of invalid pixels, as a disparity map looks like
+template <typename T>
+static void fill_planes(sgm::HostImage& disp, int scale, T invalid)
+{
+	for (int y = 0; y < disp.rows; y++) {
+		T* ptr = disp.ptr<T>(y);
+		for (int x = 0; x < disp.cols; x++) {
+			const int d = x < disp.cols / 2 ? 20 * scale + x * scale / 16 : 40 * scale - y * scale / 8;
+			ptr[x] = static_cast<T>(d);
+		}
+		for (int x = (y * 37) % disp.cols, n = 0; x < disp.cols && n < 12; x++, n++)
+			ptr[x] = invalid;
+	}
+}
+
+using Parameters = std::tuple<int, int>;
+
+class DisparityCodecTest : public ::testing::TestWithParam<Parameters> {};
+INSTANTIATE_TEST_CASE_P(TestWithParams, DisparityCodecTest,
+	::testing::Combine(::testing::Values(8, 16), ::testing::Values(0, 1)));
+
+TEST_P(DisparityCodecTest, RoundTrip)
+{
+	using namespace sgm;
+
+	const int w = 631;
+	const int h = 479;
+	const int pitch = 640;
+
+	const auto param = GetParam();
+	const int depth_bits = std::get<0>(param);
+	const bool random = std::get<1>(param) > 0;
+	const ImageType dtype = depth_bits == 8 ? SGM_8U : SGM_16U;
+	const int invalid = depth_bits == 8 ? 0 : -16;
+
+	HostImage h_disp(h, w, dtype, pitch), h_decoded(h, w, dtype, pitch);
+	if (random)
+		random_fill(h_disp);
+	else if (depth_bits == 8)
+		fill_planes<uint8_t>(h_disp, 1, static_cast<uint8_t>(invalid));
+	else
+		fill_planes<uint16_t>(h_disp, StereoSGM::SUBPIXEL_SCALE, static_cast<uint16_t>(invalid));
+
+	const std::vector<uint8_t> bytes = encode(h_disp, depth_bits, invalid);
+	EXPECT_LE(bytes.size(), encoded_disparity_bound(w, h, depth_bits));
+
+	int width, height, bits;
+	ASSERT_TRUE(get_encoded_disparity_info(bytes.data(), bytes.size(), &width, &height, &bits));
+	EXPECT_EQ(width, w);
+	EXPECT_EQ(height, h);
+	EXPECT_EQ(bits, depth_bits);
+
+	ASSERT_TRUE(decode_disparity(bytes.data(), bytes.size(), h_decoded.data, h_decoded.step));
+	EXPECT_TRUE(equals(h_disp, h_decoded));
+
+	// smooth maps must compress well below the raw size
+	if (!random)
+		EXPECT_LT(bytes.size(), static_cast<size_t>(w) * h * depth_bits / 8 / 8);
+}
+
+TEST(DisparityCodecTest, Threads)
+{
+	using namespace sgm;
+
+	HostImage h_disp(100, 64, SGM_16U), h_decoded(100, 64, SGM_16U);
+	fill_planes<uint16_t>(h_disp, StereoSGM::SUBPIXEL_SCALE, 0);
+	const std::vector<uint8_t> bytes = encode(h_disp, 16, 0);
+
+	// bands are coded independently, so the stream does not depend on the number of threads
+	std::vector<uint8_t> threaded(bytes.size());
+	EXPECT_EQ(encode_disparity(h_disp.data, h_disp.cols, h_disp.rows, h_disp.step, 16, 0, threaded.data(), threaded.size(), 4), bytes.size());
+	EXPECT_EQ(threaded, bytes);
+
+	ASSERT_TRUE(decode_disparity(bytes.data(), bytes.size(), h_decoded.data, h_decoded.step, 4));
+	EXPECT_TRUE(equals(h_disp, h_decoded));
+}
+
+TEST(DisparityCodecTest, Bound)
+{
+	using namespace sgm;
+
+	// alternating valid and invalid pixels with large deltas are the worst case of the codec
+	for (int depth_bits : { 8, 16 }) {
+		const ImageType dtype = depth_bits == 8 ? SGM_8U : SGM_16U;
+		const int max_disp = (1 << depth_bits) - 1;
+		for (int w : { 1, 2, 3, 97 }) {
+			HostImage h_disp(37, w, dtype);
+			for (int y = 0; y < h_disp.rows; y++) {
+				for (int x = 0; x < w; x++) {
+					const int d = (x + y) % 3 == 0 ? max_disp : ((x + y) % 3 == 1 ? 0 : 1);
+					if (depth_bits == 8)
+						h_disp.ptr<uint8_t>(y)[x] = static_cast<uint8_t>(d);
+					else
+						h_disp.ptr<uint16_t>(y)[x] = static_cast<uint16_t>(d);
+				}
+			}
+			EXPECT_LE(encode(h_disp, depth_bits, 0).size(), encoded_disparity_bound(w, h_disp.rows, depth_bits));
+		}
+	}
+	EXPECT_EQ(encoded_disparity_bound(0, 10, 16), 0u);
+	EXPECT_EQ(encoded_disparity_bound(10, 10, 12), 0u);
+}
+
+TEST(DisparityCodecTest, SmallBuffer)
+{
+	using namespace sgm;
+
+	HostImage h_disp(64, 100, SGM_16U);
+	random_fill(h_disp);
+
+	const size_t size = encode_disparity(h_disp.data, h_disp.cols, h_disp.rows, h_disp.step, 16, 0, nullptr, 0);
+	std::vector<uint8_t> bytes(size, 0xcd);
+	EXPECT_EQ(encode_disparity(h_disp.data, h_disp.cols, h_disp.rows, h_disp.step, 16, 0, bytes.data(), size - 1), size);
+	EXPECT_EQ(bytes[0], 0xcd);
+}
+
+TEST(DisparityCodecTest, MalformedStream)
+{
+	using namespace sgm;
+
+	HostImage h_disp(64, 100, SGM_16U), h_decoded(64, 100, SGM_16U);
+	fill_planes<uint16_t>(h_disp, 1, 0xffff);
+	std::vector<uint8_t> bytes = encode(h_disp, 16, 0xffff);
+
+	EXPECT_FALSE(decode_disparity(bytes.data(), bytes.size() - 1, h_decoded.data, h_decoded.step));
+	EXPECT_FALSE(decode_disparity(bytes.data(), bytes.size(), h_decoded.data, h_decoded.cols - 1));
+
+	// oversubscribed code lengths, every delta symbol of the first band 1 bit long
+	std::vector<uint8_t> oversubscribed = bytes;
+	const size_t first_band = 20 + 4 * 4;
+	std::fill(oversubscribed.begin() + first_band, oversubscribed.begin() + first_band + 69, 0x11);
+	EXPECT_FALSE(decode_disparity(oversubscribed.data(), oversubscribed.size(), h_decoded.data, h_decoded.step));
+
+	// 16-bit values relabelled as 8-bit leave the range of the output depth
+	HostImage h_large(64, 100, SGM_16U), h_decoded8(64, 100, SGM_8U);
+	fill_planes<uint16_t>(h_large, StereoSGM::SUBPIXEL_SCALE, 0);
+	std::vector<uint8_t> relabelled = encode(h_large, 16, 0);
+	relabelled[5] = 8;
+	EXPECT_FALSE(decode_disparity(relabelled.data(), relabelled.size(), h_decoded8.data, h_decoded8.step));
+
+	bytes[0] = 'X';
+	EXPECT_FALSE(get_encoded_disparity_info(bytes.data(), bytes.size(), nullptr, nullptr, nullptr));
+	EXPECT_FALSE(decode_disparity(bytes.data(), bytes.size(), h_decoded.data, h_decoded.step));
+}
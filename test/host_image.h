@@ -18,6 +18,8 @@ static size_t elemSize(ImageType type)
 		return 4;
 	if (type == SGM_64U)
 		return 8;
+	if (type == SGM_128U)
+		return 16;
 	return 0;
 }
 
@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 
+#include <vector>
+
 #include "host_image.h"
 #include "device_image.h"
 #include "test_utility.h"
@@ -27,7 +29,7 @@ TEST(IntegrationTest, RandomU8)
 
 	const ImageType stype = SGM_8U;
 	const ImageType dtype = SGM_16U;
-	const ImageType ctype = censusType == CensusType::CENSUS_9x7 ? SGM_64U : SGM_32U;
+	const ImageType ctype = census_image_type(censusType);
 
 	HostImage h_srcL(h, w, stype, pitch), h_srcR(h, w, stype, pitch);
 	DeviceImage d_srcL(h, w, stype, pitch), d_srcR(h, w, stype, pitch);
@@ -87,3 +89,295 @@ TEST(IntegrationTest, RandomU8)
 	correct_disparity_range(d_dispL, subpixel, min_disp);
 	EXPECT_TRUE(equals(h_dispL, d_dispL));
 }
+
+TEST(IntegrationTest, PackedStereo)
+{
+	using namespace sgm;
+
+	const int w = 311;
+	const int h = 239;
+	const int disp_size = 64;
+
+	HostImage h_srcL(h, w, SGM_16U), h_srcR(h, w, SGM_16U);
+	random_fill(h_srcL);
+	random_fill(h_srcR);
+
+	// side by side with a padded pitch, and top and bottom
+	const int sbs_pitch = 2 * w + 10;
+	HostImage h_sbs(h, sbs_pitch, SGM_16U), h_tb(2 * h, w, SGM_16U);
+	for (int y = 0; y < h; y++) {
+		memcpy(h_sbs.ptr<uint16_t>(y), h_srcL.ptr<uint16_t>(y), w * sizeof(uint16_t));
+		memcpy(h_sbs.ptr<uint16_t>(y) + w, h_srcR.ptr<uint16_t>(y), w * sizeof(uint16_t));
+		memcpy(h_tb.ptr<uint16_t>(y), h_srcL.ptr<uint16_t>(y), w * sizeof(uint16_t));
+		memcpy(h_tb.ptr<uint16_t>(y + h), h_srcR.ptr<uint16_t>(y), w * sizeof(uint16_t));
+	}
+
+	StereoSGM sgm(w, h, disp_size, 16, 16, EXECUTE_INOUT_HOST2HOST);
+
+	HostImage h_disp(h, w, SGM_16U), h_disp_sbs(h, w, SGM_16U), h_disp_tb(h, w, SGM_16U);
+	sgm.execute(h_srcL.data, h_srcR.data, h_disp.data);
+	sgm.execute(PackedStereoImage::side_by_side(h_sbs.data, sbs_pitch * 2, w * 2), h_disp_sbs.data);
+	sgm.execute(PackedStereoImage::top_bottom(h_tb.data, w * 2, h), h_disp_tb.data);
+
+	EXPECT_TRUE(equals(h_disp, h_disp_sbs));
+	EXPECT_TRUE(equals(h_disp, h_disp_tb));
+}
+
+TEST(IntegrationTest, ImageView)
+{
+	using namespace sgm;
+
+	const int w = 311;
+	const int h = 239;
+	const int disp_size = 64;
+
+	HostImage h_srcL(h, w, SGM_8U), h_srcR(h, w, SGM_8U);
+	random_fill(h_srcL);
+	random_fill(h_srcR);
+
+	// left is an ROI of a larger buffer, right is stored bottom up
+	const int roi_x = 7, roi_y = 5, roi_pitch = w + 33;
+	HostImage h_roiL(h + 2 * roi_y, roi_pitch, SGM_8U), h_flipR(h, w + 1, SGM_8U);
+	for (int y = 0; y < h; y++) {
+		memcpy(h_roiL.ptr<uint8_t>(y + roi_y) + roi_x, h_srcL.ptr<uint8_t>(y), w);
+		memcpy(h_flipR.ptr<uint8_t>(h - 1 - y), h_srcR.ptr<uint8_t>(y), w);
+	}
+
+	StereoSGM sgm(w, h, disp_size, 8, 8, EXECUTE_INOUT_HOST2HOST);
+
+	HostImage h_disp(h, w, SGM_8U), h_disp_flip(h, w, SGM_8U);
+	sgm.execute(h_srcL.data, h_srcR.data, h_disp.data);
+
+	const ImageView left{ h_roiL.ptr<uint8_t>(roi_y) + roi_x, w, h, roi_pitch, SGM_8U };
+	const ImageView right{ h_flipR.ptr<uint8_t>(h - 1), w, h, -(w + 1), SGM_8U };
+	const ImageView dst{ h_disp_flip.ptr<uint8_t>(h - 1), w, h, -w, SGM_8U };
+	sgm.execute(left, right, dst);
+
+	for (int y = 0; y < h; y++) {
+		EXPECT_EQ(0, memcmp(h_disp.ptr<uint8_t>(y), h_disp_flip.ptr<uint8_t>(h - 1 - y), w)) << "row " << y;
+	}
+}
+
+TEST(IntegrationTest, VerticalEpipolar)
+{
+	using namespace sgm;
+
+	const int w = 311;
+	const int h = 239;
+	const int disp_size = 64;
+
+	HostImage h_srcL(h, w, SGM_8U), h_srcR(h, w, SGM_8U), h_srcLt(w, h, SGM_8U), h_srcRt(w, h, SGM_8U);
+	random_fill(h_srcL);
+	random_fill(h_srcR);
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			h_srcLt.ptr<uint8_t>(x)[y] = h_srcL.ptr<uint8_t>(y)[x];
+			h_srcRt.ptr<uint8_t>(x)[y] = h_srcR.ptr<uint8_t>(y)[x];
+		}
+	}
+
+	// census of a square window is transposed up to a bit permutation, which keeps hamming distances
+	StereoSGM::Parameters param;
+	param.census_type = CensusType::CENSUS_5x5;
+	param.epipolar_direction = EpipolarDirection::VERTICAL;
+	StereoSGM sgm_v(w, h, disp_size, 8, 16, EXECUTE_INOUT_HOST2HOST, param);
+
+	param.epipolar_direction = EpipolarDirection::HORIZONTAL;
+	StereoSGM sgm_h(h, w, disp_size, 8, 16, EXECUTE_INOUT_HOST2HOST, param);
+
+	HostImage h_disp(h, w, SGM_16U), h_dispt(w, h, SGM_16U);
+	sgm_v.execute(h_srcL.data, h_srcR.data, h_disp.data);
+	sgm_h.execute(h_srcLt.data, h_srcRt.data, h_dispt.data);
+
+	int errors = 0;
+	for (int y = 0; y < h; y++)
+		for (int x = 0; x < w; x++)
+			errors += h_disp.ptr<uint16_t>(y)[x] != h_dispt.ptr<uint16_t>(x)[y];
+	EXPECT_EQ(0, errors);
+}
+
+TEST(IntegrationTest, Mask)
+{
+	using namespace sgm;
+
+	const int w = 311;
+	const int h = 239;
+	const int disp_size = 64;
+
+	HostImage h_srcL(h, w, SGM_8U), h_srcR(h, w, SGM_8U);
+	random_fill(h_srcL);
+	random_fill(h_srcR);
+
+	// fully masked rows, a masked rectangle, and the same mask packed to bits
+	const int bits_pitch = (w + 7) / 8 + 3;
+	HostImage h_mask(h, w, SGM_8U), h_bits(h, bits_pitch, SGM_8U), h_ones(h, bits_pitch, SGM_8U);
+	memset(h_bits.data, 0, h * bits_pitch);
+	memset(h_ones.data, 0xff, h * bits_pitch);
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			const bool valid = !(y >= 40 && y < 72) && !(y >= 100 && y < 150 && x >= 90 && x < 200);
+			h_mask.ptr<uint8_t>(y)[x] = valid ? 255 : 0;
+			h_bits.ptr<uint8_t>(y)[x / 8] |= valid << (x % 8);
+		}
+	}
+
+	StereoSGM sgm(w, h, disp_size, 8, 16, EXECUTE_INOUT_HOST2HOST);
+	const uint16_t invalid = static_cast<uint16_t>(sgm.get_invalid_disparity());
+
+	HostImage h_disp(h, w, SGM_16U), h_disp_ones(h, w, SGM_16U), h_disp_mask(h, w, SGM_16U), h_disp_bits(h, w, SGM_16U);
+	sgm.execute(h_srcL.data, h_srcR.data, h_disp.data);
+
+	// a mask without masked pixels does not change the result
+	sgm.set_mask(h_ones.data, bits_pitch, 1);
+	sgm.execute(h_srcL.data, h_srcR.data, h_disp_ones.data);
+	EXPECT_TRUE(equals(h_disp, h_disp_ones));
+
+	sgm.set_mask(h_mask.data, w, 8);
+	sgm.execute(h_srcL.data, h_srcR.data, h_disp_mask.data);
+	sgm.set_mask(h_bits.data, bits_pitch, 1);
+	sgm.execute(h_srcL.data, h_srcR.data, h_disp_bits.data);
+	EXPECT_TRUE(equals(h_disp_mask, h_disp_bits));
+
+	int errors = 0;
+	for (int y = 0; y < h; y++)
+		for (int x = 0; x < w; x++)
+			errors += h_mask.ptr<uint8_t>(y)[x] == 0 && h_disp_mask.ptr<uint16_t>(y)[x] != invalid;
+	EXPECT_EQ(0, errors);
+
+	// disabling the mask restores the unmasked result
+	sgm.set_mask(nullptr, 0, 8);
+	sgm.execute(h_srcL.data, h_srcR.data, h_disp_mask.data);
+	EXPECT_TRUE(equals(h_disp, h_disp_mask));
+}
+
+TEST(IntegrationTest, CostVolume)
+{
+	using namespace sgm;
+
+	const int w = 311;
+	const int h = 239;
+	const int disp_size = 64;
+
+	HostImage h_srcL(h, w, SGM_8U), h_srcR(h, w, SGM_8U);
+	random_fill(h_srcL);
+	random_fill(h_srcR);
+
+	StereoSGM::Parameters param;
+	param.subpixel = true;
+	param.min_disp = -3;
+	StereoSGM sgm(w, h, disp_size, 8, 16, EXECUTE_INOUT_HOST2HOST, param);
+
+	HostImage h_disp(h, w, SGM_16U), h_disp_costs(h, w, SGM_16U), h_disp_sum(h, w, SGM_16U);
+	EXPECT_EQ(0u, sgm.get_cost_volume(nullptr, 0));
+	sgm.execute(h_srcL.data, h_srcR.data, h_disp.data);
+
+	const size_t size = sgm.get_cost_volume(nullptr, 0);
+	const size_t sum_size = sgm.get_cost_volume(nullptr, 0, true);
+	ASSERT_GT(size, sum_size);
+
+	// nothing is written to a buffer that is too small
+	std::vector<uint8_t> volume(size, 0), sum(sum_size);
+	EXPECT_EQ(size, sgm.get_cost_volume(volume.data(), size - 1));
+	EXPECT_EQ(0, volume[0]);
+
+	EXPECT_EQ(size, sgm.get_cost_volume(volume.data(), size));
+	EXPECT_EQ(sum_size, sgm.get_cost_volume(sum.data(), sum_size, true));
+
+	CostVolumeHeader header;
+	memcpy(&header, volume.data(), sizeof(header));
+	EXPECT_EQ(0, memcmp(header.magic, "SGMCOST", 8));
+	EXPECT_EQ(static_cast<uint32_t>(disp_size), header.disp_size);
+	EXPECT_EQ(-3, header.min_disp);
+	EXPECT_EQ(8u, header.num_volumes);
+	EXPECT_EQ(static_cast<uint64_t>(w) * h * disp_size * 8, header.cost_bytes);
+
+	sgm.execute_cost_volume(volume.data(), volume.size(), h_disp_costs.data);
+	sgm.execute_cost_volume(sum.data(), sum.size(), h_disp_sum.data);
+	EXPECT_TRUE(equals(h_disp, h_disp_costs));
+	EXPECT_TRUE(equals(h_disp, h_disp_sum));
+
+	// the left image of a bottom up input is stored top down
+	HostImage h_flipL(h, w, SGM_8U);
+	for (int y = 0; y < h; y++) {
+		memcpy(h_flipL.ptr<uint8_t>(h - 1 - y), h_srcL.ptr<uint8_t>(y), w);
+	}
+	const ImageView left{ h_flipL.ptr<uint8_t>(h - 1), w, h, -w, SGM_8U };
+	const ImageView right{ h_srcR.data, w, h, w, SGM_8U };
+	const ImageView dst{ h_disp.data, w, h, w * 2, SGM_16U };
+	sgm.execute(left, right, dst);
+	ASSERT_EQ(size, sgm.get_cost_volume(volume.data(), size));
+	for (int y = 0; y < h; y++) {
+		EXPECT_EQ(0, memcmp(h_srcL.ptr<uint8_t>(y), volume.data() + header.image_offset + static_cast<size_t>(y) * w, w)) << "row " << y;
+	}
+}
+
+TEST(IntegrationTest, FrameStats)
+{
+	using namespace sgm;
+
+	const int w = 311;
+	const int h = 239;
+	const int disp_size = 64;
+	const int LR_max_diff = 1;
+
+	HostImage h_srcL(h, w, SGM_8U), h_srcR(h, w, SGM_8U);
+	random_fill(h_srcL);
+	random_fill(h_srcR);
+
+	StereoSGM::Parameters param;
+	param.path_type = PathType::SCAN_4PATH;
+	param.LR_max_diff = LR_max_diff;
+	StereoSGM sgm(w, h, disp_size, 8, 16, EXECUTE_INOUT_HOST2HOST, param);
+
+	HostImage h_disp(h, w, SGM_16U);
+	sgm.enable_frame_stats(true);
+	EXPECT_EQ(0, sgm.get_frame_stats(nullptr, nullptr, 0));
+	sgm.execute(h_srcL.data, h_srcR.data, h_disp.data);
+
+	FrameStats stats;
+	std::vector<int> histogram(disp_size);
+	ASSERT_EQ(disp_size, sgm.get_frame_stats(&stats, histogram.data(), disp_size));
+
+	// reference pipeline, counting rejections between its stages
+	HostImage h_censusL, h_censusR, h_costs;
+	HostImage h_tmpL(h, w, SGM_16U), h_tmpR(h, w, SGM_16U), h_dispL(h, w, SGM_16U), h_dispR(h, w, SGM_16U);
+	census_transform(h_srcL, h_censusL, param.census_type);
+	census_transform(h_srcR, h_censusR, param.census_type);
+	cost_aggregation(h_censusL, h_censusR, h_costs, disp_size, param.P1, param.P2, param.path_type, param.min_disp);
+	winner_takes_all(h_costs, h_tmpL, h_tmpR, disp_size, param.uniqueness, param.subpixel, param.path_type);
+	median_filter(h_tmpL, h_dispL);
+	median_filter(h_tmpR, h_dispR);
+
+	int uniqueness_rejections = 0, lr_rejections = 0;
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			uniqueness_rejections += h_tmpL.ptr<uint16_t>(y)[x] == INVALID_DISP;
+			const int d = h_dispL.ptr<uint16_t>(y)[x];
+			const int k = x - d;
+			lr_rejections += h_srcL.ptr<uint8_t>(y)[x] != 0 && d != INVALID_DISP && k >= 0 && k < w &&
+				std::abs(h_dispR.ptr<uint16_t>(y)[k] - d) > LR_max_diff;
+		}
+	}
+	check_consistency(h_dispL, h_dispR, h_srcL, param.subpixel, LR_max_diff);
+	correct_disparity_range(h_dispL, param.subpixel, param.min_disp);
+	EXPECT_TRUE(equals(h_dispL, h_disp));
+
+	const uint16_t invalid = static_cast<uint16_t>(sgm.get_invalid_disparity());
+	int invalid_pixels = 0;
+	std::vector<int> h_histogram(disp_size, 0);
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			const uint16_t d = h_disp.ptr<uint16_t>(y)[x];
+			if (d == invalid)
+				invalid_pixels++;
+			else
+				h_histogram[d]++;
+		}
+	}
+
+	EXPECT_EQ(w * h, stats.pixels);
+	EXPECT_EQ(invalid_pixels, stats.invalid_pixels);
+	EXPECT_EQ(uniqueness_rejections, stats.uniqueness_rejections);
+	EXPECT_EQ(lr_rejections, stats.lr_rejections);
+	EXPECT_EQ(h_histogram, histogram);
+}
@@ -0,0 +1,142 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "metrics.h"
+
+static std::string metric_line(const std::string& text, const std::string& name)
+{
+	const size_t pos = text.find("\n" + name + " ");
+	if (pos == std::string::npos)
+		return "";
+	return text.substr(pos + 1, text.find('\n', pos + 1) - pos - 1);
+}
+
+static long long metric_value(const std::string& text, const std::string& name)
+{
+	const std::string line = metric_line(text, name);
+	return line.empty() ? -1 : std::stoll(line.substr(name.size() + 1));
+}
+
+TEST(MetricsTest, FramesAndDrops)
+{
+	using namespace sgm;
+
+	Metrics& metrics = Metrics::instance();
+	metrics.enable(true);
+
+	const std::string before = metrics.text();
+	{
+		MetricsFrame frame;
+		EXPECT_EQ(metric_value(metrics.text(), "sgm_executions_in_flight"), metric_value(before, "sgm_executions_in_flight") + 1);
+	}
+	try {
+		MetricsFrame frame;
+		throw std::runtime_error("dropped");
+	}
+	catch (const std::runtime_error&) {}
+	const std::string after = metrics.text();
+
+	EXPECT_EQ(metric_value(after, "sgm_frames_processed_total"), metric_value(before, "sgm_frames_processed_total") + 1);
+	EXPECT_EQ(metric_value(after, "sgm_frame_drops_total"), metric_value(before, "sgm_frame_drops_total") + 1);
+	EXPECT_EQ(metric_value(after, "sgm_executions_in_flight"), metric_value(before, "sgm_executions_in_flight"));
+	EXPECT_EQ(metric_value(after, "sgm_frame_duration_seconds_count"), metric_value(before, "sgm_frame_duration_seconds_count") + 1);
+
+	metrics.enable(false);
+}
+
+TEST(MetricsTest, StageHistogram)
+{
+	using namespace sgm;
+
+	Metrics& metrics = Metrics::instance();
+	const std::string before = metrics.text();
+	metrics.observe_stage(Stage::CENSUS_LEFT, 3e-3);
+	const std::string after = metrics.text();
+
+	// buckets are cumulative, 3ms falls into le="0.005" and above
+	const std::string prefix = "sgm_stage_duration_seconds_bucket{stage=\"census_left\",";
+	EXPECT_EQ(metric_value(after, prefix + "le=\"0.0025\"}"), metric_value(before, prefix + "le=\"0.0025\"}"));
+	EXPECT_EQ(metric_value(after, prefix + "le=\"0.005\"}"), metric_value(before, prefix + "le=\"0.005\"}") + 1);
+	EXPECT_EQ(metric_value(after, prefix + "le=\"+Inf\"}"), metric_value(before, prefix + "le=\"+Inf\"}") + 1);
+}
+
+TEST(MetricsTest, Export)
+{
+	const int size = sgm::export_metrics(nullptr, 0);
+	ASSERT_GT(size, 0);
+
+	std::string text(size + 1, '\0');
+	EXPECT_EQ(sgm::export_metrics(&text[0], size + 1), size);
+	EXPECT_NE(text.find("# TYPE sgm_frames_processed_total counter"), std::string::npos);
+	EXPECT_NE(text.find("# TYPE sgm_stage_duration_seconds histogram"), std::string::npos);
+
+	char small[8];
+	EXPECT_EQ(sgm::export_metrics(small, sizeof(small)), size);
+	EXPECT_EQ(small[7], '\0');
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+
+static int connect_metrics(const char* path)
+{
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+TEST(MetricsTest, ClientClosesBeforeReading)
+{
+	const char* path = "sgm_metrics_test.sock";
+	ASSERT_TRUE(sgm::serve_metrics(path));
+
+	// the server writes to a closed connection, which must not raise SIGPIPE
+	for (int i = 0; i < 4; i++) {
+		const int fd = connect_metrics(path);
+		ASSERT_GE(fd, 0);
+		const char request[] = "GET /metrics HTTP/1.0\r\n\r\n";
+		EXPECT_EQ(send(fd, request, sizeof(request) - 1, 0), static_cast<ssize_t>(sizeof(request) - 1));
+		close(fd);
+	}
+
+	// later clients are still served
+	const int fd = connect_metrics(path);
+	ASSERT_GE(fd, 0);
+	std::string response;
+	char buffer[4096];
+	for (ssize_t n; (n = read(fd, buffer, sizeof(buffer))) > 0; )
+		response.append(buffer, static_cast<size_t>(n));
+	close(fd);
+	EXPECT_EQ(response.compare(0, 15, "HTTP/1.0 200 OK"), 0);
+
+	sgm::stop_metrics_server();
+}
+
+TEST(MetricsTest, ServeKeepsRegularFile)
+{
+	const char* path = "sgm_metrics_test.txt";
+	FILE* fp = fopen(path, "w");
+	ASSERT_NE(fp, nullptr);
+	fclose(fp);
+
+	EXPECT_THROW(sgm::serve_metrics(path), std::logic_error);
+	EXPECT_EQ(access(path, F_OK), 0);
+	remove(path);
+}
+
+#endif
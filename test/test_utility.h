@@ -5,6 +5,7 @@
 #include <limits>
 
 #include "host_image.h"
+#include "types.h"
 
 static std::default_random_engine g_engine;
 
@@ -45,6 +46,8 @@ static void random_fill(sgm::HostImage& image)
 		random_fill_<uint32_t>(image);
 	if (image.type == sgm::SGM_64U)
 		random_fill_<uint64_t>(image);
+	if (image.type == sgm::SGM_128U)
+		random_fill_(image.ptr<uint64_t>(), 2 * image.rows * (size_t)image.step);
 }
 
 static void random_fill(sgm::HostImage& image, int minv, int maxv)
@@ -59,6 +62,17 @@ static void random_fill(sgm::HostImage& image, int minv, int maxv)
 		random_fill_<uint64_t>(image, minv, maxv);
 }
 
+template <typename T>
+static bool not_equal(const T& a, const T& b)
+{
+	return a != b;
+}
+
+static bool not_equal(const sgm::census128_t& a, const sgm::census128_t& b)
+{
+	return a.data[0] != b.data[0] || a.data[1] != b.data[1];
+}
+
 template <typename T>
 static int count_nonzero_(const sgm::HostImage& a, const sgm::HostImage& b)
 {
@@ -71,7 +85,7 @@ static int count_nonzero_(const sgm::HostImage& a, const sgm::HostImage& b)
 		const T* pa = a.ptr<T>(y);
 		const T* pb = b.ptr<T>(y);
 		for (int x = 0; x < a.cols; x++)
-			if (pa[x] != pb[x])
+			if (not_equal(pa[x], pb[x]))
 				count++;
 	}
 	return count;
@@ -90,6 +104,8 @@ static int count_nonzero(const sgm::HostImage& a, const sgm::HostImage& b)
 		return count_nonzero_<uint32_t>(a, b);
 	if (a.type == sgm::SGM_64U)
 		return count_nonzero_<uint64_t>(a, b);
+	if (a.type == sgm::SGM_128U)
+		return count_nonzero_<sgm::census128_t>(a, b);
 
 	return -1;
 }
@@ -105,7 +121,7 @@ static bool equals_(const sgm::HostImage& a, const sgm::HostImage& b)
 		const T* pa = a.ptr<T>(y);
 		const T* pb = b.ptr<T>(y);
 		for (int x = 0; x < a.cols; x++)
-			if (pa[x] != pb[x])
+			if (not_equal(pa[x], pb[x]))
 				return false;
 	}
 	return true;
@@ -124,6 +140,8 @@ static bool equals(const sgm::HostImage& a, const sgm::HostImage& b)
 		return equals_<uint32_t>(a, b);
 	if (a.type == sgm::SGM_64U)
 		return equals_<uint64_t>(a, b);
+	if (a.type == sgm::SGM_128U)
+		return equals_<sgm::census128_t>(a, b);
 
 	return false;
 }
@@ -157,3 +157,47 @@ TEST_P(WinnerTakesAllTestP, RangeTest)
 	EXPECT_TRUE(equals(h_dispL, d_dispL));
 	EXPECT_TRUE(equals(h_dispR, d_dispR));
 }
+
+TEST_P(WinnerTakesAllTestP, UniquenessRejections)
+{
+	using namespace sgm;
+	using namespace details;
+
+	const auto param = GetParam();
+
+	const int w = 311;
+	const int h = 239;
+	const int pitch = 320;
+	const int disp_size = param.disp_size;
+	const int num_paths = param.path_type == PathType::SCAN_4PATH ? 4 : 8;
+	const auto cost_type = SGM_8U;
+	const auto disp_type = SGM_16U;
+
+	HostImage h_cost(num_paths, w * h * disp_size, cost_type);
+	HostImage h_dispL(h, w, disp_type, pitch), h_dispR(h, w, disp_type, pitch);
+
+	DeviceImage d_cost(num_paths, w * h * disp_size, cost_type);
+	DeviceImage d_dispL(h, w, disp_type, pitch), d_dispR(h, w, disp_type, pitch);
+
+	random_fill(h_cost);
+	d_cost.upload(h_cost.data);
+
+	// every left pixel made invalid by the reference is a uniqueness rejection
+	winner_takes_all(h_cost, h_dispL, h_dispR, disp_size, param.uniqueness, param.subpixel, param.path_type);
+	uint32_t rejections = 0;
+	for (int y = 0; y < h; y++)
+		for (int x = 0; x < w; x++)
+			rejections += h_dispL.ptr<uint16_t>(y)[x] == INVALID_DISP;
+
+	DeviceImage d_count(1, 1, SGM_32U);
+	d_count.fill_zero();
+	FrameCounters counters;
+	counters.uniqueness_rejections = d_count.ptr<uint32_t>();
+	winner_takes_all(d_cost, d_dispL, d_dispR, disp_size, param.uniqueness, param.subpixel, param.path_type,
+		EpipolarDirection::HORIZONTAL, DeviceImage(), counters);
+
+	uint32_t count = 0;
+	d_count.download(&count);
+	EXPECT_TRUE(equals(h_dispL, d_dispL));
+	EXPECT_EQ(rejections, count);
+}